@@ -0,0 +1,71 @@
+#include "assembly.h"
+
+namespace Assembly {
+	std::string prefixed(const std::string& prefix, const std::string& name) {
+		return prefix.empty() ? name : prefix + '_' + name;
+	}
+
+	Graph::Graph(const std::string& seed) {
+		segment_list.push_back(Segment{"seed", seed});
+	}
+
+	size_t Graph::addSegment(const std::string& name, const std::string& seq) {
+		segment_list.push_back(Segment{name, seq});
+		return segment_list.size() - 1;
+	}
+
+	void Graph::addLink(size_t from, size_t to) {
+		link_list.push_back({from, to});
+	}
+
+	void Graph::addPath(const std::vector<size_t>& segment_ids) {
+		path_list.push_back(segment_ids);
+	}
+
+	void Graph::filterPaths(const std::function<bool(const std::string&)>& keep) {
+		std::vector<std::vector<size_t>> kept;
+		for (size_t i = 0; i < path_list.size(); i++) {
+			if (keep(pathSeq(i))) {
+				kept.push_back(path_list[i]);
+			}
+		}
+		path_list = kept;
+	}
+
+	std::string Graph::pathSeq(size_t path_idx) const {
+		std::string result;
+		for (size_t segment_id: path_list.at(path_idx)) {
+			result += segment_list[segment_id].seq;
+		}
+		return result;
+	}
+
+	void writeGfaHeader(std::ostream& out) {
+		out << "H\tVN:Z:1.0\n";
+	}
+
+	void Graph::writeGfa(std::ostream& out, const std::string& prefix) const {
+		for (const Segment& segment: segment_list) {
+			out << "S\t" << prefixed(prefix, segment.name) << '\t' << segment.seq << '\n';
+		}
+		for (const auto& link: link_list) {
+			out << "L\t" << prefixed(prefix, segment_list[link.first].name) << "\t+\t"
+				<< prefixed(prefix, segment_list[link.second].name) << "\t+\t0M\n";
+		}
+		for (size_t i = 0; i < path_list.size(); i++) {
+			out << "P\t" << prefixed(prefix, "path" + std::to_string(i+1)) << '\t';
+			for (size_t j = 0; j < path_list[i].size(); j++) {
+				out << (j ? "," : "") << prefixed(prefix, segment_list[path_list[i][j]].name) << '+';
+			}
+			out << "\t*\n";
+		}
+	}
+
+	void Graph::writeFasta(std::ostream& out, const std::string& prefix) const {
+		for (size_t i = 0; i < path_list.size(); i++) {
+			std::string seq = pathSeq(i);
+			out << '>' << prefixed(prefix, "path" + std::to_string(i+1)) << " len=" << seq.size() << '\n'
+				<< seq << '\n';
+		}
+	}
+}
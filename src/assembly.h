@@ -0,0 +1,50 @@
+#ifndef ASSEMBLY_H
+#define ASSEMBLY_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Assembly {
+	// the seed is always the first segment of a graph
+	const size_t SEED_ID = 0;
+
+	struct Segment {
+		std::string name;
+		std::string seq;
+	};
+
+	// Local assembly around a seed sequence. Segments hold compacted unitigs
+	// and are stored once however many paths go through them. Links join
+	// segments end to start without overlap, paths list segment ids from left
+	// to right.
+	class Graph {
+		public:
+			explicit Graph(const std::string& seed);
+
+			size_t addSegment(const std::string& name, const std::string& seq);
+			void addLink(size_t from, size_t to);
+			void addPath(const std::vector<size_t>& segment_ids);
+			void filterPaths(const std::function<bool(const std::string&)>& keep);
+
+			const std::vector<Segment>& segments() const { return segment_list; }
+			const std::vector<std::pair<size_t, size_t>>& links() const { return link_list; }
+			const std::vector<std::vector<size_t>>& paths() const { return path_list; }
+			std::string pathSeq(size_t path_idx) const;
+
+			// names are prefixed with prefix and an underscore when prefix is not empty
+			void writeGfa(std::ostream& out, const std::string& prefix) const;
+			void writeFasta(std::ostream& out, const std::string& prefix) const;
+
+		private:
+			std::vector<Segment> segment_list;
+			std::vector<std::pair<size_t, size_t>> link_list;
+			std::vector<std::vector<size_t>> path_list;
+	};
+
+	// header line to write once at the start of a GFA file
+	void writeGfaHeader(std::ostream& out);
+}
+
+#endif
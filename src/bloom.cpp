@@ -1,84 +1,142 @@
 #include "bloom.h"
 #include "bit_lookup.h"
 #include "seq.h"
+#include "packed.h"
+#include "stats.h"
+#include "nthash.hpp"
+#include <array>
+#include <limits>
+#include <tuple>
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <cmath>
 #include <functional>
 #include <queue>
 #include <map>
 #include <queue>
+#include <thread>
 
 namespace Bloom {
+	// writeRaw header: magic byte and flags, then filter size, k, w and h
+	const size_t RAW_HEADER_SIZE = 2 * sizeof(uint8_t) + 4 * sizeof(uint64_t);
+
 	std::pair<size_t, uint8_t> index_value(uint64_t hash_value, size_t filter_size) {
 		uint64_t bit_idx = hash_value % (filter_size*BITS_IN_BYTE);
 		uint64_t byte_idx = bit_idx / BITS_IN_BYTE;
 		uint8_t byte_value = 1 << (bit_idx % BITS_IN_BYTE);
 		return std::pair<size_t, uint8_t>(byte_idx, byte_value);
 	}
-	void Filter::addMinimizers(const std::string& seq) {
-		for (uint64_t minimizer: Dna::getMinimizerHashes(seq, kmer_size, hash_n, window_size)) {
-			std::pair<size_t, uint8_t> idx_value = index_value(minimizer, filter_size);
-			bytevec[idx_value.first] |= idx_value.second;
-		}
+	// Per thread buffer for the hashes of one sequence. Hashing a whole sequence
+	// before touching the filter keeps the two stages apart for Stats timers.
+	static std::vector<uint64_t>& hashBuffer() {
+		thread_local std::vector<uint64_t> hashes;
+		hashes.clear();
+		return hashes;
 	}
-	void Filter::addSeq(const std::string& seq) {
-		for (uint64_t minimizer: Dna::getHashes(seq, kmer_size, hash_n)) {
-			std::pair<size_t, uint8_t> idx_value = index_value(minimizer, filter_size);
+
+	void Filter::setHashes(const std::vector<uint64_t>& hashes) {
+		makeDense();
+		Stats::ScopedTimer timer(Stats::Stage::PROBE);
+		for (uint64_t hash: hashes) {
+			std::pair<size_t, uint8_t> idx_value = index_value(hash, filter_size);
 			bytevec[idx_value.first] |= idx_value.second;
 		}
 	}
 
-	size_t Filter::searchMinimizers(const std::string& seq) {
-		if (seq.size() < window_size || seq.find('N') != std::string::npos || seq.find('n') != std::string::npos) {
-			return 0;
-		}
-		std::vector<uint64_t> minimizers = Dna::getMinimizerHashes(seq, kmer_size, hash_n, window_size);
+	size_t Filter::countHits(const std::vector<uint64_t>& hashes) {
+		Stats::ScopedTimer timer(Stats::Stage::PROBE);
 		size_t kmer_hits = 0;
-		for (size_t i = 0; i < minimizers.size(); i += hash_n) {
+		for (size_t i = 0; i < hashes.size(); i += hash_n) {
 			size_t hash_hits = 0;
 			for (size_t j = i; j < i+hash_n; j++) {
-				std::pair<size_t, uint8_t> idx_value = index_value(minimizers[j], filter_size);
-				//if (bytevec[idx_value.first] & idx_value.second) {
+				std::pair<size_t, uint8_t> idx_value = index_value(hashes[j], filter_size);
 				if (getByteVecVal(idx_value.first) & idx_value.second) {
 					hash_hits++;
 				}
-				kmer_hits += (hash_hits/hash_n);
 			}
+			kmer_hits += (hash_hits/hash_n);
 		}
+		Stats::add(Stats::Counter::KMERS, hashes.size() / hash_n);
+		Stats::add(Stats::Counter::KMER_HITS, kmer_hits);
 		return kmer_hits;
 	}
 
+	void Filter::addMinimizers(const std::string& seq) {
+		std::vector<uint64_t> minimizers;
+		{
+			Stats::ScopedTimer timer(Stats::Stage::HASH);
+			minimizers = Dna::getMinimizerHashes(seq, kmer_size, hash_n, window_size, hash_mode);
+		}
+		Stats::add(Stats::Counter::KMERS, minimizers.size() / hash_n);
+		setHashes(minimizers);
+	}
+	void Filter::addSeq(const std::string& seq) {
+		std::vector<uint64_t>& hashes = hashBuffer();
+		Stats::ScopedTimer timer(Stats::Stage::HASH);
+		Dna::KmerHasher hasher(seq, kmer_size, hash_n, hash_mode);
+		Dna::EntropyTracker entropy;
+		size_t window_pos = 0;
+		bool window_set = false;
+		while (hasher.next()) {
+			if (min_entropy > 0.0 && kmer_size >= Dna::EntropyTracker::KMER_SIZE) {
+				size_t pos = hasher.pos();
+				if (window_set && pos == window_pos + 1) {
+					entropy.removeKmer(seq.data() + window_pos);
+					entropy.addKmer(seq.data() + pos + kmer_size - Dna::EntropyTracker::KMER_SIZE);
+				} else {
+					entropy.clear();
+					entropy.add(seq.data() + pos, kmer_size);
+				}
+				window_pos = pos;
+				window_set = true;
+				if (entropy.entropy() < min_entropy) {
+					continue;
+				}
+			}
+			hashes.insert(hashes.end(), hasher.hashes(), hasher.hashes() + hash_n);
+		}
+		Stats::add(Stats::Counter::KMERS, hashes.size() / hash_n);
+		setHashes(hashes);
+	}
+
+	size_t Filter::searchMinimizers(const std::string& seq) {
+		if (seq.size() < window_size || seq.find('N') != std::string::npos || seq.find('n') != std::string::npos) {
+			return 0;
+		}
+		std::vector<uint64_t> minimizers;
+		{
+			Stats::ScopedTimer timer(Stats::Stage::HASH);
+			minimizers = Dna::getMinimizerHashes(seq, kmer_size, hash_n, window_size, hash_mode);
+		}
+		return countHits(minimizers);
+	}
+
 	size_t Filter::searchSeq(const std::string& seq) {
 		if (seq.size() < kmer_size || seq.find('N') != std::string::npos || seq.find('n') != std::string::npos) {
 			return 0;
 		}
-		std::vector<uint64_t> hashes = Dna::getHashes(seq, kmer_size, hash_n);
-		size_t kmer_hits = 0;
-		for (size_t i = 0; i < hashes.size(); i += hash_n) {
-			size_t hash_hits = 0;
-			for (size_t j = i; j < i+hash_n; j++) {
-				std::pair<size_t, uint8_t> idx_value = index_value(hashes[j], filter_size);
-				if (getByteVecVal(idx_value.first) & idx_value.second) {
-					hash_hits++;
-				}
+		std::vector<uint64_t>& hashes = hashBuffer();
+		{
+			Stats::ScopedTimer timer(Stats::Stage::HASH);
+			Dna::KmerHasher hasher(seq, kmer_size, hash_n, hash_mode);
+			while (hasher.next()) {
+				hashes.insert(hashes.end(), hasher.hashes(), hasher.hashes() + hash_n);
 			}
-			kmer_hits += (hash_hits/hash_n);
 		}
-		return kmer_hits;
+		return countHits(hashes);
 	}
 
 	uint8_t Filter::seekAt(size_t idx) {
 		uint8_t value = 0;
-		const size_t OFFSET = 34; //header subject to change
-		filter_fptr.seekg(OFFSET+idx, filter_fptr.beg);
+		filter_fptr.seekg(RAW_HEADER_SIZE + idx, filter_fptr.beg);
 		filter_fptr.read(reinterpret_cast<char*>(&value), sizeof(value));
 
 		return value;
 	}
 
 	size_t Filter::seekSeq(const std::string& seq) {
-		std::vector<uint64_t> hashes = Dna::getHashes(seq, kmer_size, hash_n);
+		std::vector<uint64_t> hashes = Dna::getHashes(seq, kmer_size, hash_n, hash_mode);
 		size_t kmer_hits = 0;
 		for (size_t i = 0; i < hashes.size(); i += hash_n) {
 			size_t hash_hits = 0;
@@ -107,13 +165,125 @@ namespace Bloom {
 		return kmer_hits;
 	}
 
+	PairCounts Filter::filterFastqPairs(const std::string& mates1_fname, const std::string& mates2_fname,
+			const std::string& out_mates1_fname, const std::string& out_mates2_fname, size_t min_count,
+			Fastq::PairCheck pair_check) {
+		FilterSet filter_set({this});
+		return filter_set.filterFastqPairs(mates1_fname, mates2_fname, {out_mates1_fname}, {out_mates2_fname}, min_count,
+				nullptr, pair_check)[0];
+	}
+
+	bool Filter::queryHashes(const std::string& seq, std::vector<uint64_t>& hashes) const {
+		return Bloom::queryHashes(seq, kmer_size, hash_n, window_size, hash_mode, hashes);
+	}
+
+	bool queryHashes(const std::string& seq, size_t kmer_size, size_t hash_n, size_t window_size,
+			Dna::HashMode hash_mode, std::vector<uint64_t>& hashes) {
+		hashes.clear();
+		bool minimizers = window_size > kmer_size;
+		if (seq.size() < (minimizers ? window_size : kmer_size)
+				|| seq.find('N') != std::string::npos || seq.find('n') != std::string::npos) {
+			return false;
+		}
+		Stats::ScopedTimer timer(Stats::Stage::HASH);
+		if (minimizers) {
+			hashes = Dna::getMinimizerHashes(seq, kmer_size, hash_n, window_size, hash_mode);
+			return true;
+		}
+		Dna::KmerHasher hasher(seq, kmer_size, hash_n, hash_mode);
+		while (hasher.next()) {
+			hashes.insert(hashes.end(), hasher.hashes(), hasher.hashes() + hash_n);
+		}
+		return true;
+	}
+
+	bool Filter::sameHashing(const Filter& other) const {
+		return kmer_size == other.kmer_size && window_size == other.window_size
+			&& hash_n == other.hash_n && hash_mode == other.hash_mode;
+	}
+
+	FilterSet::FilterSet(const std::vector<Filter*>& fs) : filters(fs), hits(fs.size(), 0) {
+		for (size_t i = 0; i < filters.size(); i++) {
+			auto group = std::find_if(groups.begin(), groups.end(), [&](const std::vector<size_t>& g) {
+				return filters[g[0]]->sameHashing(*filters[i]);
+			});
+			if (group == groups.end()) {
+				groups.push_back({i});
+			} else {
+				group->push_back(i);
+			}
+		}
+	}
+
+	const std::vector<size_t>& FilterSet::searchFastqPair(const Fastq::Pair& fq_pair) {
+		std::fill(hits.begin(), hits.end(), 0);
+		for (const std::vector<size_t>& group: groups) {
+			for (const std::string* seq: {&fq_pair.first.seq, &fq_pair.second.seq}) {
+				if (!filters[group[0]]->queryHashes(*seq, hashes)) {
+					continue;
+				}
+				for (size_t i: group) {
+					hits[i] += filters[i]->searchHashes(hashes);
+				}
+			}
+		}
+		return hits;
+	}
+
+	std::vector<PairCounts> FilterSet::filterFastqPairs(const std::string& mates1_fname, const std::string& mates2_fname,
+			const std::vector<std::string>& out_mates1_fnames, const std::vector<std::string>& out_mates2_fnames,
+			size_t min_count, Gz::Writer* hit_matrix, Fastq::PairCheck pair_check) {
+		Fastq::FragmentReader reader(Fastq::Layout::PAIRED, mates1_fname, mates2_fname, pair_check);
+		std::vector<std::unique_ptr<Fastq::FragmentWriter>> writers;
+		for (size_t i = 0; i < filters.size(); i++) {
+			writers.push_back(std::make_unique<Fastq::FragmentWriter>(Fastq::Layout::PAIRED,
+						out_mates1_fnames.at(i), out_mates2_fnames.at(i)));
+		}
+		return filterFragments(reader, writers, min_count, hit_matrix);
+	}
+
+	std::vector<PairCounts> FilterSet::filterFragments(Fastq::FragmentReader& reader,
+			const std::vector<std::unique_ptr<Fastq::FragmentWriter>>& writers, size_t min_count, Gz::Writer* hit_matrix) {
+		std::vector<PairCounts> counts(filters.size());
+		Fastq::FragmentBatch batch;
+		while (reader.nextBatch(batch)) {
+			for (const Fastq::Pair& fragment: batch) {
+				{
+					Stats::LatencyTimer latency_timer;
+					searchFastqPair(fragment);
+				}
+				for (size_t i = 0; i < filters.size(); i++) {
+					counts[i].pairs++;
+					if (hits[i] >= min_count) {
+						writers[i]->write(fragment);
+						counts[i].kept++;
+					}
+				}
+				if (hit_matrix) {
+					const std::string& seq_id = fragment.first.seq_id;
+					std::string row = seq_id.substr(0, seq_id.find_first_of(" \t"));
+					for (size_t kmer_hits: hits) {
+						row += '\t' + std::to_string(kmer_hits);
+					}
+					hit_matrix->writeLine(row);
+				}
+			}
+		}
+		for (PairCounts& filter_counts: counts) {
+			filter_counts.pair_check_failed = reader.pairCheckCounts().failed;
+		}
+		return counts;
+	}
+
 	void Filter::addFasta(const std::string& fasta_fname, size_t minsize) {
 		Gz::Reader gzrfa(fasta_fname);
+		gzrfa.startReadAhead();
 		std::optional<Fasta::Rec> fa_rec = Fasta::nextRecord(gzrfa);
 		void (Filter::*adder)(const std::string&);
 		adder = window_size > kmer_size ? &Filter::addMinimizers : &Filter::addSeq;
 		while (fa_rec) {
 			if (fa_rec) {
+				Stats::LatencyTimer latency_timer;
 				for (const auto& rec: fa_rec->splitOnMask()) {
 					if (rec.size() >= minsize) {
 						//addSeq(rec.seq);
@@ -126,35 +296,65 @@ namespace Bloom {
 	}
 
 	void Filter::addFastq(const std::string& fastq_fname, size_t minsize) {
-		Gz::Reader gzrfq(fastq_fname);
-		std::optional<Fastq::Rec> fq_rec = Fastq::nextRecord(gzrfq);
+		Fastq::FragmentReader reader(Fastq::Layout::SINGLE, fastq_fname);
+		Fastq::FragmentBatch batch;
 		size_t counter = 0;
 		void (Filter::*adder)(const std::string&);
 		adder = window_size > kmer_size ? &Filter::addMinimizers : &Filter::addSeq;
-		while (fq_rec) {
-			if (fq_rec) {
-				//addSeq(fq_rec->seq);
-				(this->*adder)(fq_rec->seq);
-			}
-			fq_rec = Fastq::nextRecord(gzrfq);
-			counter++;
-			if (!(counter % 1000000)) {
-				std::cerr << counter << '\n';
-				std::cerr << fq_rec->seq << '\n';
+		while (reader.nextBatch(batch)) {
+			for (const Fastq::Pair& fragment: batch) {
+				Stats::LatencyTimer latency_timer;
+				(this->*adder)(fragment.first.seq);
+				counter++;
+				if (!(counter % 1000000)) {
+					std::cerr << counter << '\n';
+				}
 			}
 		}
 	}
 
 
+	Filter Filter::denseCopy() const {
+		Filter result = Filter(size(), kmer_size, window_size, hash_n, hash_mode);
+		if (sparse) {
+			sparse->copyTo(result.bytevec.data());
+		} else {
+			std::copy(bytes(), bytes() + size(), result.bytevec.begin());
+		}
+		return result;
+	}
+
+	void Filter::densify() {
+		ByteVec dense(filter_size);
+		if (sparse) {
+			sparse->copyTo(dense.data());
+		} else if (mapped) {
+			std::copy(mapped, mapped + filter_size, dense.begin());
+		} else if (filter_fptr.is_open()) {
+			filter_fptr.clear();
+			filter_fptr.seekg(RAW_HEADER_SIZE);
+			filter_fptr.read(reinterpret_cast<char*>(dense.data()), filter_size);
+			filter_fptr.close();
+		}
+		bytevec = std::move(dense);
+		sparse.reset();
+		mapped = nullptr;
+		mapping.reset();
+	}
+
 	int Filter::writeRaw(const std::string& out_fname) const {
+		if (mapped || sparse) {
+			return denseCopy().writeRaw(out_fname);
+		}
 		std::ofstream outfh(out_fname, std::ios::out | std::ios::binary);
 		uint8_t magic_byte = 0;
+		uint8_t flags = headerFlags();
 		uint64_t fsize = static_cast<uint64_t>(bytevec.size());
 		uint64_t k = static_cast<uint64_t>(kmer_size);
 		uint64_t w = static_cast<uint64_t>(window_size);
 		uint64_t h = static_cast<uint64_t>(hash_n);
 		outfh.write((char*) &magic_byte, sizeof(magic_byte));
-		outfh.write((char*) &magic_byte, sizeof(magic_byte));
+		outfh.write((char*) &flags, sizeof(flags));
 		outfh.write((char*) &fsize, sizeof(fsize));
 		outfh.write((char*) &k, sizeof(k));
 		outfh.write((char*) &w, sizeof(w));
@@ -162,34 +362,159 @@ namespace Bloom {
 		//outfh.write((char*) &out_fname[0], out_fname.size()*sizeof(char));
 		outfh.write((char*) &bytevec[0], filter_size*sizeof(bytevec.at(0)));
 		outfh.close();
+		if (!outfh) {
+			std::cerr << "Can not write " << out_fname << '\n';
+			return 1;
+		}
 		return 0;
 	}
 
 	int Filter::writeGz(const std::string& out_fname) const {
+		if (mapped || sparse) {
+			return denseCopy().writeGz(out_fname);
+		}
 		Gz::Writer gzwriter(out_fname);
 		//gzFile fp = gzopen(out_fname.c_str(),"wb");
 
+		// zero filter size marks header with flags, older filters start with the size
+		uint64_t marker = 0;
+		uint64_t flags = static_cast<uint64_t>(headerFlags());
 		uint64_t fsize = static_cast<uint64_t>(bytevec.size());
 		uint64_t k = static_cast<uint64_t>(kmer_size);
 		uint64_t w = static_cast<uint64_t>(window_size);
 		uint64_t h = static_cast<uint64_t>(hash_n);
+		gzwriter.write(&marker, sizeof(marker));
+		gzwriter.write(&flags, sizeof(flags));
 		gzwriter.write(&fsize, sizeof(fsize));
 		gzwriter.write(&k, sizeof(k));
-		gzwriter.write(&k, sizeof(w));
+		gzwriter.write(&w, sizeof(w));
 		gzwriter.write(&h, sizeof(h));
-		return gzwriter.bufferedWrite(bytevec);
+		return gzwriter.bufferedWrite(bytevec.data(), bytevec.size());
+	}
+
+	const char CHUNKED_MAGIC[8] = {'P', 'R', 'M', 'C', 'H', 'U', 'N', 'K'};
+	// flags, filter size, k, w, h, chunk size and chunk count follow the magic
+	const size_t CHUNKED_FIELD_N = 7;
+
+	static size_t threadCount(size_t thread_n) {
+		return thread_n > 0 ? thread_n : std::max<size_t>(1, std::thread::hardware_concurrency());
+	}
+
+	int Filter::writeChunked(const std::string& out_fname, size_t thread_n) const {
+		if (sparse) {
+			return denseCopy().writeChunked(out_fname, thread_n);
+		}
+		thread_n = threadCount(thread_n);
+		uint64_t fsize = size();
+		uint64_t chunk_n = (fsize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		std::ofstream outfh(out_fname, std::ios::out | std::ios::binary);
+		uint64_t fields[CHUNKED_FIELD_N] = {headerFlags(), fsize, kmer_size, window_size, hash_n, CHUNK_SIZE, chunk_n};
+		outfh.write(CHUNKED_MAGIC, sizeof(CHUNKED_MAGIC));
+		outfh.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+		// the index of compressed chunk sizes is filled in once the chunks are written
+		std::vector<uint64_t> chunk_sizes(chunk_n, 0);
+		std::streampos index_pos = outfh.tellp();
+		outfh.write(reinterpret_cast<const char*>(chunk_sizes.data()), chunk_n * sizeof(uint64_t));
+
+		// chunks are compressed a batch at a time to bound the memory held
+		std::vector<std::vector<uint8_t>> batch(thread_n);
+		std::atomic<bool> failed{false};
+		for (uint64_t batch_beg = 0; batch_beg < chunk_n; batch_beg += thread_n) {
+			size_t batch_n = std::min<uint64_t>(thread_n, chunk_n - batch_beg);
+			Utils::parallelFor(batch_n, thread_n, [&](size_t i) {
+				uint64_t chunk_beg = (batch_beg + i) * CHUNK_SIZE;
+				uint64_t chunk_size = std::min(CHUNK_SIZE, fsize - chunk_beg);
+				const uint8_t* data = bytes() + chunk_beg;
+				batch[i].clear();
+				if (std::all_of(data, data + chunk_size, [](uint8_t byte) { return byte == 0; })) {
+					return;
+				}
+				uLongf compressed_size = compressBound(chunk_size);
+				batch[i].resize(compressed_size);
+				if (compress2(batch[i].data(), &compressed_size, data, chunk_size, Z_DEFAULT_COMPRESSION) != Z_OK) {
+					failed = true;
+				}
+				batch[i].resize(compressed_size);
+			});
+			for (size_t i = 0; i < batch_n; i++) {
+				chunk_sizes[batch_beg + i] = batch[i].size();
+				outfh.write(reinterpret_cast<const char*>(batch[i].data()), batch[i].size());
+			}
+		}
+		outfh.seekp(index_pos);
+		outfh.write(reinterpret_cast<const char*>(chunk_sizes.data()), chunk_n * sizeof(uint64_t));
+		outfh.close();
+		return failed || !outfh ? 1 : 0;
 	}
 
 	int Filter::write(const std::string& out_fname, Compression cmpr) const {
 		if (cmpr == Compression::GZ) {
 			return writeGz(out_fname);
+		} else if (cmpr == Compression::CHUNKED) {
+			return writeChunked(out_fname);
 		} else {
 			return writeRaw(out_fname);
 		}
 	}
 
-	std::optional<Filter> Filter::loadRaw(const std::string& in_fname) {
+	// Collects the bytes of a filter being loaded, in order. They are kept as
+	// SparseBytes until more than SPARSE_MAX_FILL of the filter bits are set,
+	// then the dense filter is allocated and filled in.
+	class BytesLoader {
+		public:
+			BytesLoader(uint64_t size, bool allow_sparse) : total(size) {
+				if (allow_sparse) {
+					sparse = std::make_shared<SparseBytes>();
+				} else {
+					dense.resize(total);
+				}
+			}
+			uint64_t loaded() const { return loaded_n; }
+			// where the next bytes go once dense, null while sparse
+			uint8_t* denseNext() { return sparse ? nullptr : dense.data() + loaded_n; }
+			// counts bytes written through denseNext
+			void skip(uint64_t bytes) { loaded_n += bytes; }
+			// only the last bytes added may end inside a SparseBytes block
+			void add(const uint8_t* data, size_t bytes) {
+				if (!sparse) {
+					std::memcpy(dense.data() + loaded_n, data, bytes);
+					loaded_n += bytes;
+					return;
+				}
+				sparse->append(data, bytes);
+				loaded_n += bytes;
+				size_t i = 0;
+				for (uint64_t word; i + sizeof(word) <= bytes; i += sizeof(word)) {
+					std::memcpy(&word, data + i, sizeof(word));
+					set_bits += __builtin_popcountll(word);
+				}
+				for (; i < bytes; i++) {
+					set_bits += __builtin_popcount(data[i]);
+				}
+				if (set_bits > total * BITS_IN_BYTE * Filter::SPARSE_MAX_FILL) {
+					dense.resize(total);
+					sparse->copyTo(dense.data());
+					sparse.reset();
+				}
+			}
+			// the sparse bytes, or null when the filter is in dense
+			std::shared_ptr<const SparseBytes> finishSparse() {
+				if (sparse) {
+					sparse->shrinkToFit();
+				}
+				return sparse;
+			}
+			ByteVec dense;
+		private:
+			uint64_t total;
+			uint64_t loaded_n = 0;
+			uint64_t set_bits = 0;
+			std::shared_ptr<SparseBytes> sparse;
+	};
+
+	std::optional<Filter> Filter::loadRaw(const std::string& in_fname, bool allow_sparse) {
 		uint8_t magic_byte = 0;
+		uint8_t flags = 0;
 		uint64_t filter_size = 0;
 		uint64_t kmer_size = 0;
 		uint64_t window_size = 0;
@@ -197,15 +522,30 @@ namespace Bloom {
 
 		std::ifstream infh(in_fname, std::ios::out | std::ios::binary);
 		infh.read(reinterpret_cast<char*>(&magic_byte), sizeof(magic_byte));
-		infh.read(reinterpret_cast<char*>(&magic_byte), sizeof(magic_byte));
+		infh.read(reinterpret_cast<char*>(&flags), sizeof(flags));
 		infh.read(reinterpret_cast<char*>(&filter_size), sizeof(uint64_t));
 		infh.read(reinterpret_cast<char*>(&kmer_size), sizeof(uint64_t));
 		infh.read(reinterpret_cast<char*>(&window_size), sizeof(uint64_t));
 		infh.read(reinterpret_cast<char*>(&hash_n), sizeof(uint64_t));
 
 		// Read the remaining data into a vector<uint8_t>
-		Filter result = Filter(filter_size, kmer_size, window_size, hash_n);
-		infh.read(reinterpret_cast<char*>(result.bytevec.data()), filter_size);
+		BytesLoader loader(filter_size, allow_sparse);
+		std::vector<uint8_t> block(SparseBytes::BLOCK_SIZE);
+		while (loader.loaded() < filter_size) {
+			uint64_t rest = filter_size - loader.loaded();
+			if (uint8_t* out = loader.denseNext()) {
+				infh.read(reinterpret_cast<char*>(out), rest);
+				loader.skip(rest);
+				break;
+			}
+			size_t block_size = std::min<uint64_t>(block.size(), rest);
+			infh.read(reinterpret_cast<char*>(block.data()), block_size);
+			loader.add(block.data(), block_size);
+		}
+		Filter result = Filter(0, kmer_size, window_size, hash_n, hashModeFromFlags(flags));
+		result.filter_size = filter_size;
+		result.bytevec = std::move(loader.dense);
+		result.sparse = loader.finishSparse();
 
 		// Close the file
 		infh.close();
@@ -213,7 +553,12 @@ namespace Bloom {
 	}
 
 	std::optional<Filter> Filter::loadPointer(const std::string& in_fname) {
+		if (inferCompression(in_fname) != Compression::RAW) {
+			std::cerr << "Only raw filters can be searched without loading: " << in_fname << '\n';
+			return {};
+		}
 		uint8_t magic_byte = 0;
+		uint8_t flags = 0;
 		uint64_t filter_size = 0;
 		uint64_t kmer_size = 0;
 		uint64_t window_size = 0;
@@ -221,7 +566,7 @@ namespace Bloom {
 
 		std::ifstream infh(in_fname, std::ios::out | std::ios::binary);
 		infh.read(reinterpret_cast<char*>(&magic_byte), sizeof(magic_byte));
-		infh.read(reinterpret_cast<char*>(&magic_byte), sizeof(magic_byte));
+		infh.read(reinterpret_cast<char*>(&flags), sizeof(flags));
 		infh.read(reinterpret_cast<char*>(&filter_size), sizeof(uint64_t));
 		infh.read(reinterpret_cast<char*>(&kmer_size), sizeof(uint64_t));
 		infh.read(reinterpret_cast<char*>(&window_size), sizeof(uint64_t));
@@ -233,6 +578,7 @@ namespace Bloom {
 		result.kmer_size = kmer_size;
 		result.window_size = window_size;
 		result.hash_n = hash_n;
+		result.hash_mode = hashModeFromFlags(flags);
 		result.bytevec = {};
 		result.filter_fptr.open(in_fname, std::ios::out | std::ios::binary);
 
@@ -241,14 +587,51 @@ namespace Bloom {
 		return result;
 	}
 
+	std::optional<Filter> Filter::loadMmap(const std::string& in_fname) {
+		if (inferCompression(in_fname) != Compression::RAW) {
+			std::cerr << "Only raw filters can be memory mapped: " << in_fname << '\n';
+			return {};
+		}
+		std::optional<Utils::MappedFile> file = Utils::MappedFile::open(in_fname);
+		if (!file || file->size() < RAW_HEADER_SIZE) {
+			std::cerr << "Can not map " << in_fname << '\n';
+			return {};
+		}
+		const uint8_t* header = file->data();
+		uint8_t flags = header[1];
+		uint64_t filter_size = 0;
+		uint64_t kmer_size = 0;
+		uint64_t window_size = 0;
+		uint64_t hash_n = 0;
+		std::memcpy(&filter_size, header + 2, sizeof(uint64_t));
+		std::memcpy(&kmer_size, header + 10, sizeof(uint64_t));
+		std::memcpy(&window_size, header + 18, sizeof(uint64_t));
+		std::memcpy(&hash_n, header + 26, sizeof(uint64_t));
+		if (file->size() - RAW_HEADER_SIZE < filter_size) {
+			std::cerr << "Truncated filter " << in_fname << '\n';
+			return {};
+		}
+
+		Filter result = Filter(0, 0, 0, 0);
+		result.filter_size = filter_size;
+		result.kmer_size = kmer_size;
+		result.window_size = window_size;
+		result.hash_n = hash_n;
+		result.hash_mode = hashModeFromFlags(flags);
+		result.mapping = std::make_shared<Utils::MappedFile>(std::move(*file));
+		result.mapped = result.mapping->data() + RAW_HEADER_SIZE;
+		return result;
+	}
+
 	void Filter::closePointer(){
 		if (filter_fptr.is_open()) {
 			filter_fptr.close();
 		}
 	}
 
-	std::optional<Filter> Filter::loadGz(const std::string& in_fname) {
+	std::optional<Filter> Filter::loadGz(const std::string& in_fname, bool allow_sparse) {
 
+		uint64_t flags = 0;
 		uint64_t filter_size = 0;
 		uint64_t kmer_size = 0;
 		uint64_t window_size = 0;
@@ -257,44 +640,161 @@ namespace Bloom {
 		Gz::Reader gz_reader(in_fname);
 
 		gz_reader.read(&filter_size, sizeof(uint64_t));
+		if (filter_size == 0) {
+			gz_reader.read(&flags, sizeof(uint64_t));
+			gz_reader.read(&filter_size, sizeof(uint64_t));
+		}
 		gz_reader.read(&kmer_size, sizeof(uint64_t));
 		gz_reader.read(&window_size, sizeof(uint64_t));
 		gz_reader.read(&hash_n, sizeof(uint64_t));
 
 		// Read the remaining data into a vector<uint8_t>
-		auto bufload = gz_reader.bufferedLoad(filter_size);
-		if (bufload) {
-			Filter result = Filter(0, 0, 0, 0);
-			result.filter_size = filter_size;
-			result.kmer_size = kmer_size;
-			result.hash_n = hash_n;
-			result.bytevec = std::move(*bufload);
-			return result;
-			//return std::move(result);
-		} else {
+		BytesLoader loader(filter_size, allow_sparse);
+		std::vector<uint8_t> block(SparseBytes::BLOCK_SIZE);
+		{
+			Stats::ScopedTimer timer(Stats::Stage::DECOMPRESS);
+			Stats::add(Stats::Counter::BYTES_IN, filter_size);
+			// once dense the rest is read in pieces zlib can take at once
+			const uint64_t max_read = 1 << 30;
+			while (loader.loaded() < filter_size) {
+				uint64_t rest = filter_size - loader.loaded();
+				uint8_t* out = loader.denseNext();
+				size_t read_size = std::min<uint64_t>(out ? max_read : block.size(), rest);
+				if (gz_reader.read(out ? out : block.data(), read_size) != static_cast<int>(read_size)) {
+					std::cerr << "Truncated filter " << in_fname << '\n';
+					return {};
+				}
+				if (out) {
+					loader.skip(read_size);
+				} else {
+					loader.add(block.data(), read_size);
+				}
+			}
+		}
+		Filter result = Filter(0, kmer_size, window_size, hash_n, hashModeFromFlags(flags));
+		result.filter_size = filter_size;
+		result.bytevec = std::move(loader.dense);
+		result.sparse = loader.finishSparse();
+		return result;
+	}
+
+	std::optional<Filter> Filter::loadChunked(const std::string& in_fname, size_t thread_n, bool allow_sparse) {
+		std::optional<Utils::MappedFile> file = Utils::MappedFile::open(in_fname);
+		const size_t header_size = sizeof(CHUNKED_MAGIC) + CHUNKED_FIELD_N * sizeof(uint64_t);
+		if (!file || file->size() < header_size
+				|| std::memcmp(file->data(), CHUNKED_MAGIC, sizeof(CHUNKED_MAGIC)) != 0) {
+			std::cerr << in_fname << " is not a chunked filter\n";
+			return {};
+		}
+		uint64_t fields[CHUNKED_FIELD_N];
+		std::memcpy(fields, file->data() + sizeof(CHUNKED_MAGIC), sizeof(fields));
+		auto [flags, filter_size, kmer_size, window_size, hash_n, chunk_size, chunk_n] = fields;
+		if (chunk_size == 0 || chunk_n != (filter_size + chunk_size - 1) / chunk_size
+				|| file->size() - header_size < chunk_n * sizeof(uint64_t)) {
+			std::cerr << "Corrupt chunk index in " << in_fname << '\n';
+			return {};
+		}
+		std::vector<uint64_t> chunk_offsets(chunk_n + 1, header_size + chunk_n * sizeof(uint64_t));
+		for (uint64_t i = 0; i < chunk_n; i++) {
+			uint64_t compressed_size = 0;
+			std::memcpy(&compressed_size, file->data() + header_size + i * sizeof(uint64_t), sizeof(uint64_t));
+			chunk_offsets[i + 1] = chunk_offsets[i] + compressed_size;
+		}
+		if (chunk_offsets[chunk_n] > file->size()) {
+			std::cerr << "Truncated filter " << in_fname << '\n';
+			return {};
+		}
+
+		std::atomic<bool> failed{false};
+		// inflates chunk i to out, all zero chunks are only written when out is not zeroed already
+		auto inflateChunk = [&](size_t i, uint8_t* out, bool zeroed) {
+			uint64_t compressed_size = chunk_offsets[i + 1] - chunk_offsets[i];
+			uLongf expected_size = std::min(chunk_size, filter_size - i * chunk_size);
+			if (compressed_size == 0) {
+				if (!zeroed) {
+					std::memset(out, 0, expected_size);
+				}
+				return;
+			}
+			uLongf inflated_size = expected_size;
+			if (uncompress(out, &inflated_size, file->data() + chunk_offsets[i], compressed_size) != Z_OK
+					|| inflated_size != expected_size) {
+				failed = true;
+			}
+		};
+		thread_n = threadCount(thread_n);
+		BytesLoader loader(filter_size, allow_sparse);
+		{
+			Stats::ScopedTimer timer(Stats::Stage::DECOMPRESS);
+			Stats::add(Stats::Counter::BYTES_IN, chunk_offsets[chunk_n]);
+			// while sparse, a batch of chunks is inflated to buffers and added in order
+			std::vector<std::vector<uint8_t>> buffers;
+			for (uint64_t batch_beg = 0; batch_beg < chunk_n && !failed; batch_beg += thread_n) {
+				if (uint8_t* out = loader.denseNext()) {
+					Utils::parallelFor(chunk_n - batch_beg, thread_n, [&](size_t i) {
+						inflateChunk(batch_beg + i, out + i * chunk_size, true);
+					});
+					loader.skip(filter_size - loader.loaded());
+					break;
+				}
+				size_t batch_n = std::min<uint64_t>(thread_n, chunk_n - batch_beg);
+				if (buffers.empty()) {
+					buffers.assign(std::min<uint64_t>(thread_n, chunk_n), std::vector<uint8_t>(chunk_size));
+				}
+				Utils::parallelFor(batch_n, thread_n, [&](size_t i) {
+					inflateChunk(batch_beg + i, buffers[i].data(), false);
+				});
+				for (size_t i = 0; i < batch_n; i++) {
+					loader.add(buffers[i].data(), std::min(chunk_size, filter_size - (batch_beg + i) * chunk_size));
+				}
+			}
+		}
+		if (failed) {
+			std::cerr << "Corrupt chunk in " << in_fname << '\n';
 			return {};
 		}
+		Filter result = Filter(0, kmer_size, window_size, hash_n, hashModeFromFlags(flags));
+		result.filter_size = filter_size;
+		result.bytevec = std::move(loader.dense);
+		result.sparse = loader.finishSparse();
+		return result;
 	}
 
-  
-	std::optional<Filter> Filter::load(const std::string& in_fname) {
+	std::optional<Filter> Filter::load(const std::string& in_fname, bool allow_sparse) {
 		Bloom::Compression cmpr = Filter::inferCompression(in_fname);
 		if (cmpr == Bloom::Compression::GZ) {
-			return Filter::loadGz(in_fname);
+			return Filter::loadGz(in_fname, allow_sparse);
+		} else if (cmpr == Bloom::Compression::CHUNKED) {
+			return Filter::loadChunked(in_fname, 0, allow_sparse);
 		} else {
-			return Filter::loadRaw(in_fname);
+			return Filter::loadRaw(in_fname, allow_sparse);
+		}
+	}
+	uint8_t Filter::headerFlags() const {
+		uint8_t flags = 0;
+		if (hash_mode == Dna::HashMode::FORWARD) {
+			flags |= FLAG_FORWARD_HASH;
 		}
+		return flags;
+	}
+
+	Dna::HashMode Filter::hashModeFromFlags(uint64_t flags) {
+		return (flags & FLAG_FORWARD_HASH) ? Dna::HashMode::FORWARD : Dna::HashMode::CANONICAL;
 	}
+
 	size_t Filter::setBitsCount() const {
+		if (sparse) {
+			return sparse->setBitsCount();
+		}
 		size_t count = 0;
 		for (size_t i=0; i < size(); i++) {
-			count += BitLookup::BIT_COUNT[bytevec[i]];
+			count += BitLookup::BIT_COUNT[bytes()[i]];
 		}
 		return count;
 	}
 	double Filter::falsePostiveRate() const {
 		double k = static_cast<double>(hash_n);
-		double m = static_cast<double>(bytevec.size());
+		double m = static_cast<double>(size());
 		double set_bits = static_cast<double>(this->setBitsCount());
 		double n_star = - (m/k)*logf(1.0-(set_bits/m));
 		double res = pow(1 - exp((-k*n_star)/m), k);
@@ -315,135 +815,361 @@ namespace Bloom {
 				return t1.size() > t2.size();
 			}
 	};
-	std::vector<std::string> Filter::bfs(std::string src, robin_hood::unordered_set<uint64_t> seen_kmer_hashes,
-                 const std::function<std::string(std::string)>& extract_kmer,
-                 const std::function<std::string(std::string, char)>& next_seq,
-                 const std::function<std::string(std::string, std::string)>& add_parent_to_path,
-                 const std::function<std::string(std::string, uint64_t)>& clip,
-				 int max_candidate_limit,
-				 int depth_limit
-				 ) {
-		std::string current_kmer = extract_kmer(src);
-		Dna::addKmerHashes(current_kmer, kmer_size, 1, seen_kmer_hashes);
-		bool finished_path = true;
-		std::queue<std::string> q{};
-		std::map<std::string, std::string> parent{};
-		std::map<std::string, int> pathlen{};
-		q.push(current_kmer);
-		parent[current_kmer] = "";
-		pathlen[current_kmer] = 0;
-		double shannon_threshold = 2.0;
+	ExtensionCache::Shard& ExtensionCache::shardOf(uint64_t kmer) {
+		return shards[Dna::hashKmer(kmer) % SHARD_N];
+	}
 
-		std::priority_queue<std::string,
-			std::vector<std::string>,
-			CmpLonger<std::string>> pq;
+	std::optional<std::vector<std::string>> ExtensionCache::find(uint64_t kmer, Direction direction, const Limits& limits,
+			const robin_hood::unordered_set<uint64_t>& seen) {
+		Shard& shard = shardOf(kmer);
+		Ref ref;
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			const auto& refs = shard.refs[static_cast<size_t>(direction)];
+			auto it = refs.find(kmer);
+			if (it == refs.end()) {
+				miss_n++;
+				return {};
+			}
+			ref = it->second;
+		}
+		// a shorter walk from further along could reach leaves the depth limit cut off
+		if (!(ref.entry->limits == limits) || (ref.offset > 0 && ref.entry->truncated)) {
+			miss_n++;
+			return {};
+		}
+		// a fresh walk would skip the query's kmers past the start
+		const auto& nodes = ref.entry->nodes;
+		for (uint64_t hash: seen) {
+			auto node = std::lower_bound(nodes.begin(), nodes.end(), std::make_pair(hash, size_t(0)));
+			if (node != nodes.end() && node->first == hash && node->second > ref.offset) {
+				miss_n++;
+				return {};
+			}
+		}
+		hit_n++;
+		std::vector<std::string> result;
+		result.reserve(ref.entry->candidates.size());
+		for (const std::string& candidate: ref.entry->candidates) {
+			size_t offset = std::min(ref.offset, candidate.size());
+			if (direction == Direction::RIGHT) {
+				result.push_back(candidate.substr(offset));
+			} else {
+				result.push_back(candidate.substr(0, candidate.size() - offset));
+			}
+		}
+		return result;
+	}
 
+	void ExtensionCache::insert(const BfsWalk& walk, Direction direction, const Limits& limits,
+			const std::vector<uint64_t>& node_hashes, const std::vector<std::string>& candidates) {
+		// timed out walks depend on the machine, seed dependent ones on the query
+		if (entry_n >= max_entries || walk.truncation == Truncation::TIME || walk.seed_dependent) {
+			return;
+		}
+		bool truncated = walk.truncation != Truncation::NONE;
+		auto entry = std::make_shared<Entry>(Entry{candidates, limits, truncated, {}});
+		entry->nodes.reserve(node_hashes.size());
+		for (size_t i = 0; i < node_hashes.size(); i++) {
+			entry->nodes.emplace_back(node_hashes[i], i);
+		}
+		std::sort(entry->nodes.begin(), entry->nodes.end());
+		entry_n += entry->nodes.size();
+		const std::vector<uint64_t>& unitig = walk.unitig;
+		// offset lookups are refused for truncated walks, and a walk meeting a
+		// kmer twice may have skipped one that a walk from further along takes
+		size_t register_n = truncated || walk.seen_skips > 0 ? std::min<size_t>(1, unitig.size()) : unitig.size();
+		std::shared_ptr<const Entry> shared_entry = std::move(entry);
+		for (size_t offset = 0; offset < register_n; offset++) {
+			Shard& shard = shardOf(unitig[offset]);
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			if (shard.refs[static_cast<size_t>(direction)].emplace(unitig[offset], Ref{shared_entry, offset}).second) {
+				entry_n++;
+			}
+		}
+	}
 
-		std::vector<std::string> candidate_seqs;
-		while (q.size() > 0) {
-			std::string curr_seq = q.front();
-			q.pop();
-			bool is_leaf = true;
-			double curr_shannon = Dna::shannon(curr_seq);
-			bool is_low_complexity = curr_shannon < shannon_threshold;
-			bool too_many_neighbours = false;
-			int neighbours = 0;
-			std::vector<std::string> potential_neighbours = {};
-			if (pathlen[curr_seq] > depth_limit) {
-				continue;
+	bool Filter::containsHashes(const uint64_t* hashes) {
+		for (size_t i = 0; i < hash_n; i++) {
+			std::pair<size_t, uint8_t> idx_value = index_value(hashes[i], filter_size);
+			if (!(getByteVecVal(idx_value.first) & idx_value.second)) {
+				return false;
 			}
+		}
+		return true;
+	}
 
-			for (char c : std::string("ATGC")) {
-				std::string potential_neighbour = extract_kmer(next_seq(curr_seq, c));
-				uint64_t neighbour_hash = Dna::getHashes(potential_neighbour, kmer_size, 1)[0];
-				if (searchSeq(potential_neighbour) && !seen_kmer_hashes.count(neighbour_hash)) {
-					potential_neighbours.push_back(potential_neighbour);
-				}
+	void TruncationCounts::add(Truncation truncation) {
+		switch (truncation) {
+			case Truncation::DEPTH:
+				depth++;
+				break;
+			case Truncation::NODES:
+				nodes++;
+				break;
+			case Truncation::MEMORY:
+				memory++;
+				break;
+			case Truncation::TIME:
+				time++;
+				break;
+			case Truncation::NONE:
+				break;
+		}
+	}
+
+	// Walk storage of the calling thread. Queries clear and refill it instead of
+	// allocating, so a thread only grows its frontier up to the largest walk seen.
+	struct WalkArena {
+		std::array<BfsWalk, 2> walks;
+		std::array<robin_hood::unordered_set<uint64_t>, 2> seen;
+	};
+
+	static WalkArena& walkArena() {
+		thread_local WalkArena arena;
+		return arena;
+	}
+
+	static size_t directionIdx(Direction direction) {
+		return direction == Direction::RIGHT ? 0 : 1;
+	}
+
+	Truncation Filter::budgetExceeded(size_t node_n, size_t seen_n, size_t processed_n,
+			std::chrono::steady_clock::time_point start) const {
+		if (walk_budget.max_nodes > 0 && node_n >= walk_budget.max_nodes) {
+			return Truncation::NODES;
+		}
+		// a seen kmer costs its hash plus roughly as much again in table overhead
+		size_t walk_bytes = node_n*sizeof(BfsNode) + seen_n*2*sizeof(uint64_t);
+		if (walk_budget.max_bytes > 0 && walk_bytes >= walk_budget.max_bytes) {
+			return Truncation::MEMORY;
+		}
+		// reading the clock for every node would dominate small walks
+		if (walk_budget.max_millis > 0 && processed_n % 256 == 0) {
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+			if (static_cast<uint64_t>(elapsed.count()) >= walk_budget.max_millis) {
+				return Truncation::TIME;
 			}
-			too_many_neighbours = potential_neighbours.size() > 2;
+		}
+		return Truncation::NONE;
+	}
 
-			if (potential_neighbours.size() > 2) {
+	bool Filter::walk(const std::string& src,
+			robin_hood::unordered_set<uint64_t>& seen_kmer_hashes,
+			Direction direction,
+			int max_candidate_limit,
+			int depth_limit,
+			BfsWalk& result,
+			const std::vector<uint64_t>* seeds
+			) {
+		result.nodes.clear();
+		result.leaves.clear();
+		result.unitig.clear();
+		result.truncation = Truncation::NONE;
+		result.seen_skips = 0;
+		result.seed_dependent = false;
+		result.revisits.clear();
+		Stats::ScopedTimer timer(Stats::Stage::BFS);
+		if (src.size() < kmer_size || kmer_size > Dna::MAX_PACKED_KMER_SIZE || max_candidate_limit <= 0) {
+			return false;
+		}
+		const size_t k = kmer_size;
+		const size_t candidate_limit = max_candidate_limit;
+		const double shannon_threshold = 2.0;
+		const uint64_t kmer_mask = k == Dna::BASES_IN_WORD ? ~0ULL : (1ULL << 2*k) - 1;
+		const size_t first_base_shift = 2*(k-1);
+		auto base_hash = [this](uint64_t fwd_hash, uint64_t rev_hash) {
+			return hash_mode == Dna::HashMode::CANONICAL ? std::min(fwd_hash, rev_hash) : fwd_hash;
+		};
 
+		std::string src_kmer = direction == Direction::RIGHT ? src.substr(src.size()-k, k) : src.substr(0, k);
+		BfsNode root;
+		root.kmer = Dna::packKmer(src_kmer.data(), k);
+		root.fwd_hash = NTF64(src_kmer.data(), k);
+		root.rev_hash = NTR64(src_kmer.data(), k);
+		root.parent = 0;
+		root.depth = 0;
+		root.entropy_log_sum = Dna::EntropyTracker::packedLogSum(root.kmer, k);
+		result.nodes.push_back(root);
+		if (!std::all_of(src_kmer.begin(), src_kmer.end(), Dna::isBase)) {
+			result.leaves.push_back(0);
+			return true;
+		}
+		const uint64_t root_hash = base_hash(root.fwd_hash, root.rev_hash);
+		seen_kmer_hashes.insert(root_hash);
+
+		// shortest kept leaf on top, so longer paths replace it once the limit is reached
+		using Leaf = std::pair<int, size_t>;
+		std::priority_queue<Leaf, std::vector<Leaf>, std::greater<Leaf>> leaves;
+		std::vector<uint64_t> hashes(hash_n, 0);
+		std::array<BfsNode, 4> neighbours;
+		std::array<uint64_t, 4> revisited;
+		std::vector<BfsNode>& nodes = result.nodes;
+		// unbranched start of the walk
+		result.unitig.push_back(root.kmer);
+		size_t unitig_end = 0;
+		bool unitig_open = true;
+		// trinucleotides leaving and entering the counted ones of a kmer on a
+		// step, the last trinucleotide of a kmer is not counted
+		const size_t first_trinucleotide_shift = k >= Dna::EntropyTracker::KMER_SIZE ? 2*(k-3) : 0;
+		const auto start_time = std::chrono::steady_clock::now();
+		const size_t seen_start = seen_kmer_hashes.size();
+
+		for (size_t curr = 0; curr < nodes.size(); curr++) {
+			if (result.truncation == Truncation::NONE || result.truncation == Truncation::DEPTH) {
+				Truncation over_budget = budgetExceeded(nodes.size(), seen_kmer_hashes.size() - seen_start, curr, start_time);
+				if (over_budget != Truncation::NONE) {
+					result.truncation = over_budget;
+				}
 			}
-			if (!is_low_complexity && !too_many_neighbours) {
-				for (std::string potential_neighbour: potential_neighbours) {
-					uint64_t neighbour_hash = Dna::getHashes(potential_neighbour, kmer_size, 1)[0];
-					Dna::addKmerHashes(potential_neighbour, kmer_size, 1, seen_kmer_hashes);
-					parent[potential_neighbour] = curr_seq;
-					pathlen[potential_neighbour] = pathlen[curr_seq]+1;
-					q.push(potential_neighbour);
-					is_leaf = false;
-					neighbours++;
+			// once over budget the queued nodes are only collected as leaves
+			bool stopped = result.truncation != Truncation::NONE && result.truncation != Truncation::DEPTH;
+			const BfsNode& node = nodes[curr];
+			int depth = node.depth;
+			bool at_depth_limit = depth >= depth_limit || stopped;
+			char char_out = Dna::baseChar(direction == Direction::RIGHT ? node.kmer >> first_base_shift : node.kmer & 3);
+			size_t neighbour_n = 0;
+			size_t revisit_n = 0;
+			for (uint8_t code = 0; code < 4 && !at_depth_limit; code++) {
+				char char_in = Dna::baseChar(code);
+				BfsNode& next = neighbours[neighbour_n];
+				if (direction == Direction::RIGHT) {
+					next.kmer = ((node.kmer << 2) | code) & kmer_mask;
+					next.fwd_hash = NTF64(node.fwd_hash, k, char_out, char_in);
+					next.rev_hash = NTR64(node.rev_hash, k, char_out, char_in);
+				} else {
+					next.kmer = (node.kmer >> 2) | (static_cast<uint64_t>(code) << first_base_shift);
+					next.fwd_hash = NTF64L(node.fwd_hash, k, char_out, char_in);
+					next.rev_hash = NTR64L(node.rev_hash, k, char_out, char_in);
+				}
+				hashes[0] = base_hash(next.fwd_hash, next.rev_hash);
+				if (seen_kmer_hashes.count(hashes[0])) {
+					revisited[revisit_n++] = next.kmer;
+					result.seen_skips++;
+					// every walk skips its own start kmer
+					if (seeds && hashes[0] != root_hash && std::binary_search(seeds->begin(), seeds->end(), hashes[0])) {
+						result.seed_dependent = true;
+					}
+					continue;
+				}
+				Dna::multiHash(k, hash_n, hashes.data());
+				if (containsHashes(hashes.data())) {
+					neighbour_n++;
+				}
+			}
+			bool is_low_complexity = Dna::EntropyTracker::packedEntropy(node.entropy_log_sum, k) < shannon_threshold;
+			bool too_many_neighbours = neighbour_n > 2;
+			size_t pushed = 0;
+			if (!is_low_complexity && !too_many_neighbours && !at_depth_limit) {
+				for (size_t i = 0; i < neighbour_n; i++) {
+					BfsNode& next = neighbours[i];
+					next.parent = curr;
+					next.depth = depth + 1;
+					uint8_t code_out = direction == Direction::RIGHT ? node.kmer >> first_trinucleotide_shift : node.kmer >> 2;
+					uint8_t code_in = direction == Direction::RIGHT ? node.kmer : next.kmer >> first_trinucleotide_shift;
+					next.entropy_log_sum = Dna::EntropyTracker::shiftLogSum(node.entropy_log_sum, node.kmer, k, code_out, code_in);
+				}
+				for (size_t i = 0; i < revisit_n; i++) {
+					result.revisits.emplace_back(curr, revisited[i]);
 				}
+				// push_back may invalidate node, it is not used past this point
+				for (size_t i = 0; i < neighbour_n; i++) {
+					if (seen_kmer_hashes.insert(base_hash(neighbours[i].fwd_hash, neighbours[i].rev_hash)).second) {
+						nodes.push_back(neighbours[i]);
+						pushed++;
+					} else {
+						result.revisits.emplace_back(curr, neighbours[i].kmer);
+					}
+				}
+			}
+			if (at_depth_limit && result.truncation == Truncation::NONE) {
+				result.truncation = Truncation::DEPTH;
 			}
-			if (is_leaf) {
-				std::string path = curr_seq;
-				std::string curr_parent = parent[path];
-				while (curr_parent != "") {
-					path = add_parent_to_path(path, curr_parent);
-					curr_parent = parent[curr_parent];
+			if (unitig_open && curr == unitig_end) {
+				unitig_open = pushed == 1;
+				if (unitig_open) {
+					unitig_end = nodes.size() - 1;
+					result.unitig.push_back(nodes.back().kmer);
 				}
-				std::string candidate = clip(path, kmer_size);
-				if (pq.size() >= max_candidate_limit && pq.top().size() < candidate.size()) {
-					pq.pop();
+			}
+			if (pushed == 0) {
+				if (leaves.size() >= candidate_limit && leaves.top().first < depth) {
+					leaves.pop();
 				}
-				if (pq.size() < max_candidate_limit) {
-					pq.push(candidate);
+				if (leaves.size() < candidate_limit) {
+					leaves.push(Leaf(depth, curr));
 				}
 			}
-			//std::cerr << curr_seq << '\t' << pathlen[curr_seq] 
-				//<< "\tseen kmers: " << seen_kmer_hashes.size()
-				//<< "\tneighbours: " << neighbours
-				//<< "\tshannon: " << curr_shannon << '\n';
 		}
-		size_t candidate_count = pq.size();
-		for (int i=0; i < candidate_count; i++) {
-			candidate_seqs.push_back(pq.top());
-			pq.pop();
+		while (!leaves.empty()) {
+			result.leaves.push_back(leaves.top().second);
+			leaves.pop();
 		}
-		return candidate_seqs;
+		// longest extensions first
+		std::reverse(result.leaves.begin(), result.leaves.end());
+		Stats::add(Stats::Counter::BFS_NODES, nodes.size());
+		return true;
 	}
 
-	std::vector<std::string> Filter::bfs5prime(const std::string& src,
-			robin_hood::unordered_set<uint64_t> seen_kmer_hashes,
-			int max_candidate_limit,
-			int max_path_length
-			) {
-
-		auto extract_kmer = [this](std::string s){ return s.substr(s.size()-kmer_size, kmer_size); };
-		auto next_seq = [](std::string str, char c) { return str + c; };
-		auto add_parent_to_path = [](std::string path, std::string parent) { return parent[0] + path; };
-		auto clip = [](std::string path, uint64_t ksize) { return path.substr(ksize, path.size()-ksize); };
-		return bfs(src,
-				seen_kmer_hashes,
-				extract_kmer,
-				next_seq,
-				add_parent_to_path,
-				clip,
-				max_candidate_limit,
-				max_path_length
-				);
+	std::string Filter::walkExtension(const BfsWalk& walk, size_t node_idx, Direction direction) const {
+		const size_t first_base_shift = 2*(kmer_size-1);
+		int depth = walk.nodes[node_idx].depth;
+		std::string extension(depth, 'N');
+		for (int i = 0; i < depth; i++) {
+			const BfsNode& node = walk.nodes[node_idx];
+			if (direction == Direction::RIGHT) {
+				extension[depth-1-i] = Dna::baseChar(node.kmer & 3);
+			} else {
+				extension[i] = Dna::baseChar(node.kmer >> first_base_shift);
+			}
+			node_idx = node.parent;
+		}
+		return extension;
 	}
 
-	std::vector<std::string> Filter::bfs3prime(const std::string& src,
-			robin_hood::unordered_set<uint64_t> seen_kmer_hashes,
+	std::vector<std::string> Filter::bfs(const std::string& src,
+			robin_hood::unordered_set<uint64_t>& seen_kmer_hashes,
+			Direction direction,
 			int max_candidate_limit,
-			int max_path_length
+			int depth_limit,
+			ExtensionCache* cache
 			) {
-
-		auto extract_kmer = [this](std::string s){ return s.substr(0, kmer_size); };
-		auto next_seq = [](std::string str, char c) { return c + str; };
-		auto add_parent_to_path = [](std::string path, std::string parent) { return  path + parent[parent.size()-1]; };
-		auto clip = [](std::string path, uint64_t ksize) { return path.substr(0, path.size()-ksize); };
-		return bfs(src,
-				seen_kmer_hashes,
-				extract_kmer,
-				next_seq,
-				add_parent_to_path,
-				clip,
-				max_candidate_limit,
-				max_path_length
-				);
+		std::vector<std::string> candidate_seqs;
+		bool cacheable = cache && src.size() >= kmer_size && kmer_size <= Dna::MAX_PACKED_KMER_SIZE;
+		uint64_t src_packed = 0;
+		if (cacheable) {
+			std::string src_kmer = direction == Direction::RIGHT ? src.substr(src.size()-kmer_size, kmer_size) : src.substr(0, kmer_size);
+			cacheable = std::all_of(src_kmer.begin(), src_kmer.end(), Dna::isBase);
+			src_packed = Dna::packKmer(src_kmer.data(), kmer_size);
+		}
+		const ExtensionCache::Limits limits{max_candidate_limit, depth_limit, walk_budget.max_nodes, walk_budget.max_bytes};
+		std::vector<uint64_t> seeds;
+		if (cacheable) {
+			std::optional<std::vector<std::string>> cached = cache->find(src_packed, direction, limits, seen_kmer_hashes);
+			if (cached) {
+				return *cached;
+			}
+			seeds.assign(seen_kmer_hashes.begin(), seen_kmer_hashes.end());
+			std::sort(seeds.begin(), seeds.end());
+		}
+		BfsWalk& walk_result = walkArena().walks[directionIdx(direction)];
+		if (!walk(src, seen_kmer_hashes, direction, max_candidate_limit, depth_limit, walk_result,
+					cacheable ? &seeds : nullptr)) {
+			return candidate_seqs;
+		}
+		truncation_counts.add(walk_result.truncation);
+		for (size_t leaf: walk_result.leaves) {
+			candidate_seqs.push_back(walkExtension(walk_result, leaf, direction));
+		}
+		if (cacheable) {
+			std::vector<uint64_t> node_hashes;
+			node_hashes.reserve(walk_result.nodes.size());
+			for (const BfsNode& node: walk_result.nodes) {
+				node_hashes.push_back(hash_mode == Dna::HashMode::CANONICAL ? std::min(node.fwd_hash, node.rev_hash) : node.fwd_hash);
+			}
+			cache->insert(walk_result, direction, limits, node_hashes, candidate_seqs);
+		}
+		return candidate_seqs;
 	}
 
 	void Filter::dfs(std::string current_seq, robin_hood::unordered_set<uint64_t> seen_kmer_hashes,
@@ -452,12 +1178,12 @@ namespace Bloom {
                  const std::function<std::string(std::string, char)>& next_seq
 				 ) {
 		std::string current_kmer = extract_kmer(current_seq);
-		Dna::addKmerHashes(current_kmer, kmer_size, 1, seen_kmer_hashes);
+		Dna::addKmerHashes(current_kmer, kmer_size, 1, seen_kmer_hashes, hash_mode);
 		bool finished_path = true;
 
 		for (char c : std::string("ATGC")) {
 			std::string potential_neighbour = extract_kmer(next_seq(current_kmer, c));
-			uint64_t neighbour_hash = Dna::getHashes(potential_neighbour, kmer_size, 1)[0];
+			uint64_t neighbour_hash = Dna::getHashes(potential_neighbour, kmer_size, 1, hash_mode)[0];
 			if (searchSeq(potential_neighbour) && !seen_kmer_hashes.count(neighbour_hash)) {
 				finished_path = false;
 				dfs(next_seq(current_seq, c), seen_kmer_hashes, candidate_seqs, extract_kmer, next_seq);
@@ -500,11 +1226,14 @@ namespace Bloom {
 				);
 	}
 
-	std::vector<std::string> Filter::extendSeq(const std::string &seq, int max_candidate_limit, int max_path_length) {
-		robin_hood::unordered_set<uint64_t> seen_kmers_5p;
+	std::vector<std::string> Filter::extendSeq(const std::string &seq, int max_candidate_limit, int max_path_length, ExtensionCache* cache) {
+		WalkArena& arena = walkArena();
+		robin_hood::unordered_set<uint64_t>& seen_kmers_5p = arena.seen[0];
+		robin_hood::unordered_set<uint64_t>& seen_kmers_3p = arena.seen[1];
+		seen_kmers_5p.clear();
 		size_t hash_n_for_dfs = 1;
-		Dna::addKmerHashes(seq, kmer_size, hash_n_for_dfs, seen_kmers_5p);
-		robin_hood::unordered_set<uint64_t> seen_kmers_3p = seen_kmers_5p;
+		Dna::addKmerHashes(seq, kmer_size, hash_n_for_dfs, seen_kmers_5p, hash_mode);
+		seen_kmers_3p = seen_kmers_5p;
 		std::vector<std::string> candidate_seqs_5p;
 		std::vector<std::string> candidate_seqs_3p;
 		std::vector<std::string> extended_seqs;
@@ -514,8 +1243,8 @@ namespace Bloom {
 		//std::cerr << "bfs5prime\n";
 
 		std::string dst = "";
-		candidate_seqs_5p = bfs5prime(seq,  seen_kmers_5p, max_candidate_limit, max_path_length);
-		candidate_seqs_3p = bfs3prime(seq,  seen_kmers_3p, max_candidate_limit, max_path_length);
+		candidate_seqs_5p = bfs(seq, seen_kmers_5p, Direction::RIGHT, max_candidate_limit, max_path_length, cache);
+		candidate_seqs_3p = bfs(seq, seen_kmers_3p, Direction::LEFT, max_candidate_limit, max_path_length, cache);
 		//std::cerr << "candidate sizes: " << candidate_seqs_5p.size() << '\t' << candidate_seqs_3p.size() << '\n';
 		std::priority_queue<std::string,
 			std::vector<std::string>,
@@ -539,34 +1268,172 @@ namespace Bloom {
 		return extended_seqs;
 	}
 
-	std::vector<std::string> Filter::extendSeqPair(const std::string &seq1,const std::string &seq2, int max_candidate_limit, int max_path_length) {
+	std::vector<std::string> Filter::extendSeqPair(const std::string &seq1,const std::string &seq2, int max_candidate_limit, int max_path_length, ExtensionCache* cache) {
 		std::vector<std::string> result{};
-		std::vector<std::string> candidates_mate1 = extendSeq(seq1, max_candidate_limit, max_path_length);
-		std::vector<std::string> candidates_mate2 = extendSeq(seq2, max_candidate_limit, max_path_length);
-		const std::string seq1_rc = Dna::revcom(seq1);
-		const std::string seq2_rc = Dna::revcom(seq2);
-		for (auto c1: candidates_mate1) {
-			if (c1.find(seq2) != std::string::npos ||c1.find(seq2_rc) != std::string::npos) {
+		std::vector<std::string> candidates_mate1 = extendSeq(seq1, max_candidate_limit, max_path_length, cache);
+		std::vector<std::string> candidates_mate2 = extendSeq(seq2, max_candidate_limit, max_path_length, cache);
+		for (const auto& c1: candidates_mate1) {
+			if (Dna::containsKmersOf(c1, seq2, kmer_size)) {
 				result.push_back(c1);
 			}
 		}
-		for (auto c2: candidates_mate1) {
-			if (c2.find(seq1) != std::string::npos ||c2.find(seq1_rc) != std::string::npos) {
+		for (const auto& c2: candidates_mate2) {
+			if (Dna::containsKmersOf(c2, seq1, kmer_size)) {
 				result.push_back(c2);
 			}
 		}
 		return result;
 	}
 
+	// Splits a walk into unitigs at branching and reconverging nodes and adds
+	// them to graph, linked along the walk and wherever it met a kmer again.
+	// Returns the segment of every node, the walk start belongs to the seed.
+	std::vector<size_t> compactWalk(const BfsWalk& walk, Direction direction, size_t kmer_size, Assembly::Graph& graph) {
+		const size_t first_base_shift = 2*(kmer_size-1);
+		const std::vector<BfsNode>& nodes = walk.nodes;
+		// steps out of every node, to children and to kmers met again
+		std::vector<uint32_t> child_n(nodes.size(), 0);
+		for (size_t i = 1; i < nodes.size(); i++) {
+			child_n[nodes[i].parent]++;
+		}
+		// revisited kmers of the walk other than its start (seed kmers, and
+		// kmers met on the other strand in canonical mode, have no node)
+		std::vector<std::pair<size_t, size_t>> joins;
+		std::vector<bool> joined(nodes.size(), false);
+		if (!walk.revisits.empty()) {
+			robin_hood::unordered_map<uint64_t, size_t> node_of_kmer;
+			for (size_t i = 1; i < nodes.size(); i++) {
+				node_of_kmer.emplace(nodes[i].kmer, i);
+			}
+			for (const auto& [from, kmer]: walk.revisits) {
+				auto to = node_of_kmer.find(kmer);
+				if (to != node_of_kmer.end()) {
+					joins.emplace_back(from, to->second);
+					child_n[from]++;
+					joined[to->second] = true;
+				}
+			}
+		}
+		// unitigs are numbered locally first, the seed is not one of them
+		const size_t SEED = std::numeric_limits<size_t>::max();
+		std::vector<size_t> node_unitig(nodes.size(), SEED);
+		std::vector<std::string> unitig_seqs;
+		std::vector<size_t> unitig_parent;
+		for (size_t i = 1; i < nodes.size(); i++) {
+			size_t parent = nodes[i].parent;
+			if (parent == 0 || child_n[parent] != 1 || joined[i]) {
+				node_unitig[i] = unitig_seqs.size();
+				unitig_seqs.push_back("");
+				unitig_parent.push_back(node_unitig[parent]);
+			} else {
+				node_unitig[i] = node_unitig[parent];
+			}
+			uint8_t code = direction == Direction::RIGHT ? nodes[i].kmer & 3 : nodes[i].kmer >> first_base_shift;
+			unitig_seqs[node_unitig[i]] += Dna::baseChar(code);
+		}
+		std::vector<size_t> segment_ids(unitig_seqs.size());
+		std::string name_prefix = direction == Direction::RIGHT ? "R" : "L";
+		for (size_t i = 0; i < unitig_seqs.size(); i++) {
+			if (direction == Direction::LEFT) {
+				// bases were collected walking away from the seed
+				std::reverse(unitig_seqs[i].begin(), unitig_seqs[i].end());
+			}
+			segment_ids[i] = graph.addSegment(name_prefix + std::to_string(i+1), unitig_seqs[i]);
+			size_t parent_id = unitig_parent[i] == SEED ? Assembly::SEED_ID : segment_ids[unitig_parent[i]];
+			if (direction == Direction::RIGHT) {
+				graph.addLink(parent_id, segment_ids[i]);
+			} else {
+				graph.addLink(segment_ids[i], parent_id);
+			}
+		}
+		std::vector<size_t> node_segments(nodes.size(), Assembly::SEED_ID);
+		for (size_t i = 1; i < nodes.size(); i++) {
+			node_segments[i] = segment_ids[node_unitig[i]];
+		}
+		for (const auto& [from, to]: joins) {
+			if (direction == Direction::RIGHT) {
+				graph.addLink(node_segments[from], node_segments[to]);
+			} else {
+				graph.addLink(node_segments[to], node_segments[from]);
+			}
+		}
+		return node_segments;
+	}
+
+	// segments passed walking from the seed to leaf, the seed excluded
+	std::vector<size_t> leafSegments(const BfsWalk& walk, const std::vector<size_t>& node_segments, size_t leaf) {
+		std::vector<size_t> result;
+		for (size_t idx = leaf; idx != 0; idx = walk.nodes[idx].parent) {
+			if (result.empty() || result.back() != node_segments[idx]) {
+				result.push_back(node_segments[idx]);
+			}
+		}
+		std::reverse(result.begin(), result.end());
+		return result;
+	}
+
+	Assembly::Graph Filter::assembleSeq(const std::string& seq, int max_candidate_limit, int max_path_length) {
+		Assembly::Graph graph(seq);
+		WalkArena& arena = walkArena();
+		robin_hood::unordered_set<uint64_t>& seen_kmers_right = arena.seen[0];
+		robin_hood::unordered_set<uint64_t>& seen_kmers_left = arena.seen[1];
+		seen_kmers_right.clear();
+		Dna::addKmerHashes(seq, kmer_size, 1, seen_kmers_right, hash_mode);
+		seen_kmers_left = seen_kmers_right;
+		BfsWalk& right_walk = arena.walks[directionIdx(Direction::RIGHT)];
+		BfsWalk& left_walk = arena.walks[directionIdx(Direction::LEFT)];
+		if (!walk(seq, seen_kmers_right, Direction::RIGHT, max_candidate_limit, max_path_length, right_walk)
+				|| !walk(seq, seen_kmers_left, Direction::LEFT, max_candidate_limit, max_path_length, left_walk)) {
+			graph.addPath({Assembly::SEED_ID});
+			return graph;
+		}
+		truncation_counts.add(right_walk.truncation);
+		truncation_counts.add(left_walk.truncation);
+		std::vector<size_t> right_segments = compactWalk(right_walk, Direction::RIGHT, kmer_size, graph);
+		std::vector<size_t> left_segments = compactWalk(left_walk, Direction::LEFT, kmer_size, graph);
+
+		// rank leaf combinations by length before building any path
+		std::vector<std::tuple<int, size_t, size_t>> combinations;
+		for (size_t left_leaf: left_walk.leaves) {
+			for (size_t right_leaf: right_walk.leaves) {
+				int length = left_walk.nodes[left_leaf].depth + right_walk.nodes[right_leaf].depth;
+				combinations.push_back({-length, left_leaf, right_leaf});
+			}
+		}
+		size_t path_n = std::min(combinations.size(), static_cast<size_t>(std::max(max_candidate_limit, 0)));
+		std::partial_sort(combinations.begin(), combinations.begin() + path_n, combinations.end());
+		for (size_t i = 0; i < path_n; i++) {
+			std::vector<size_t> path = leafSegments(left_walk, left_segments, std::get<1>(combinations[i]));
+			std::reverse(path.begin(), path.end());
+			path.push_back(Assembly::SEED_ID);
+			for (size_t segment_id: leafSegments(right_walk, right_segments, std::get<2>(combinations[i]))) {
+				path.push_back(segment_id);
+			}
+			graph.addPath(path);
+		}
+		return graph;
+	}
+
+	std::pair<Assembly::Graph, Assembly::Graph> Filter::assembleSeqPair(const std::string& seq1, const std::string& seq2,
+			int max_candidate_limit, int max_path_length) {
+		Assembly::Graph graph1 = assembleSeq(seq1, max_candidate_limit, max_path_length);
+		Assembly::Graph graph2 = assembleSeq(seq2, max_candidate_limit, max_path_length);
+		graph1.filterPaths([this, &seq2](const std::string& path) { return Dna::containsKmersOf(path, seq2, kmer_size); });
+		graph2.filterPaths([this, &seq1](const std::string& path) { return Dna::containsKmersOf(path, seq1, kmer_size); });
+		return {graph1, graph2};
+	}
+
 	Bloom::Compression Filter::inferCompression(const std::string &in_fname) {
-		uint8_t magic_byte1 = 0;
-		uint8_t magic_byte2 = 0;
+		char magic[sizeof(CHUNKED_MAGIC)] = {0};
 
 		std::ifstream infh(in_fname, std::ios::out | std::ios::binary);
-		infh.read(reinterpret_cast<char*>(&magic_byte1), sizeof(magic_byte1));
-		infh.read(reinterpret_cast<char*>(&magic_byte2), sizeof(magic_byte2));
+		infh.read(magic, sizeof(magic));
+		uint8_t magic_byte1 = magic[0];
+		uint8_t magic_byte2 = magic[1];
 		if (magic_byte1 == 0x1f && magic_byte2 == 0x8b) {
 			return Bloom::Compression::GZ;
+		} else if (std::memcmp(magic, CHUNKED_MAGIC, sizeof(magic)) == 0) {
+			return Bloom::Compression::CHUNKED;
 		} else {
 			return Bloom::Compression::RAW;
 		}
@@ -1,7 +1,9 @@
 #ifndef BLOOM_H
 #define BLOOM_H
+#include "assembly.h"
 #include "fastx.h"
 #include "seq.h"
+#include "sparse.h"
 #include <cstdint>
 #include <fstream>
 #include <ntHashIterator.hpp>
@@ -10,19 +12,180 @@
 #include <zlib.h>
 #include "utils.h"
 #include <fstream>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 
 namespace Bloom {
 const size_t BITS_IN_BYTE = 8;
+// header flags stored in the second magic byte of raw filters and
+// in the flag word of gz filters
+const uint8_t FLAG_FORWARD_HASH = 1;
 enum class Compression {
 	RAW,
 	GZ,
+	// independently deflated chunks behind a chunk index, see writeChunked
+	CHUNKED,
+};
+// side of a sequence that is extended by walking the de Bruijn graph
+enum class Direction {
+	RIGHT,
+	LEFT,
+};
+
+// Query hashes of seq, hash_n per kmer, or per minimizer when the window is
+// longer than a kmer. False when seq is too short or has Ns.
+bool queryHashes(const std::string& seq, size_t kmer_size, size_t hash_n, size_t window_size,
+				 Dna::HashMode hash_mode, std::vector<uint64_t>& hashes);
+
+// fragments (read pairs or single end reads) read and written by filterFastqPairs and filterFragments
+struct PairCounts {
+  size_t pairs = 0;
+  size_t kept = 0;
+  // reading stopped early at mates naming different fragments, see Fastq::PairCheck
+  bool pair_check_failed = false;
+};
+
+// node of the de Bruijn graph walked during extension
+struct BfsNode {
+  uint64_t kmer; // 2 bit packed, first base in the highest bits
+  uint64_t fwd_hash;
+  uint64_t rev_hash;
+  size_t parent;
+  int depth;
+  // Dna::EntropyTracker::packedLogSum of kmer, its last trinucleotide left out as in Dna::shannon
+  double entropy_log_sum;
+};
+
+// why a walk stopped before running out of nodes to expand
+enum class Truncation {
+  NONE,
+  DEPTH,
+  NODES,
+  MEMORY,
+  TIME,
+};
+
+// per walk limits, 0 disables a limit
+struct WalkBudget {
+  size_t max_nodes = 0;
+  size_t max_bytes = 0;
+  uint64_t max_millis = 0;
+};
+
+// walks cut short so far, by reason
+struct TruncationCounts {
+  std::atomic<size_t> depth{0};
+  std::atomic<size_t> nodes{0};
+  std::atomic<size_t> memory{0};
+  std::atomic<size_t> time{0};
+  TruncationCounts() = default;
+  TruncationCounts(const TruncationCounts& other)
+      : depth(other.depth.load()), nodes(other.nodes.load()), memory(other.memory.load()), time(other.time.load()) {}
+  TruncationCounts& operator=(const TruncationCounts& other) {
+    depth = other.depth.load();
+    nodes = other.nodes.load();
+    memory = other.memory.load();
+    time = other.time.load();
+    return *this;
+  }
+  void add(Truncation truncation);
+};
+
+// Nodes are stored in visiting order, so the node vector doubles as the BFS
+// queue and every parent comes before its children. Walks are reused between
+// queries, clearing keeps the allocated storage.
+struct BfsWalk {
+  std::vector<BfsNode> nodes;
+  // indices of the kept leaves, deepest first
+  std::vector<size_t> leaves;
+  // start kmer followed by the kmers of the unbranched start of the walk
+  std::vector<uint64_t> unitig;
+  Truncation truncation = Truncation::NONE;
+  // neighbours skipped as already seen, and whether one of them was seen by
+  // the query rather than the walk (tracked when walk() is given the seeds)
+  size_t seen_skips = 0;
+  bool seed_dependent = false;
+  // kmers an expanded node stepped to after they were seen, as the index of
+  // the node and the packed kmer, so reconverging paths can be linked
+  std::vector<std::pair<size_t, uint64_t>> revisits;
 };
 
+// Extension results shared between queries (and threads), keyed by the packed
+// kmer a traversal starts from and by the limits of the walk. Kmers on the
+// unbranched start of a traversal that never met a kmer twice are registered
+// with their offset, so a query starting further along the same unitig reuses
+// the result with the walked prefix dropped. Only walks that skipped none of
+// the query's own kmers are kept, and a result is reused only when none of the
+// new query's kmers lie on it, so hits match what a fresh walk returns.
+class ExtensionCache {
+public:
+  // everything besides the graph and the start kmer a walk result depends on
+  struct Limits {
+	int max_candidates;
+	int depth_limit;
+	size_t max_nodes;
+	size_t max_bytes;
+	bool operator==(const Limits& other) const {
+	  return max_candidates == other.max_candidates && depth_limit == other.depth_limit
+		  && max_nodes == other.max_nodes && max_bytes == other.max_bytes;
+	}
+  };
+
+  explicit ExtensionCache(size_t max_entries = 1000000) : max_entries(max_entries) {}
+  // seen holds the hashes the query marks as seen before walking
+  std::optional<std::vector<std::string>> find(uint64_t kmer, Direction direction, const Limits& limits,
+											   const robin_hood::unordered_set<uint64_t>& seen);
+  // node_hashes are the seen hashes of the walk nodes, in walk order
+  void insert(const BfsWalk& walk, Direction direction, const Limits& limits,
+			  const std::vector<uint64_t>& node_hashes, const std::vector<std::string>& candidates);
+  // kmers registered plus walk kmers held for the reuse check
+  size_t size() const { return entry_n; }
+  size_t hits() const { return hit_n; }
+  size_t misses() const { return miss_n; }
+
+private:
+  static const size_t SHARD_N = 64;
+  struct Entry {
+	std::vector<std::string> candidates;
+	Limits limits;
+	bool truncated;
+	// seen hash and walk index of every node, sorted by hash
+	std::vector<std::pair<uint64_t, size_t>> nodes;
+  };
+  struct Ref {
+	std::shared_ptr<const Entry> entry;
+	size_t offset;
+  };
+  struct Shard {
+	std::mutex mutex;
+	robin_hood::unordered_map<uint64_t, Ref> refs[2];
+  };
+  Shard& shardOf(uint64_t kmer);
+
+  size_t max_entries;
+  std::array<Shard, SHARD_N> shards;
+  std::atomic<size_t> entry_n{0};
+  std::atomic<size_t> hit_n{0};
+  std::atomic<size_t> miss_n{0};
+};
+
+// filter bytes, placed following Utils::memoryPolicy
+using ByteVec = std::vector<uint8_t, Utils::LargePageAllocator<uint8_t>>;
+
 class Filter {
 public:
-  Filter(uint64_t s, uint64_t k, uint64_t w, uint64_t h)
-      : filter_size(s), kmer_size(k), window_size(w), hash_n(h) {
-    bytevec = std::vector<uint8_t>(s, 0);
+  // uncompressed bytes per chunk of chunked filters
+  static constexpr uint64_t CHUNK_SIZE = 1 << 22;
+  // filters loaded with allow_sparse are kept as SparseBytes when at most this
+  // fraction of their bits is set (sparse bytes then take about a quarter of the filter)
+  static constexpr double SPARSE_MAX_FILL = 0.01;
+
+  Filter(uint64_t s, uint64_t k, uint64_t w, uint64_t h, Dna::HashMode hm = Dna::HashMode::CANONICAL)
+      : filter_size(s), kmer_size(k), window_size(w), hash_n(h), hash_mode(hm) {
+    bytevec = ByteVec(s, 0);
   }
 
   void addSeq(const std::string& seq);
@@ -33,37 +196,86 @@ public:
   size_t seekSeq(const std::string& seq);
   size_t searchMinimizers(const std::string& seq);
   size_t searchFastqPair(const Fastq::Pair& fq_pair);
+  // hashes searchFastqPair probes for seq (minimizers when the window is
+  // longer than a kmer), false when seq is too short or has Ns
+  bool queryHashes(const std::string& seq, std::vector<uint64_t>& hashes) const;
+  // kmers of hashes from queryHashes of a filter with the same hashing found in this one
+  size_t searchHashes(const std::vector<uint64_t>& hashes) { return countHits(hashes); }
+  // same kmer size, window, hash count and hash mode, so query hashes can be shared
+  bool sameHashing(const Filter& other) const;
+  // copies the pairs of mates1/mates2 with at least min_count kmer hits to out_mates1/out_mates2
+  PairCounts filterFastqPairs(const std::string& mates1_fname, const std::string& mates2_fname,
+							  const std::string& out_mates1_fname, const std::string& out_mates2_fname,
+							  size_t min_count, Fastq::PairCheck pair_check = Fastq::PairCheck::STRICT);
 
   std::vector<std::string> extendSeq(const std::string& seq,
 									 int max_candidates,
-									 int max_path_length
+									 int max_path_length,
+									 ExtensionCache* cache = nullptr
   );
   std::vector<std::string> extendSeqPair(const std::string& seq1,
 										 const std::string& seq2,
 										 int max_candidates,
-										 int max_path_length
+										 int max_path_length,
+										 ExtensionCache* cache = nullptr
+  );
+
+  // Walks both ends of seq like extendSeq, but compacts the walked graph into
+  // unitigs and returns it with the longest max_candidates paths through the seed
+  Assembly::Graph assembleSeq(const std::string& seq,
+							  int max_candidates,
+							  int max_path_length
+  );
+  // graphs of both mates, keeping only paths that contain the other mate
+  std::pair<Assembly::Graph, Assembly::Graph> assembleSeqPair(const std::string& seq1,
+															  const std::string& seq2,
+															  int max_candidates,
+															  int max_path_length
   );
 
   int writeRaw(const std::string &out_fname) const;
   int writeGz(const std::string &out_fname) const;
+  // Filter bytes split into CHUNK_SIZE chunks deflated on thread_n threads
+  // (0 for all cores), all zero chunks of sparse filters are stored empty
+  int writeChunked(const std::string &out_fname, size_t thread_n = 0) const;
   int write(const std::string &out_fname, Compression cmpr) const;
-  static std::optional<Filter> loadRaw(const std::string& in_fname);
-  static std::optional<Filter> loadGz(const std::string& in_fname);
-  static std::optional<Filter> load(const std::string& in_fname);
+  // With allow_sparse, filters with at most SPARSE_MAX_FILL of their bits set
+  // are loaded as SparseBytes, without allocating the dense filter
+  static std::optional<Filter> loadRaw(const std::string& in_fname, bool allow_sparse = false);
+  static std::optional<Filter> loadGz(const std::string& in_fname, bool allow_sparse = false);
+  // inflates the chunks in parallel straight into the filter
+  static std::optional<Filter> loadChunked(const std::string& in_fname, size_t thread_n = 0, bool allow_sparse = false);
+  static std::optional<Filter> load(const std::string& in_fname, bool allow_sparse = false);
 
   static std::optional<Filter> loadPointer(const std::string& in_fname);
   void closePointer();
+  // maps a raw filter read only, pages are shared with other processes
+  // mapping the same file and loaded on first access
+  static std::optional<Filter> loadMmap(const std::string& in_fname);
+  bool isMapped() const { return mapped != nullptr; }
+  // sparse filters are searched and written as they are, adding to them makes them dense
+  bool isSparse() const { return sparse != nullptr; }
 
   static Bloom::Compression inferCompression(const std::string& in_fname);
-  size_t size() const { return bytevec.size(); }
+  size_t size() const { return mapped || sparse ? filter_size : bytevec.size(); }
   uint64_t hashN() const { return hash_n; }
   uint64_t kmerSize() const { return kmer_size; }
   uint64_t windowSize() const { return window_size; }
-  uint8_t at(size_t idx) { return bytevec.at(idx); };
-  uint8_t& atRef(size_t idx) { return bytevec.at(idx); };
+  Dna::HashMode hashMode() const { return hash_mode; }
+  // kmers with lower trinucleotide entropy are skipped by addSeq, 0 disables
+  void setMinEntropy(double entropy) { min_entropy = entropy; }
+  void setWalkBudget(const WalkBudget& budget) { walk_budget = budget; }
+  const TruncationCounts& truncationCounts() const { return truncation_counts; }
+  double minEntropy() const { return min_entropy; }
+  uint8_t at(size_t idx) { return sparse ? sparse->at(idx) : bytevec.at(idx); };
+  uint8_t& atRef(size_t idx) { makeDense(); return bytevec.at(idx); };
   uint8_t seekAt(size_t idx);
   uint8_t getByteVecVal(size_t idx) { 
-	  if (filter_fptr.is_open()) {
+	  if (mapped) {
+		  return mapped[idx];
+	  } else if (sparse) {
+		  return sparse->at(idx);
+	  } else if (filter_fptr.is_open()) {
 		  return this->seekAt(idx);
 	  } else {
 		  return this->at(idx);
@@ -80,7 +292,28 @@ private:
   uint64_t kmer_size;
   uint64_t window_size;
   uint64_t hash_n;
-  std::vector<uint8_t> bytevec;
+  Dna::HashMode hash_mode;
+  double min_entropy = 0.0;
+  WalkBudget walk_budget;
+  TruncationCounts truncation_counts;
+  ByteVec bytevec;
+  std::shared_ptr<Utils::MappedFile> mapping;
+  // filter bytes inside mapping
+  const uint8_t* mapped = nullptr;
+  // replaces bytevec of filters loaded sparse
+  std::shared_ptr<const SparseBytes> sparse;
+  const uint8_t* bytes() const { return mapped ? mapped : bytevec.data(); }
+  // moves the bytes of sparse, mapped and unloaded filters into bytevec before they change
+  void makeDense() {
+    if (sparse || mapped || filter_fptr.is_open()) {
+      densify();
+    }
+  }
+  void densify();
+  // copy with the bytes in bytevec, for writing mapped and sparse filters
+  Filter denseCopy() const;
+  uint8_t headerFlags() const;
+  static Dna::HashMode hashModeFromFlags(uint64_t flags);
   void dfs(std::string current_seq,
 		  robin_hood::unordered_set<uint64_t> seen_kmer_hashes,
 		  std::vector<std::string>& candidate_seqs,
@@ -96,26 +329,65 @@ private:
 		  robin_hood::unordered_set<uint64_t> seen_kmer_hashes,
 		  std::vector<std::string>& candidate_seqs
 		  );
-  std::vector<std::string> bfs(std::string src,
-		  robin_hood::unordered_set<uint64_t> seen_kmer_hashes,
-		  const std::function<std::string(std::string)>& extract_kmer,
-		  const std::function<std::string(std::string, char)>& next_seq,
-		  const std::function<std::string(std::string, std::string)>& add_parent_to_path,
-		  const std::function<std::string(std::string, uint64_t)>& clip,
+  bool containsHashes(const uint64_t* hashes);
+  // sets the bits of every hash
+  void setHashes(const std::vector<uint64_t>& hashes);
+  // kmers with all hash_n consecutive hashes found
+  size_t countHits(const std::vector<uint64_t>& hashes);
+  // walk budget limit reached after queueing node_n nodes and marking seen_n kmers as seen
+  Truncation budgetExceeded(size_t node_n, size_t seen_n, size_t processed_n,
+							std::chrono::steady_clock::time_point start) const;
+  // breadth first walk from the kmer at the given end of src, false if src
+  // can not be walked from
+  // seeds, when given, are the sorted hashes seen before the walk
+  bool walk(const std::string& src,
+		  robin_hood::unordered_set<uint64_t>& seen_kmer_hashes,
+		  Direction direction,
 		  int max_candidate_limit,
-		  int depth_limit
+		  int depth_limit,
+		  BfsWalk& result,
+		  const std::vector<uint64_t>* seeds = nullptr
 		  );
-  std::vector<std::string> bfs5prime(const std::string& src,
-		  robin_hood::unordered_set<uint64_t> seen_kmer_hashes,
-		  int max_candidate_limit,
-		  int depth_limit
-		  );
-  std::vector<std::string> bfs3prime(const std::string& src,
-		  robin_hood::unordered_set<uint64_t> seen_kmer_hashes,
+  // bases added on the way from the walk start to node_idx
+  std::string walkExtension(const BfsWalk& walk, size_t node_idx, Direction direction) const;
+  std::vector<std::string> bfs(const std::string& src,
+		  robin_hood::unordered_set<uint64_t>& seen_kmer_hashes,
+		  Direction direction,
 		  int max_candidate_limit,
-		  int depth_limit
+		  int depth_limit,
+		  ExtensionCache* cache
 		  );
 
 };
+
+// Filters searched together in one pass over the reads. Filters with the same
+// hashing share the hashes of each read, the others still share parsing and
+// decompression.
+class FilterSet {
+public:
+  explicit FilterSet(const std::vector<Filter*>& filters);
+  size_t size() const { return filters.size(); }
+  size_t hashGroupN() const { return groups.size(); }
+  // kmer hits of both mates in every filter, in the given filter order
+  const std::vector<size_t>& searchFastqPair(const Fastq::Pair& fq_pair);
+  // Writes the fragments with at least min_count hits in filter i to
+  // writers[i], and the name and hits of every fragment to hit_matrix when given
+  std::vector<PairCounts> filterFragments(Fastq::FragmentReader& reader,
+										  const std::vector<std::unique_ptr<Fastq::FragmentWriter>>& writers,
+										  size_t min_count, Gz::Writer* hit_matrix = nullptr);
+  // filterFragments over paired files
+  std::vector<PairCounts> filterFastqPairs(const std::string& mates1_fname, const std::string& mates2_fname,
+										   const std::vector<std::string>& out_mates1_fnames,
+										   const std::vector<std::string>& out_mates2_fnames,
+										   size_t min_count, Gz::Writer* hit_matrix = nullptr,
+										   Fastq::PairCheck pair_check = Fastq::PairCheck::STRICT);
+
+private:
+  std::vector<Filter*> filters;
+  // indices of filters sharing hashing
+  std::vector<std::vector<size_t>> groups;
+  std::vector<uint64_t> hashes;
+  std::vector<size_t> hits;
+};
 } // namespace Bloom
 #endif
@@ -3,16 +3,92 @@
 #include "fastx.h"
 #include "kraken2.h"
 #include "seq.h"
+#include "server.h"
+#include "sliced.h"
+#include "stats.h"
+#include "telemetry.h"
 #include "utils.h"
+#include "workload.h"
 #include <cxxopts.hpp>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <fstream>
+#include <functional>
+#include <memory>
 
 namespace Cmd {
 void print_help(const cxxopts::Options &options) {
   std::cerr << options.help();
 }
+
+// Collects Stats when the command was given --stats-json
+void startStats(const cxxopts::ParseResult& result) {
+  if (result.count("stats-json")) {
+	Stats::reset();
+	Stats::setEnabled(true);
+  }
+}
+
+// Emits progress records while the command runs when it was given --telemetry
+std::unique_ptr<Telemetry::Emitter> startTelemetry(const cxxopts::ParseResult& result, const std::string& command,
+		const std::vector<std::string>& inputs) {
+  if (!result.count("telemetry")) {
+	return nullptr;
+  }
+  auto interval = std::chrono::milliseconds(static_cast<int64_t>(1000 * result["telemetry-interval"].as<double>()));
+  return std::make_unique<Telemetry::Emitter>(result["telemetry"].as<std::string>(), command, inputs,
+		  std::max(interval, std::chrono::milliseconds(1)));
+}
+
+// Places filter memory as given by --huge-pages and --numa, false for unknown values
+bool setMemoryPolicy(const cxxopts::ParseResult& result) {
+  std::optional<Utils::HugePages> huge_pages = Utils::parseHugePages(result["huge-pages"].as<std::string>());
+  std::optional<Utils::NumaPolicy> numa = Utils::parseNumaPolicy(result["numa"].as<std::string>());
+  if (!huge_pages || !numa) {
+	std::cerr << "Expected --huge-pages off, thp, 2M or 1G and --numa local or interleave\n";
+	return false;
+  }
+  Utils::setMemoryPolicy({*huge_pages, *numa});
+  return true;
+}
+
+void setReadAhead(const cxxopts::ParseResult& result) {
+  if (result.count("read-ahead")) {
+	Gz::setReadAheadBuffers(result["read-ahead"].as<size_t>());
+  }
+}
+
+// reports mismatched mates, false when reading stopped on one
+bool reportPairCheck(const Fastq::FragmentReader& reader) {
+  const Fastq::PairCheckCounts& counts = reader.pairCheckCounts();
+  if (counts.mismatched > 0 && !counts.failed) {
+	std::cerr << counts.mismatched << " pairs with mates naming different reads";
+	if (counts.skipped > 0) {
+	  std::cerr << ", " << counts.skipped << " reads skipped to resynchronize";
+	}
+	std::cerr << '\n';
+  }
+  return !counts.failed;
+}
+
+void writeStats(const cxxopts::ParseResult& result) {
+  if (!result.count("stats-json")) {
+	return;
+  }
+  Stats::setEnabled(false);
+  std::string stats_fname = result["stats-json"].as<std::string>();
+  std::ofstream out(stats_fname);
+  if (!out) {
+	std::cerr << "Can not open " << stats_fname << '\n';
+	return;
+  }
+  Stats::writeJson(out);
+}
 namespace Mask {
 	int run(int argc, char **argv) {
 
@@ -32,7 +108,12 @@ namespace Mask {
 		  cxxopts::value<size_t>()->default_value("31"))
 		   ("o,output", "output file to write masked fasta file",
 			cxxopts::value<std::string>()->default_value("-"))
-			  ("h,help", "Help message");
+		  ("stats-json", "Write per stage timings, throughput and record latency percentiles as JSON to this file",
+			  cxxopts::value<std::string>())
+		  ("telemetry", "Append progress records as JSON lines to this file, or send them to unix:PATH",
+			  cxxopts::value<std::string>())
+		  ("telemetry-interval", "Seconds between progress records", cxxopts::value<double>()->default_value("10"))
+		  ("h,help", "Help message");
 
 	  if (argc < 3) {
 		print_help(options);
@@ -64,13 +145,64 @@ namespace Mask {
 		return 1;
 	  }
 
+	  startStats(result);
+	  std::vector<std::string> inputs = {fasta_fname};
+	  inputs.insert(inputs.end(), kraken2_fnames.begin(), kraken2_fnames.end());
+	  inputs.insert(inputs.end(), reference_fnames.begin(), reference_fnames.end());
+	  std::unique_ptr<Telemetry::Emitter> telemetry = startTelemetry(result, "mask", inputs);
 	  Fasta::loadSoftmaskAndPrint(fasta_fname, kraken2_fnames, reference_fnames, output_fname, kmer_size);
+	  if (telemetry) {
+		  telemetry->stop();
+	  }
+	  writeStats(result);
 	  return 0;
 	}
 
 } // namespace Mask
 
 namespace BloomBuild {
+	// Bit-sliced index with one slice of size bytes per taxon, taxa in order of first appearance
+	int buildSlicedIndex(const cxxopts::ParseResult& result, const std::vector<std::string>& taxon_args, uint64_t size,
+			uint64_t klen, uint64_t wlen, uint64_t nhash, Dna::HashMode hash_mode, Bloom::Compression out_compression) {
+	  std::vector<std::string> taxa;
+	  std::vector<std::pair<size_t, std::string>> taxon_fnames;
+	  for (const std::string& arg: taxon_args) {
+		  size_t separator = arg.find('=');
+		  if (separator == std::string::npos || separator == 0) {
+			  std::cerr << "Expected TAXON=FILE, got " << arg << '\n';
+			  return 1;
+		  }
+		  std::string taxon = arg.substr(0, separator);
+		  size_t taxon_idx = std::find(taxa.begin(), taxa.end(), taxon) - taxa.begin();
+		  if (taxon_idx == taxa.size()) {
+			  taxa.push_back(taxon);
+		  }
+		  taxon_fnames.emplace_back(taxon_idx, arg.substr(separator + 1));
+	  }
+	  if (result["min-entropy"].as<double>() > 0) {
+		  std::cerr << "--min-entropy is not used by multi taxon indices\n";
+	  }
+	  std::vector<std::string> fnames;
+	  for (const auto& taxon_fname: taxon_fnames) {
+		  fnames.push_back(taxon_fname.second);
+	  }
+	  startStats(result);
+	  std::unique_ptr<Telemetry::Emitter> telemetry = startTelemetry(result, "bloom-build", fnames);
+
+	  Bloom::SlicedIndex index(size * Bloom::BITS_IN_BYTE, taxa, klen, wlen, nhash, hash_mode);
+	  uint64_t seqlen = result["seqlen"].as<uint64_t>();
+	  for (const auto& [taxon_idx, fname]: taxon_fnames) {
+		  std::cerr << taxa[taxon_idx] << '\t' << fname << '\n';
+		  index.addFile(taxon_idx, fname, seqlen);
+	  }
+	  int status = index.write(result["output"].as<std::string>(), out_compression);
+	  if (telemetry) {
+		  telemetry->stop();
+	  }
+	  writeStats(result);
+	  return status;
+	}
+
 	int run(int argc, char **argv) {
 
 	  cxxopts::Options options("bloom-build", "build Bloom's filter");
@@ -78,15 +210,35 @@ namespace BloomBuild {
 		  "r,reference",
 		  "Reference in fasta or fastq format. Can be supplied multiple times",
 		  cxxopts::value<std::vector<std::string>>())
+		  ("t,taxon", "TAXON=FILE reference of one taxon of a bit-sliced multi taxon index, "
+			  "can be supplied multiple times and for the same taxon",
+			  cxxopts::value<std::vector<std::string>>())
 		  ("k,klen", "Kmer length to use for filter", cxxopts::value<uint64_t>()->default_value("31"))
 		  ("w,wlen", "Window length to use for filter", cxxopts::value<uint64_t>()->default_value("35"))
-		  ("s,size", "filter size in bytes, kilobytes, megabytes or gigabytes (suffixes K,M,G)",
+		  ("s,size", "filter size (or size of every taxon's slice) in bytes, kilobytes, megabytes or gigabytes (suffixes K,M,G)",
 			  cxxopts::value<std::string>()->default_value("10G"))
 		  ("l,seqlen", "Minimum sequence length to use for inserting in filter",
 			  cxxopts::value<uint64_t>()->default_value("100"))
 		  ("n,nhash", "Number of hashes to use", cxxopts::value<uint64_t>()->default_value("3"))
+		  ("hash-mode", "Kmer hashing mode: canonical (strand independent) or forward",
+			  cxxopts::value<std::string>()->default_value("canonical"))
+		  ("min-entropy", "Skip kmers with lower trinucleotide Shannon entropy, 0 keeps all kmers (not used with minimizers)",
+			  cxxopts::value<double>()->default_value("0"))
 		  ("o,output", "output file", cxxopts::value<std::string>())
 		  ("raw", "use uncompressed output format", cxxopts::value<bool>()->default_value("false"))
+		  ("chunked", "compress the filter as independent chunks that load on all cores",
+			  cxxopts::value<bool>()->default_value("false"))
+		  ("stats-json", "Write per stage timings, throughput and record latency percentiles as JSON to this file",
+			  cxxopts::value<std::string>())
+		  ("telemetry", "Append progress records as JSON lines to this file, or send them to unix:PATH",
+			  cxxopts::value<std::string>())
+		  ("telemetry-interval", "Seconds between progress records", cxxopts::value<double>()->default_value("10"))
+		  ("huge-pages", "Back filters with huge pages: off, thp (transparent), 2M or 1G (reserved hugetlbfs pages)",
+			  cxxopts::value<std::string>()->default_value("thp"))
+		  ("numa", "Place filter pages on the node touching them first (local) or interleave them over all NUMA nodes",
+			  cxxopts::value<std::string>()->default_value("local"))
+		  ("read-ahead", "Input buffers decoded ahead by a thread per input file, 0 disables (default 4 with more than one CPU, 0 otherwise)",
+			  cxxopts::value<size_t>())
 		  ("h,help", "Help message");
 
 	  if (argc < 3) {
@@ -95,17 +247,27 @@ namespace BloomBuild {
 	  }
 
 	  auto result = options.parse(argc - 1, argv + 1);
+	  setReadAhead(result);
+	  if (!setMemoryPolicy(result)) {
+		return 1;
+	  }
 	  if (result.count("help")) {
 		std::cerr << "Showing help message\n";
 		print_help(options);
 		return 0;
 	  }
 
-	  std::vector<std::string> seq_fnames =
-		  result["reference"].as<std::vector<std::string>>();
-	  std::string output_fname = result["output"].as<std::string>();
+	  std::vector<std::string> seq_fnames;
+	  if (result.count("reference")) {
+		  seq_fnames = result["reference"].as<std::vector<std::string>>();
+	  }
+	  std::vector<std::string> taxon_args;
+	  if (result.count("taxon")) {
+		  taxon_args = result["taxon"].as<std::vector<std::string>>();
+	  }
+	  std::string output_fname = result.count("output") ? result["output"].as<std::string>() : "";
 
-	  if (seq_fnames.size() == 0) {
+	  if (seq_fnames.size() == 0 && taxon_args.size() == 0) {
 		std::cerr << "Provide fasta/fastq input\n";
 		print_help(options);
 		return 1;
@@ -124,8 +286,38 @@ namespace BloomBuild {
 	  uint64_t nhash = result["nhash"].as<uint64_t>();
 	  std::string output = result["output"].as<std::string>();
 	  bool writeRaw = result["raw"].as<bool>();
-	  Bloom::Compression out_compression = writeRaw ? Bloom::Compression::RAW : Bloom::Compression::GZ;
-	  Bloom::Filter blmf = Bloom::Filter(size, klen, wlen, nhash);
+	  std::string hash_mode_str = result["hash-mode"].as<std::string>();
+	  Dna::HashMode hash_mode = Dna::HashMode::CANONICAL;
+	  if (hash_mode_str == "forward") {
+		  hash_mode = Dna::HashMode::FORWARD;
+	  } else if (hash_mode_str != "canonical") {
+		std::cerr << "Unknown hash mode " << hash_mode_str << '\n';
+		print_help(options);
+		return 1;
+	  }
+	  bool writeChunked = result["chunked"].as<bool>();
+	  if (writeRaw && writeChunked) {
+		std::cerr << "--raw and --chunked are exclusive\n";
+		return 1;
+	  }
+	  Bloom::Compression out_compression = writeRaw ? Bloom::Compression::RAW
+		  : writeChunked ? Bloom::Compression::CHUNKED
+		  : Bloom::Compression::GZ;
+	  if (taxon_args.size() > 0) {
+		  if (seq_fnames.size() > 0) {
+			std::cerr << "References of a multi taxon index are given with --taxon\n";
+			return 1;
+		  }
+		  if (writeChunked) {
+			std::cerr << "Multi taxon indices are written raw or gz, not chunked\n";
+			return 1;
+		  }
+		  return buildSlicedIndex(result, taxon_args, size, klen, wlen, nhash, hash_mode, out_compression);
+	  }
+	  Bloom::Filter blmf = Bloom::Filter(size, klen, wlen, nhash, hash_mode);
+	  blmf.setMinEntropy(result["min-entropy"].as<double>());
+	  startStats(result);
+	  std::unique_ptr<Telemetry::Emitter> telemetry = startTelemetry(result, "bloom-build", seq_fnames);
 
 	  for (const std::string &fname : seq_fnames) {
 		std::cerr << fname << '\n';
@@ -146,89 +338,434 @@ namespace BloomBuild {
 		}
 	  }
 
-	  blmf.write(output_fname, out_compression);
+	  int status = blmf.write(output_fname, out_compression) == 0 ? 0 : 1;
+	  if (telemetry) {
+		  telemetry->stop();
+	  }
+	  writeStats(result);
 
-	  return 0;
+	  return status;
 	}
 } // namespace BloomBuild
 
 namespace BloomSearch {
+	// Runs the search in a bloom-serve daemon, output paths are made absolute
+	// as the daemon resolves them from its own working directory
+	int queryServer(const cxxopts::ParseResult& result) {
+	  std::string socket_path = result["server"].as<std::string>();
+	  std::vector<std::string> bloom_filter_names = result["bloom"].as<std::vector<std::string>>();
+	  if (bloom_filter_names.size() != 1) {
+		  std::cerr << "--server searches one filter at a time\n";
+		  return 1;
+	  }
+	  std::string bloom_filter_name = bloom_filter_names[0];
+	  std::string seq = result["sequence"].as<std::string>();
+	  std::string request;
+	  if (seq.size() > 0) {
+		  request = "COUNT " + bloom_filter_name + '\n' + seq + "\n\n";
+	  } else if (!result.count("mates1") || !result.count("mates2") || !result.count("out-mates1") || !result.count("out-mates2")) {
+		  std::cerr << "--server filters paired files given with -i, -I, -o and -O\n";
+		  return 1;
+	  } else {
+		  request = "FILTER " + bloom_filter_name + ' ' + std::to_string(result["mincount"].as<size_t>());
+		  for (const char* fname: {"mates1", "mates2"}) {
+			  request += ' ' + std::filesystem::absolute(result[fname].as<std::string>()).string();
+		  }
+		  for (const char* fname: {"out-mates1", "out-mates2"}) {
+			  request += ' ' + std::filesystem::absolute(result[fname].as<std::vector<std::string>>()[0]).string();
+		  }
+		  request += '\n';
+	  }
+	  std::optional<std::string> response = Server::exchange(socket_path, request);
+	  if (!response) {
+		  return 1;
+	  }
+	  std::istringstream lines(*response);
+	  std::string status;
+	  std::getline(lines, status);
+	  if (status.compare(0, 2, "OK") != 0) {
+		  std::cerr << "bloom-serve: " << status << '\n';
+		  return 1;
+	  }
+	  if (seq.size() > 0) {
+		  std::string hits;
+		  std::getline(lines, hits);
+		  std::cout << "Kmers matching: " << hits << '\n';
+	  }
+	  return 0;
+	}
+
+	// Reads given as -i and -I, --interleaved or -u, and the -o/-O outputs
+	struct ReadFiles {
+	  Fastq::Layout layout = Fastq::Layout::PAIRED;
+	  std::string mates1;
+	  std::string mates2;
+	  std::vector<std::string> out_mates1;
+	  std::vector<std::string> out_mates2;
+	  // inferred from each output name when not given
+	  std::optional<Gz::Format> out_format;
+	  Fastq::PairCheck pair_check = Fastq::PairCheck::STRICT;
+	};
+
+	std::optional<ReadFiles> readFiles(const cxxopts::ParseResult& result) {
+	  ReadFiles files;
+	  size_t layout_n = (result.count("mates1") || result.count("mates2")) + result.count("interleaved") + result.count("unpaired");
+	  if (layout_n != 1) {
+		  std::cerr << "Give the reads as -i and -I, --interleaved or -u\n";
+		  return {};
+	  }
+	  if (result.count("interleaved")) {
+		  files.layout = Fastq::Layout::INTERLEAVED;
+		  files.mates1 = result["interleaved"].as<std::string>();
+	  } else if (result.count("unpaired")) {
+		  files.layout = Fastq::Layout::SINGLE;
+		  files.mates1 = result["unpaired"].as<std::string>();
+	  } else if (!result.count("mates1") || !result.count("mates2")) {
+		  std::cerr << "Paired reads need both -i and -I\n";
+		  return {};
+	  } else {
+		  files.mates1 = result["mates1"].as<std::string>();
+		  files.mates2 = result["mates2"].as<std::string>();
+	  }
+	  if (result.count("out-mates1")) {
+		  files.out_mates1 = result["out-mates1"].as<std::vector<std::string>>();
+	  }
+	  if (result.count("out-mates2")) {
+		  files.out_mates2 = result["out-mates2"].as<std::vector<std::string>>();
+	  }
+	  std::string out_format = result["output-format"].as<std::string>();
+	  if (out_format != "auto") {
+		  files.out_format = Gz::parseFormat(out_format);
+		  if (!files.out_format) {
+			  std::cerr << "Unknown output format " << out_format << ", expected auto, plain, gz, gz-fast or bgzf\n";
+			  return {};
+		  }
+	  }
+	  std::optional<Fastq::PairCheck> pair_check = Fastq::parsePairCheck(result["pair-check"].as<std::string>());
+	  if (!pair_check) {
+		  std::cerr << "Expected --pair-check strict, warn or resync\n";
+		  return {};
+	  }
+	  files.pair_check = *pair_check;
+	  bool paired = files.layout == Fastq::Layout::PAIRED;
+	  if (paired ? files.out_mates2.size() != files.out_mates1.size() : files.out_mates2.size() > 0) {
+		  std::cerr << (paired ? "Expected an -O for every -o\n" : "-O is only used for paired files, give one -o per output\n");
+		  return {};
+	  }
+	  // writers to the standard output would interleave their blocks
+	  size_t stdout_n = std::count(files.out_mates1.begin(), files.out_mates1.end(), Gz::STDIO_NAME)
+		  + std::count(files.out_mates2.begin(), files.out_mates2.end(), Gz::STDIO_NAME);
+	  if (stdout_n > 1) {
+		  std::cerr << "Only one output can be - (the standard output)\n";
+		  return {};
+	  }
+	  if (paired && files.mates1 == Gz::STDIO_NAME && files.mates2 == Gz::STDIO_NAME) {
+		  std::cerr << "Only one input can be -, use --interleaved to read both mates from the standard input\n";
+		  return {};
+	  }
+	  return files;
+	}
+
+	std::vector<std::unique_ptr<Fastq::FragmentWriter>> fragmentWriters(const ReadFiles& files) {
+	  std::vector<std::unique_ptr<Fastq::FragmentWriter>> writers;
+	  for (size_t i = 0; i < files.out_mates1.size(); i++) {
+		  std::string out_mates2 = files.layout == Fastq::Layout::PAIRED ? files.out_mates2[i] : "";
+		  writers.push_back(std::make_unique<Fastq::FragmentWriter>(files.layout, files.out_mates1[i], out_mates2,
+				  files.out_format));
+	  }
+	  return writers;
+	}
+
+	// Per taxon kmer hits of the sequence, or read pairs matching each taxon
+	int searchSlicedIndex(const cxxopts::ParseResult& result, const std::string& index_fname) {
+	  std::optional<Bloom::SlicedIndex> index = Bloom::SlicedIndex::load(index_fname);
+	  if (!index) {
+		  return 1;
+	  }
+	  const std::vector<std::string>& taxa = index->taxa();
+	  std::string seq = result["sequence"].as<std::string>();
+	  if (seq.size() > 0) {
+		  std::vector<size_t> hits(taxa.size(), 0);
+		  index->searchSeq(seq, hits);
+		  for (size_t i = 0; i < taxa.size(); i++) {
+			  std::cout << taxa[i] << "\tKmers matching: " << hits[i] << '\n';
+		  }
+		  return 0;
+	  }
+	  std::optional<ReadFiles> files = readFiles(result);
+	  if (!files) {
+		  return 1;
+	  }
+	  if (files->out_mates1.size() > 1) {
+		  std::cerr << "A multi taxon index writes the reads matching any taxon to a single output\n";
+		  return 1;
+	  }
+	  std::unique_ptr<Gz::Writer> hit_matrix;
+	  if (result.count("hit-matrix")) {
+		  std::string hit_matrix_fname = result["hit-matrix"].as<std::string>();
+		  hit_matrix = std::make_unique<Gz::Writer>(hit_matrix_fname, Gz::formatFromName(hit_matrix_fname));
+		  std::string header = "read";
+		  for (const std::string& taxon: taxa) {
+			  header += '\t' + taxon;
+		  }
+		  hit_matrix->writeLine(header);
+	  }
+	  Fastq::FragmentReader reader(files->layout, files->mates1, files->mates2, files->pair_check);
+	  std::vector<std::unique_ptr<Fastq::FragmentWriter>> writers = fragmentWriters(*files);
+	  std::vector<Bloom::PairCounts> counts = index->filterFragments(reader, writers.empty() ? nullptr : writers[0].get(),
+			  result["mincount"].as<size_t>(), hit_matrix.get());
+	  // the reads may be streamed to the standard output
+	  bool reads_to_stdout = !files->out_mates1.empty() && files->out_mates1[0] == Gz::STDIO_NAME;
+	  std::ostream& summary = reads_to_stdout ? std::cerr : std::cout;
+	  for (size_t i = 0; i < taxa.size(); i++) {
+		  summary << taxa[i] << (files->layout == Fastq::Layout::SINGLE ? "\tReads matching: " : "\tPairs matching: ")
+			  << counts[i].kept << '\n';
+	  }
+	  return reportPairCheck(reader) ? 0 : 1;
+	}
+
 	int run(int argc, char **argv) {
 
 	  cxxopts::Options options("bloom-search", "Search in Bloom's filter");
-	  options.add_options()("b,bloom", "Bloom filter",
-							cxxopts::value<std::string>())(
+	  options.add_options()("b,bloom", "Bloom filter or multi taxon index, filters can be repeated to search several in one pass",
+							cxxopts::value<std::vector<std::string>>())(
 		  "s,sequence", "Sequence to search",
 		  cxxopts::value<std::string>()->default_value(""))(
-		  "i,mates1", "Reads mates 1 (fastq(.gz))", cxxopts::value<std::string>())(
+		  "i,mates1", "Reads mates 1 (fastq(.gz)), - for the standard input", cxxopts::value<std::string>())(
 		  "I,mates2", "Reads mates 2 (fastq(.gz))", cxxopts::value<std::string>())(
-		  "o,out-mates1", "Output file of reads mates 1 (fastq(.gz))", cxxopts::value<std::string>())(
-		  "O,out-mates2", "Output file of reads mates 2 (fastq(.gz))", cxxopts::value<std::string>())(
+		  "interleaved", "Paired reads with mates one after the other (fastq(.gz)), - for the standard input",
+		  cxxopts::value<std::string>())(
+		  "o,out-mates1", "Output file of reads mates 1, of interleaved pairs or of single end reads (fastq(.gz)), "
+		  "one per filter, - for uncompressed standard output", cxxopts::value<std::vector<std::string>>())(
+		  "O,out-mates2", "Output file of reads mates 2 (fastq(.gz)), one per filter", cxxopts::value<std::vector<std::string>>())(
+		  "output-format", "Encoding of the output reads: auto (from the name: .gz gzip, .bgz bgzf, otherwise plain), "
+		  "plain, gz, gz-fast or bgzf", cxxopts::value<std::string>()->default_value("auto"))(
+		  "hit-matrix", "Write read names and kmer hits in every filter as tsv(.gz)", cxxopts::value<std::string>())(
 		  "no-load", "Do not load filter in memory", cxxopts::value<bool>()->default_value("false"))(
+		  "sparse", "Keep filters with few bits set sparse in memory, trading lookup speed for memory",
+		  cxxopts::value<bool>()->default_value("false"))(
 		  "c,mincount", "minimum number of matching kmers for hit",
 		  cxxopts::value<size_t>()->default_value("50"))(
-		  "u,unpaired", "Single end reads",
-		  cxxopts::value<std::string>())("h,help", "Help message");
+		  "u,unpaired", "Single end reads (fastq(.gz)), - for the standard input",
+		  cxxopts::value<std::string>())(
+		  "pair-check", "When the mates of a pair name different reads: strict (stop with an error), "
+		  "warn (report and go on) or resync (skip reads until the mates are back in step)",
+		  cxxopts::value<std::string>()->default_value("strict"))
+		  ("server", "Query a bloom-serve daemon on this socket instead of loading the filter, "
+			  "-b names one of its filters", cxxopts::value<std::string>())
+		  ("stats-json", "Write per stage timings, throughput and record latency percentiles as JSON to this file",
+			  cxxopts::value<std::string>())
+		  ("telemetry", "Append progress records as JSON lines to this file, or send them to unix:PATH",
+			  cxxopts::value<std::string>())
+		  ("telemetry-interval", "Seconds between progress records", cxxopts::value<double>()->default_value("10"))
+		  ("huge-pages", "Back filters with huge pages: off, thp (transparent), 2M or 1G (reserved hugetlbfs pages)",
+			  cxxopts::value<std::string>()->default_value("thp"))
+		  ("numa", "Place filter pages on the node touching them first (local) or interleave them over all NUMA nodes",
+			  cxxopts::value<std::string>()->default_value("local"))
+		  ("read-ahead", "Input buffers decoded ahead by a thread per input file, 0 disables (default 4 with more than one CPU, 0 otherwise)",
+			  cxxopts::value<size_t>())
+		  ("h,help", "Help message");
 
 	  if (argc < 3) {
 		print_help(options);
 		return 0;
 	  }
 	  auto result = options.parse(argc - 1, argv + 1);
+	  setReadAhead(result);
+	  if (!setMemoryPolicy(result)) {
+		return 1;
+	  }
+	  if (result.count("server")) {
+		  return queryServer(result);
+	  }
 	  std::string seq = result["sequence"].as<std::string>();
 	  bool no_load = result["no-load"].as<bool>();
-	  std::string bloom_filter_name = result["bloom"].as<std::string>();
+	  bool allow_sparse = result["sparse"].as<bool>();
+	  std::vector<std::string> bloom_filter_names = result["bloom"].as<std::vector<std::string>>();
+	  startStats(result);
+	  std::vector<std::string> inputs = bloom_filter_names;
+	  for (const char* mates: {"mates1", "mates2", "interleaved", "unpaired"}) {
+		  if (result.count(mates) && result[mates].as<std::string>() != Gz::STDIO_NAME) {
+			  inputs.push_back(result[mates].as<std::string>());
+		  }
+	  }
+	  std::unique_ptr<Telemetry::Emitter> telemetry = startTelemetry(result, "bloom-search", inputs);
+	  if (bloom_filter_names.size() == 1 && Bloom::SlicedIndex::isIndex(bloom_filter_names[0])) {
+		  int status = searchSlicedIndex(result, bloom_filter_names[0]);
+		  if (telemetry) {
+			  telemetry->stop();
+		  }
+		  writeStats(result);
+		  return status;
+	  }
 
-	  std::optional<Bloom::Filter> bloom_filter = {};
-	  if (no_load) {
-		  bloom_filter = Bloom::Filter::loadPointer(bloom_filter_name);
-	  } else {
-		  bloom_filter = Bloom::Filter::load(bloom_filter_name);
+	  std::vector<Bloom::Filter> bloom_filters;
+	  bloom_filters.reserve(bloom_filter_names.size());
+	  for (const std::string& bloom_filter_name: bloom_filter_names) {
+		  std::optional<Bloom::Filter> bloom_filter = {};
+		  if (no_load) {
+			  bloom_filter = Bloom::Filter::loadPointer(bloom_filter_name);
+		  } else {
+			  bloom_filter = Bloom::Filter::load(bloom_filter_name, allow_sparse);
+		  }
+		  if (!bloom_filter) {
+			  std::cerr << "Can not load " << bloom_filter_name << '\n';
+			  return 1;
+		  }
+		  bloom_filters.push_back(std::move(*bloom_filter));
 	  }
 	  
-	  size_t hits = 0;
 	  if (seq.size() > 0) {
-		if (bloom_filter->windowSize() > bloom_filter->kmerSize()) {
-			hits = bloom_filter->searchMinimizers(seq);
-		} else {
-			hits = bloom_filter->searchSeq(seq);
+		for (size_t i = 0; i < bloom_filters.size(); i++) {
+			Bloom::Filter& bloom_filter = bloom_filters[i];
+			size_t hits = 0;
+			if (bloom_filter.windowSize() > bloom_filter.kmerSize()) {
+				hits = bloom_filter.searchMinimizers(seq);
+			} else {
+				hits = bloom_filter.searchSeq(seq);
+			}
+			if (bloom_filters.size() > 1) {
+				std::cout << bloom_filter_names[i] << '\t';
+			}
+			std::cout << "Kmers matching: " << hits << '\n';
 		}
-		std::cout << "Kmers matching: " << hits << '\n';
 		return 0;
 	  }
 
-	  std::string mates1_fname = result["mates1"].as<std::string>();
-	  std::string mates2_fname = result["mates2"].as<std::string>();
-	  std::string out_mates1_fname = result["out-mates1"].as<std::string>();
-	  std::string out_mates2_fname = result["out-mates2"].as<std::string>();
+	  std::optional<ReadFiles> files = readFiles(result);
+	  if (!files) {
+		  return 1;
+	  }
+	  if (files->out_mates1.size() != bloom_filters.size()) {
+		  std::cerr << "Expected one output per filter\n";
+		  return 1;
+	  }
 	  size_t hit_threshold = result["mincount"].as<size_t>();
 
-	  Gz::Reader mates1_reader = Gz::Reader(mates1_fname);
-	  Gz::Reader mates2_reader = Gz::Reader(mates2_fname);
+	  std::vector<Bloom::Filter*> filter_ptrs;
+	  for (Bloom::Filter& bloom_filter: bloom_filters) {
+		  filter_ptrs.push_back(&bloom_filter);
+	  }
+	  Bloom::FilterSet filter_set(filter_ptrs);
+	  std::unique_ptr<Gz::Writer> hit_matrix;
+	  if (result.count("hit-matrix")) {
+		  std::string hit_matrix_fname = result["hit-matrix"].as<std::string>();
+		  hit_matrix = std::make_unique<Gz::Writer>(hit_matrix_fname, Gz::formatFromName(hit_matrix_fname));
+		  std::string header = "read";
+		  for (const std::string& bloom_filter_name: bloom_filter_names) {
+			  header += '\t' + bloom_filter_name;
+		  }
+		  hit_matrix->writeLine(header);
+	  }
+	  Fastq::FragmentReader reader(files->layout, files->mates1, files->mates2, files->pair_check);
+	  filter_set.filterFragments(reader, fragmentWriters(*files), hit_threshold, hit_matrix.get());
+	  bool pairs_in_step = reportPairCheck(reader);
+	  hit_matrix.reset();
+	  for (Bloom::Filter& bloom_filter: bloom_filters) {
+		  bloom_filter.closePointer();
+	  }
+	  if (telemetry) {
+		  telemetry->stop();
+	  }
+	  writeStats(result);
+
+	  return pairs_in_step ? 0 : 1;
+	}
+} // namespace BloomSearch
 
-	  Gz::Writer mates1_writer = Gz::Writer(out_mates1_fname);
-	  Gz::Writer mates2_writer = Gz::Writer(out_mates2_fname);
+namespace BloomServe {
+	int run(int argc, char **argv) {
+	  cxxopts::Options options("bloom-serve", "Answer bloom-search queries over a unix socket");
+	  options.add_options()
+		  ("b,bloom", "Bloom filter, optionally named as NAME=PATH, can be repeated",
+			  cxxopts::value<std::vector<std::string>>())
+		  ("s,socket", "Socket path", cxxopts::value<std::string>())
+		  ("mmap", "Map raw filters instead of reading them, the page cache is shared between processes",
+			  cxxopts::value<bool>()->default_value("false"))
+		  ("huge-pages", "Back filters with huge pages: off, thp (transparent), 2M or 1G (reserved hugetlbfs pages)",
+			  cxxopts::value<std::string>()->default_value("thp"))
+		  ("numa", "Place filter pages on the node touching them first (local) or interleave them over all NUMA nodes",
+			  cxxopts::value<std::string>()->default_value("local"))
+		  ("read-ahead", "Input buffers decoded ahead by a thread per input file, 0 disables (default 4 with more than one CPU, 0 otherwise)",
+			  cxxopts::value<size_t>())
+		  ("pair-check", "When the mates of a pair name different reads: strict (fail the request), "
+			  "warn (report and go on) or resync (skip reads until the mates are back in step)",
+			  cxxopts::value<std::string>()->default_value("strict"))
+		  ("h,help", "Help message");
 
-	  std::optional<Fastq::Pair> curr_rec_pair =
-		  Fastq::nextRecordPair(mates1_reader, mates2_reader);
+	  if (argc < 3) {
+		print_help(options);
+		return 0;
+	  }
+	  auto result = options.parse(argc - 1, argv + 1);
+	  setReadAhead(result);
+	  if (!setMemoryPolicy(result)) {
+		return 1;
+	  }
+	  if (!result.count("bloom") || !result.count("socket")) {
+		print_help(options);
+		return 1;
+	  }
+	  std::optional<Fastq::PairCheck> pair_check = Fastq::parsePairCheck(result["pair-check"].as<std::string>());
+	  if (!pair_check) {
+		  std::cerr << "Expected --pair-check strict, warn or resync\n";
+		  return 1;
+	  }
+	  bool use_mmap = result["mmap"].as<bool>();
+	  Server::Filters filters;
+	  for (const std::string& arg: result["bloom"].as<std::vector<std::string>>()) {
+		  size_t separator = arg.find('=');
+		  std::string name = separator == std::string::npos ? arg : arg.substr(0, separator);
+		  std::string fname = separator == std::string::npos ? arg : arg.substr(separator + 1);
+		  std::optional<Bloom::Filter> filter = use_mmap && Bloom::Filter::inferCompression(fname) == Bloom::Compression::RAW
+			  ? Bloom::Filter::loadMmap(fname)
+			  : Bloom::Filter::load(fname);
+		  if (!filter) {
+			  std::cerr << "Can not load " << fname << '\n';
+			  return 1;
+		  }
+		  filters.emplace(name, std::move(*filter));
+	  }
+	  std::cerr << "Serving " << filters.size() << " filters on " << result["socket"].as<std::string>() << '\n';
+	  return Server::serve(result["socket"].as<std::string>(), filters, *pair_check);
+	}
+} // namespace BloomServe
 
-	  while (curr_rec_pair) {
-		size_t kmer_hits = bloom_filter->searchFastqPair(*curr_rec_pair);
-		if (kmer_hits >= hit_threshold) {
-			Fastq::writeRecordPair(mates1_writer, mates2_writer, *curr_rec_pair);
-		  // std::cout << "Kmer hits\t" << kmer_hits << '\n';
-		  //curr_rec_pair->first.print();
-		  //curr_rec_pair->second.print();
+namespace Extend {
+	// Reads fragments in batches, extends each batch on thread_n threads and
+	// writes the results in input order
+	template <typename Result>
+	void extendBatches(Fastq::FragmentReader& reader,
+			const std::function<Result(const Fastq::Pair&)>& extend,
+			const std::function<void(const Fastq::Pair&, const Result&)>& output,
+			size_t thread_n) {
+		Fastq::FragmentBatch batch(256 * thread_n);
+		std::vector<Result> results;
+		while (reader.nextBatch(batch)) {
+			results.assign(batch.size(), Result());
+			Utils::parallelFor(batch.size(), thread_n, [&](size_t i) {
+				Stats::LatencyTimer latency_timer;
+				results[i] = extend(batch[i]);
+			});
+			Stats::ScopedTimer timer(Stats::Stage::WRITE);
+			for (size_t i = 0; i < batch.size(); i++) {
+				output(batch[i], results[i]);
+			}
 		}
-		curr_rec_pair = Fastq::nextRecordPair(mates1_reader, mates2_reader);
-	  }
-	  bloom_filter->closePointer();
+	}
 
-	  return 0;
+	void printCandidates(const std::vector<std::string>& candidate_seqs) {
+		for (const auto& seq: candidate_seqs) {
+			std::cout << seq << '\n';
+			Stats::add(Stats::Counter::BYTES_OUT, seq.size() + 1);
+		}
+	}
+
+	// first word of a read id, usable as a GFA name
+	std::string gfaName(const std::string& seq_id) {
+		return seq_id.substr(0, seq_id.find_first_of(" \t"));
 	}
-} // namespace BloomSearch
 
-namespace Extend {
 	int run(int argc, char **argv) {
 
 	  cxxopts::Options options("extend",
@@ -241,6 +778,29 @@ namespace Extend {
 		  ("max-candidates", "Maximum number of candidate sequences to output", cxxopts::value<int>()->default_value("10"))
 		  ("max-path-length", "Maximum allowed extended sequence length", cxxopts::value<int>()->default_value("1000"))
 		  ("no-load", "Do not load filter in memory", cxxopts::value<bool>()->default_value("false"))
+		  ("t,threads", "Number of threads extending reads", cxxopts::value<size_t>()->default_value("1"))
+		  ("cache-size", "Maximum number of kmers in the cache of explored paths shared between reads, 0 disables it",
+			  cxxopts::value<size_t>()->default_value("0"))
+		  ("max-nodes", "Stop a walk after queueing this many kmers, 0 for no limit", cxxopts::value<size_t>()->default_value("0"))
+		  ("max-memory", "Stop a walk once its frontier and seen kmers take about this much memory, 0 for no limit",
+			  cxxopts::value<std::string>()->default_value("512M"))
+		  ("max-time-ms", "Stop a walk after this many milliseconds, 0 for no limit", cxxopts::value<uint64_t>()->default_value("0"))
+		  ("pair-check", "When the mates of a pair name different reads: strict (stop with an error), "
+			  "warn (report and go on) or resync (skip reads until the mates are back in step)",
+			  cxxopts::value<std::string>()->default_value("strict"))
+		  ("stats-json", "Write per stage timings, throughput and record latency percentiles as JSON to this file",
+			  cxxopts::value<std::string>())
+		  ("telemetry", "Append progress records as JSON lines to this file, or send them to unix:PATH",
+			  cxxopts::value<std::string>())
+		  ("telemetry-interval", "Seconds between progress records", cxxopts::value<double>()->default_value("10"))
+		  ("gfa", "Write the compacted local assembly graphs to this GFA file and the top paths as fasta to stdout",
+			  cxxopts::value<std::string>())
+		  ("huge-pages", "Back filters with huge pages: off, thp (transparent), 2M or 1G (reserved hugetlbfs pages)",
+			  cxxopts::value<std::string>()->default_value("thp"))
+		  ("numa", "Place filter pages on the node touching them first (local) or interleave them over all NUMA nodes",
+			  cxxopts::value<std::string>()->default_value("local"))
+		  ("read-ahead", "Input buffers decoded ahead by a thread per input file, 0 disables (default 4 with more than one CPU, 0 otherwise)",
+			  cxxopts::value<size_t>())
 		  ("h,help", "Help message");
 
 	  if (argc < 3) {
@@ -248,11 +808,34 @@ namespace Extend {
 		return 0;
 	  }
 	  auto result = options.parse(argc - 1, argv + 1);
+	  setReadAhead(result);
+	  if (!setMemoryPolicy(result)) {
+		return 1;
+	  }
 	  std::string seq = result["sequence"].as<std::string>();
 	  std::string bloom_filter_name = result["bloom"].as<std::string>();
 	  bool no_load = result["no-load"].as<bool>();
 	  int max_candidates = result["max-candidates"].as<int>();
 	  int max_path_length = result["max-path-length"].as<int>();
+	  size_t thread_n = std::max<size_t>(1, result["threads"].as<size_t>());
+	  size_t cache_size = result["cache-size"].as<size_t>();
+	  std::optional<Fastq::PairCheck> pair_check = Fastq::parsePairCheck(result["pair-check"].as<std::string>());
+	  if (!pair_check) {
+		  std::cerr << "Expected --pair-check strict, warn or resync\n";
+		  return 1;
+	  }
+	  Bloom::WalkBudget walk_budget;
+	  walk_budget.max_nodes = result["max-nodes"].as<size_t>();
+	  walk_budget.max_bytes = Utils::dataSizeToBytes(result["max-memory"].as<std::string>());
+	  walk_budget.max_millis = result["max-time-ms"].as<uint64_t>();
+	  if (no_load && thread_n > 1) {
+		  std::cerr << "Filter lookups are not thread safe with --no-load, using 1 thread\n";
+		  thread_n = 1;
+	  }
+	  std::unique_ptr<Bloom::ExtensionCache> cache;
+	  if (cache_size > 0) {
+		  cache = std::make_unique<Bloom::ExtensionCache>(cache_size);
+	  }
 
 	  std::optional<Bloom::Filter> bloom_filter = {};
 	  if (no_load) {
@@ -264,48 +847,122 @@ namespace Extend {
 		  std::cerr << "Failed to load bloom filter\n";
 		  return 1;
 	  } 
+	  bloom_filter->setWalkBudget(walk_budget);
+	  startStats(result);
+	  std::vector<std::string> inputs;
+	  for (const char* reads: {"mates1", "mates2", "unpaired"}) {
+		  if (result.count(reads)) {
+			  inputs.push_back(result[reads].as<std::string>());
+		  }
+	  }
+	  std::unique_ptr<Telemetry::Emitter> telemetry = startTelemetry(result, "extend", inputs);
+	  if (bloom_filter->kmerSize() > Dna::MAX_PACKED_KMER_SIZE) {
+		  std::cerr << "Extension supports kmer sizes up to " << Dna::MAX_PACKED_KMER_SIZE << '\n';
+		  return 1;
+	  }
+	  std::ofstream gfa_out;
+	  if (result.count("gfa")) {
+		  gfa_out.open(result["gfa"].as<std::string>());
+		  if (!gfa_out) {
+			  std::cerr << "Can not open " << result["gfa"].as<std::string>() << '\n';
+			  return 1;
+		  }
+		  Assembly::writeGfaHeader(gfa_out);
+	  }
+	  bool assemble = gfa_out.is_open();
+	  auto write_graph = [&gfa_out](const Assembly::Graph& graph, const std::string& name) {
+		  graph.writeGfa(gfa_out, name);
+		  graph.writeFasta(std::cout, name);
+	  };
+
 	  if (result.count("sequence")) {
-		  std::vector<std::string> candidate_seqs = bloom_filter->extendSeq(seq, max_candidates, max_path_length);
-		  for (const auto& seq: candidate_seqs) {
-			  std::cout << seq << '\n';
+		  if (assemble) {
+			  write_graph(bloom_filter->assembleSeq(seq, max_candidates, max_path_length), "seq");
+		  } else {
+			  printCandidates(bloom_filter->extendSeq(seq, max_candidates, max_path_length));
 		  }
 	  }
+	  bool pairs_in_step = true;
 	  if (result.count("mates1") && result.count("mates2")) {
 		  std::string mates1_fname = result["mates1"].as<std::string>();
 		  std::string mates2_fname = result["mates2"].as<std::string>();
-		  Gz::Reader mates1_reader = Gz::Reader(mates1_fname);
-		  Gz::Reader mates2_reader = Gz::Reader(mates2_fname);
-
-		  std::optional<Fastq::Pair> curr_rec_pair =
-			  Fastq::nextRecordPair(mates1_reader, mates2_reader);
+		  Fastq::FragmentReader pair_reader(Fastq::Layout::PAIRED, mates1_fname, mates2_fname, *pair_check);
 
-		  while (curr_rec_pair) {
-			  std::cerr << curr_rec_pair->first.seq_id << '\n';
-			std::vector<std::string> candidate_seqs = bloom_filter->extendSeqPair(curr_rec_pair->first.seq, curr_rec_pair->second.seq, max_candidates, max_path_length);
-			for (const auto& seq: candidate_seqs) {
-				std::cout << seq << '\n';
-			}
-			curr_rec_pair = Fastq::nextRecordPair(mates1_reader, mates2_reader);
+		  if (assemble) {
+			  using Graphs = std::optional<std::pair<Assembly::Graph, Assembly::Graph>>;
+			  extendBatches<Graphs>(
+					  pair_reader,
+					  [&](const Fastq::Pair& pair) -> Graphs {
+						  return bloom_filter->assembleSeqPair(pair.first.seq, pair.second.seq, max_candidates, max_path_length);
+					  },
+					  [&](const Fastq::Pair& pair, const Graphs& graphs) {
+						  std::string name1 = gfaName(pair.first.seq_id);
+						  std::string name2 = gfaName(pair.second.seq_id);
+						  if (name1 == name2) {
+							  name1 += "/1";
+							  name2 += "/2";
+						  }
+						  write_graph(graphs->first, name1);
+						  write_graph(graphs->second, name2);
+					  },
+					  thread_n);
+		  } else {
+			  extendBatches<std::vector<std::string>>(
+					  pair_reader,
+					  [&](const Fastq::Pair& pair) {
+						  return bloom_filter->extendSeqPair(pair.first.seq, pair.second.seq, max_candidates, max_path_length, cache.get());
+					  },
+					  [](const Fastq::Pair& pair, const std::vector<std::string>& candidate_seqs) {
+						  std::cerr << pair.first.seq_id << '\n';
+						  printCandidates(candidate_seqs);
+					  },
+					  thread_n);
 		  }
+		  pairs_in_step = reportPairCheck(pair_reader);
 	  }
 	  if (result.count("unpaired")) {
 		  std::string unpaired_fname = result["unpaired"].as<std::string>();
-		  Gz::Reader unpaired_reader = Gz::Reader(unpaired_fname);
-
-		  std::optional<Fastq::Rec> curr_rec =
-			  Fastq::nextRecord(unpaired_reader);
+		  Fastq::FragmentReader unpaired_reader(Fastq::Layout::SINGLE, unpaired_fname);
 
-		  while (curr_rec) {
-			std::vector<std::string> candidate_seqs = bloom_filter->extendSeq(curr_rec->seq, max_candidates, max_path_length);
-			for (const auto& seq: candidate_seqs) {
-				std::cout << seq << '\n';
-			}
-			curr_rec = Fastq::nextRecord(unpaired_reader);
+		  if (assemble) {
+			  using Graph = std::optional<Assembly::Graph>;
+			  extendBatches<Graph>(
+					  unpaired_reader,
+					  [&](const Fastq::Pair& read) -> Graph {
+						  return bloom_filter->assembleSeq(read.first.seq, max_candidates, max_path_length);
+					  },
+					  [&](const Fastq::Pair& read, const Graph& graph) {
+						  write_graph(*graph, gfaName(read.first.seq_id));
+					  },
+					  thread_n);
+		  } else {
+			  extendBatches<std::vector<std::string>>(
+					  unpaired_reader,
+					  [&](const Fastq::Pair& read) {
+						  return bloom_filter->extendSeq(read.first.seq, max_candidates, max_path_length, cache.get());
+					  },
+					  [](const Fastq::Pair&, const std::vector<std::string>& candidate_seqs) {
+						  printCandidates(candidate_seqs);
+					  },
+					  thread_n);
 		  }
 	  }
+	  if (cache && cache->hits() + cache->misses() > 0) {
+		  std::cerr << "extension cache: " << cache->size() << " kmers, "
+			  << cache->hits() << " hits, " << cache->misses() << " misses\n";
+	  }
+	  const Bloom::TruncationCounts& truncations = bloom_filter->truncationCounts();
+	  if (truncations.depth + truncations.nodes + truncations.memory + truncations.time > 0) {
+		  std::cerr << "truncated walks: depth " << truncations.depth << ", node budget " << truncations.nodes
+			  << ", memory budget " << truncations.memory << ", time budget " << truncations.time << '\n';
+	  }
+	  if (telemetry) {
+		  telemetry->stop();
+	  }
+	  writeStats(result);
 
 	  bloom_filter->closePointer();
-	  return 0;
+	  return pairs_in_step ? 0 : 1;
 	}
 } // namespace Extend
 
@@ -325,6 +982,8 @@ namespace StatsBloom {
 			std::string bloom_filter_name = result["bloom"].as<std::string>();
 			std::optional<Bloom::Filter> bloom_filter = Bloom::Filter::load(bloom_filter_name);
 			std::cout << "bloom filter size:\t" << bloom_filter->size() << '\n';
+			std::cout << "hash mode:\t"
+				<< (bloom_filter->hashMode() == Dna::HashMode::CANONICAL ? "canonical" : "forward") << '\n';
 			std::cout << "set bits:\t" << bloom_filter->setBitsCount() << '\n';
 			std::cout << "false positive rate:\t" << bloom_filter->falsePostiveRate() << '\n';
 
@@ -388,4 +1047,178 @@ namespace StatsFasta {
 			return 0;
 		}
 	} // namespace Stats
+
+namespace Bench {
+	struct StageResult {
+		std::string name;
+		int status = 0;
+		double seconds = 0.0;
+		double cpu_seconds = 0.0;
+		// on disk size of the inputs, compressed if they are
+		uint64_t input_bytes = 0;
+		// reads (or read pairs) processed, 0 when the stage does not take reads
+		uint64_t reads = 0;
+	};
+
+	// Runs a subcommand in process, as if called from the command line
+	StageResult runStage(const std::string& name, const std::function<int(int, char**)>& command,
+			const std::vector<std::string>& args, const std::vector<std::string>& inputs) {
+		std::vector<std::string> argv_strs = {"paramer", name};
+		argv_strs.insert(argv_strs.end(), args.begin(), args.end());
+		std::vector<char*> argv_ptrs;
+		for (std::string& arg: argv_strs) {
+			argv_ptrs.push_back(arg.data());
+		}
+		StageResult stage;
+		stage.name = name;
+		for (const std::string& fname: inputs) {
+			stage.input_bytes += std::filesystem::file_size(fname);
+		}
+		std::cerr << "bench: running " << name << '\n';
+		std::clock_t cpu_start = std::clock();
+		auto start = std::chrono::steady_clock::now();
+		stage.status = command(argv_ptrs.size(), argv_ptrs.data());
+		stage.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		stage.cpu_seconds = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+		return stage;
+	}
+
+	size_t countFastqRecords(const std::string& fname) {
+		Gz::Reader gzr(fname);
+		size_t rec_n = 0;
+		for (Fastq::Rec rec; Fastq::readRecord(gzr, rec); ) {
+			rec_n++;
+		}
+		return rec_n;
+	}
+
+	void writeJson(std::ostream& out, const Workload::Config& config, uint64_t filter_size,
+			size_t thread_n, const std::vector<StageResult>& stages) {
+		out << "{\n";
+		out << "  \"config\": {"
+			<< "\"parasite_size\": " << config.parasite_size
+			<< ", \"host_size\": " << config.host_size
+			<< ", \"read_pairs\": " << config.read_pair_n
+			<< ", \"read_size\": " << config.read_size
+			<< ", \"parasite_fraction\": " << config.parasite_fraction
+			<< ", \"mutation_rate\": " << config.mutation_rate
+			<< ", \"seed\": " << config.seed
+			<< ", \"filter_size\": " << filter_size
+			<< ", \"threads\": " << thread_n
+			<< "},\n";
+		out << "  \"stages\": [\n";
+		for (size_t i = 0; i < stages.size(); i++) {
+			const StageResult& stage = stages[i];
+			out << "    {\"name\": \"" << stage.name << "\""
+				<< ", \"status\": " << stage.status
+				<< ", \"seconds\": " << stage.seconds
+				<< ", \"cpu_seconds\": " << stage.cpu_seconds
+				<< ", \"input_bytes\": " << stage.input_bytes
+				<< ", \"mb_per_s\": " << (stage.seconds > 0 ? stage.input_bytes / 1e6 / stage.seconds : 0.0);
+			if (stage.reads > 0) {
+				out << ", \"reads\": " << stage.reads
+					<< ", \"reads_per_s\": " << (stage.seconds > 0 ? stage.reads / stage.seconds : 0.0);
+			}
+			out << "}" << (i + 1 < stages.size() ? "," : "") << '\n';
+		}
+		out << "  ]\n";
+		out << "}\n";
+	}
+
+	int run(int argc, char **argv) {
+		cxxopts::Options options("bench",
+				"Generate a synthetic workload and time bloom-build, bloom-search, mask and extend on it");
+		options.add_options()
+			("d,dir", "Directory for generated inputs and outputs", cxxopts::value<std::string>()->default_value("paramer_bench"))
+			("parasite-size", "Parasite genome size (suffixes K,M,G)", cxxopts::value<std::string>()->default_value("2M"))
+			("host-size", "Host genome size (suffixes K,M,G)", cxxopts::value<std::string>()->default_value("4M"))
+			("read-pairs", "Number of simulated read pairs", cxxopts::value<size_t>()->default_value("200000"))
+			("read-size", "Simulated read length", cxxopts::value<size_t>()->default_value("150"))
+			("parasite-fraction", "Fraction of read pairs sampled from the parasite", cxxopts::value<double>()->default_value("0.1"))
+			("mutation-rate", "Substitution rate of parasite segments copied into the host", cxxopts::value<double>()->default_value("0.01"))
+			("seed", "Random seed", cxxopts::value<uint64_t>()->default_value("1"))
+			("filter-size", "Bloom filter size (suffixes K,M,G)", cxxopts::value<std::string>()->default_value("64M"))
+			("t,threads", "Threads used by extend", cxxopts::value<size_t>()->default_value("1"))
+			("o,output", "JSON results, - for stdout", cxxopts::value<std::string>()->default_value("-"))
+			("h,help", "Help message");
+
+		auto result = options.parse(argc - 1, argv + 1);
+		if (result.count("help")) {
+			print_help(options);
+			return 0;
+		}
+		Workload::Config config;
+		config.parasite_size = Utils::dataSizeToBytes(result["parasite-size"].as<std::string>());
+		config.host_size = Utils::dataSizeToBytes(result["host-size"].as<std::string>());
+		config.read_pair_n = result["read-pairs"].as<size_t>();
+		config.read_size = result["read-size"].as<size_t>();
+		config.parasite_fraction = result["parasite-fraction"].as<double>();
+		config.mutation_rate = result["mutation-rate"].as<double>();
+		config.seed = result["seed"].as<uint64_t>();
+		uint64_t filter_size = Utils::dataSizeToBytes(result["filter-size"].as<std::string>());
+		size_t thread_n = std::max<size_t>(1, result["threads"].as<size_t>());
+		std::string dir = result["dir"].as<std::string>();
+		std::string output_fname = result["output"].as<std::string>();
+		if (config.parasite_size == 0 || filter_size == 0) {
+			std::cerr << "Parasite genome and filter sizes must be positive\n";
+			return 1;
+		}
+
+		std::vector<StageResult> stages;
+		StageResult generate_stage;
+		generate_stage.name = "generate";
+		std::cerr << "bench: generating inputs in " << dir << '\n';
+		std::clock_t cpu_start = std::clock();
+		auto start = std::chrono::steady_clock::now();
+		Workload::Files files = Workload::generate(config, dir);
+		generate_stage.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		generate_stage.cpu_seconds = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+		stages.push_back(generate_stage);
+
+		auto path = [&dir](const std::string& name) {
+			std::filesystem::path fname = std::filesystem::path(dir) / name;
+			std::filesystem::remove(fname);
+			return fname.string();
+		};
+		std::string filter_fname = path("parasite.blm");
+		std::string hits1_fname = path("hits_1.fq.gz");
+		std::string hits2_fname = path("hits_2.fq.gz");
+		std::string masked_fname = path("parasite.masked.fa.gz");
+		std::string extended_fname = path("extended.txt");
+
+		stages.push_back(runStage("bloom-build", BloomBuild::run,
+				{"-r", files.parasite_fasta, "-k", "31", "-w", "31", "-s", std::to_string(filter_size), "-o", filter_fname},
+				{files.parasite_fasta}));
+		stages.push_back(runStage("bloom-search", BloomSearch::run,
+				{"-b", filter_fname, "-i", files.mates1, "-I", files.mates2, "-o", hits1_fname, "-O", hits2_fname},
+				{filter_fname, files.mates1, files.mates2}));
+		stages.back().reads = config.read_pair_n;
+		stages.push_back(runStage("mask", Mask::run,
+				{"-f", files.parasite_fasta, "-k", files.kraken2, "-r", files.host_fasta, "-o", masked_fname},
+				{files.parasite_fasta, files.kraken2, files.host_fasta}));
+		{
+			// extend writes candidates to stdout
+			std::ofstream extended_out(extended_fname);
+			std::streambuf* cout_buf = std::cout.rdbuf(extended_out.rdbuf());
+			stages.push_back(runStage("extend", Extend::run,
+					{"-b", filter_fname, "-1", hits1_fname, "-2", hits2_fname, "-t", std::to_string(thread_n)},
+					{filter_fname, hits1_fname, hits2_fname}));
+			std::cout.rdbuf(cout_buf);
+		}
+		stages.back().reads = countFastqRecords(hits1_fname);
+
+		std::streambuf* buf;
+		std::ofstream ofh;
+		if (output_fname != "-") {
+			ofh.open(output_fname);
+			buf = ofh.rdbuf();
+		} else {
+			buf = std::cout.rdbuf();
+		}
+		std::ostream out(buf);
+		writeJson(out, config, filter_size, thread_n, stages);
+		bool failed = std::any_of(stages.begin(), stages.end(), [](const StageResult& stage) { return stage.status != 0; });
+		return failed ? 1 : 0;
+	}
+} // namespace Bench
 } // namespace Cmd
@@ -10,9 +10,11 @@ namespace Cmd {
 	namespace Mask { int run(int argc, char **argv); }
 	namespace BloomBuild { int run(int argc, char **argv); }
 	namespace BloomSearch { int run(int argc, char **argv); }
+	namespace BloomServe { int run(int argc, char **argv); }
 	namespace Extend { int run(int argc, char **argv); }
 	namespace StatsBloom { int run(int argc, char **argv); }
 	namespace StatsFasta { int run(int argc, char **argv); }
+	namespace Bench { int run(int argc, char **argv); }
 
 }
 
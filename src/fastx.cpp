@@ -1,5 +1,8 @@
 #include "fastx.h"
+#include "stats.h"
+#include <cstring>
 #include <string_view>
+#include <unordered_map>
 
 namespace Fastx {
 	std::optional<FileFormat> inferFileFormat(const std::string& fname) {
@@ -29,36 +32,51 @@ namespace Fastq {
 		std::cout << qual << '\n';
 	}
 
-	std::optional<Rec> nextRecord(Gz::Reader& gzr) {
-		std::string seq_id = gzr.nextLine();
-		std::string seq = gzr.nextLine();
-		gzr.nextLine();
-		std::string qual = gzr.nextLine();
+	bool readRecord(Gz::Reader& gzr, Rec& rec) {
+		Stats::ScopedTimer timer(Stats::Stage::PARSE);
+		if (!gzr.readLine(rec.seq_id) || rec.seq_id.empty()) {
+			return false;
+		}
+		gzr.readLine(rec.seq);
+		// the separator line is read into qual and overwritten
+		gzr.readLine(rec.qual);
+		gzr.readLine(rec.qual);
+		rec.seq_id.erase(0, 1);
+		Stats::add(Stats::Counter::RECORDS, 1);
+		return true;
+	}
 
-		if (seq_id.size() > 0) {
-			return Rec(seq_id.substr(1), seq, qual);
-		} else {
+	bool readRecordPair(Gz::Reader& gzr1, Gz::Reader& gzr2, Pair& rec_pair) {
+		bool has_first = readRecord(gzr1, rec_pair.first);
+		bool has_second = readRecord(gzr2, rec_pair.second);
+		return has_first && has_second;
+	}
+
+	std::optional<Rec> nextRecord(Gz::Reader& gzr) {
+		Rec rec;
+		if (!readRecord(gzr, rec)) {
 			return {};
 		}
+		return rec;
 	}
 
 	std::optional<Pair> nextRecordPair(Gz::Reader& gzr1, Gz::Reader& gzr2) {
-		std::optional<Rec> rec1 = nextRecord(gzr1);
-		std::optional<Rec> rec2 = nextRecord(gzr2);
-		if (rec1 && rec2) {
-			return std::pair<Rec, Rec>(*rec1, *rec2);
-		} else {
+		Pair rec_pair;
+		if (!readRecordPair(gzr1, gzr2, rec_pair)) {
 			return {};
 		}
+		return rec_pair;
 	}
 
 	int writeRecord(Gz::Writer &gzw, const Rec &rec) {
-		int errors = 0;
-		errors |= gzw.writeLine("@"+rec.seq_id);
-		errors |= gzw.writeLine(rec.seq);
-		errors |= gzw.writeLine("+");
-		errors |= gzw.writeLine(rec.qual);
-		return errors;
+		gzw.append('@');
+		gzw.append(rec.seq_id);
+		gzw.append('\n');
+		gzw.append(rec.seq);
+		gzw.append("\n+\n", 3);
+		gzw.append(rec.qual);
+		gzw.append('\n');
+		return gzw.failed() ? 1 : 0;
 	}
 	int writeRecordPair(Gz::Writer &gzw1, Gz::Writer &gzw2, const Pair &rec_pair) {
 		int errors = 0;
@@ -67,6 +85,202 @@ namespace Fastq {
 		return errors;
 	}
 
+	std::optional<PairCheck> parsePairCheck(const std::string& name) {
+		if (name == "strict") {
+			return PairCheck::STRICT;
+		} else if (name == "warn") {
+			return PairCheck::WARN;
+		} else if (name == "resync") {
+			return PairCheck::RESYNC;
+		}
+		return {};
+	}
+
+	// the read id up to the first blank, without a /1 or /2 suffix
+	static std::string_view fragmentName(const std::string& seq_id) {
+		size_t size = std::strcspn(seq_id.c_str(), " \t");
+		if (size >= 2 && seq_id[size - 2] == '/' && (seq_id[size - 1] == '1' || seq_id[size - 1] == '2')) {
+			size -= 2;
+		}
+		return std::string_view(seq_id.data(), size);
+	}
+
+	bool sameFragment(const std::string& seq_id1, const std::string& seq_id2) {
+		return fragmentName(seq_id1) == fragmentName(seq_id2);
+	}
+
+	FragmentReader::FragmentReader(Layout layout, const std::string& fname1, const std::string& fname2, PairCheck check)
+		: read_layout(layout), pair_check(check), reader1(std::make_unique<Gz::Reader>(fname1)) {
+		// mates are decoded on a thread each, so neither waits on the other
+		reader1->startReadAhead();
+		if (layout == Layout::PAIRED) {
+			reader2 = std::make_unique<Gz::Reader>(fname2);
+			reader2->startReadAhead();
+		}
+	}
+
+	bool FragmentReader::readMate(size_t file, Rec& rec) {
+		std::deque<Rec>& records = read_ahead[file];
+		if (!records.empty()) {
+			std::swap(rec, records.front());
+			records.pop_front();
+			return true;
+		}
+		return readRecord(file == 0 ? *reader1 : *reader2, rec);
+	}
+
+	bool FragmentReader::next(Pair& fragment) {
+		if (read_layout == Layout::SINGLE) {
+			fragment.second.seq_id.clear();
+			fragment.second.seq.clear();
+			fragment.second.qual.clear();
+			return readMate(0, fragment.first);
+		}
+		if (check_counts.failed) {
+			return false;
+		}
+		bool has_first = readMate(0, fragment.first);
+		bool has_second = readMate(read_layout == Layout::PAIRED ? 1 : 0, fragment.second);
+		if (has_first != has_second) {
+			// a mate missing at the end can not be resynchronized
+			check_counts.mismatched++;
+			Stats::add(Stats::Counter::MATE_MISMATCHES, 1);
+			check_counts.failed = pair_check == PairCheck::STRICT;
+			std::cerr << (pair_check == PairCheck::STRICT ? "Error" : "Warning") << ": the read after pair "
+				<< fragment_n << " has no mate, the input ends unpaired\n";
+		}
+		if (!has_first || !has_second) {
+			return false;
+		}
+		if (!sameFragment(fragment.first.seq_id, fragment.second.seq_id) && !mismatch(fragment)) {
+			return false;
+		}
+		fragment_n++;
+		return true;
+	}
+
+	bool FragmentReader::mismatch(Pair& fragment) {
+		check_counts.mismatched++;
+		Stats::add(Stats::Counter::MATE_MISMATCHES, 1);
+		switch (pair_check) {
+			case PairCheck::STRICT:
+				std::cerr << "Error: mates after pair " << fragment_n << " name different fragments: "
+					<< fragment.first.seq_id << " and " << fragment.second.seq_id << '\n';
+				check_counts.failed = true;
+				return false;
+			case PairCheck::WARN:
+				if (check_counts.mismatched == 1) {
+					std::cerr << "Warning: mates after pair " << fragment_n << " name different fragments: "
+						<< fragment.first.seq_id << " and " << fragment.second.seq_id << ", further mismatches are only counted\n";
+				}
+				return true;
+			case PairCheck::RESYNC:
+				break;
+		}
+		if (resync(fragment)) {
+			return true;
+		}
+		std::cerr << "Error: mates after pair " << fragment_n << " are not back in step within "
+			<< RESYNC_WINDOW << " records\n";
+		check_counts.failed = true;
+		return false;
+	}
+
+	bool FragmentReader::resync(Pair& fragment) {
+		size_t file2 = read_layout == Layout::PAIRED ? 1 : 0;
+		// the mismatched mates and the records after them, in file order
+		std::vector<Rec> window1;
+		std::vector<Rec> window2;
+		window1.push_back(std::move(fragment.first));
+		(file2 == 0 ? window1 : window2).push_back(std::move(fragment.second));
+		for (Rec rec; window1.size() < RESYNC_WINDOW && readMate(0, rec); ) {
+			window1.push_back(std::move(rec));
+		}
+		for (Rec rec; file2 == 1 && window2.size() < RESYNC_WINDOW && readMate(1, rec); ) {
+			window2.push_back(std::move(rec));
+		}
+		// the first pair of consecutive records of one file, or of records of
+		// both files, naming one fragment; the fewest records are skipped
+		size_t first_idx = 0;
+		size_t second_idx = 0;
+		bool found = false;
+		if (file2 == 0) {
+			for (size_t i = 0; i + 1 < window1.size() && !found; i++) {
+				found = sameFragment(window1[i].seq_id, window1[i + 1].seq_id);
+				first_idx = i;
+				second_idx = i + 1;
+			}
+		} else {
+			std::unordered_map<std::string_view, size_t> second_names;
+			for (size_t j = window2.size(); j-- > 0; ) {
+				second_names[fragmentName(window2[j].seq_id)] = j;
+			}
+			for (size_t i = 0; i < window1.size(); i++) {
+				auto match = second_names.find(fragmentName(window1[i].seq_id));
+				if (match != second_names.end() && (!found || i + match->second < first_idx + second_idx)) {
+					first_idx = i;
+					second_idx = match->second;
+					found = true;
+				}
+			}
+		}
+		if (!found) {
+			return false;
+		}
+		size_t skipped = file2 == 0 ? first_idx : first_idx + second_idx;
+		check_counts.skipped += skipped;
+		Stats::add(Stats::Counter::SKIPPED_RECORDS, skipped);
+		fragment.first = std::move(window1[first_idx]);
+		if (file2 == 0) {
+			fragment.second = std::move(window1[second_idx]);
+		} else {
+			fragment.second = std::move(window2[second_idx]);
+			read_ahead[1].insert(read_ahead[1].begin(), std::make_move_iterator(window2.begin() + second_idx + 1),
+					std::make_move_iterator(window2.end()));
+		}
+		read_ahead[0].insert(read_ahead[0].begin(),
+				std::make_move_iterator(window1.begin() + (file2 == 0 ? second_idx : first_idx) + 1),
+				std::make_move_iterator(window1.end()));
+		return true;
+	}
+
+	std::optional<Pair> FragmentReader::next() {
+		Pair fragment;
+		if (!next(fragment)) {
+			return {};
+		}
+		return fragment;
+	}
+
+	bool FragmentReader::nextBatch(FragmentBatch& batch) {
+		batch.fragment_n = 0;
+		while (batch.fragment_n < batch.capacity() && next(batch.fragments[batch.fragment_n])) {
+			batch.fragment_n++;
+		}
+		return batch.fragment_n > 0;
+	}
+
+	FragmentWriter::FragmentWriter(Layout layout, const std::string& fname1, const std::string& fname2,
+			std::optional<Gz::Format> format)
+		: write_layout(layout),
+		writer1(std::make_unique<Gz::Writer>(fname1, format.value_or(Gz::formatFromName(fname1)))) {
+		if (layout == Layout::PAIRED) {
+			writer2 = std::make_unique<Gz::Writer>(fname2, format.value_or(Gz::formatFromName(fname2)));
+		}
+	}
+
+	int FragmentWriter::write(const Pair& fragment) {
+		switch (write_layout) {
+			case Layout::PAIRED:
+				return writeRecordPair(*writer1, *writer2, fragment);
+			case Layout::INTERLEAVED:
+				return writeRecordPair(*writer1, *writer1, fragment);
+			case Layout::SINGLE:
+				break;
+		}
+		return writeRecord(*writer1, fragment.first);
+	}
+
 	std::vector<Rec> Rec::splitOnMask() const {
 		std::vector<Rec> result;
 		std::vector<std::string> split_seqs = Dna::splitOnMask(seq);
@@ -106,6 +320,7 @@ namespace Fasta {
 	}
 
 	std::optional<Rec> nextRecord(Gz::Reader& gzr) {
+		Stats::ScopedTimer timer(Stats::Stage::PARSE);
 		std::string tmp_buffer = gzr.last_line;
 		std::string seq_id = tmp_buffer.size() > 0 && tmp_buffer[0] == '>'
 			? tmp_buffer : gzr.nextLine();
@@ -119,6 +334,7 @@ namespace Fasta {
 		}
 		if (seq_id.size() > 0) {
 			//seq_id.remove(0);
+			Stats::add(Stats::Counter::RECORDS, 1);
 			return Rec(seq_id.substr(1), seq);
 		} else {
 			return {};
@@ -126,7 +342,7 @@ namespace Fasta {
 
 	}
 	void Rec::softmaskWithKraken2(const Kraken2::Rec& k2_rec, size_t kmer_size) {
-		auto r1_pairs = k2_rec.getR1Kmers();
+		const auto& r1_pairs = k2_rec.getR1Kmers();
 		size_t kmer_pos = 0;
 		for (const auto& p: r1_pairs) {
 			if (p.first != "0"){
@@ -139,15 +355,25 @@ namespace Fasta {
 		return;
 	}
 
-	robin_hood::unordered_set<std::string> loadUnmaskedKmers(const std::string& fname, size_t kmer_size) {
-		robin_hood::unordered_set<std::string> result;
+	std::optional<robin_hood::unordered_set<uint64_t>> loadUnmaskedKmers(const std::string& fname, size_t kmer_size) {
+		if (kmer_size == 0 || kmer_size > Dna::MAX_PACKED_KMER_SIZE) {
+			std::cerr << "Kmer size " << kmer_size << " can not be packed, expected 1 to "
+				<< Dna::MAX_PACKED_KMER_SIZE << '\n';
+			return {};
+		}
+		robin_hood::unordered_set<uint64_t> result;
 		Gz::Reader fh = Gz::Reader(fname);
 		std::optional<Fasta::Rec> rec = Fasta::nextRecord(fh);
 		while (rec) {
-			for (Fasta::Rec seq: rec->splitOnMask()) {
-				Dna::addKmers(seq.seq, kmer_size, result);
+			for (Dna::SeqInterval interval: Dna::nonmaskedRegions(rec->seq)) {
+				size_t interval_size = interval.second - interval.first;
+				if (interval_size >= kmer_size) {
+					Stats::ScopedTimer timer(Stats::Stage::HASH);
+					Stats::add(Stats::Counter::KMERS, interval_size - kmer_size + 1);
+					Dna::PackedSeq packed_seq(rec->seq.data() + interval.first, interval_size);
+					Dna::addCanonicalKmers(packed_seq, kmer_size, result);
+				}
 			}
-			std::cerr << "Loaded kmers " << result.size() << '\n';
 			rec = Fasta::nextRecord(fh);
 		}
 		return result;
@@ -163,14 +389,11 @@ namespace Fasta {
 			for (Dna::SeqInterval interval: Dna::nonmaskedRegions(rec->seq)) {
 				size_t interval_size = interval.second - interval.first;
 				if (interval_size >= kmer_size) {
-					ntHashIterator itr(rec->seq.c_str()+interval.first, hash_n, kmer_size);
-					size_t hash_i = 0;
-					size_t kmer_count = interval_size - kmer_size + 1;
-					size_t hashes_in_window = hash_n * kmer_count;
-					while (hash_i++ < hashes_in_window) {
-						uint64_t hash_value = (*itr)[hash_i % hash_n];
-						result.insert(hash_value);
-						++itr;
+					Stats::ScopedTimer timer(Stats::Stage::HASH);
+					Stats::add(Stats::Counter::KMERS, interval_size - kmer_size + 1);
+					Dna::KmerHasher hasher(rec->seq.data()+interval.first, interval_size, kmer_size, hash_n);
+					while (hasher.next()) {
+						result.insert(hasher.hashes()[0]);
 					}
 				}
 			}
@@ -187,11 +410,11 @@ namespace Fasta {
 			for (Fasta::Rec seq: rec->splitOnMask()) {
 				std::cerr << "Dropping from " << seq.seq_id << '\n';
 				if (seq.size() >= kmer_size) {
-					ntHashIterator itr(seq.seq, hash_n, kmer_size);
-					while (itr != itr.end()) {
-						uint64_t hash_value = (*itr)[0];
-						kmers.erase(hash_value);
-						++itr;
+					Stats::ScopedTimer timer(Stats::Stage::HASH);
+					Stats::add(Stats::Counter::KMERS, seq.size() - kmer_size + 1);
+					Dna::KmerHasher hasher(seq.seq, kmer_size, hash_n);
+					while (hasher.next()) {
+						kmers.erase(hasher.hashes()[0]);
 					}
 				}
 			}
@@ -199,6 +422,22 @@ namespace Fasta {
 		}
 	}
 
+	void dropKmersFound(const std::string& fname, size_t kmer_size, robin_hood::unordered_set<uint64_t>& kmers) {
+		Gz::Reader fh = Gz::Reader(fname);
+		std::optional<Fasta::Rec> rec = Fasta::nextRecord(fh);
+		while (rec) {
+			for (Fasta::Rec seq: rec->splitOnMask()) {
+				std::cerr << "Dropping from " << seq.seq_id << '\n';
+				if (seq.size() >= kmer_size) {
+					Stats::ScopedTimer timer(Stats::Stage::HASH);
+					Stats::add(Stats::Counter::KMERS, seq.size() - kmer_size + 1);
+					Dna::eraseCanonicalKmers(Dna::PackedSeq(seq.seq), kmer_size, kmers);
+				}
+			}
+			rec = Fasta::nextRecord(fh);
+		}
+	}
+
 	bool idsMatch(const std::string& id1,  const std::string& id2) {
 		size_t min_size = std::min(id1.size(), id2.size());
 		return id1.substr(0, min_size) == id2.substr(0, min_size);
@@ -225,20 +464,38 @@ namespace Fasta {
 
 		Gz::Reader gzrfa = Gz::Reader(fasta_fname);
 		std::vector<Gz::Reader> k2_readers;
+		k2_readers.reserve(kraken2_fnames.size());
 
 		for (const auto &fn : kraken2_fnames) {
 			k2_readers.emplace_back(fn);
 		}
 
 		std::optional<Fasta::Rec> fa_rec = Fasta::nextRecord(gzrfa);
-		std::vector<std::optional<Kraken2::Rec>> k2_recs;
+		std::vector<Kraken2::IntervalStream> k2_streams;
+		std::vector<bool> k2_has_rec;
 
 		for (auto &gzkr2 : k2_readers) {
-			k2_recs.push_back(Kraken2::nextRecord(gzkr2));
+			k2_streams.emplace_back(gzkr2);
+			k2_has_rec.push_back(k2_streams.back().nextRecord());
 		}
 
 		robin_hood::unordered_set<uint64_t> fa_kmers = {};
-		if (reference_fnames.size() > 0) {
+		// 2 bit kmers are exact and cheaper to hash, ntHash values are kept for longer kmers
+		bool packed = kmer_size <= Dna::MAX_PACKED_KMER_SIZE;
+		if (reference_fnames.size() > 0 && packed) {
+			std::optional<robin_hood::unordered_set<uint64_t>> unmasked = loadUnmaskedKmers(fasta_fname, kmer_size);
+			if (!unmasked) {
+				return;
+			}
+			fa_kmers = std::move(*unmasked);
+			std::cerr << "kmers loaded: " << fa_kmers.size() << '\n';
+			std::cerr << "Dropping kmers found in refs\n";
+			for (std::string ref_name : reference_fnames) {
+				dropKmersFound(ref_name, kmer_size, fa_kmers);
+			}
+			std::cerr << "kmers kept: " << fa_kmers.size() << '\n';
+			std::cerr << "clean target fasta file\n";
+		} else if (reference_fnames.size() > 0) {
 			fa_kmers = loadUnmaskedKmerHashes(fasta_fname, kmer_size);
 			std::cerr << "kmer hashes loaded: " << fa_kmers.size() << '\n';
 			std::cerr << "Dropping hashes found in refs\n";
@@ -250,20 +507,33 @@ namespace Fasta {
 		}
 
 		while (fa_rec) {
+			Stats::LatencyTimer latency_timer;
 			//std::cerr << "Processing " << fa_rec->seq_id << '\n';
-			for (const auto &k2_rec : k2_recs) {
-				if (k2_rec) {
-					if (idsMatch(fa_rec->seq_id, k2_rec->seq_id)) {
-						fa_rec->softmaskWithKraken2(*k2_rec);
+			std::vector<Kraken2::IntervalStream*> matching_streams;
+			for (size_t i = 0; i < k2_streams.size(); i++) {
+				if (k2_has_rec[i]) {
+					if (idsMatch(fa_rec->seq_id, k2_streams[i].seqId())) {
+						matching_streams.push_back(&k2_streams[i]);
 				  } else {
 					std::cerr << "Ids do not match\n";
 					std::cerr << fa_rec->seq_id << "\t"
-							  << k2_rec->seq_id << '\n';
+							  << k2_streams[i].seqId() << '\n';
 				  }
 				}
 			}
+			Kraken2::IntervalMerger k2_intervals(matching_streams);
+			std::optional<Dna::SeqInterval> interval = k2_intervals.nextInterval();
+			while (interval) {
+				fa_rec->softmask(interval->first, std::min(interval->second, fa_rec->size()));
+				interval = k2_intervals.nextInterval();
+			}
 			if (reference_fnames.size() > 0) {
-				Dna::softmaskNotInKmerHashes(fa_rec->seq, fa_kmers, kmer_size);
+				Stats::ScopedTimer timer(Stats::Stage::HASH);
+				if (packed) {
+					Dna::softmaskNotInKmers(fa_rec->seq, fa_kmers, kmer_size);
+				} else {
+					Dna::softmaskNotInKmerHashes(fa_rec->seq, fa_kmers, kmer_size);
+				}
 			}
 
 			if (gzw) {
@@ -274,10 +544,9 @@ namespace Fasta {
 				fa_rec->print();
 			}
 			fa_rec = Fasta::nextRecord(gzrfa);
-			k2_recs.clear();
 
-			for (auto &gzkr2 : k2_readers) {
-			  k2_recs.push_back(Kraken2::nextRecord(gzkr2));
+			for (size_t i = 0; i < k2_streams.size(); i++) {
+				k2_has_rec[i] = k2_has_rec[i] && k2_streams[i].nextRecord();
 			}
 		}
 		if (fh) {
@@ -285,11 +554,16 @@ namespace Fasta {
 		}
 	}
 	int writeRecord(Gz::Writer &gzw, const Rec &rec) {
-		gzw.writeLine(">"+rec.seq_id);
-		gzw.writeLine(rec.seq);
-		return 0;
+		gzw.append('>');
+		gzw.append(rec.seq_id);
+		gzw.append('\n');
+		gzw.append(rec.seq);
+		gzw.append('\n');
+		return gzw.failed() ? 1 : 0;
 	}
 	int writeRecordRaw(std::ofstream &fh, const Rec &rec) {
+		Stats::ScopedTimer timer(Stats::Stage::WRITE);
+		Stats::add(Stats::Counter::BYTES_OUT, rec.seq_id.size() + rec.seq.size() + 3);
 		fh << ">" << rec.seq_id << '\n';
 		fh << rec.seq << '\n';
 		return 0;
@@ -3,8 +3,13 @@
 #include <optional>
 #include "utils.h"
 #include "seq.h"
+#include "packed.h"
 #include "kraken2.h"
+#include <algorithm>
+#include <array>
+#include <deque>
 #include <fstream>
+#include <memory>
 #include <ntHashIterator.hpp>
 
 
@@ -20,6 +25,7 @@ namespace Fastx {
 namespace Fastq {
 	class Rec {
 		public:
+			Rec() = default;
 			Rec(const std::string& sid, const std::string& sq, const std::string& q);
 			void print() const;
 			size_t size() const {return seq.size();}
@@ -33,9 +39,112 @@ namespace Fastq {
 
 	std::optional<Rec> nextRecord(Gz::Reader& gzr);
 	std::optional<Pair> nextRecordPair(Gz::Reader& gzr1, Gz::Reader& gzr2);
+	// Read into an existing record, reusing the capacity of its strings,
+	// false at the end of the input
+	bool readRecord(Gz::Reader& gzr, Rec& rec);
+	bool readRecordPair(Gz::Reader& gzr1, Gz::Reader& gzr2, Pair& rec_pair);
 
 	int writeRecord(Gz::Writer& gzw, const Rec& rec);
 	int writeRecordPair(Gz::Writer& gzw1, Gz::Writer& gzw2, const Pair& rec_pair);
+
+	// how the reads of a sample are stored
+	enum class Layout {
+		// mates in two files
+		PAIRED,
+		// mates one after the other in one file
+		INTERLEAVED,
+		SINGLE,
+	};
+
+	// Fragments read together and refilled batch after batch. Once the strings
+	// of its records have grown to the read lengths, reading a batch allocates
+	// nothing, so a batch is the unit of work of searches, builds and extends.
+	class FragmentBatch {
+		public:
+			static constexpr size_t DEFAULT_CAPACITY = 1024;
+			explicit FragmentBatch(size_t capacity = DEFAULT_CAPACITY) : fragments(std::max<size_t>(1, capacity)) {}
+			size_t size() const { return fragment_n; }
+			size_t capacity() const { return fragments.size(); }
+			bool empty() const { return fragment_n == 0; }
+			const Pair& operator[](size_t i) const { return fragments[i]; }
+			std::vector<Pair>::const_iterator begin() const { return fragments.begin(); }
+			std::vector<Pair>::const_iterator end() const { return fragments.begin() + fragment_n; }
+		private:
+			friend class FragmentReader;
+			std::vector<Pair> fragments;
+			size_t fragment_n = 0;
+	};
+
+	// what a FragmentReader does when the mates of a pair name different fragments
+	enum class PairCheck {
+		// stop reading, the fragments before the mismatch are kept
+		STRICT,
+		// report the first mismatch, count the others and keep the pairs
+		WARN,
+		// skip the fewest records that bring the mates back in step
+		RESYNC,
+	};
+	// strict, warn or resync
+	std::optional<PairCheck> parsePairCheck(const std::string& name);
+	// true when both read ids match up to their first blank, a /1 or /2 suffix aside
+	bool sameFragment(const std::string& seq_id1, const std::string& seq_id2);
+
+	struct PairCheckCounts {
+		// pairs whose mates named different fragments, a mate missing at the end included
+		size_t mismatched = 0;
+		// records dropped to resynchronize
+		size_t skipped = 0;
+		// reading stopped on a mismatch
+		bool failed = false;
+	};
+
+	// Fragments of a sample in any layout. A fragment is a pair of mates, or a
+	// single end read with an empty second record, so searches and filters
+	// handle every layout alike. The names of the mates of every pair are
+	// compared as they are read.
+	class FragmentReader {
+		public:
+			// resynchronizing looks this many records ahead in each file
+			static constexpr size_t RESYNC_WINDOW = 4096;
+			// fname2 is only used for PAIRED, Gz::STDIO_NAME reads the standard input
+			FragmentReader(Layout layout, const std::string& fname1, const std::string& fname2="",
+					PairCheck check=PairCheck::STRICT);
+			std::optional<Pair> next();
+			// reads the next fragment into fragment, reusing its strings
+			bool next(Pair& fragment);
+			// refills batch with up to its capacity of fragments, false when none was left
+			bool nextBatch(FragmentBatch& batch);
+			Layout layout() const { return read_layout; }
+			const PairCheckCounts& pairCheckCounts() const { return check_counts; }
+		private:
+			// the next record of file 0 or 1, records read ahead while resynchronizing first
+			bool readMate(size_t file, Rec& rec);
+			// handles a pair whose mates differ, false when reading stops
+			bool mismatch(Pair& fragment);
+			bool resync(Pair& fragment);
+
+			Layout read_layout;
+			PairCheck pair_check;
+			std::unique_ptr<Gz::Reader> reader1;
+			std::unique_ptr<Gz::Reader> reader2;
+			std::array<std::deque<Rec>, 2> read_ahead;
+			size_t fragment_n = 0;
+			PairCheckCounts check_counts;
+	};
+
+	// Writes fragments in the given layout, the empty mate of single end reads is dropped
+	class FragmentWriter {
+		public:
+			// fname2 is only used for PAIRED, Gz::STDIO_NAME writes to the standard output.
+			// Without a format, each file's is inferred from its name.
+			FragmentWriter(Layout layout, const std::string& fname1, const std::string& fname2="",
+					std::optional<Gz::Format> format={});
+			int write(const Pair& fragment);
+		private:
+			Layout write_layout;
+			std::unique_ptr<Gz::Writer> writer1;
+			std::unique_ptr<Gz::Writer> writer2;
+	};
 }
 
 namespace Fasta {
@@ -53,9 +162,11 @@ namespace Fasta {
 			std::string seq;
 	};
 	std::optional<Rec> nextRecord(Gz::Reader& gzr);
-	robin_hood::unordered_set<std::string> loadUnmaskedKmers(const std::string& fname, size_t kmer_size);
+	// canonical 2 bit kmers of the unmasked regions, empty optional for kmer_size > 32
+	std::optional<robin_hood::unordered_set<uint64_t>> loadUnmaskedKmers(const std::string& fname, size_t kmer_size);
 	robin_hood::unordered_set<uint64_t> loadUnmaskedKmerHashes(const std::string& fname, size_t kmer_size);
 	void dropKmerHashesFound(const std::string& fname, size_t kmer_size, robin_hood::unordered_set<uint64_t>& kmers);
+	void dropKmersFound(const std::string& fname, size_t kmer_size, robin_hood::unordered_set<uint64_t>& kmers);
 	void loadSoftmaskAndPrint(const std::string& fasta_fname
 			, const std::vector<std::string>& kraken2_fnames
 			, const std::vector<std::string>& reference_fnames
@@ -1,4 +1,5 @@
 #include "kraken2.h"
+#include "stats.h"
 
 namespace Kraken2 {
 	Rec::Rec(bool c
@@ -36,8 +37,10 @@ namespace Kraken2 {
 
 	std::optional<Rec> nextRecord(Gz::Reader& gzr) {
 		//Assume single end for current purposes
+		Stats::ScopedTimer timer(Stats::Stage::PARSE);
 		const std::string& line = gzr.nextLine();
 		if (line.size() > 0) {
+			Stats::add(Stats::Counter::RECORDS, 1);
 			std::istringstream iss(line);
 			std::string str, clsf_str, seq_id, taxid, seq_len;
 
@@ -67,5 +70,159 @@ namespace Kraken2 {
 
 	}
 	//Rec nextRecord(Gz::Reader& gzr) {
+
+	IntervalStream::IntervalStream(Gz::Reader& gzr, size_t ksize) :
+		reader(&gzr),
+		kmer_size(ksize)
+	{}
+
+	void IntervalStream::skipLine() {
+		int c = reader->nextChar();
+		while (c != -1 && c != '\n') {
+			c = reader->nextChar();
+		}
+		line_open = false;
+	}
+
+	bool IntervalStream::nextField(std::string& field) {
+		field.clear();
+		int c = reader->nextChar();
+		while (c != -1 && c != '\t' && c != '\n') {
+			field.push_back(static_cast<char>(c));
+			c = reader->nextChar();
+		}
+		line_open = c == '\t';
+		return c != -1 || field.size() > 0;
+	}
+
+	bool IntervalStream::nextKmerPair(bool& unclassified, size_t& kmers) {
+		while (line_open) {
+			int c = reader->nextChar();
+			while (c == ' ') {
+				c = reader->nextChar();
+			}
+			size_t taxid_size = 0;
+			bool zero_taxid = true;
+			while (c != -1 && c != ':' && c != ' ' && c != '\n') {
+				zero_taxid &= c == '0';
+				taxid_size++;
+				c = reader->nextChar();
+			}
+			if (c == ':') {
+				c = reader->nextChar();
+			}
+			bool has_count = false;
+			kmers = 0;
+			while (c >= '0' && c <= '9') {
+				kmers = kmers*10 + static_cast<size_t>(c - '0');
+				has_count = true;
+				c = reader->nextChar();
+			}
+			// skip paired end separator "|:|" and anything else unparsable
+			while (c != -1 && c != ' ' && c != '\n' && c != '\r') {
+				has_count = false;
+				c = reader->nextChar();
+			}
+			if (c != ' ') {
+				line_open = false;
+				if (c == '\r') {
+					skipLine();
+				}
+			}
+			if (has_count && taxid_size > 0) {
+				unclassified = zero_taxid;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Reading goes through Gz::Reader::nextChar, so decompression is counted as parsing here
+	bool IntervalStream::nextRecord() {
+		Stats::ScopedTimer timer(Stats::Stage::PARSE);
+		if (line_open) {
+			skipLine();
+		}
+		pending.reset();
+		kmer_pos = 0;
+		seq_size = 0;
+		std::string field;
+		if (!nextField(field) || field.size() == 0) {
+			seq_id.clear();
+			return false;
+		}
+		Stats::add(Stats::Counter::RECORDS, 1);
+		nextField(seq_id);
+		nextField(field); //taxid
+		nextField(field);
+		for (char c : field) {
+			if (c < '0' || c > '9') {
+				break;
+			}
+			seq_size = seq_size*10 + static_cast<size_t>(c - '0');
+		}
+		return true;
+	}
+
+	std::optional<Dna::SeqInterval> IntervalStream::nextInterval() {
+		Stats::ScopedTimer timer(Stats::Stage::PARSE);
+		bool unclassified = true;
+		size_t kmers = 0;
+		while (nextKmerPair(unclassified, kmers)) {
+			if (unclassified) {
+				kmer_pos += kmers;
+				continue;
+			}
+			size_t beg = kmer_pos;
+			size_t end = std::min(kmer_pos + (kmers ? kmers - 1 : kmers) + kmer_size, seq_size);
+			kmer_pos += kmers;
+			if (pending && beg <= pending->second) {
+				pending->second = std::max(pending->second, end);
+			} else if (pending) {
+				Dna::SeqInterval result = *pending;
+				pending = Dna::SeqInterval(beg, end);
+				return result;
+			} else {
+				pending = Dna::SeqInterval(beg, end);
+			}
+		}
+		std::optional<Dna::SeqInterval> result = pending;
+		pending.reset();
+		return result;
+	}
+
+	IntervalMerger::IntervalMerger(const std::vector<IntervalStream*>& strms) :
+		streams(strms)
+	{
+		for (IntervalStream* strm : streams) {
+			heads.push_back(strm->nextInterval());
+		}
+	}
+
+	std::optional<Dna::SeqInterval> IntervalMerger::nextInterval() {
+		size_t first_idx = heads.size();
+		for (size_t i = 0; i < heads.size(); i++) {
+			if (heads[i] && (first_idx == heads.size() || heads[i]->first < heads[first_idx]->first)) {
+				first_idx = i;
+			}
+		}
+		if (first_idx == heads.size()) {
+			return {};
+		}
+		Dna::SeqInterval result = *heads[first_idx];
+		heads[first_idx] = streams[first_idx]->nextInterval();
+		bool merged = true;
+		while (merged) {
+			merged = false;
+			for (size_t i = 0; i < heads.size(); i++) {
+				if (heads[i] && heads[i]->first <= result.second) {
+					result.second = std::max(result.second, heads[i]->second);
+					heads[i] = streams[i]->nextInterval();
+					merged = true;
+				}
+			}
+		}
+		return result;
+	}
 }
 
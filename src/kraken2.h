@@ -5,6 +5,7 @@
 #include <vector>
 #include <sstream>
 #include "utils.h"
+#include "seq.h"
 
 namespace Kraken2 {
 	using TaxaKmerPair = std::pair<std::string, size_t>;
@@ -33,6 +34,40 @@ namespace Kraken2 {
 	};
 
 	std::optional<Rec> nextRecord(Gz::Reader& gzr);
+
+	// Reads kraken2 output token by token and turns classified kmer runs
+	// into masked intervals without materializing the kmer list of a record
+	class IntervalStream {
+		public:
+			explicit IntervalStream(Gz::Reader& gzr, size_t kmer_size=35);
+			bool nextRecord();
+			std::optional<Dna::SeqInterval> nextInterval();
+			const std::string& seqId() const { return seq_id; }
+			size_t seqSize() const { return seq_size; }
+		private:
+			bool nextField(std::string& field);
+			bool nextKmerPair(bool& unclassified, size_t& kmers);
+			void skipLine();
+
+			Gz::Reader* reader;
+			size_t kmer_size;
+			std::string seq_id;
+			size_t seq_size = 0;
+			size_t kmer_pos = 0;
+			bool line_open = false;
+			std::optional<Dna::SeqInterval> pending = {};
+	};
+
+	// Merges interval streams of several kraken2 files for the same sequence
+	// into a single stream of non-overlapping intervals sorted by start
+	class IntervalMerger {
+		public:
+			explicit IntervalMerger(const std::vector<IntervalStream*>& strms);
+			std::optional<Dna::SeqInterval> nextInterval();
+		private:
+			std::vector<IntervalStream*> streams;
+			std::vector<std::optional<Dna::SeqInterval>> heads;
+	};
 }
 
 #endif
@@ -10,9 +10,11 @@ void print_cmd_usage() {
   std::cerr << "      mask           mask fasta file with kraken2 file and/or kmers found in another fasta file\n";
   std::cerr << "      bloom-build    build Bloom's filter\n";
   std::cerr << "      bloom-search   search in Bloom's filter\n";
+  std::cerr << "      bloom-serve    keep Bloom's filters loaded and answer searches over a unix socket\n";
   std::cerr << "      extend         extend sequence in 3' and 5' directions with kmers found in Bloom's filter\n";
   std::cerr << "      stats-bloom    gather metrics from bloom filter\n";
   std::cerr << "      stats-fasta    gather metrics from fasta files\n";
+  std::cerr << "      bench          time the commands on a generated workload\n";
 }
 
 int main(int argc, char **argv) {
@@ -22,13 +24,16 @@ int main(int argc, char **argv) {
     return 0;
   }
 
-  if (std::string(argv[1]) == "mask") { Cmd::Mask::run(argc, argv); }
-  else if (std::string(argv[1]) == "bloom-build") { Cmd::BloomBuild::run(argc, argv); }
-  else if (std::string(argv[1]) == "bloom-search") { Cmd::BloomSearch::run(argc, argv); }
-  else if (std::string(argv[1]) == "extend") { Cmd::Extend::run(argc, argv); }
-  else if (std::string(argv[1]) == "stats-bloom") { Cmd::StatsBloom::run(argc, argv); }
-  else if (std::string(argv[1]) == "stats-fasta") { Cmd::StatsFasta::run(argc, argv); }
+  int status = 0;
+  if (std::string(argv[1]) == "mask") { status = Cmd::Mask::run(argc, argv); }
+  else if (std::string(argv[1]) == "bloom-build") { status = Cmd::BloomBuild::run(argc, argv); }
+  else if (std::string(argv[1]) == "bloom-search") { status = Cmd::BloomSearch::run(argc, argv); }
+  else if (std::string(argv[1]) == "bloom-serve") { status = Cmd::BloomServe::run(argc, argv); }
+  else if (std::string(argv[1]) == "extend") { status = Cmd::Extend::run(argc, argv); }
+  else if (std::string(argv[1]) == "stats-bloom") { status = Cmd::StatsBloom::run(argc, argv); }
+  else if (std::string(argv[1]) == "stats-fasta") { status = Cmd::StatsFasta::run(argc, argv); }
+  else if (std::string(argv[1]) == "bench") { status = Cmd::Bench::run(argc, argv); }
   else { print_cmd_usage(); }
 
-  return 0;
+  return status;
 }
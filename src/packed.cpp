@@ -0,0 +1,238 @@
+#include "packed.h"
+#include <algorithm>
+#include <array>
+
+namespace Dna {
+	const uint8_t CODE_N = 4;
+
+	const std::array<uint8_t, 256> BASE_CODES = [](){
+		std::array<uint8_t, 256> codes{};
+		codes.fill(CODE_N);
+		codes['A'] = 0; codes['a'] = 0;
+		codes['C'] = 1; codes['c'] = 1;
+		codes['G'] = 2; codes['g'] = 2;
+		codes['T'] = 3; codes['t'] = 3;
+		return codes;
+	}();
+
+	uint8_t baseCode(char c) {
+		return BASE_CODES[static_cast<uint8_t>(c)];
+	}
+
+	char baseChar(uint8_t code) {
+		return "ACGTN"[std::min(code, CODE_N)];
+	}
+
+	// reverses the order of 2 bit groups in a word
+	uint64_t reverseBasesInWord(uint64_t x) {
+		x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+		x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+		return __builtin_bswap64(x);
+	}
+
+	uint64_t reverseBitsInWord(uint64_t x) {
+		x = reverseBasesInWord(x);
+		return ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+	}
+
+	void shiftWordsLeft(std::vector<uint64_t>& words, size_t bits) {
+		if (bits == 0) {
+			return;
+		}
+		for (size_t i = 0; i < words.size(); i++) {
+			uint64_t carry = i+1 < words.size() ? words[i+1] >> (BITS_IN_WORD - bits) : 0;
+			words[i] = (words[i] << bits) | carry;
+		}
+	}
+
+	uint64_t bitMask(size_t idx) {
+		return 1ULL << (BITS_IN_WORD - 1 - idx % BITS_IN_WORD);
+	}
+
+	void setBits(std::vector<uint64_t>& words, size_t beg, size_t end, bool value) {
+		for (size_t i = beg; i < end; i++) {
+			if (value) {
+				words[i / BITS_IN_WORD] |= bitMask(i);
+			} else {
+				words[i / BITS_IN_WORD] &= ~bitMask(i);
+			}
+		}
+	}
+
+	PackedSeq::PackedSeq(const std::string& seq) : PackedSeq(seq.data(), seq.size()) {}
+
+	PackedSeq::PackedSeq(const char* seq, size_t size) :
+		seq_size(size),
+		bases((size + BASES_IN_WORD - 1) / BASES_IN_WORD, 0),
+		n_mask((size + BITS_IN_WORD - 1) / BITS_IN_WORD, 0),
+		soft_mask((size + BITS_IN_WORD - 1) / BITS_IN_WORD, 0)
+	{
+		for (size_t w = 0; w < bases.size(); w++) {
+			size_t beg = w * BASES_IN_WORD;
+			size_t end = std::min(beg + BASES_IN_WORD, size);
+			uint64_t word = 0;
+			for (size_t i = beg; i < end; i++) {
+				uint64_t code = BASE_CODES[static_cast<uint8_t>(seq[i])] & 3;
+				word |= code << (BITS_IN_WORD - 2 - 2*(i - beg));
+			}
+			bases[w] = word;
+		}
+		for (size_t w = 0; w < n_mask.size(); w++) {
+			size_t beg = w * BITS_IN_WORD;
+			size_t end = std::min(beg + BITS_IN_WORD, size);
+			uint64_t n_word = 0;
+			uint64_t soft_word = 0;
+			for (size_t i = beg; i < end; i++) {
+				uint64_t bit = BITS_IN_WORD - 1 - (i - beg);
+				n_word |= static_cast<uint64_t>(BASE_CODES[static_cast<uint8_t>(seq[i])] == CODE_N) << bit;
+				soft_word |= static_cast<uint64_t>(seq[i] >= 'a') << bit;
+			}
+			n_mask[w] = n_word;
+			soft_mask[w] = soft_word;
+		}
+	}
+
+	std::string PackedSeq::toString() const {
+		std::string result(seq_size, 'N');
+		for (size_t i = 0; i < seq_size; i++) {
+			char c = isN(i) ? 'N' : baseChar(baseAt(i));
+			result[i] = isSoftmasked(i) ? c + 32 : c;
+		}
+		return result;
+	}
+
+	size_t PackedSeq::bytes() const {
+		return sizeof(uint64_t) * (bases.capacity() + n_mask.capacity() + soft_mask.capacity());
+	}
+
+	uint8_t PackedSeq::baseAt(size_t idx) const {
+		uint64_t word = bases[idx / BASES_IN_WORD];
+		return (word >> (BITS_IN_WORD - 2 - 2*(idx % BASES_IN_WORD))) & 3;
+	}
+
+	bool PackedSeq::isN(size_t idx) const {
+		return n_mask[idx / BITS_IN_WORD] & bitMask(idx);
+	}
+
+	bool PackedSeq::isSoftmasked(size_t idx) const {
+		return soft_mask[idx / BITS_IN_WORD] & bitMask(idx);
+	}
+
+	bool PackedSeq::hasN(size_t beg, size_t end) const {
+		while (beg < end) {
+			size_t w = beg / BITS_IN_WORD;
+			size_t word_end = std::min(end, (w+1) * BITS_IN_WORD);
+			size_t span = word_end - beg;
+			uint64_t mask = span == BITS_IN_WORD ? ~0ULL : ((1ULL << span) - 1) << (BITS_IN_WORD - span - beg % BITS_IN_WORD);
+			if (n_mask[w] & mask) {
+				return true;
+			}
+			beg = word_end;
+		}
+		return false;
+	}
+
+	void PackedSeq::softmask(size_t beg, size_t end) {
+		setBits(soft_mask, beg, std::min(end, seq_size), true);
+	}
+
+	void PackedSeq::unmask(size_t beg, size_t end) {
+		setBits(soft_mask, beg, std::min(end, seq_size), false);
+	}
+
+	uint64_t PackedSeq::kmer(size_t pos, size_t kmer_size) const {
+		size_t w = pos / BASES_IN_WORD;
+		size_t offset = 2 * (pos % BASES_IN_WORD);
+		uint64_t value = bases[w] << offset;
+		if (offset > 0 && w+1 < bases.size()) {
+			value |= bases[w+1] >> (BITS_IN_WORD - offset);
+		}
+		return value >> (BITS_IN_WORD - 2*kmer_size);
+	}
+
+	PackedSeq PackedSeq::revcom() const {
+		PackedSeq result;
+		result.seq_size = seq_size;
+		result.bases.resize(bases.size());
+		result.n_mask.resize(n_mask.size());
+		result.soft_mask.resize(soft_mask.size());
+		for (size_t i = 0; i < bases.size(); i++) {
+			result.bases[i] = reverseBasesInWord(~bases[bases.size()-1-i]);
+		}
+		for (size_t i = 0; i < n_mask.size(); i++) {
+			result.n_mask[i] = reverseBitsInWord(n_mask[n_mask.size()-1-i]);
+			result.soft_mask[i] = reverseBitsInWord(soft_mask[soft_mask.size()-1-i]);
+		}
+		shiftWordsLeft(result.bases, 2 * (bases.size() * BASES_IN_WORD - seq_size));
+		shiftWordsLeft(result.n_mask, n_mask.size() * BITS_IN_WORD - seq_size);
+		shiftWordsLeft(result.soft_mask, soft_mask.size() * BITS_IN_WORD - seq_size);
+		return result;
+	}
+
+	uint64_t packKmer(const char* kmer, size_t kmer_size) {
+		uint64_t value = 0;
+		for (size_t i = 0; i < kmer_size; i++) {
+			value = (value << 2) | (BASE_CODES[static_cast<uint8_t>(kmer[i])] & 3);
+		}
+		return value;
+	}
+
+	std::string unpackKmer(uint64_t kmer, size_t kmer_size) {
+		std::string result(kmer_size, 'N');
+		for (size_t i = 0; i < kmer_size; i++) {
+			result[kmer_size-1-i] = baseChar(kmer & 3);
+			kmer >>= 2;
+		}
+		return result;
+	}
+
+	uint64_t revcomKmer(uint64_t kmer, size_t kmer_size) {
+		return reverseBasesInWord(~kmer) >> (BITS_IN_WORD - 2*kmer_size);
+	}
+
+	uint64_t canonicalKmer(uint64_t kmer, size_t kmer_size) {
+		return std::min(kmer, revcomKmer(kmer, kmer_size));
+	}
+
+	uint64_t hashKmer(uint64_t kmer) {
+		kmer ^= kmer >> 33;
+		kmer *= 0xff51afd7ed558ccdULL;
+		kmer ^= kmer >> 33;
+		kmer *= 0xc4ceb9fe1a85ec53ULL;
+		kmer ^= kmer >> 33;
+		return kmer;
+	}
+
+	void addPackedKmers(const PackedSeq& seq, size_t kmer_size, robin_hood::unordered_set<uint64_t>& kmers) {
+		if (seq.size() < kmer_size || kmer_size == 0 || kmer_size > MAX_PACKED_KMER_SIZE) {
+			return;
+		}
+		for (size_t pos = 0; pos + kmer_size <= seq.size(); pos++) {
+			if (!seq.hasN(pos, pos + kmer_size)) {
+				kmers.insert(seq.kmer(pos, kmer_size));
+			}
+		}
+	}
+
+	void addCanonicalKmers(const PackedSeq& seq, size_t kmer_size, robin_hood::unordered_set<uint64_t>& kmers) {
+		if (seq.size() < kmer_size || kmer_size == 0 || kmer_size > MAX_PACKED_KMER_SIZE) {
+			return;
+		}
+		for (size_t pos = 0; pos + kmer_size <= seq.size(); pos++) {
+			if (!seq.hasN(pos, pos + kmer_size)) {
+				kmers.insert(canonicalKmer(seq.kmer(pos, kmer_size), kmer_size));
+			}
+		}
+	}
+
+	void eraseCanonicalKmers(const PackedSeq& seq, size_t kmer_size, robin_hood::unordered_set<uint64_t>& kmers) {
+		if (seq.size() < kmer_size || kmer_size == 0 || kmer_size > MAX_PACKED_KMER_SIZE) {
+			return;
+		}
+		for (size_t pos = 0; pos + kmer_size <= seq.size() && !kmers.empty(); pos++) {
+			if (!seq.hasN(pos, pos + kmer_size)) {
+				kmers.erase(canonicalKmer(seq.kmer(pos, kmer_size), kmer_size));
+			}
+		}
+	}
+}
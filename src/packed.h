@@ -0,0 +1,64 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "robin_hood.h"
+
+namespace Dna {
+	const size_t BASES_IN_WORD = 32;
+	const size_t BITS_IN_WORD = 64;
+	const size_t MAX_PACKED_KMER_SIZE = 32;
+
+	// Sequence stored with 2 bits per base (A=0, C=1, G=2, T=3) plus separate
+	// bitvectors for N (any character other than ACGT) and softmasked positions.
+	// Words are filled from the most significant bits so that a kmer extracted
+	// from the sequence compares like its string representation.
+	class PackedSeq {
+		public:
+			PackedSeq() = default;
+			explicit PackedSeq(const std::string& seq);
+			PackedSeq(const char* seq, size_t size);
+
+			std::string toString() const;
+			size_t size() const { return seq_size; }
+			size_t bytes() const;
+
+			uint8_t baseAt(size_t idx) const;
+			bool isN(size_t idx) const;
+			bool isSoftmasked(size_t idx) const;
+			bool hasN(size_t beg, size_t end) const;
+
+			void softmask(size_t beg, size_t end);
+			void unmask(size_t beg, size_t end);
+
+			// kmer of size <= 32 starting at pos, first base in the most significant bits
+			uint64_t kmer(size_t pos, size_t kmer_size) const;
+			PackedSeq revcom() const;
+
+			const std::vector<uint64_t>& baseWords() const { return bases; }
+
+		private:
+			size_t seq_size = 0;
+			std::vector<uint64_t> bases;
+			std::vector<uint64_t> n_mask;
+			std::vector<uint64_t> soft_mask;
+	};
+
+	uint8_t baseCode(char c);
+	char baseChar(uint8_t code);
+
+	uint64_t packKmer(const char* kmer, size_t kmer_size);
+	std::string unpackKmer(uint64_t kmer, size_t kmer_size);
+	uint64_t revcomKmer(uint64_t kmer, size_t kmer_size);
+	uint64_t canonicalKmer(uint64_t kmer, size_t kmer_size);
+	uint64_t hashKmer(uint64_t kmer);
+
+	void addPackedKmers(const PackedSeq& seq, size_t kmer_size, robin_hood::unordered_set<uint64_t>& kmers);
+	// strand independent variants, kmers containing N are skipped
+	void addCanonicalKmers(const PackedSeq& seq, size_t kmer_size, robin_hood::unordered_set<uint64_t>& kmers);
+	void eraseCanonicalKmers(const PackedSeq& seq, size_t kmer_size, robin_hood::unordered_set<uint64_t>& kmers);
+}
+
+#endif
@@ -1,65 +1,30 @@
 #include "seq.h"
+#include "simd.h"
+#include "packed.h"
 #include <algorithm>
 #include <iostream>
-#include "ntHashIterator.hpp"
+#include "nthash.hpp"
+#include <array>
 #include <limits>
 #include <queue>
-#include <map>
 #include <math.h>
 
 namespace Dna {
 	std::string revcom(const std::string& seq) {
 		std::string result(seq.size(), 'N');
-		if (seq.size() == 0) {
-			return result;
-		}
-		for (size_t i = 0; i < seq.size(); i++) {
-			int res_idx = seq.size()-1 - i;
-			switch (seq[i]) {
-				case 'A':
-					result[res_idx] = 'T';
-					break;
-				case 'a':
-					result[res_idx] = 't';
-					break;
-				case 'T':
-					result[res_idx] = 'A';
-					break;
-				case 't':
-					result[res_idx] = 'a';
-					break;
-				case 'G':
-					result[res_idx] = 'C';
-					break;
-				case 'g':
-					result[res_idx] = 'c';
-					break;
-				case 'C':
-					result[res_idx] = 'G';
-					break;
-				case 'c':
-					result[res_idx] = 'g';
-					break;
-				default:
-					result[res_idx] = seq[i];
-			}
-		}
+		Simd::kernels().revcom(seq.data(), &result[0], seq.size());
 		return result;
 	}
 
 	void softmask(std::string& seq, size_t beg, size_t end) {
-		for (size_t i=beg; i<end; i++){
-			if (seq[i] < 97) {
-				seq[i] += 32;
-			}
+		if (beg < end) {
+			Simd::kernels().softmask(&seq[beg], end - beg);
 		}
 	}
 
 	void unmask(std::string& seq, size_t beg, size_t end) {
-		for (size_t i=beg; i<end; i++){
-			if (seq[i] >= 97) {
-				seq[i] -= 32;
-			}
+		if (beg < end) {
+			Simd::kernels().unmask(&seq[beg], end - beg);
 		}
 	}
 
@@ -80,10 +45,14 @@ namespace Dna {
 	void addKmerHashes(const std::string& seq,
 			size_t size,
 			size_t hash_n,
-			robin_hood::unordered_set<uint64_t>& kmer_hashes
+			robin_hood::unordered_set<uint64_t>& kmer_hashes,
+			HashMode mode
 			){
-		for (const auto& hash: getHashes(seq, size, hash_n)){
-			kmer_hashes.insert(hash);
+		KmerHasher hasher(seq, size, hash_n, mode);
+		while (hasher.next()) {
+			for (size_t i = 0; i < hash_n; i++) {
+				kmer_hashes.insert(hasher.hashes()[i]);
+			}
 		}
 	}
 	bool isMasked(char c) {
@@ -94,20 +63,9 @@ namespace Dna {
 		if (beg >= seq.size()) {
 			return std::pair<size_t,size_t>(seq.size(), seq.size());
 		}
-		char c = seq[beg];
-		bool curr_mask = isMasked(c);
-		bool prev_mask = curr_mask;
-		size_t i = beg;
-		while (curr_mask == prev_mask && i < seq.size()) {
-			prev_mask = curr_mask;
-			c = seq[i];
-			curr_mask = isMasked(c);
-			if (prev_mask != curr_mask){
-				return std::pair<size_t,size_t>(beg, i);
-			}
-			i++;
-		}
-		return std::pair<size_t,size_t>(beg, i);
+		bool curr_mask = isMasked(seq[beg]);
+		size_t toggle = Simd::kernels().findMaskToggle(seq.data() + beg, seq.size() - beg, curr_mask);
+		return std::pair<size_t,size_t>(beg, beg + toggle);
 	}
 
 	std::vector<std::string> splitOnMask(const std::string& seq) {
@@ -155,33 +113,154 @@ namespace Dna {
 	}
 
 	bool hasMasked(const std::string& seq) {
-		for (const char c: seq) {
-			if (isMasked(c)) {
+		return Simd::kernels().findMaskToggle(seq.data(), seq.size(), false) != seq.size();
+	}
+
+	std::string canonicalKmer(const std::string &kmer) {
+		size_t kmer_size = kmer.size();
+		for (size_t i = 0; i < kmer_size; i++) {
+			char rc = Simd::complementChar(kmer[kmer_size-1-i]);
+			if (kmer[i] != rc) {
+				return kmer[i] < rc ? kmer : revcom(kmer);
+			}
+		}
+		return kmer;
+	}
+
+	const std::array<bool, 256> BASE_LOOKUP = [](){
+		std::array<bool, 256> lookup{};
+		for (char c : std::string("ACGTacgt")) {
+			lookup[static_cast<uint8_t>(c)] = true;
+		}
+		return lookup;
+	}();
+
+	bool isBase(char c) {
+		return BASE_LOOKUP[static_cast<uint8_t>(c)];
+	}
+
+	void multiHash(size_t kmer_size, size_t hash_n, uint64_t* hash_values) {
+		for (size_t i = 1; i < hash_n; i++) {
+			uint64_t value = hash_values[0] * (i ^ kmer_size * multiSeed);
+			value ^= value >> multiShift;
+			hash_values[i] = value;
+		}
+	}
+
+	KmerHasher::KmerHasher(const char* sq, size_t sz, size_t ksize, size_t hn, HashMode hm) :
+		seq(sq),
+		seq_size(sz),
+		kmer_size(ksize),
+		hash_n(hn),
+		mode(hm),
+		hash_values(hn, 0)
+	{}
+
+	KmerHasher::KmerHasher(const std::string& sq, size_t ksize, size_t hn, HashMode hm) :
+		KmerHasher(sq.data(), sq.size(), ksize, hn, hm)
+	{}
+
+	void KmerHasher::setHashes() {
+		if (mode == HashMode::CANONICAL) {
+			hash_values[0] = std::min(fwd_hash, rev_hash);
+		} else {
+			hash_values[0] = fwd_hash;
+		}
+		multiHash(kmer_size, hash_n, hash_values.data());
+	}
+
+	bool KmerHasher::init(size_t beg) {
+		if (kmer_size == 0) {
+			return false;
+		}
+		size_t valid_bases = 0;
+		kmer_pos = beg;
+		while (kmer_pos + kmer_size <= seq_size) {
+			if (isBase(seq[kmer_pos + valid_bases])) {
+				valid_bases++;
+			} else {
+				kmer_pos += valid_bases + 1;
+				valid_bases = 0;
+			}
+			if (valid_bases == kmer_size) {
+				fwd_hash = NTF64(seq + kmer_pos, kmer_size);
+				rev_hash = NTR64(seq + kmer_pos, kmer_size);
+				setHashes();
 				return true;
 			}
 		}
+		kmer_pos = seq_size;
 		return false;
 	}
 
-	std::string canonicalKmer(const std::string &kmer) {
-		std::string rc = revcom(kmer);
-		bool origCanonical = std::lexicographical_compare(
-					kmer.cbegin()
-					, kmer.cend()
-					, rc.cbegin()
-					, rc.cend());
-		return origCanonical ? kmer : rc;
+	bool KmerHasher::next() {
+		if (!started) {
+			started = true;
+			return init(0);
+		}
+		if (kmer_pos + kmer_size >= seq_size) {
+			kmer_pos = seq_size;
+			return false;
+		}
+		unsigned char char_out = seq[kmer_pos];
+		unsigned char char_in = seq[kmer_pos + kmer_size];
+		if (!isBase(char_in)) {
+			return init(kmer_pos + kmer_size + 1);
+		}
+		fwd_hash = NTF64(fwd_hash, kmer_size, char_out, char_in);
+		rev_hash = NTR64(rev_hash, kmer_size, char_out, char_in);
+		kmer_pos++;
+		setHashes();
+		return true;
 	}
 
-	std::vector<uint64_t> getHashes(const std::string& seq, size_t kmer_size, size_t hash_n) {
-		std::vector<uint64_t> results;
-		ntHashIterator itr(seq, hash_n, kmer_size);
-		while (itr != itr.end()) {
-			for (size_t i = 0; i < hash_n; i++){
-				size_t hash_value = (*itr)[i];
-				results.push_back(hash_value);
+	bool containsKmersOf(const std::string& seq, const std::string& query, size_t kmer_size) {
+		KmerHasher query_hasher(query, kmer_size, 1);
+		if (!query_hasher.next()) {
+			return seq.find(query) != std::string::npos || seq.find(revcom(query)) != std::string::npos;
+		}
+		size_t first_pos = query_hasher.pos();
+		uint64_t first_fwd = query_hasher.forwardHash();
+		uint64_t first_rev = query_hasher.reverseHash();
+		size_t last_pos = first_pos;
+		uint64_t last_fwd = first_fwd;
+		uint64_t last_rev = first_rev;
+		while (query_hasher.next()) {
+			last_pos = query_hasher.pos();
+			last_fwd = query_hasher.forwardHash();
+			last_rev = query_hasher.reverseHash();
+		}
+		// on the forward strand the first kmer comes first, on the reverse
+		// strand the reverse complement of the last one does
+		size_t distance = last_pos - first_pos;
+		std::vector<uint64_t> fwd_hashes(seq.size(), 0);
+		std::vector<bool> valid(seq.size(), false);
+		KmerHasher hasher(seq, kmer_size, 1);
+		while (hasher.next()) {
+			size_t pos = hasher.pos();
+			uint64_t fwd_hash = hasher.forwardHash();
+			fwd_hashes[pos] = fwd_hash;
+			valid[pos] = true;
+			if (pos < distance || !valid[pos - distance]) {
+				continue;
+			}
+			uint64_t start_hash = fwd_hashes[pos - distance];
+			if ((start_hash == first_fwd && fwd_hash == last_fwd)
+					|| (start_hash == last_rev && fwd_hash == first_rev)) {
+				return true;
 			}
-			++itr;
+		}
+		return false;
+	}
+
+	std::vector<uint64_t> getHashes(const std::string& seq, size_t kmer_size, size_t hash_n, HashMode mode) {
+		std::vector<uint64_t> results;
+		if (seq.size() >= kmer_size) {
+			results.reserve((seq.size() - kmer_size + 1) * hash_n);
+		}
+		KmerHasher hasher(seq, kmer_size, hash_n, mode);
+		while (hasher.next()) {
+			results.insert(results.end(), hasher.hashes(), hasher.hashes() + hash_n);
 		}
 		return results;
 	}
@@ -190,13 +269,14 @@ namespace Dna {
 			const std::string &seq,
 			size_t kmer_size,
 			size_t hash_n,
-			size_t window_size) {
+			size_t window_size,
+			HashMode mode) {
 
 		std::vector<uint64_t> min_hash_per_window{};
 		if (window_size > seq.size() || kmer_size > seq.size()) {
 			return min_hash_per_window;
 		}
-		std::vector<uint64_t> hashes = getHashes(seq, kmer_size, hash_n);
+		std::vector<uint64_t> hashes = getHashes(seq, kmer_size, hash_n, mode);
 
 		size_t kmers_in_window = window_size - kmer_size + 1;
 		size_t windows_in_seq = seq.size() - window_size + 1;
@@ -216,61 +296,188 @@ namespace Dna {
 
 	void softmaskNotInKmerHashes(std::string& seq, const robin_hood::unordered_set<uint64_t>& kmer_hashes, size_t kmer_size) {
 		size_t hash_n = 1;
-		for (auto split_rec: Dna::splitOnMaskWithInterval(seq)) {
-			if (split_rec.second.size() >= kmer_size) {
-				ntHashIterator itr(split_rec.second, hash_n, kmer_size);
-				size_t global_beg = split_rec.first.first;
-				size_t local_beg = 0;
-				while (itr != itr.end()) {
-					uint64_t hash_value = (*itr)[0];
+		for (const SeqInterval& interval: Dna::nonmaskedRegions(seq)) {
+			size_t interval_size = interval.second - interval.first;
+			if (interval_size >= kmer_size) {
+				KmerHasher hasher(seq.data() + interval.first, interval_size, kmer_size, hash_n);
+				size_t global_beg = interval.first;
+				while (hasher.next()) {
+					uint64_t hash_value = hasher.hashes()[0];
 					if (!kmer_hashes.count(hash_value)) {
-							//std::cerr << "Masking " << rec->seq_id
-									//<< '\t' << local_beg  << " .. " << local_beg+kmer_size
-									//<< '\t' << rec->seq.substr(global_beg+local_beg, kmer_size)
-									//<< '\t' << split_rec.second.substr(local_beg, kmer_size)
-									//<< '\t' << hash_value << '\n';
-						Dna::softmask(seq, global_beg+local_beg, global_beg+local_beg+kmer_size);
+						Dna::softmask(seq, global_beg+hasher.pos(), global_beg+hasher.pos()+kmer_size);
 					}
-					++itr;
-					++local_beg;
 				}
 			 }
 		}
 	}
-	double shannon(const std::string& seq) {
-		const size_t kmer_size = 3;
-		if (seq.size() < kmer_size) {
+
+	void softmaskNotInKmers(std::string& seq, const robin_hood::unordered_set<uint64_t>& kmers, size_t kmer_size) {
+		for (const SeqInterval& interval: Dna::nonmaskedRegions(seq)) {
+			size_t interval_size = interval.second - interval.first;
+			if (interval_size < kmer_size) {
+				continue;
+			}
+			// packed before masking, softmask only changes the case of the bases
+			PackedSeq packed_seq(seq.data() + interval.first, interval_size);
+			for (size_t pos = 0; pos + kmer_size <= interval_size; pos++) {
+				if (packed_seq.hasN(pos, pos + kmer_size)) {
+					continue;
+				}
+				if (!kmers.count(canonicalKmer(packed_seq.kmer(pos, kmer_size), kmer_size))) {
+					Dna::softmask(seq, interval.first + pos, interval.first + pos + kmer_size);
+				}
+			}
+		}
+	}
+	// count * log(count) for the counts seen in short windows
+	const std::array<double, 256> COUNT_LOG_COUNT = [](){
+		std::array<double, 256> values{};
+		for (size_t c = 1; c < values.size(); c++) {
+			values[c] = c * std::log(c);
+		}
+		return values;
+	}();
+
+	double countLogCount(uint32_t count) {
+		return count < COUNT_LOG_COUNT.size() ? COUNT_LOG_COUNT[count] : count * std::log(count);
+	}
+
+	int trinucleotideIndex(const char* kmer) {
+		uint8_t c0 = baseCode(kmer[0]);
+		uint8_t c1 = baseCode(kmer[1]);
+		uint8_t c2 = baseCode(kmer[2]);
+		if ((c0 | c1 | c2) > 3) {
+			return -1;
+		}
+		return (c0 << 4) | (c1 << 2) | c2;
+	}
+
+	void EntropyTracker::add(const char* seq, size_t size) {
+		for (size_t i = 0; i + KMER_SIZE <= size; i++) {
+			addKmer(seq + i);
+		}
+	}
+
+	void EntropyTracker::addKmer(const char* kmer) {
+		int idx = trinucleotideIndex(kmer);
+		if (idx >= 0) {
+			addCode(idx);
+		}
+	}
+
+	void EntropyTracker::removeKmer(const char* kmer) {
+		int idx = trinucleotideIndex(kmer);
+		if (idx >= 0) {
+			removeCode(idx);
+		}
+	}
+
+	void EntropyTracker::addCode(uint8_t code) {
+		uint32_t& count = counts[code & 63];
+		count_log_sum += countLogCount(count + 1) - countLogCount(count);
+		count++;
+		kmer_n++;
+	}
+
+	void EntropyTracker::removeCode(uint8_t code) {
+		uint32_t& count = counts[code & 63];
+		if (count == 0) {
+			return;
+		}
+		count_log_sum += countLogCount(count - 1) - countLogCount(count);
+		count--;
+		kmer_n--;
+	}
+
+	void EntropyTracker::addPacked(uint64_t kmer, size_t kmer_size) {
+		for (size_t i = 0; i + KMER_SIZE <= kmer_size; i++) {
+			addCode(kmer >> 2*i);
+		}
+	}
+
+	double EntropyTracker::packedLogSum(uint64_t kmer, size_t kmer_size) {
+		EntropyTracker tracker;
+		if (kmer_size > KMER_SIZE) {
+			// the last trinucleotide is left out, as in shannon()
+			tracker.addPacked(kmer >> 2, kmer_size - 1);
+		}
+		return tracker.count_log_sum;
+	}
+
+	size_t EntropyTracker::packedCount(uint64_t kmer, size_t kmer_size, uint8_t code) {
+		if (kmer_size < KMER_SIZE) {
+			return 0;
+		}
+		const uint64_t low_bits = 0x5555555555555555ULL;
+		// low bit of every base equal to base
+		auto positions = [kmer, low_bits](uint8_t base) {
+			uint64_t diff = kmer ^ (low_bits * base);
+			return ~(diff | (diff >> 1)) & low_bits;
+		};
+		// windows starting at bases 0 to kmer_size - 3, the first base is the highest
+		uint64_t window_mask = low_bits & ((uint64_t(1) << 2*(kmer_size - 2)) - 1);
+		uint64_t matches = positions(code & 3) & (positions((code >> 2) & 3) >> 2) & (positions((code >> 4) & 3) >> 4);
+		return __builtin_popcountll(matches & window_mask);
+	}
+
+	double EntropyTracker::shiftLogSum(double log_sum, uint64_t kmer, size_t kmer_size, uint8_t code_out, uint8_t code_in) {
+		if (kmer_size <= KMER_SIZE) {
+			return log_sum;
+		}
+		code_out &= 63;
+		code_in &= 63;
+		// counted trinucleotides are those of all bases but the last
+		uint64_t counted = kmer >> 2;
+		uint32_t out_n = packedCount(counted, kmer_size - 1, code_out);
+		log_sum += countLogCount(out_n - 1) - countLogCount(out_n);
+		uint32_t in_n = packedCount(counted, kmer_size - 1, code_in) - (code_in == code_out);
+		return log_sum + countLogCount(in_n + 1) - countLogCount(in_n);
+	}
+
+	double EntropyTracker::packedEntropy(double log_sum, size_t kmer_size) {
+		if (kmer_size < KMER_SIZE) {
 			return 0.0;
 		}
-		std::map<std::string, int> counts;
-		for (size_t i = 0; i < seq.size() - kmer_size; i++) {
-			std::string kmer = seq.substr(i, kmer_size);
-			counts[kmer]++;
+		double total = kmer_size - KMER_SIZE + 1;
+		return std::max(((total - 1) * std::log(total) - log_sum) / total, 0.0);
+	}
+
+	void EntropyTracker::clear() {
+		counts.fill(0);
+		kmer_n = 0;
+		count_log_sum = 0.0;
+	}
+
+	double EntropyTracker::entropy() const {
+		return entropy(kmer_n);
+	}
+
+	double EntropyTracker::entropy(size_t total) const {
+		if (kmer_n == 0 || total == 0) {
+			return 0.0;
 		}
-		size_t total_kmer_n = seq.size() - kmer_size + 1;
-		double shannon = 0.0;
-		for (const auto& pair : counts) {
-			double p = static_cast<double>(pair.second) / total_kmer_n;
-			shannon += p*std::log(p);
+		// -sum(c/t * log(c/t)) == (n*log(t) - sum(c*log(c))) / t
+		double result = (kmer_n * std::log(total) - count_log_sum) / total;
+		return std::max(result, 0.0);
+	}
+
+	double shannon(const std::string& seq) {
+		const size_t kmer_size = EntropyTracker::KMER_SIZE;
+		if (seq.size() < kmer_size) {
+			return 0.0;
 		}
-		return -shannon;
+		// the last trinucleotide is left out but still counted in the total,
+		// which is what the values computed so far were based on
+		EntropyTracker tracker;
+		tracker.add(seq.data(), seq.size() - 1);
+		return tracker.entropy(seq.size() - kmer_size + 1);
 	}
 	MaskingStats maskingStats(const std::string& seq) {
 		MaskingStats result = MaskingStats();
+		Simd::MaskCounts counts = Simd::kernels().countMasked(seq.data(), seq.size());
 		result.size = seq.size();
-		result.softmasked = 0;
-		result.hardmasked = 0;
-		if (seq.size() == 0) {
-			return  result;
-		}
-		for (const char& c: seq) {
-			if (c == 'N' || c == 'n') {
-				result.hardmasked++;
-			} 
-			if (c >= 'a' && c <= 'z' && c != 'n') {
-				result.softmasked++;
-			}
-		}
+		result.softmasked = counts.softmasked;
+		result.hardmasked = counts.hardmasked;
 		return result;
 	}
 }
@@ -6,10 +6,15 @@
 #include <set>
 #include <unordered_set>
 #include <algorithm>
+#include <array>
 #include "robin_hood.h"
 
 namespace Dna {
 	using SeqInterval = std::pair<size_t, size_t>;
+	enum class HashMode : uint8_t {
+		CANONICAL = 0,
+		FORWARD = 1,
+	};
 	struct MaskingStats {
 		size_t size = 0;
 		size_t softmasked = 0;
@@ -25,11 +30,51 @@ namespace Dna {
 	
 	void addKmers(const std::string& seq, size_t size, robin_hood::unordered_set<std::string>& kmers);
 
-	void addKmerHashes(const std::string& seq, size_t size, size_t hash_n, robin_hood::unordered_set<uint64_t>& kmer_hashes);
+	void addKmerHashes(const std::string& seq, size_t size, size_t hash_n, robin_hood::unordered_set<uint64_t>& kmer_hashes
+			, HashMode mode=HashMode::CANONICAL);
+
+	std::vector<uint64_t> getHashes(const std::string& seq, size_t kmer_size, size_t hash_n
+			, HashMode mode=HashMode::CANONICAL);
+
+	std::vector<uint64_t> getMinimizerHashes(const std::string& seq, size_t kmer_size, size_t hash_n, size_t window_size
+			, HashMode mode=HashMode::CANONICAL);
 
-	std::vector<uint64_t> getHashes(const std::string& seq, size_t kmer_size, size_t hash_n);
+	// Fills hash_values[1..hash_n) with ntHash multi-hash variants of hash_values[0]
+	void multiHash(size_t kmer_size, size_t hash_n, uint64_t* hash_values);
+
+	// Rolls ntHash over a sequence one base at a time, skipping kmers that contain
+	// anything other than ACGT. In canonical mode a kmer and its reverse complement
+	// produce the same hashes.
+	class KmerHasher {
+		public:
+			KmerHasher(const char* sq, size_t sz, size_t ksize, size_t hn, HashMode hm=HashMode::CANONICAL);
+			KmerHasher(const std::string& sq, size_t ksize, size_t hn, HashMode hm=HashMode::CANONICAL);
+			bool next();
+			size_t pos() const { return kmer_pos; }
+			const uint64_t* hashes() const { return hash_values.data(); }
+			uint64_t forwardHash() const { return fwd_hash; }
+			uint64_t reverseHash() const { return rev_hash; }
+		private:
+			bool init(size_t beg);
+			void setHashes();
+
+			const char* seq;
+			size_t seq_size;
+			size_t kmer_size;
+			size_t hash_n;
+			HashMode mode;
+			size_t kmer_pos = 0;
+			bool started = false;
+			uint64_t fwd_hash = 0;
+			uint64_t rev_hash = 0;
+			std::vector<uint64_t> hash_values;
+	};
 
-	std::vector<uint64_t> getMinimizerHashes(const std::string& seq, size_t kmer_size, size_t hash_n, size_t window_size);
+	bool isBase(char c);
+
+	// Strand independent containment check: true when the first and last kmers
+	// of query are found in seq on the same strand and as far apart as in query
+	bool containsKmersOf(const std::string& seq, const std::string& query, size_t kmer_size);
 	std::pair<size_t,size_t> nextToggleMaskedRegion(const std::string& seq, size_t beg);
 
 	std::vector<std::string> splitOnMask(const std::string& seq);
@@ -44,6 +89,50 @@ namespace Dna {
 	void softmaskNotInKmerHashes(std::string& seq
 			, const robin_hood::unordered_set<uint64_t>& kmer_hashes
 			, size_t kmer_size);
+	// same as softmaskNotInKmerHashes for canonical 2 bit kmers, kmer_size <= 32
+	void softmaskNotInKmers(std::string& seq
+			, const robin_hood::unordered_set<uint64_t>& kmers
+			, size_t kmer_size);
+	// Shannon entropy of the trinucleotide composition of a window, kept up to
+	// date in O(1) as trinucleotides enter and leave the window. Trinucleotides
+	// containing anything other than ACGT are not counted.
+	class EntropyTracker {
+		public:
+			static const size_t KMER_SIZE = 3;
+			// counts every trinucleotide of seq[0, size)
+			void add(const char* seq, size_t size);
+			// trinucleotide starting at kmer
+			void addKmer(const char* kmer);
+			void removeKmer(const char* kmer);
+			// trinucleotide given as 2 bit codes, first base in the highest bits
+			void addCode(uint8_t code);
+			void removeCode(uint8_t code);
+			// every trinucleotide of a 2 bit packed kmer
+			void addPacked(uint64_t kmer, size_t kmer_size);
+			void clear();
+			size_t kmerCount() const { return kmer_n; }
+			double entropy() const;
+			// frequencies are taken relative to total instead of kmerCount()
+			double entropy(size_t total) const;
+
+			// State of a 2 bit packed kmer small enough to keep per graph node: the
+			// sum of c*log(c) over its trinucleotide counts c, which are read back
+			// from the kmer itself when a trinucleotide leaves and one enters.
+			// As in shannon(), the last trinucleotide of the kmer is not counted
+			// but is part of the total, so packedEntropy matches shannon(kmer).
+			static double packedLogSum(uint64_t kmer, size_t kmer_size);
+			// occurrences of the trinucleotide code in a packed kmer
+			static size_t packedCount(uint64_t kmer, size_t kmer_size, uint8_t code);
+			// log sum once code_out has left the counted trinucleotides of kmer
+			// and code_in has entered them
+			static double shiftLogSum(double log_sum, uint64_t kmer, size_t kmer_size, uint8_t code_out, uint8_t code_in);
+			static double packedEntropy(double log_sum, size_t kmer_size);
+		private:
+			std::array<uint32_t, 64> counts{};
+			size_t kmer_n = 0;
+			double count_log_sum = 0.0;
+	};
+
 	double shannon(const std::string& seq);
 	MaskingStats maskingStats(const std::string& seq);
 }
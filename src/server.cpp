@@ -0,0 +1,258 @@
+#include "server.h"
+#include "utils.h"
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <set>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace Server {
+	static std::vector<std::string> splitWords(const std::string& line) {
+		std::istringstream stream(line);
+		std::vector<std::string> words;
+		std::string word;
+		while (stream >> word) {
+			words.push_back(word);
+		}
+		return words;
+	}
+
+	std::string Session::count(const std::string& seq) {
+		size_t hits = counting->windowSize() > counting->kmerSize()
+			? counting->searchMinimizers(seq)
+			: counting->searchSeq(seq);
+		return std::to_string(hits) + '\n';
+	}
+
+	std::string Session::filterPairs(const std::vector<std::string>& words) {
+		if (words.size() != 7) {
+			return "ERR usage: FILTER <filter> <mincount> <mates1> <mates2> <out1> <out2>\n";
+		}
+		auto filter = filters.find(words[1]);
+		if (filter == filters.end()) {
+			return "ERR unknown filter " + words[1] + '\n';
+		}
+		size_t min_count = 0;
+		std::istringstream min_count_stream(words[2]);
+		if (!(min_count_stream >> min_count)) {
+			return "ERR invalid mincount " + words[2] + '\n';
+		}
+		for (size_t i = 3; i < 5; i++) {
+			if (access(words[i].c_str(), R_OK) != 0) {
+				return "ERR can not read " + words[i] + '\n';
+			}
+		}
+		Bloom::PairCounts counts = filter->second.filterFastqPairs(words[3], words[4], words[5], words[6], min_count,
+				pair_check);
+		if (counts.pair_check_failed) {
+			return "ERR mates of " + words[3] + " and " + words[4] + " name different fragments after pair "
+				+ std::to_string(counts.pairs) + ", the output is incomplete\n";
+		}
+		return "OK " + std::to_string(counts.pairs) + ' ' + std::to_string(counts.kept) + '\n';
+	}
+
+	std::string Session::handleLine(const std::string& line) {
+		if (counting) {
+			if (line.empty()) {
+				counting = nullptr;
+				return "\n";
+			}
+			return count(line);
+		}
+		std::vector<std::string> words = splitWords(line);
+		if (words.empty()) {
+			return "ERR empty request\n";
+		}
+		const std::string& request = words[0];
+		if (request == "LIST") {
+			std::string response = "OK " + std::to_string(filters.size()) + '\n';
+			for (const auto& [name, filter]: filters) {
+				response += name + ' ' + std::to_string(filter.kmerSize()) + ' ' + std::to_string(filter.windowSize())
+					+ ' ' + std::to_string(filter.size()) + '\n';
+			}
+			return response + '\n';
+		} else if (request == "COUNT") {
+			auto filter = words.size() == 2 ? filters.find(words[1]) : filters.end();
+			if (filter == filters.end()) {
+				return words.size() == 2 ? "ERR unknown filter " + words[1] + '\n' : "ERR usage: COUNT <filter>\n";
+			}
+			counting = &filter->second;
+			return "OK\n";
+		} else if (request == "FILTER") {
+			return filterPairs(words);
+		} else if (request == "SHUTDOWN") {
+			shutdown_requested = true;
+			return "OK\n";
+		} else if (request == "QUIT") {
+			is_closed = true;
+			return "OK\n";
+		}
+		return "ERR unknown request " + request + '\n';
+	}
+
+	static volatile std::sig_atomic_t signal_received = 0;
+
+	static void onSignal(int) {
+		signal_received = 1;
+	}
+
+	static bool writeAll(int fd, const std::string& data) {
+		size_t written = 0;
+		while (written < data.size()) {
+			ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+			if (n <= 0) {
+				return false;
+			}
+			written += n;
+		}
+		return true;
+	}
+
+	// descriptors of the open connections, shut down when the server stops
+	// and awaited until the last one closes
+	struct Connections {
+		std::mutex mutex;
+		std::condition_variable closed;
+		std::set<int> fds;
+		std::atomic<bool> stopping{false};
+	};
+
+	// Answers the requests of one client until it quits or disconnects, runs
+	// detached, so nothing of the server is touched after the fd is released
+	static void handleConnection(int fd, Filters& filters, Fastq::PairCheck pair_check, Connections& connections) {
+		{
+			Session session(filters, pair_check);
+			std::string pending;
+			std::vector<char> buffer(1 << 16);
+			while (!session.closed()) {
+				ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+				if (n <= 0) {
+					break;
+				}
+				pending.append(buffer.data(), n);
+				std::string responses;
+				size_t line_beg = 0;
+				for (size_t line_end = pending.find('\n'); line_end != std::string::npos && !session.closed();
+						line_end = pending.find('\n', line_beg)) {
+					std::string line = pending.substr(line_beg, line_end - line_beg);
+					Utils::trimNewlineInplace(line);
+					responses += session.handleLine(line);
+					line_beg = line_end + 1;
+				}
+				pending.erase(0, line_beg);
+				if (!writeAll(fd, responses)) {
+					break;
+				}
+				if (session.shutdownRequested()) {
+					connections.stopping = true;
+				}
+			}
+		}
+		std::lock_guard<std::mutex> lock(connections.mutex);
+		connections.fds.erase(fd);
+		close(fd);
+		connections.closed.notify_all();
+	}
+
+	static int listenUnixSocket(const std::string& path) {
+		sockaddr_un addr;
+		std::memset(&addr, 0, sizeof(addr));
+		if (path.size() >= sizeof(addr.sun_path)) {
+			std::cerr << "Socket path too long: " << path << '\n';
+			return -1;
+		}
+		addr.sun_family = AF_UNIX;
+		std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+		int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock < 0) {
+			return -1;
+		}
+		// a socket file left by a crashed server is replaced, a live one is not
+		int live = Utils::connectUnixSocket(path);
+		if (live >= 0) {
+			close(live);
+			close(sock);
+			std::cerr << "A server is already listening on " << path << '\n';
+			return -1;
+		}
+		unlink(path.c_str());
+		// requests name files read and written as the server user, so only that
+		// user may connect; nobody can connect before listen
+		if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || chmod(path.c_str(), 0600) != 0
+				|| listen(sock, 64) != 0) {
+			std::cerr << "Can not listen on " << path << ": " << std::strerror(errno) << '\n';
+			close(sock);
+			return -1;
+		}
+		return sock;
+	}
+
+	int serve(const std::string& socket_path, Filters& filters, Fastq::PairCheck pair_check) {
+		int listen_fd = listenUnixSocket(socket_path);
+		if (listen_fd < 0) {
+			return 1;
+		}
+		signal_received = 0;
+		auto previous_int = std::signal(SIGINT, onSignal);
+		auto previous_term = std::signal(SIGTERM, onSignal);
+
+		Connections connections;
+		pollfd listen_poll = {listen_fd, POLLIN, 0};
+		while (!connections.stopping && !signal_received) {
+			// the timeout bounds the delay of noticing SHUTDOWN from a connection thread
+			int ready = poll(&listen_poll, 1, 100);
+			if (ready <= 0) {
+				continue;
+			}
+			int fd = accept(listen_fd, nullptr, nullptr);
+			if (fd >= 0) {
+				std::lock_guard<std::mutex> lock(connections.mutex);
+				connections.fds.insert(fd);
+				std::thread(handleConnection, fd, std::ref(filters), pair_check, std::ref(connections)).detach();
+			}
+		}
+		close(listen_fd);
+		unlink(socket_path.c_str());
+		{
+			// idle clients get end of file, requests in progress are finished
+			std::unique_lock<std::mutex> lock(connections.mutex);
+			for (int fd: connections.fds) {
+				shutdown(fd, SHUT_RD);
+			}
+			connections.closed.wait(lock, [&connections] { return connections.fds.empty(); });
+		}
+		std::signal(SIGINT, previous_int);
+		std::signal(SIGTERM, previous_term);
+		return 0;
+	}
+
+	std::optional<std::string> exchange(const std::string& socket_path, const std::string& requests) {
+		int fd = Utils::connectUnixSocket(socket_path);
+		if (fd < 0) {
+			std::cerr << "Can not connect to " << socket_path << '\n';
+			return {};
+		}
+		if (!writeAll(fd, requests + "QUIT\n")) {
+			close(fd);
+			return {};
+		}
+		std::string response;
+		std::vector<char> buffer(1 << 16);
+		for (ssize_t n = recv(fd, buffer.data(), buffer.size(), 0); n > 0;
+				n = recv(fd, buffer.data(), buffer.size(), 0)) {
+			response.append(buffer.data(), n);
+		}
+		close(fd);
+		return response;
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "bloom.h"
+#include <atomic>
+#include <map>
+#include <optional>
+#include <string>
+
+// Long running bloom-search: filters are loaded (or mapped) once and queried
+// over a local stream socket with a line protocol. Every request is one line
+// of space separated words, every response starts with an "OK" or "ERR" line.
+//
+//   LIST                           OK <n>, then "<name> <k> <w> <bytes>" per filter and an empty line
+//   COUNT <filter>                 OK, then each following sequence line is answered with its
+//                                  kmer hits until an empty line, which is echoed back
+//   FILTER <filter> <mincount> <mates1> <mates2> <out1> <out2>
+//                                  OK <pairs> <kept>, paths are resolved by the server; ERR when
+//                                  the pair check of the server stopped at mismatched mates
+//   SHUTDOWN                       OK, stops accepting connections, idle ones are closed
+//   QUIT                           OK, closes the connection
+namespace Server {
+	using Filters = std::map<std::string, Bloom::Filter>;
+
+	// Protocol state of one connection
+	class Session {
+		public:
+			explicit Session(Filters& filters, Fastq::PairCheck pair_check = Fastq::PairCheck::STRICT)
+				: filters(filters), pair_check(pair_check) {}
+			// response to one request line (without the newline)
+			std::string handleLine(const std::string& line);
+			bool closed() const { return is_closed; }
+			bool shutdownRequested() const { return shutdown_requested; }
+		private:
+			std::string count(const std::string& seq);
+			std::string filterPairs(const std::vector<std::string>& words);
+
+			Filters& filters;
+			Fastq::PairCheck pair_check;
+			// filter of the COUNT block in progress
+			Bloom::Filter* counting = nullptr;
+			bool is_closed = false;
+			bool shutdown_requested = false;
+	};
+
+	// Serves until SHUTDOWN or SIGINT/SIGTERM, the socket file is removed on exit
+	int serve(const std::string& socket_path, Filters& filters, Fastq::PairCheck pair_check = Fastq::PairCheck::STRICT);
+
+	// Sends requests followed by QUIT and returns everything the server answered.
+	// Requests are written before reading, so batches are expected to be small.
+	std::optional<std::string> exchange(const std::string& socket_path, const std::string& requests);
+}
+
+#endif
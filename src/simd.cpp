@@ -0,0 +1,355 @@
+#include "simd.h"
+#include <cstdlib>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace Simd {
+	char complementChar(char c) {
+		switch (c) {
+			case 'A': return 'T';
+			case 'a': return 't';
+			case 'T': return 'A';
+			case 't': return 'a';
+			case 'G': return 'C';
+			case 'g': return 'c';
+			case 'C': return 'G';
+			case 'c': return 'g';
+			default: return c;
+		}
+	}
+
+	bool isMaskedChar(char c) {
+		return c == 'a' || c == 't' || c == 'g' || c == 'c' || c == 'N' || c == 'n';
+	}
+
+	void revcomScalar(const char* in, char* out, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			out[size-1-i] = complementChar(in[i]);
+		}
+	}
+
+	void softmaskScalar(char* seq, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			if (seq[i] < 97) {
+				seq[i] += 32;
+			}
+		}
+	}
+
+	void unmaskScalar(char* seq, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			if (seq[i] >= 97) {
+				seq[i] -= 32;
+			}
+		}
+	}
+
+	size_t findMaskToggleScalar(const char* seq, size_t size, bool masked) {
+		for (size_t i = 0; i < size; i++) {
+			if (isMaskedChar(seq[i]) != masked) {
+				return i;
+			}
+		}
+		return size;
+	}
+
+	MaskCounts countMaskedScalar(const char* seq, size_t size) {
+		MaskCounts result;
+		for (size_t i = 0; i < size; i++) {
+			char c = seq[i];
+			if (c == 'N' || c == 'n') {
+				result.hardmasked++;
+			}
+			if (c >= 'a' && c <= 'z' && c != 'n') {
+				result.softmasked++;
+			}
+		}
+		return result;
+	}
+
+#ifdef SIMD_X86
+	// Complement is looked up by the low nibble, which is unique for A, C, G, T
+	// (and their lowercase forms). The xor delta is only applied to characters
+	// that really are one of those bases, everything else is copied unchanged.
+	__attribute__((target("ssse3")))
+	__m128i complementSsse3(__m128i c) {
+		const __m128i delta_table = _mm_setr_epi8(0, 0x15, 0, 0x04, 0x15, 0, 0, 0x04, 0, 0, 0, 0, 0, 0, 0, 0);
+		const __m128i base_table = _mm_setr_epi8(0, 'A', 0, 'C', 'T', 0, 0, 'G', 0, 0, 0, 0, 0, 0, 0, 0);
+		__m128i low_nibble = _mm_and_si128(c, _mm_set1_epi8(0x0F));
+		__m128i delta = _mm_shuffle_epi8(delta_table, low_nibble);
+		__m128i expected = _mm_shuffle_epi8(base_table, low_nibble);
+		__m128i is_base = _mm_cmpeq_epi8(_mm_and_si128(c, _mm_set1_epi8(static_cast<char>(0xDF))), expected);
+		return _mm_xor_si128(c, _mm_and_si128(delta, is_base));
+	}
+
+	__attribute__((target("ssse3")))
+	__m128i maskedSsse3(__m128i c) {
+		__m128i result = _mm_cmpeq_epi8(c, _mm_set1_epi8('a'));
+		result = _mm_or_si128(result, _mm_cmpeq_epi8(c, _mm_set1_epi8('t')));
+		result = _mm_or_si128(result, _mm_cmpeq_epi8(c, _mm_set1_epi8('g')));
+		result = _mm_or_si128(result, _mm_cmpeq_epi8(c, _mm_set1_epi8('c')));
+		result = _mm_or_si128(result, _mm_cmpeq_epi8(c, _mm_set1_epi8('N')));
+		return _mm_or_si128(result, _mm_cmpeq_epi8(c, _mm_set1_epi8('n')));
+	}
+
+	__attribute__((target("ssse3")))
+	void revcomSsse3(const char* in, char* out, size_t size) {
+		const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+		size_t i = 0;
+		for (; i + 16 <= size; i += 16) {
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			__m128i rc = _mm_shuffle_epi8(complementSsse3(c), reverse);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + size - i - 16), rc);
+		}
+		revcomScalar(in + i, out, size - i);
+	}
+
+	__attribute__((target("ssse3")))
+	void softmaskSsse3(char* seq, size_t size) {
+		size_t i = 0;
+		for (; i + 16 <= size; i += 16) {
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i));
+			__m128i upper = _mm_cmplt_epi8(c, _mm_set1_epi8(97));
+			c = _mm_add_epi8(c, _mm_and_si128(upper, _mm_set1_epi8(32)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(seq + i), c);
+		}
+		softmaskScalar(seq + i, size - i);
+	}
+
+	__attribute__((target("ssse3")))
+	void unmaskSsse3(char* seq, size_t size) {
+		size_t i = 0;
+		for (; i + 16 <= size; i += 16) {
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i));
+			__m128i lower = _mm_cmpgt_epi8(c, _mm_set1_epi8(96));
+			c = _mm_sub_epi8(c, _mm_and_si128(lower, _mm_set1_epi8(32)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(seq + i), c);
+		}
+		unmaskScalar(seq + i, size - i);
+	}
+
+	__attribute__((target("ssse3")))
+	size_t findMaskToggleSsse3(const char* seq, size_t size, bool masked) {
+		uint32_t flip = masked ? 0xFFFF : 0;
+		size_t i = 0;
+		for (; i + 16 <= size; i += 16) {
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i));
+			uint32_t bits = static_cast<uint32_t>(_mm_movemask_epi8(maskedSsse3(c))) ^ flip;
+			if (bits) {
+				return i + __builtin_ctz(bits);
+			}
+		}
+		return i + findMaskToggleScalar(seq + i, size - i, masked);
+	}
+
+	__attribute__((target("ssse3")))
+	MaskCounts countMaskedSsse3(const char* seq, size_t size) {
+		MaskCounts result;
+		size_t i = 0;
+		for (; i + 16 <= size; i += 16) {
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i));
+			__m128i small_n = _mm_cmpeq_epi8(c, _mm_set1_epi8('n'));
+			__m128i hard = _mm_or_si128(small_n, _mm_cmpeq_epi8(c, _mm_set1_epi8('N')));
+			__m128i lower = _mm_and_si128(
+					_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)),
+					_mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+			__m128i soft = _mm_andnot_si128(small_n, lower);
+			result.hardmasked += __builtin_popcount(_mm_movemask_epi8(hard));
+			result.softmasked += __builtin_popcount(_mm_movemask_epi8(soft));
+		}
+		MaskCounts tail = countMaskedScalar(seq + i, size - i);
+		result.hardmasked += tail.hardmasked;
+		result.softmasked += tail.softmasked;
+		return result;
+	}
+
+	__attribute__((target("avx2")))
+	__m256i complementAvx2(__m256i c) {
+		const __m256i delta_table = _mm256_setr_epi8(
+				0, 0x15, 0, 0x04, 0x15, 0, 0, 0x04, 0, 0, 0, 0, 0, 0, 0, 0,
+				0, 0x15, 0, 0x04, 0x15, 0, 0, 0x04, 0, 0, 0, 0, 0, 0, 0, 0);
+		const __m256i base_table = _mm256_setr_epi8(
+				0, 'A', 0, 'C', 'T', 0, 0, 'G', 0, 0, 0, 0, 0, 0, 0, 0,
+				0, 'A', 0, 'C', 'T', 0, 0, 'G', 0, 0, 0, 0, 0, 0, 0, 0);
+		__m256i low_nibble = _mm256_and_si256(c, _mm256_set1_epi8(0x0F));
+		__m256i delta = _mm256_shuffle_epi8(delta_table, low_nibble);
+		__m256i expected = _mm256_shuffle_epi8(base_table, low_nibble);
+		__m256i is_base = _mm256_cmpeq_epi8(_mm256_and_si256(c, _mm256_set1_epi8(static_cast<char>(0xDF))), expected);
+		return _mm256_xor_si256(c, _mm256_and_si256(delta, is_base));
+	}
+
+	__attribute__((target("avx2")))
+	__m256i maskedAvx2(__m256i c) {
+		__m256i result = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('a'));
+		result = _mm256_or_si256(result, _mm256_cmpeq_epi8(c, _mm256_set1_epi8('t')));
+		result = _mm256_or_si256(result, _mm256_cmpeq_epi8(c, _mm256_set1_epi8('g')));
+		result = _mm256_or_si256(result, _mm256_cmpeq_epi8(c, _mm256_set1_epi8('c')));
+		result = _mm256_or_si256(result, _mm256_cmpeq_epi8(c, _mm256_set1_epi8('N')));
+		return _mm256_or_si256(result, _mm256_cmpeq_epi8(c, _mm256_set1_epi8('n')));
+	}
+
+	__attribute__((target("avx2")))
+	void revcomAvx2(const char* in, char* out, size_t size) {
+		const __m256i reverse = _mm256_setr_epi8(
+				15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+				15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32) {
+			__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+			__m256i rc = _mm256_shuffle_epi8(complementAvx2(c), reverse);
+			rc = _mm256_permute4x64_epi64(rc, 0x4E);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + size - i - 32), rc);
+		}
+		revcomScalar(in + i, out, size - i);
+	}
+
+	__attribute__((target("avx2")))
+	void softmaskAvx2(char* seq, size_t size) {
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32) {
+			__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq + i));
+			__m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(97), c);
+			c = _mm256_add_epi8(c, _mm256_and_si256(upper, _mm256_set1_epi8(32)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(seq + i), c);
+		}
+		softmaskScalar(seq + i, size - i);
+	}
+
+	__attribute__((target("avx2")))
+	void unmaskAvx2(char* seq, size_t size) {
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32) {
+			__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq + i));
+			__m256i lower = _mm256_cmpgt_epi8(c, _mm256_set1_epi8(96));
+			c = _mm256_sub_epi8(c, _mm256_and_si256(lower, _mm256_set1_epi8(32)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(seq + i), c);
+		}
+		unmaskScalar(seq + i, size - i);
+	}
+
+	__attribute__((target("avx2,bmi")))
+	size_t findMaskToggleAvx2(const char* seq, size_t size, bool masked) {
+		uint32_t flip = masked ? 0xFFFFFFFF : 0;
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32) {
+			__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq + i));
+			uint32_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(maskedAvx2(c))) ^ flip;
+			if (bits) {
+				return i + __builtin_ctz(bits);
+			}
+		}
+		return i + findMaskToggleScalar(seq + i, size - i, masked);
+	}
+
+	__attribute__((target("avx2,popcnt")))
+	MaskCounts countMaskedAvx2(const char* seq, size_t size) {
+		MaskCounts result;
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32) {
+			__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq + i));
+			__m256i small_n = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('n'));
+			__m256i hard = _mm256_or_si256(small_n, _mm256_cmpeq_epi8(c, _mm256_set1_epi8('N')));
+			__m256i lower = _mm256_and_si256(
+					_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)),
+					_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+			__m256i soft = _mm256_andnot_si256(small_n, lower);
+			result.hardmasked += __builtin_popcount(static_cast<uint32_t>(_mm256_movemask_epi8(hard)));
+			result.softmasked += __builtin_popcount(static_cast<uint32_t>(_mm256_movemask_epi8(soft)));
+		}
+		MaskCounts tail = countMaskedScalar(seq + i, size - i);
+		result.hardmasked += tail.hardmasked;
+		result.softmasked += tail.softmasked;
+		return result;
+	}
+#endif
+
+	const Kernels SCALAR_KERNELS = {
+		revcomScalar,
+		softmaskScalar,
+		unmaskScalar,
+		findMaskToggleScalar,
+		countMaskedScalar,
+	};
+
+#ifdef SIMD_X86
+	const Kernels SSSE3_KERNELS = {
+		revcomSsse3,
+		softmaskSsse3,
+		unmaskSsse3,
+		findMaskToggleSsse3,
+		countMaskedSsse3,
+	};
+
+	const Kernels AVX2_KERNELS = {
+		revcomAvx2,
+		softmaskAvx2,
+		unmaskAvx2,
+		findMaskToggleAvx2,
+		countMaskedAvx2,
+	};
+#endif
+
+	bool isSupported(Level level) {
+#ifdef SIMD_X86
+		__builtin_cpu_init();
+		switch (level) {
+			case Level::AVX2:
+				return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("popcnt");
+			case Level::SSSE3:
+				return __builtin_cpu_supports("ssse3");
+			default:
+				return true;
+		}
+#else
+		return level == Level::SCALAR;
+#endif
+	}
+
+	Level detectLevel() {
+		// PARAMER_SIMD=scalar|ssse3|avx2 caps the level, e.g. for benchmarking
+		const char* requested = std::getenv("PARAMER_SIMD");
+		std::string cap = requested ? requested : "";
+		if (cap != "scalar" && cap != "ssse3" && isSupported(Level::AVX2)) {
+			return Level::AVX2;
+		}
+		if (cap != "scalar" && isSupported(Level::SSSE3)) {
+			return Level::SSSE3;
+		}
+		return Level::SCALAR;
+	}
+
+	const Kernels& kernels(Level level) {
+#ifdef SIMD_X86
+		switch (level) {
+			case Level::AVX2:
+				return AVX2_KERNELS;
+			case Level::SSSE3:
+				return SSSE3_KERNELS;
+			default:
+				return SCALAR_KERNELS;
+		}
+#else
+		return SCALAR_KERNELS;
+#endif
+	}
+
+	const Kernels& kernels() {
+		static const Kernels& best = kernels(detectLevel());
+		return best;
+	}
+
+	const char* levelName(Level level) {
+		switch (level) {
+			case Level::AVX2:
+				return "avx2";
+			case Level::SSSE3:
+				return "ssse3";
+			default:
+				return "scalar";
+		}
+	}
+}
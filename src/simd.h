@@ -0,0 +1,41 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Character level sequence kernels with SSSE3/AVX2 implementations that are
+// picked at runtime based on the cpu the binary is running on
+namespace Simd {
+	enum class Level {
+		SCALAR,
+		SSSE3,
+		AVX2,
+	};
+
+	struct MaskCounts {
+		size_t softmasked = 0;
+		size_t hardmasked = 0;
+	};
+
+	struct Kernels {
+		void (*revcom)(const char* in, char* out, size_t size);
+		void (*softmask)(char* seq, size_t size);
+		void (*unmask)(char* seq, size_t size);
+		// index of the first character whose masked state differs from masked, size if none
+		size_t (*findMaskToggle)(const char* seq, size_t size, bool masked);
+		MaskCounts (*countMasked)(const char* seq, size_t size);
+	};
+
+	// complement of one base keeping its case, other characters are returned as is
+	char complementChar(char c);
+
+	Level detectLevel();
+	bool isSupported(Level level);
+	const Kernels& kernels(Level level);
+	// kernels for the best level supported by the cpu
+	const Kernels& kernels();
+	const char* levelName(Level level);
+}
+
+#endif
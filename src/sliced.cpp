@@ -0,0 +1,242 @@
+#include "sliced.h"
+#include "stats.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+namespace Bloom {
+	const char SLICED_MAGIC[8] = {'P', 'R', 'M', 'S', 'L', 'I', 'C', 'E'};
+	// zlib reads and writes at most UINT_MAX bytes per call
+	const size_t IO_CHUNK_SIZE = 1 << 30;
+
+	SlicedIndex::SlicedIndex(uint64_t positions, const std::vector<std::string>& taxa, uint64_t k, uint64_t w,
+			uint64_t h, Dna::HashMode hm)
+		: position_n(std::max<uint64_t>(1, positions)), taxon_names(taxa),
+		load_n((taxa.size() + TAXA_PER_LOAD - 1) / TAXA_PER_LOAD), load_masks(load_n, 0), kmer_size(k),
+		window_size(w), hash_n(h), hash_mode(hm), row_bytes(bytes() + sizeof(uint64_t), 0),
+		pair_hits(taxa.size(), 0) {
+		for (size_t load = 0; load < load_n; load++) {
+			size_t taxa_n = std::min(TAXA_PER_LOAD, taxa.size() - load * TAXA_PER_LOAD);
+			load_masks[load] = (uint64_t(1) << taxa_n) - 1;
+		}
+	}
+
+	void SlicedIndex::addSeq(size_t taxon, const std::string& seq) {
+		if (!queryHashes(seq, kmer_size, hash_n, window_size, hash_mode, hashes)) {
+			return;
+		}
+		Stats::add(Stats::Counter::KMERS, hashes.size() / hash_n);
+		Stats::ScopedTimer timer(Stats::Stage::PROBE);
+		for (uint64_t hash: hashes) {
+			uint64_t offset = (hash % position_n) * taxon_names.size() + taxon;
+			row_bytes[offset / BITS_IN_BYTE] |= 1 << (offset % BITS_IN_BYTE);
+		}
+	}
+
+	void SlicedIndex::addFile(size_t taxon, const std::string& fname, size_t minsize) {
+		std::optional<FileFormat> fformat = Fastx::inferFileFormat(fname);
+		Gz::Reader reader(fname);
+		reader.startReadAhead();
+		if (fformat == FileFormat::Fasta) {
+			for (std::optional<Fasta::Rec> fa_rec = Fasta::nextRecord(reader); fa_rec; fa_rec = Fasta::nextRecord(reader)) {
+				Stats::LatencyTimer latency_timer;
+				for (const auto& rec: fa_rec->splitOnMask()) {
+					if (rec.size() >= minsize) {
+						addSeq(taxon, rec.seq);
+					}
+				}
+			}
+		} else if (fformat == FileFormat::Fastq) {
+			for (Fastq::Rec fq_rec; Fastq::readRecord(reader, fq_rec); ) {
+				Stats::LatencyTimer latency_timer;
+				if (fq_rec.size() >= minsize) {
+					addSeq(taxon, fq_rec.seq);
+				}
+			}
+		} else {
+			std::cerr << "Unrecognized file format " << fname << '\n';
+		}
+	}
+
+	void SlicedIndex::searchSeq(const std::string& seq, std::vector<size_t>& hits) {
+		if (!queryHashes(seq, kmer_size, hash_n, window_size, hash_mode, hashes)) {
+			return;
+		}
+		Stats::ScopedTimer timer(Stats::Stage::PROBE);
+		size_t kmer_hits = 0;
+		for (size_t i = 0; i < hashes.size(); i += hash_n) {
+			bool found = false;
+			for (size_t load = 0; load < load_n; load++) {
+				uint64_t bits = rowBits(hashes[i], load);
+				for (size_t j = i + 1; j < i + hash_n && bits; j++) {
+					bits &= rowBits(hashes[j], load);
+				}
+				found |= bits != 0;
+				for (; bits; bits &= bits - 1) {
+					hits[load * TAXA_PER_LOAD + __builtin_ctzll(bits)]++;
+				}
+			}
+			kmer_hits += found;
+		}
+		Stats::add(Stats::Counter::KMERS, hashes.size() / hash_n);
+		Stats::add(Stats::Counter::KMER_HITS, kmer_hits);
+	}
+
+	const std::vector<size_t>& SlicedIndex::searchFastqPair(const Fastq::Pair& fq_pair) {
+		std::fill(pair_hits.begin(), pair_hits.end(), 0);
+		searchSeq(fq_pair.first.seq, pair_hits);
+		searchSeq(fq_pair.second.seq, pair_hits);
+		return pair_hits;
+	}
+
+	std::vector<PairCounts> SlicedIndex::filterFastqPairs(const std::string& mates1_fname,
+			const std::string& mates2_fname, const std::string& out_mates1_fname, const std::string& out_mates2_fname,
+			size_t min_count, Gz::Writer* hit_matrix, Fastq::PairCheck pair_check) {
+		Fastq::FragmentReader reader(Fastq::Layout::PAIRED, mates1_fname, mates2_fname, pair_check);
+		std::unique_ptr<Fastq::FragmentWriter> writer;
+		if (!out_mates1_fname.empty() && !out_mates2_fname.empty()) {
+			writer = std::make_unique<Fastq::FragmentWriter>(Fastq::Layout::PAIRED, out_mates1_fname, out_mates2_fname);
+		}
+		return filterFragments(reader, writer.get(), min_count, hit_matrix);
+	}
+
+	std::vector<PairCounts> SlicedIndex::filterFragments(Fastq::FragmentReader& reader, Fastq::FragmentWriter* writer,
+			size_t min_count, Gz::Writer* hit_matrix) {
+		std::vector<PairCounts> counts(taxon_names.size());
+		Fastq::FragmentBatch batch;
+		while (reader.nextBatch(batch)) {
+			for (const Fastq::Pair& fragment: batch) {
+				{
+					Stats::LatencyTimer latency_timer;
+					searchFastqPair(fragment);
+				}
+				bool kept = false;
+				for (size_t i = 0; i < counts.size(); i++) {
+					counts[i].pairs++;
+					if (pair_hits[i] >= min_count) {
+						counts[i].kept++;
+						kept = true;
+					}
+				}
+				if (kept && writer) {
+					writer->write(fragment);
+				}
+				if (hit_matrix) {
+					const std::string& seq_id = fragment.first.seq_id;
+					std::string row = seq_id.substr(0, seq_id.find_first_of(" \t"));
+					for (size_t kmer_hits: pair_hits) {
+						row += '\t' + std::to_string(kmer_hits);
+					}
+					hit_matrix->writeLine(row);
+				}
+			}
+		}
+		for (PairCounts& taxon_counts: counts) {
+			taxon_counts.pair_check_failed = reader.pairCheckCounts().failed;
+		}
+		return counts;
+	}
+
+	size_t SlicedIndex::setBitsCount(size_t taxon) const {
+		size_t count = 0;
+		for (uint64_t pos = 0; pos < position_n; pos++) {
+			uint64_t offset = pos * taxon_names.size() + taxon;
+			count += (row_bytes[offset / BITS_IN_BYTE] >> (offset % BITS_IN_BYTE)) & 1;
+		}
+		return count;
+	}
+
+	// header fields after the magic, in file order
+	static std::vector<uint64_t> headerFields(const SlicedIndex& index) {
+		uint64_t flags = index.hashMode() == Dna::HashMode::FORWARD ? FLAG_FORWARD_HASH : 0;
+		return {flags, index.positions(), index.kmerSize(), index.windowSize(), index.hashN(), index.taxa().size()};
+	}
+
+	int SlicedIndex::write(const std::string& out_fname, Compression cmpr) const {
+		std::string header(SLICED_MAGIC, sizeof(SLICED_MAGIC));
+		auto append = [&header](const void* data, size_t bytes) {
+			header.append(reinterpret_cast<const char*>(data), bytes);
+		};
+		for (uint64_t field: headerFields(*this)) {
+			append(&field, sizeof(field));
+		}
+		for (const std::string& name: taxon_names) {
+			uint64_t name_size = name.size();
+			append(&name_size, sizeof(name_size));
+			append(name.data(), name.size());
+		}
+		const char* data = reinterpret_cast<const char*>(row_bytes.data());
+		size_t data_size = bytes();
+		if (cmpr == Compression::RAW) {
+			std::ofstream outfh(out_fname, std::ios::out | std::ios::binary);
+			outfh.write(header.data(), header.size());
+			outfh.write(data, data_size);
+			return outfh ? 0 : 1;
+		}
+		Gz::Writer gzwriter(out_fname);
+		gzwriter.write(header.data(), header.size());
+		for (size_t written = 0; written < data_size; written += IO_CHUNK_SIZE) {
+			size_t chunk = std::min(IO_CHUNK_SIZE, data_size - written);
+			if (gzwriter.write(const_cast<char*>(data + written), chunk) != static_cast<int>(chunk)) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	// reads exactly bytes, gz and uncompressed files alike
+	static bool readExactly(Gz::Reader& reader, void* buff, size_t bytes) {
+		char* out = reinterpret_cast<char*>(buff);
+		for (size_t done = 0; done < bytes; ) {
+			size_t chunk = std::min(IO_CHUNK_SIZE, bytes - done);
+			if (reader.read(out + done, chunk) != static_cast<int>(chunk)) {
+				return false;
+			}
+			done += chunk;
+		}
+		return true;
+	}
+
+	bool SlicedIndex::isIndex(const std::string& in_fname) {
+		if (!std::filesystem::exists(in_fname)) {
+			return false;
+		}
+		char magic[sizeof(SLICED_MAGIC)] = {0};
+		Gz::Reader reader(in_fname);
+		return readExactly(reader, magic, sizeof(magic)) && std::memcmp(magic, SLICED_MAGIC, sizeof(magic)) == 0;
+	}
+
+	std::optional<SlicedIndex> SlicedIndex::load(const std::string& in_fname) {
+		if (!isIndex(in_fname)) {
+			std::cerr << in_fname << " is not a sliced index\n";
+			return {};
+		}
+		Gz::Reader reader(in_fname);
+		char magic[sizeof(SLICED_MAGIC)];
+		uint64_t fields[6];
+		if (!readExactly(reader, magic, sizeof(magic)) || !readExactly(reader, fields, sizeof(fields))) {
+			return {};
+		}
+		std::vector<std::string> taxa(fields[5]);
+		for (std::string& name: taxa) {
+			uint64_t name_size = 0;
+			if (!readExactly(reader, &name_size, sizeof(name_size))) {
+				return {};
+			}
+			name.resize(name_size);
+			if (!readExactly(reader, name.data(), name_size)) {
+				return {};
+			}
+		}
+		Dna::HashMode hash_mode = (fields[0] & FLAG_FORWARD_HASH) ? Dna::HashMode::FORWARD : Dna::HashMode::CANONICAL;
+		SlicedIndex result(fields[1], taxa, fields[2], fields[3], fields[4], hash_mode);
+		if (!readExactly(reader, result.row_bytes.data(), result.bytes())) {
+			std::cerr << "Truncated index " << in_fname << '\n';
+			return {};
+		}
+		return result;
+	}
+} // namespace Bloom
@@ -0,0 +1,87 @@
+#ifndef SLICED_H
+#define SLICED_H
+
+#include "bloom.h"
+#include "fastx.h"
+#include "seq.h"
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace Bloom {
+// Bit-sliced signature index over many taxa (BIGSI/COBS style). Every filter
+// position holds a row of one bit per taxon, rows packed back to back, so the
+// index takes the size of one slice per taxon. The hash_n rows of a kmer answer
+// membership in all taxa at once: the rows are ANDed and the surviving bits
+// are the taxa containing the kmer.
+// Searches reuse buffers of the index, so an index is searched from one thread.
+class SlicedIndex {
+public:
+  // taxa read with one unaligned 64 bit load, wherever in a byte the row starts
+  static constexpr size_t TAXA_PER_LOAD = 56;
+  // positions is the number of bits in the slice of every taxon
+  SlicedIndex(uint64_t positions, const std::vector<std::string>& taxa, uint64_t k, uint64_t w, uint64_t h,
+			  Dna::HashMode hm = Dna::HashMode::CANONICAL);
+
+  void addSeq(size_t taxon, const std::string& seq);
+  // sequences of at least minsize bases of a fasta or fastq file, fasta records are split on masked bases
+  void addFile(size_t taxon, const std::string& fname, size_t minsize);
+  // kmer hits of seq in every taxon, added to hits
+  void searchSeq(const std::string& seq, std::vector<size_t>& hits);
+  // kmer hits of both mates in every taxon
+  const std::vector<size_t>& searchFastqPair(const Fastq::Pair& fq_pair);
+  // Per taxon counts of fragments with at least min_count hits. Fragments
+  // with min_count hits in any taxon are written to writer when given, the
+  // name and hits of every fragment to hit_matrix.
+  std::vector<PairCounts> filterFragments(Fastq::FragmentReader& reader, Fastq::FragmentWriter* writer,
+										  size_t min_count, Gz::Writer* hit_matrix = nullptr);
+  // filterFragments over paired files, out_mates1/out_mates2 may be empty
+  std::vector<PairCounts> filterFastqPairs(const std::string& mates1_fname, const std::string& mates2_fname,
+										   const std::string& out_mates1_fname, const std::string& out_mates2_fname,
+										   size_t min_count, Gz::Writer* hit_matrix = nullptr,
+										   Fastq::PairCheck pair_check = Fastq::PairCheck::STRICT);
+
+  int write(const std::string& out_fname, Compression cmpr) const;
+  // reads raw and gz indices alike
+  static std::optional<SlicedIndex> load(const std::string& in_fname);
+  // true when the file starts with the index magic rather than a filter header
+  static bool isIndex(const std::string& in_fname);
+
+  const std::vector<std::string>& taxa() const { return taxon_names; }
+  uint64_t positions() const { return position_n; }
+  size_t loadsPerPosition() const { return load_n; }
+  // bytes taken by the rows of all positions, about the number of taxa times the slice size
+  uint64_t bytes() const { return (position_n * taxon_names.size() + BITS_IN_BYTE - 1) / BITS_IN_BYTE; }
+  uint64_t kmerSize() const { return kmer_size; }
+  uint64_t windowSize() const { return window_size; }
+  uint64_t hashN() const { return hash_n; }
+  Dna::HashMode hashMode() const { return hash_mode; }
+  // bits set in the slice of taxon
+  size_t setBitsCount(size_t taxon) const;
+
+private:
+  // taxa load * TAXA_PER_LOAD onwards of the row of hash, bytes are read little endian
+  uint64_t rowBits(uint64_t hash, size_t load) const {
+	  uint64_t offset = (hash % position_n) * taxon_names.size() + load * TAXA_PER_LOAD;
+	  uint64_t value = 0;
+	  std::memcpy(&value, &row_bytes[offset / BITS_IN_BYTE], sizeof(value));
+	  return (value >> (offset % BITS_IN_BYTE)) & load_masks[load];
+  }
+
+  uint64_t position_n;
+  std::vector<std::string> taxon_names;
+  size_t load_n;
+  std::vector<uint64_t> load_masks;
+  uint64_t kmer_size;
+  uint64_t window_size;
+  uint64_t hash_n;
+  Dna::HashMode hash_mode;
+  // bytes() followed by the bytes a load at the last row may read past it
+  std::vector<uint8_t> row_bytes;
+  std::vector<uint64_t> hashes;
+  std::vector<size_t> pair_hits;
+};
+} // namespace Bloom
+#endif
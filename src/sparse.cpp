@@ -0,0 +1,63 @@
+#include "sparse.h"
+#include <cstring>
+
+namespace Bloom {
+	void SparseBytes::append(const uint8_t* data, size_t size) {
+		for (size_t beg = 0; beg < size; beg += BLOCK_SIZE) {
+			const uint8_t* block_data = data + beg;
+			size_t block_size = std::min(BLOCK_SIZE, size - beg);
+			size_t nonzero = std::count_if(block_data, block_data + block_size, [](uint8_t byte) { return byte != 0; });
+			if (nonzero > MAX_ARRAY_SIZE) {
+				blocks.push_back(Block{dense.size(), static_cast<uint32_t>(block_size), true});
+				dense.insert(dense.end(), block_data, block_data + block_size);
+				continue;
+			}
+			blocks.push_back(Block{offsets.size(), static_cast<uint32_t>(nonzero), false});
+			for (size_t i = 0; i < block_size; i++) {
+				if (block_data[i]) {
+					offsets.push_back(i);
+					values.push_back(block_data[i]);
+				}
+			}
+		}
+		byte_n += size;
+	}
+
+	size_t SparseBytes::memoryBytes() const {
+		return blocks.capacity() * sizeof(Block) + offsets.capacity() * sizeof(uint16_t) + values.capacity()
+			+ dense.capacity();
+	}
+
+	size_t SparseBytes::setBitsCount() const {
+		size_t count = 0;
+		for (uint8_t value: values) {
+			count += __builtin_popcount(value);
+		}
+		for (uint8_t value: dense) {
+			count += __builtin_popcount(value);
+		}
+		return count;
+	}
+
+	void SparseBytes::copyTo(uint8_t* out) const {
+		for (size_t i = 0; i < blocks.size(); i++) {
+			const Block& block = blocks[i];
+			uint8_t* block_out = out + i * BLOCK_SIZE;
+			if (block.dense) {
+				std::memcpy(block_out, &dense[block.begin], block.size);
+				continue;
+			}
+			std::memset(block_out, 0, std::min(BLOCK_SIZE, byte_n - i * BLOCK_SIZE));
+			for (size_t j = block.begin; j < block.begin + block.size; j++) {
+				block_out[offsets[j]] = values[j];
+			}
+		}
+	}
+
+	void SparseBytes::shrinkToFit() {
+		blocks.shrink_to_fit();
+		offsets.shrink_to_fit();
+		values.shrink_to_fit();
+		dense.shrink_to_fit();
+	}
+} // namespace Bloom
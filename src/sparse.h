@@ -0,0 +1,58 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Bloom {
+// Read only byte array for filters with few bits set, in the spirit of
+// roaring bitmaps: the bytes are split into 4KB blocks and every block is
+// stored empty, as sorted offsets and values of its non zero bytes, or as a
+// dense copy once that takes less space.
+class SparseBytes {
+public:
+  static constexpr size_t BLOCK_BITS = 12;
+  static constexpr size_t BLOCK_SIZE = size_t(1) << BLOCK_BITS;
+  // blocks with more non zero bytes are stored dense (3 bytes per entry otherwise)
+  static constexpr size_t MAX_ARRAY_SIZE = BLOCK_SIZE / 3;
+
+  // appends size bytes after the ones already added, only the last append may
+  // end inside a block
+  void append(const uint8_t* data, size_t size);
+
+  uint8_t at(size_t idx) const {
+    const Block& block = blocks[idx >> BLOCK_BITS];
+    uint16_t offset = idx & (BLOCK_SIZE - 1);
+    if (block.dense) {
+      return dense[block.begin + offset];
+    }
+    auto beg = offsets.begin() + block.begin;
+    auto end = beg + block.size;
+    auto it = std::lower_bound(beg, end, offset);
+    return it != end && *it == offset ? values[it - offsets.begin()] : 0;
+  }
+  size_t size() const { return byte_n; }
+  // heap bytes held, blocks included
+  size_t memoryBytes() const;
+  size_t setBitsCount() const;
+  // writes all size() bytes to out
+  void copyTo(uint8_t* out) const;
+  // releases the spare capacity left by appending
+  void shrinkToFit();
+
+private:
+  struct Block {
+    // first entry in offsets/values, or first byte in dense
+    uint64_t begin;
+    uint32_t size;
+    bool dense;
+  };
+  size_t byte_n = 0;
+  std::vector<Block> blocks;
+  std::vector<uint16_t> offsets;
+  std::vector<uint8_t> values;
+  std::vector<uint8_t> dense;
+};
+} // namespace Bloom
+#endif
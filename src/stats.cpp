@@ -0,0 +1,194 @@
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Stats {
+	std::atomic<bool> enabled_flag{false};
+	std::atomic<bool> counting_flag{false};
+	std::array<std::atomic<uint64_t>, COUNTER_N> counter_values{};
+	static std::array<std::atomic<uint64_t>, STAGE_N> stage_nanos{};
+	static std::array<std::atomic<uint64_t>, STAGE_N> stage_calls{};
+	static std::chrono::steady_clock::time_point enabled_at = std::chrono::steady_clock::now();
+	// innermost running timer of the thread
+	static thread_local ScopedTimer* current_timer = nullptr;
+
+	static uint64_t nanosSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void setEnabled(bool enabled) {
+		if (enabled) {
+			enabled_at = std::chrono::steady_clock::now();
+		}
+		enabled_flag = enabled;
+	}
+
+	void setCounting(bool counting) {
+		counting_flag = counting;
+	}
+
+	void reset() {
+		for (auto& value: counter_values) {
+			value = 0;
+		}
+		for (size_t i = 0; i < STAGE_N; i++) {
+			stage_nanos[i] = 0;
+			stage_calls[i] = 0;
+		}
+		recordLatencies().clear();
+		enabled_at = std::chrono::steady_clock::now();
+	}
+
+	void addTime(Stage stage, uint64_t nanos, uint64_t calls) {
+		stage_nanos[static_cast<size_t>(stage)].fetch_add(nanos, std::memory_order_relaxed);
+		stage_calls[static_cast<size_t>(stage)].fetch_add(calls, std::memory_order_relaxed);
+	}
+
+	uint64_t count(Counter counter) {
+		return counter_values[static_cast<size_t>(counter)].load();
+	}
+
+	uint64_t nanos(Stage stage) {
+		return stage_nanos[static_cast<size_t>(stage)].load();
+	}
+
+	const char* stageName(Stage stage) {
+		switch (stage) {
+			case Stage::PARSE: return "parse";
+			case Stage::DECOMPRESS: return "decompress";
+			case Stage::HASH: return "hash";
+			case Stage::PROBE: return "probe";
+			case Stage::WRITE: return "write";
+			case Stage::BFS: return "bfs";
+			case Stage::READ_WAIT: return "read_wait";
+		}
+		return "";
+	}
+
+	const char* counterName(Counter counter) {
+		switch (counter) {
+			case Counter::RECORDS: return "records";
+			case Counter::BYTES_IN: return "bytes_in";
+			case Counter::BYTES_OUT: return "bytes_out";
+			case Counter::KMERS: return "kmers";
+			case Counter::KMER_HITS: return "kmer_hits";
+			case Counter::BFS_NODES: return "bfs_nodes";
+			case Counter::MATE_MISMATCHES: return "mate_mismatches";
+			case Counter::SKIPPED_RECORDS: return "skipped_records";
+		}
+		return "";
+	}
+
+	size_t LatencyHistogram::bucketIdx(uint64_t nanos) {
+		if (nanos < SUB_BUCKET_N) {
+			return nanos;
+		}
+		size_t exponent = 63 - __builtin_clzll(nanos);
+		size_t sub_bucket = (nanos >> (exponent - 4)) & (SUB_BUCKET_N - 1);
+		return (exponent - 3) * SUB_BUCKET_N + sub_bucket;
+	}
+
+	uint64_t LatencyHistogram::bucketMin(size_t idx) {
+		if (idx < SUB_BUCKET_N) {
+			return idx;
+		}
+		size_t exponent = idx / SUB_BUCKET_N + 3;
+		return (SUB_BUCKET_N + idx % SUB_BUCKET_N) << (exponent - 4);
+	}
+
+	void LatencyHistogram::record(uint64_t nanos) {
+		buckets[bucketIdx(nanos)].fetch_add(1, std::memory_order_relaxed);
+		uint64_t seen_max = max_nanos.load(std::memory_order_relaxed);
+		while (nanos > seen_max && !max_nanos.compare_exchange_weak(seen_max, nanos, std::memory_order_relaxed)) {
+		}
+	}
+
+	void LatencyHistogram::clear() {
+		for (auto& bucket: buckets) {
+			bucket = 0;
+		}
+		max_nanos = 0;
+	}
+
+	uint64_t LatencyHistogram::count() const {
+		uint64_t total = 0;
+		for (const auto& bucket: buckets) {
+			total += bucket.load();
+		}
+		return total;
+	}
+
+	uint64_t LatencyHistogram::percentile(double q) const {
+		uint64_t total = count();
+		if (total == 0) {
+			return 0;
+		}
+		uint64_t rank = std::max<uint64_t>(1, std::ceil(q * total));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKET_N; i++) {
+			seen += buckets[i].load();
+			if (seen >= rank) {
+				return bucketMin(i);
+			}
+		}
+		return bucketMin(BUCKET_N - 1);
+	}
+
+	LatencyHistogram& recordLatencies() {
+		static LatencyHistogram histogram;
+		return histogram;
+	}
+
+	void ScopedTimer::begin() {
+		parent = current_timer;
+		current_timer = this;
+		start = std::chrono::steady_clock::now();
+	}
+
+	void ScopedTimer::end() {
+		uint64_t elapsed = nanosSince(start);
+		addTime(stage, elapsed - std::min(elapsed, nested_nanos));
+		if (parent) {
+			parent->nested_nanos += elapsed;
+		}
+		current_timer = parent;
+	}
+
+	void LatencyTimer::end() {
+		recordLatencies().record(nanosSince(start));
+	}
+
+	void writeJson(std::ostream& out) {
+		double wall_seconds = nanosSince(enabled_at) / 1e9;
+		auto rate = [wall_seconds](uint64_t n) { return wall_seconds > 0 ? n / wall_seconds : 0.0; };
+		out << "{\n";
+		out << "  \"wall_seconds\": " << wall_seconds << ",\n";
+		out << "  \"stages\": {";
+		for (size_t i = 0; i < STAGE_N; i++) {
+			out << (i > 0 ? ", " : "") << '"' << stageName(static_cast<Stage>(i)) << "\": {\"seconds\": "
+				<< stage_nanos[i].load() / 1e9 << ", \"calls\": " << stage_calls[i].load() << '}';
+		}
+		out << "},\n";
+		out << "  \"counters\": {";
+		for (size_t i = 0; i < COUNTER_N; i++) {
+			out << (i > 0 ? ", " : "") << '"' << counterName(static_cast<Counter>(i)) << "\": " << counter_values[i].load();
+		}
+		out << "},\n";
+		out << "  \"rates\": {"
+			<< "\"records_per_s\": " << rate(count(Counter::RECORDS))
+			<< ", \"kmers_per_s\": " << rate(count(Counter::KMERS))
+			<< ", \"bytes_in_per_s\": " << rate(count(Counter::BYTES_IN))
+			<< ", \"bytes_out_per_s\": " << rate(count(Counter::BYTES_OUT))
+			<< "},\n";
+		const LatencyHistogram& latencies = recordLatencies();
+		out << "  \"record_latency_us\": {"
+			<< "\"count\": " << latencies.count()
+			<< ", \"p50\": " << latencies.percentile(0.5) / 1e3
+			<< ", \"p90\": " << latencies.percentile(0.9) / 1e3
+			<< ", \"p99\": " << latencies.percentile(0.99) / 1e3
+			<< ", \"p999\": " << latencies.percentile(0.999) / 1e3
+			<< ", \"max\": " << latencies.max() / 1e3
+			<< "}\n";
+		out << "}\n";
+	}
+}
@@ -0,0 +1,126 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Process wide timers and counters for the hot paths. Collection is off until
+// setEnabled(true), building with -DPARAMER_NO_STATS compiles it out.
+namespace Stats {
+#ifdef PARAMER_NO_STATS
+	constexpr bool COMPILED = false;
+#else
+	constexpr bool COMPILED = true;
+#endif
+
+	enum class Stage {
+		PARSE,
+		DECOMPRESS,
+		HASH,
+		// filter memory accesses, lookups and inserts
+		PROBE,
+		WRITE,
+		BFS,
+		// readers waiting for buffers decoded on a read-ahead thread, whose
+		// decoding is counted as DECOMPRESS on that thread
+		READ_WAIT,
+	};
+	const size_t STAGE_N = 7;
+
+	enum class Counter {
+		RECORDS,
+		BYTES_IN,
+		BYTES_OUT,
+		KMERS,
+		KMER_HITS,
+		BFS_NODES,
+		// read pairs whose mates name different fragments
+		MATE_MISMATCHES,
+		// records dropped to bring mates back in step
+		SKIPPED_RECORDS,
+	};
+	const size_t COUNTER_N = 8;
+
+	extern std::atomic<bool> enabled_flag;
+	extern std::atomic<bool> counting_flag;
+	extern std::array<std::atomic<uint64_t>, COUNTER_N> counter_values;
+
+	inline bool enabled() { return COMPILED && enabled_flag.load(std::memory_order_relaxed); }
+	// counters are also kept while timers are off when counting is set
+	inline bool counting() { return COMPILED && (counting_flag.load(std::memory_order_relaxed) || enabled()); }
+	// enabling also restarts the wall clock used for rates
+	void setEnabled(bool enabled);
+	void setCounting(bool counting);
+	void reset();
+	inline void add(Counter counter, uint64_t n) {
+		if (counting()) {
+			counter_values[static_cast<size_t>(counter)].fetch_add(n, std::memory_order_relaxed);
+		}
+	}
+	void addTime(Stage stage, uint64_t nanos, uint64_t calls=1);
+	uint64_t count(Counter counter);
+	uint64_t nanos(Stage stage);
+	const char* stageName(Stage stage);
+	const char* counterName(Counter counter);
+
+	// Log-linear histogram, 16 buckets per power of two
+	class LatencyHistogram {
+		public:
+			static const size_t SUB_BUCKET_N = 16;
+			static const size_t BUCKET_N = 61 * SUB_BUCKET_N;
+			void record(uint64_t nanos);
+			void clear();
+			uint64_t count() const;
+			// lower bound of the bucket holding the q quantile, 0 when empty
+			uint64_t percentile(double q) const;
+			// largest latency recorded, not rounded down to its bucket
+			uint64_t max() const { return max_nanos.load(std::memory_order_relaxed); }
+			static size_t bucketIdx(uint64_t nanos);
+			static uint64_t bucketMin(size_t idx);
+		private:
+			std::array<std::atomic<uint64_t>, BUCKET_N> buckets{};
+			std::atomic<uint64_t> max_nanos{0};
+	};
+
+	// latencies of whole records (reads, read pairs or contigs)
+	LatencyHistogram& recordLatencies();
+
+	// Adds its lifetime to stage, minus the time of timers nested in it on the
+	// same thread, so stage times add up to the instrumented total
+	class ScopedTimer {
+		public:
+			explicit ScopedTimer(Stage s) : stage(s), active(enabled()) { if (active) begin(); }
+			~ScopedTimer() { if (active) end(); }
+			ScopedTimer(const ScopedTimer&) = delete;
+			ScopedTimer& operator=(const ScopedTimer&) = delete;
+		private:
+			void begin();
+			void end();
+			Stage stage;
+			bool active;
+			std::chrono::steady_clock::time_point start;
+			uint64_t nested_nanos = 0;
+			ScopedTimer* parent = nullptr;
+	};
+
+	// records its lifetime in recordLatencies()
+	class LatencyTimer {
+		public:
+			LatencyTimer() : active(enabled()) { if (active) start = std::chrono::steady_clock::now(); }
+			~LatencyTimer() { if (active) end(); }
+			LatencyTimer(const LatencyTimer&) = delete;
+			LatencyTimer& operator=(const LatencyTimer&) = delete;
+		private:
+			void end();
+			bool active;
+			std::chrono::steady_clock::time_point start;
+	};
+
+	// totals, rates and latency percentiles since setEnabled(true)
+	void writeJson(std::ostream& out);
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include "telemetry.h"
+#include "stats.h"
+#include "utils.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace Telemetry {
+	const std::string UNIX_PREFIX = "unix:";
+
+	uint64_t residentBytes() {
+		std::ifstream statm("/proc/self/statm");
+		uint64_t total_pages = 0;
+		uint64_t resident_pages = 0;
+		if (!(statm >> total_pages >> resident_pages)) {
+			return 0;
+		}
+		return resident_pages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+	}
+
+	std::string formatRecord(const std::string& command, const Sample& sample, const Sample& previous,
+			uint64_t input_bytes, bool done) {
+		double interval = sample.elapsed_seconds - previous.elapsed_seconds;
+		auto rate = [interval](uint64_t current, uint64_t before) {
+			return interval > 0 && current >= before ? (current - before) / interval : 0.0;
+		};
+		double compressed_rate = rate(sample.compressed_bytes_in, previous.compressed_bytes_in);
+		std::ostringstream out;
+		out << "{\"command\": \"" << command << "\""
+			<< ", \"elapsed_s\": " << sample.elapsed_seconds
+			<< ", \"records\": " << sample.records
+			<< ", \"bytes_in\": " << sample.bytes_in
+			<< ", \"compressed_bytes_in\": " << sample.compressed_bytes_in
+			<< ", \"records_per_s\": " << rate(sample.records, previous.records)
+			<< ", \"bytes_in_per_s\": " << rate(sample.bytes_in, previous.bytes_in)
+			<< ", \"compressed_bytes_in_per_s\": " << compressed_rate;
+		if (input_bytes > 0) {
+			double progress = std::min(1.0, static_cast<double>(sample.compressed_bytes_in) / input_bytes);
+			out << ", \"progress\": " << progress;
+			if (!done && compressed_rate > 0 && sample.compressed_bytes_in < input_bytes) {
+				out << ", \"eta_s\": " << (input_bytes - sample.compressed_bytes_in) / compressed_rate;
+			}
+		}
+		out << ", \"rss_bytes\": " << sample.rss_bytes
+			<< ", \"done\": " << (done ? "true" : "false")
+			<< "}\n";
+		return out.str();
+	}
+
+	Emitter::Emitter(const std::string& target, const std::string& cmd,
+			const std::vector<std::string>& inputs, std::chrono::milliseconds intrvl)
+		: command(cmd), interval(intrvl), start(std::chrono::steady_clock::now()) {
+		for (const std::string& fname: inputs) {
+			std::error_code error;
+			uint64_t size = std::filesystem::file_size(fname, error);
+			input_bytes += error ? 0 : size;
+		}
+		if (target.compare(0, UNIX_PREFIX.size(), UNIX_PREFIX) == 0) {
+			fd = Utils::connectUnixSocket(target.substr(UNIX_PREFIX.size()));
+			is_socket = true;
+		} else {
+			fd = open(target.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		}
+		if (fd < 0) {
+			std::cerr << "Can not open telemetry target " << target << '\n';
+			return;
+		}
+		Stats::setCounting(true);
+		previous = sample();
+		thread = std::thread(&Emitter::run, this);
+	}
+
+	Emitter::~Emitter() {
+		stop();
+	}
+
+	Sample Emitter::sample() const {
+		Sample current;
+		current.elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		current.records = Stats::count(Stats::Counter::RECORDS);
+		current.bytes_in = Stats::count(Stats::Counter::BYTES_IN);
+		current.compressed_bytes_in = Gz::compressedBytesRead();
+		current.rss_bytes = residentBytes();
+		return current;
+	}
+
+	void Emitter::emit(const Sample& current, bool done) {
+		std::string record = formatRecord(command, current, previous, input_bytes, done);
+		previous = current;
+		size_t written = 0;
+		while (written < record.size()) {
+			// a closed socket must not raise SIGPIPE in the middle of a run
+			ssize_t n = is_socket
+				? send(fd, record.data() + written, record.size() - written, MSG_NOSIGNAL)
+				: write(fd, record.data() + written, record.size() - written);
+			if (n <= 0) {
+				return;
+			}
+			written += n;
+		}
+	}
+
+	void Emitter::run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!stop_cv.wait_for(lock, interval, [this] { return stopping; })) {
+			emit(sample(), false);
+		}
+	}
+
+	void Emitter::stop() {
+		if (!thread.joinable()) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		stop_cv.notify_all();
+		thread.join();
+		emit(sample(), true);
+		close(fd);
+		fd = -1;
+		Stats::setCounting(false);
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Periodic progress records written as JSON lines by a background thread.
+// Records are built from Stats counters and Gz::compressedBytesRead(), so
+// the reading and hashing threads do no extra work.
+namespace Telemetry {
+	struct Sample {
+		double elapsed_seconds = 0.0;
+		uint64_t records = 0;
+		uint64_t bytes_in = 0;
+		uint64_t compressed_bytes_in = 0;
+		uint64_t rss_bytes = 0;
+	};
+
+	// resident set size of the process, 0 where /proc is not available
+	uint64_t residentBytes();
+	// One JSON line. Rates are over the interval since previous, the ETA
+	// extrapolates the compressed input rate to input_bytes.
+	std::string formatRecord(const std::string& command, const Sample& sample, const Sample& previous,
+			uint64_t input_bytes, bool done);
+
+	class Emitter {
+		public:
+			// target is a file path (appended to) or unix:PATH for a local stream socket,
+			// inputs are the files the command reads, used for the ETA
+			Emitter(const std::string& target, const std::string& command,
+					const std::vector<std::string>& inputs, std::chrono::milliseconds interval);
+			~Emitter();
+			Emitter(const Emitter&) = delete;
+			Emitter& operator=(const Emitter&) = delete;
+			bool isOpen() const { return fd >= 0; }
+			// writes a final record and joins the thread
+			void stop();
+		private:
+			void run();
+			Sample sample() const;
+			void emit(const Sample& current, bool done);
+
+			std::string command;
+			uint64_t input_bytes = 0;
+			std::chrono::milliseconds interval;
+			std::chrono::steady_clock::time_point start;
+			int fd = -1;
+			bool is_socket = false;
+			Sample previous;
+			bool stopping = false;
+			std::mutex mutex;
+			std::condition_variable stop_cv;
+			std::thread thread;
+	};
+}
+
+#endif
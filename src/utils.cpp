@@ -1,5 +1,23 @@
 #include "utils.h"
+#include "stats.h"
 #include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
 namespace Utils {
 	bool trimNewlineInplace(std::string& str) {
 		size_t input_size = str.size();
@@ -40,135 +58,811 @@ namespace Utils {
 		
 		return modifiers[size_unit]*result;
 	}
+
+	void parallelFor(size_t task_n, size_t thread_n, const std::function<void(size_t)>& task) {
+		std::atomic<size_t> next_task{0};
+		auto worker = [&]() {
+			for (size_t i = next_task++; i < task_n; i = next_task++) {
+				task(i);
+			}
+		};
+		thread_n = std::max<size_t>(1, std::min(thread_n, task_n));
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < thread_n; i++) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (std::thread& thread: threads) {
+			thread.join();
+		}
+	}
+}
+
+namespace Utils {
+	int connectUnixSocket(const std::string& path) {
+		sockaddr_un addr;
+		std::memset(&addr, 0, sizeof(addr));
+		if (path.size() >= sizeof(addr.sun_path)) {
+			return -1;
+		}
+		addr.sun_family = AF_UNIX;
+		std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+		int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock >= 0 && connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+			::close(sock);
+			sock = -1;
+		}
+		return sock;
+	}
+
+	std::optional<MappedFile> MappedFile::open(const std::string& fname) {
+		int fd = ::open(fname.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return {};
+		}
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+			::close(fd);
+			return {};
+		}
+		size_t size = file_stat.st_size;
+		void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		// the mapping stays valid after the descriptor is closed
+		::close(fd);
+		if (addr == MAP_FAILED) {
+			return {};
+		}
+		return MappedFile(static_cast<const uint8_t*>(addr), size);
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept : addr(other.addr), map_size(other.map_size) {
+		other.addr = nullptr;
+		other.map_size = 0;
+	}
+
+	MappedFile::~MappedFile() {
+		if (addr) {
+			munmap(const_cast<uint8_t*>(addr), map_size);
+		}
+	}
+
+	static std::mutex memory_mutex;
+	static MemoryPolicy memory_policy;
+	// length of every large mapping, hugetlb mappings are unmapped in whole pages
+	static std::map<void*, size_t> large_mappings;
+
+	void setMemoryPolicy(const MemoryPolicy& policy) {
+		std::lock_guard<std::mutex> lock(memory_mutex);
+		memory_policy = policy;
+	}
+
+	MemoryPolicy memoryPolicy() {
+		std::lock_guard<std::mutex> lock(memory_mutex);
+		return memory_policy;
+	}
+
+	std::optional<HugePages> parseHugePages(const std::string& name) {
+		if (name == "off") {
+			return HugePages::OFF;
+		} else if (name == "thp") {
+			return HugePages::TRANSPARENT;
+		} else if (name == "2M") {
+			return HugePages::EXPLICIT_2M;
+		} else if (name == "1G") {
+			return HugePages::EXPLICIT_1G;
+		}
+		return {};
+	}
+
+	std::optional<NumaPolicy> parseNumaPolicy(const std::string& name) {
+		if (name == "local") {
+			return NumaPolicy::LOCAL;
+		} else if (name == "interleave") {
+			return NumaPolicy::INTERLEAVE;
+		}
+		return {};
+	}
+
+	// nodes listed in /sys as ranges like 0-1,3, empty without NUMA support
+	static std::vector<size_t> onlineNumaNodes() {
+		std::ifstream online("/sys/devices/system/node/online");
+		std::vector<size_t> nodes;
+		std::string range;
+		while (std::getline(online, range, ',')) {
+			size_t first = 0;
+			size_t last = 0;
+			char dash = 0;
+			std::istringstream range_stream(range);
+			range_stream >> first;
+			if (!(range_stream >> dash >> last)) {
+				last = first;
+			}
+			for (size_t node = first; node <= last; node++) {
+				nodes.push_back(node);
+			}
+		}
+		return nodes;
+	}
+
+	static void interleavePages(void* addr, size_t bytes) {
+		// MPOL_INTERLEAVE of numaif.h, set through the syscall to not need libnuma
+		const int mpol_interleave = 3;
+		std::vector<size_t> nodes = onlineNumaNodes();
+		if (nodes.size() < 2) {
+			return;
+		}
+		std::vector<unsigned long> mask(nodes.back() / (8 * sizeof(unsigned long)) + 1, 0);
+		for (size_t node: nodes) {
+			mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		}
+		if (syscall(SYS_mbind, addr, bytes, mpol_interleave, mask.data(), mask.size() * 8 * sizeof(unsigned long) + 1, 0) != 0) {
+			std::cerr << "Can not interleave memory over NUMA nodes: " << std::strerror(errno) << '\n';
+		}
+	}
+
+	static void* mapHugeTlb(size_t bytes, HugePages huge_pages) {
+		static std::atomic<bool> warned{false};
+		size_t page_size = huge_pages == HugePages::EXPLICIT_1G ? size_t(1) << 30 : LARGE_ALLOCATION;
+		int page_flag = (huge_pages == HugePages::EXPLICIT_1G ? 30 : 21) << MAP_HUGE_SHIFT;
+		size_t length = (bytes + page_size - 1) / page_size * page_size;
+		void* addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | page_flag,
+				-1, 0);
+		if (addr == MAP_FAILED) {
+			if (!warned.exchange(true)) {
+				std::cerr << "No free " << (page_size >> 20) << "MB huge pages, using transparent huge pages\n";
+			}
+			return nullptr;
+		}
+		std::lock_guard<std::mutex> lock(memory_mutex);
+		large_mappings[addr] = length;
+		return addr;
+	}
+
+	// mapping aligned to the transparent huge page size, so the whole range can be backed by them
+	static void* mapAligned(size_t bytes, bool huge_pages) {
+		size_t length = (bytes + LARGE_ALLOCATION - 1) / LARGE_ALLOCATION * LARGE_ALLOCATION;
+		void* addr = mmap(nullptr, length + LARGE_ALLOCATION, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED) {
+			throw std::bad_alloc();
+		}
+		uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+		uintptr_t aligned = (begin + LARGE_ALLOCATION - 1) / LARGE_ALLOCATION * LARGE_ALLOCATION;
+		if (aligned > begin) {
+			munmap(addr, aligned - begin);
+		}
+		munmap(reinterpret_cast<void*>(aligned + length), begin + LARGE_ALLOCATION - aligned);
+		void* result = reinterpret_cast<void*>(aligned);
+		if (huge_pages) {
+			madvise(result, length, MADV_HUGEPAGE);
+		}
+		std::lock_guard<std::mutex> lock(memory_mutex);
+		large_mappings[result] = length;
+		return result;
+	}
+
+	// length of the mapping made for a large allocation, whole pages
+	static size_t mappedLength(void* addr) {
+		std::lock_guard<std::mutex> lock(memory_mutex);
+		return large_mappings.at(addr);
+	}
+
+	void* allocateLarge(size_t bytes) {
+		if (bytes < LARGE_ALLOCATION) {
+			return ::operator new(bytes);
+		}
+		MemoryPolicy policy = memoryPolicy();
+		void* addr = nullptr;
+		if (policy.huge_pages == HugePages::EXPLICIT_2M || policy.huge_pages == HugePages::EXPLICIT_1G) {
+			addr = mapHugeTlb(bytes, policy.huge_pages);
+		}
+		if (!addr) {
+			addr = mapAligned(bytes, policy.huge_pages != HugePages::OFF);
+		}
+		// before the pages are first touched, which places them. The whole mapping
+		// is covered, mbind fails on a hugetlb range ending inside a huge page
+		if (policy.numa == NumaPolicy::INTERLEAVE) {
+			interleavePages(addr, mappedLength(addr));
+		}
+		return addr;
+	}
+
+	void deallocateLarge(void* ptr, size_t bytes) {
+		if (bytes < LARGE_ALLOCATION) {
+			::operator delete(ptr);
+			return;
+		}
+		size_t length = mappedLength(ptr);
+		{
+			std::lock_guard<std::mutex> lock(memory_mutex);
+			large_mappings.erase(ptr);
+		}
+		munmap(ptr, length);
+	}
 }
 
 namespace Gz {
-	Reader::Reader(const std::string& fn) : file_name(fn) {
-		buffer = new char[buf_size];
-		if (std::filesystem::exists(file_name)) {
-			file_handler = gzopen(file_name.c_str(), "rb");
-			state = ReaderState::OK;
-		} else {
-			std::cerr << "File does not exist " << file_name << '\n';
-			file_handler = nullptr; //gzopen(file_name.c_str(), "rb");
+	static std::atomic<uint64_t> source_bytes_read{0};
+
+	uint64_t compressedBytesRead() {
+		return source_bytes_read;
+	}
+
+	std::unique_ptr<FileSource> FileSource::open(const std::string& fname) {
+		int fd = fname == STDIO_NAME ? dup(STDIN_FILENO) : ::open(fname.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return nullptr;
+		}
+		// fails harmlessly on pipes
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		return std::make_unique<FileSource>(fd);
+	}
+
+	FileSource::~FileSource() {
+		::close(fd);
+	}
+
+	size_t FileSource::next(const uint8_t*& data) {
+		ssize_t n = ::read(fd, block.data(), block.size());
+		while (n < 0 && errno == EINTR) {
+			n = ::read(fd, block.data(), block.size());
+		}
+		data = block.data();
+		return n < 0 ? 0 : n;
+	}
+
+	size_t MemorySource::next(const uint8_t*& data) {
+		size_t n = memory->size() - offset;
+		data = reinterpret_cast<const uint8_t*>(memory->data()) + offset;
+		offset += n;
+		return n;
+	}
+
+	std::unique_ptr<MappedSource> MappedSource::open(const std::string& fname) {
+		std::optional<Utils::MappedFile> file = Utils::MappedFile::open(fname);
+		if (!file) {
+			return nullptr;
+		}
+		return std::make_unique<MappedSource>(std::make_shared<const Utils::MappedFile>(std::move(*file)));
+	}
+
+	size_t MappedSource::next(const uint8_t*& data) {
+		size_t n = std::min(CHUNK_SIZE, mapped->size() - offset);
+		data = mapped->data() + offset;
+		offset += n;
+		return n;
+	}
+
+	static std::atomic<size_t> read_ahead_buffers{std::thread::hardware_concurrency() > 1 ? READ_AHEAD_BUFFERS : 0};
+
+	void setReadAheadBuffers(size_t buffer_n) {
+		read_ahead_buffers = buffer_n;
+	}
+
+	size_t readAheadBuffers() {
+		return read_ahead_buffers;
+	}
+
+	// Source and zlib state of a reader, on the heap so moving the reader
+	// leaves it, and the read ahead thread using it, in place
+	struct Reader::Decoder {
+		Decoder(std::unique_ptr<Source> src, const std::string& fname) : name(fname), source(std::move(src)) {
+			// 16 + MAX_WBITS expects a gzip header
+			if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+				std::cerr << "Can not initialize zlib for " << name << '\n';
+				source = nullptr;
+				failed = true;
+			}
+		}
+		~Decoder() {
+			inflateEnd(&stream);
+		}
+		// decodes up to size bytes into out, 0 at the end of the input
+		size_t decode(uint8_t* out, size_t size);
+
+		std::string name;
+		std::unique_ptr<Source> source;
+		z_stream stream = {};
+		// undecoded input, in the last chunk of source or in head
+		const uint8_t* in = nullptr;
+		size_t in_n = 0;
+		// the first bytes, when the gzip magic is split over two chunks
+		std::vector<uint8_t> head;
+		bool format_known = false;
+		bool compressed = false;
+		// inside a gzip member, its end is awaited
+		bool member_open = false;
+		bool input_done = false;
+		std::atomic<bool> failed{false};
+	};
+
+	size_t Reader::Decoder::decode(uint8_t* out, size_t size) {
+		if (!source || input_done) {
+			return 0;
+		}
+		if (!format_known) {
+			in_n = source->next(in);
+			if (in_n == 1) {
+				head.assign(in, in + 1);
+				const uint8_t* rest = nullptr;
+				size_t rest_n = source->next(rest);
+				head.insert(head.end(), rest, rest + rest_n);
+				in = head.data();
+				in_n = head.size();
+			}
+			source_bytes_read += in_n;
+			compressed = in_n >= 2 && in[0] == 0x1f && in[1] == 0x8b;
+			format_known = true;
+		}
+		size_t produced = 0;
+		while (produced < size) {
+			if (in_n == 0) {
+				in_n = source->next(in);
+				source_bytes_read += in_n;
+				if (in_n == 0) {
+					if (member_open) {
+						std::cerr << "Truncated gzip input " << name << '\n';
+						failed = true;
+					}
+					input_done = true;
+					break;
+				}
+			}
+			if (!compressed) {
+				size_t n = std::min(in_n, size - produced);
+				std::memcpy(out + produced, in, n);
+				in += n;
+				in_n -= n;
+				produced += n;
+				continue;
+			}
+			if (!member_open) {
+				// further gzip members are decoded too, anything else after a
+				// member is ignored like zlib's gzread does
+				if (in[0] != 0x1f) {
+					input_done = true;
+					break;
+				}
+				inflateReset(&stream);
+				member_open = true;
+			}
+			stream.next_in = const_cast<Bytef*>(in);
+			stream.avail_in = std::min<size_t>(in_n, std::numeric_limits<unsigned>::max());
+			stream.next_out = out + produced;
+			stream.avail_out = std::min<size_t>(size - produced, std::numeric_limits<unsigned>::max());
+			size_t avail_in = stream.avail_in;
+			size_t avail_out = stream.avail_out;
+			int ret = inflate(&stream, Z_NO_FLUSH);
+			in += avail_in - stream.avail_in;
+			in_n -= avail_in - stream.avail_in;
+			produced += avail_out - stream.avail_out;
+			if (ret == Z_STREAM_END) {
+				member_open = false;
+			} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+				std::cerr << "Corrupt gzip input " << name << '\n';
+				failed = true;
+				input_done = true;
+				break;
+			}
+		}
+		return produced;
+	}
+
+	// Decodes on its own thread into a ring of buffers, the reader holds one
+	// buffer at a time and hands it back when it asks for the next
+	class Reader::ReadAhead {
+		public:
+			ReadAhead(Decoder& decoder, size_t buffer_n) : buffers(buffer_n), sizes(buffer_n, 0) {
+				for (auto& ring_buffer: buffers) {
+					ring_buffer.reset(new uint8_t[READ_AHEAD_BUFFER_SIZE]);
+				}
+				thread = std::thread(&ReadAhead::run, this, std::ref(decoder));
+			}
+			~ReadAhead() {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stopping = true;
+				}
+				changed.notify_all();
+				thread.join();
+			}
+			// points data at the next decoded bytes, 0 at the end of the input
+			size_t next(const uint8_t*& data) {
+				Stats::ScopedTimer timer(Stats::Stage::READ_WAIT);
+				std::unique_lock<std::mutex> lock(mutex);
+				released = taken;
+				changed.notify_all();
+				changed.wait(lock, [this] { return produced > taken || finished; });
+				if (produced == taken) {
+					return 0;
+				}
+				size_t slot = taken++ % buffers.size();
+				data = buffers[slot].get();
+				return sizes[slot];
+			}
+		private:
+			void run(Decoder& decoder) {
+				while (true) {
+					size_t slot = 0;
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						changed.wait(lock, [this] { return stopping || produced - released < buffers.size(); });
+						if (stopping) {
+							return;
+						}
+						slot = produced % buffers.size();
+					}
+					size_t size = 0;
+					{
+						Stats::ScopedTimer timer(Stats::Stage::DECOMPRESS);
+						size = decoder.decode(buffers[slot].get(), READ_AHEAD_BUFFER_SIZE);
+					}
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						sizes[slot] = size;
+						produced++;
+						finished = size == 0;
+					}
+					changed.notify_all();
+					if (size == 0) {
+						return;
+					}
+				}
+			}
+
+			std::vector<std::unique_ptr<uint8_t[]>> buffers;
+			std::vector<size_t> sizes;
+			std::mutex mutex;
+			std::condition_variable changed;
+			// buffers filled, handed to the reader and handed back
+			size_t produced = 0;
+			size_t taken = 0;
+			size_t released = 0;
+			bool finished = false;
+			bool stopping = false;
+			std::thread thread;
+	};
+
+	Reader::Reader(std::unique_ptr<Source> src, const std::string& name)
+		: decoder(std::make_unique<Decoder>(std::move(src), name)), buffer(new uint8_t[BUFFER_SIZE]) {
+		if (decoder->failed) {
+			state = ReaderState::ERROR;
+		}
+	}
+
+	Reader::Reader(const std::string& fn) : Reader(nullptr, fn) {
+		if (state != ReaderState::OK) {
+			return;
+		}
+		if (fn != STDIO_NAME && !std::filesystem::exists(fn)) {
+			std::cerr << "File does not exist " << fn << '\n';
 			state = ReaderState::FILENOTFOUND;
+			return;
+		}
+		decoder->source = FileSource::open(fn);
+		if (!decoder->source) {
+			std::cerr << "Can not open " << fn << '\n';
+			state = ReaderState::ERROR;
 		}
 	}
 
-	Reader::Reader(const Reader& gzr) noexcept {
-		//std::cerr << "gz cptor\n";
-		last_line = gzr.last_line;
-		file_name = gzr.file_name;
-		file_handler = gzopen(file_name.c_str(), "rb");
-		buffer = new char[buf_size];
-		state = gzr.state;
+	Reader::Reader(Reader&& other) noexcept
+		: last_line(std::move(other.last_line)), decoder(std::move(other.decoder)),
+		read_ahead(std::move(other.read_ahead)), buffer(std::move(other.buffer)), data(other.data),
+		data_pos(other.data_pos), data_end(other.data_end), state(other.state) {
+		other.data = nullptr;
+		other.data_pos = 0;
+		other.data_end = 0;
 	}
 
-	Reader::Reader(Reader&& other) noexcept {
-		//std::cerr << "gz mvtor\n";
+	Reader& Reader::operator=(Reader&& other) noexcept {
+		// the thread of this reader stops before its decoder goes
+		read_ahead.reset();
 		last_line = std::move(other.last_line);
-		file_name = std::move(other.file_name);
-		file_handler = gzopen(file_name.c_str(), "rb");
-		buffer = new char[buf_size];
-		state = std::move(other.state);
+		decoder = std::move(other.decoder);
+		read_ahead = std::move(other.read_ahead);
+		buffer = std::move(other.buffer);
+		data = other.data;
+		data_pos = other.data_pos;
+		data_end = other.data_end;
+		state = other.state;
+		other.data = nullptr;
+		other.data_pos = 0;
+		other.data_end = 0;
+		return *this;
 	}
 
+	Reader::~Reader() = default;
 
-	Reader::~Reader() {
-		//std::cerr << "gz dtor\n";
-		gzclose(file_handler);
-		delete[] buffer;
+	ReaderState Reader::status() const {
+		return decoder && decoder->failed ? ReaderState::ERROR : state;
 	}
+
+	void Reader::startReadAhead(size_t buffer_n) {
+		if (buffer_n == 0 || read_ahead || !decoder || !decoder->source) {
+			return;
+		}
+		read_ahead = std::make_unique<ReadAhead>(*decoder, buffer_n);
+	}
+
+	bool Reader::fillBuffer() {
+		data_pos = 0;
+		if (read_ahead) {
+			data_end = read_ahead->next(data);
+		} else {
+			data = buffer.get();
+			data_end = decoder ? decoder->decode(buffer.get(), BUFFER_SIZE) : 0;
+		}
+		return data_end > 0;
+	}
+
 	std::string Reader::nextLine() {
-		if (state == ReaderState::FILENOTFOUND) {
-			return "";
+		std::string line;
+		readLine(line);
+		last_line = line;
+		return line;
+	}
+
+	bool Reader::readLine(std::string& line) {
+		line.clear();
+		if (!decoder) {
+			return false;
 		}
-		auto retval = gzgets(file_handler, buffer, static_cast<int>(buf_size));
-		std::string line(buffer);
-		if (buffer == NULL) {
-			std::cerr << "Failed to read\n";
-			state = ReaderState::ERROR;
+		Stats::ScopedTimer timer(Stats::Stage::DECOMPRESS);
+		bool has_newline = false;
+		while (data_pos < data_end || fillBuffer()) {
+			const uint8_t* beg = data + data_pos;
+			size_t avail = data_end - data_pos;
+			const uint8_t* newline = static_cast<const uint8_t*>(std::memchr(beg, '\n', avail));
+			size_t n = newline ? newline - beg : avail;
+			line.append(reinterpret_cast<const char*>(beg), n);
+			data_pos += n;
+			if (newline) {
+				data_pos++;
+				has_newline = true;
+				break;
+			}
 		}
-		if (retval == NULL) {
-			state = ReaderState::DONE;
-			std::string line = "";
-			return line;
-		} else {
-			while (!Utils::trimNewlineInplace(line)) {
-				retval = gzgets(file_handler, buffer, static_cast<int>(buf_size));
-				line += std::string(buffer);
+		if (!has_newline && line.empty()) {
+			if (state == ReaderState::OK) {
+				state = ReaderState::DONE;
 			}
-			Utils::trimNewlineInplace(line);
-			last_line = line;
-			return line;
+			return false;
+		}
+		Stats::add(Stats::Counter::BYTES_IN, line.size() + has_newline);
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
 		}
+		return true;
 	}
+
+	int Reader::nextChar() {
+		if (data_pos == data_end && !fillBuffer()) {
+			if (state == ReaderState::OK) {
+				state = ReaderState::DONE;
+			}
+			return -1;
+		}
+		Stats::add(Stats::Counter::BYTES_IN, 1);
+		return data[data_pos++];
+	}
+
 	std::optional<std::vector<uint8_t>> Reader::bufferedLoad(uint64_t bytes) {
-		int max_bytes = std::numeric_limits<int>::max();
-		size_t offset = 0;
-		uint64_t loaded_bytes = 0;
 		std::vector<uint8_t> bytevec(bytes, 0);
-
-		while (loaded_bytes < bytes) {
-			int buffer_size = std::min(static_cast<uint64_t>(max_bytes), bytes - loaded_bytes);
-			int gzread_output = gzread(file_handler, reinterpret_cast<char*>(bytevec.data()+offset), buffer_size);
-			if (gzread_output < 0) {
-				return  {};
-			} else {
-				loaded_bytes += buffer_size;
-				offset = loaded_bytes;
+		Stats::ScopedTimer timer(Stats::Stage::DECOMPRESS);
+		Stats::add(Stats::Counter::BYTES_IN, bytes);
+		int max_bytes = std::numeric_limits<int>::max();
+		for (uint64_t loaded_bytes = 0; loaded_bytes < bytes; ) {
+			int chunk = std::min(static_cast<uint64_t>(max_bytes), bytes - loaded_bytes);
+			if (read(bytevec.data() + loaded_bytes, chunk) != chunk) {
+				return {};
 			}
+			loaded_bytes += chunk;
 		}
 		return bytevec;
-
 	}
+
 	int Reader::read(void* buff, size_t bytes) {
-		return gzread(file_handler, reinterpret_cast<char*>(buff), bytes);
+		if (!decoder || !decoder->source) {
+			return -1;
+		}
+		bytes = std::min<size_t>(bytes, std::numeric_limits<int>::max());
+		uint8_t* out = reinterpret_cast<uint8_t*>(buff);
+		size_t done = 0;
+		while (done < bytes) {
+			if (data_pos < data_end) {
+				size_t n = std::min(bytes - done, data_end - data_pos);
+				std::memcpy(out + done, data + data_pos, n);
+				data_pos += n;
+				done += n;
+			} else if (!read_ahead && bytes - done >= BUFFER_SIZE) {
+				// large reads are decoded in place
+				size_t n = decoder->decode(out + done, bytes - done);
+				if (n == 0) {
+					break;
+				}
+				done += n;
+			} else if (!fillBuffer()) {
+				break;
+			}
+		}
+		return status() == ReaderState::ERROR ? -1 : static_cast<int>(done);
 	}
-	Writer::Writer(const std::string& fn) : file_name(fn) {
-		if (!std::filesystem::exists(file_name)) {
-			file_handler = gzopen(file_name.c_str(), "wb");
-		} else {
+
+	Format formatFromName(const std::string& fname) {
+		auto endsWith = [&fname](const std::string& suffix) {
+			return fname.size() >= suffix.size() && fname.compare(fname.size() - suffix.size(), suffix.size(), suffix) == 0;
+		};
+		if (endsWith(".bgz") || endsWith(".bgzf")) {
+			return Format::BGZF;
+		} else if (endsWith(".gz")) {
+			return Format::GZ;
+		}
+		return Format::PLAIN;
+	}
+
+	std::optional<Format> parseFormat(const std::string& name) {
+		if (name == "plain") {
+			return Format::PLAIN;
+		} else if (name == "gz") {
+			return Format::GZ;
+		} else if (name == "gz-fast") {
+			return Format::GZ_FAST;
+		} else if (name == "bgzf") {
+			return Format::BGZF;
+		}
+		return {};
+	}
+
+	// BGZF blocks hold at most 64 KiB compressed, this much input always fits
+	const size_t BGZF_BLOCK_INPUT = 0xff00;
+	const size_t BGZF_BLOCK_SIZE = 1 << 16;
+	const size_t BGZF_HEADER_SIZE = 18;
+	const size_t BGZF_FOOTER_SIZE = 8;
+	// empty block marking the end of a BGZF file
+	const uint8_t BGZF_EOF[28] = {
+		0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43, 0x02, 0, 0x1b, 0, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+	static void putLittleEndian(uint8_t* out, uint32_t value, size_t bytes) {
+		for (size_t i = 0; i < bytes; i++) {
+			out[i] = (value >> (8 * i)) & 0xff;
+		}
+	}
+
+	static bool writeAll(int fd, const uint8_t* data, size_t bytes) {
+		for (size_t written = 0; written < bytes; ) {
+			ssize_t n = ::write(fd, data + written, bytes - written);
+			if (n <= 0) {
+				return false;
+			}
+			written += n;
+		}
+		return true;
+	}
+
+	// one gzip member with the BC extra field holding the member size
+	static bool writeBgzfBlock(int fd, const char* data, size_t bytes) {
+		std::array<uint8_t, BGZF_BLOCK_SIZE> block;
+		z_stream stream;
+		std::memset(&stream, 0, sizeof(stream));
+		if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			return false;
+		}
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		stream.avail_in = bytes;
+		stream.next_out = block.data() + BGZF_HEADER_SIZE;
+		stream.avail_out = BGZF_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+		int status = deflate(&stream, Z_FINISH);
+		size_t compressed = stream.total_out;
+		deflateEnd(&stream);
+		if (status != Z_STREAM_END) {
+			return false;
+		}
+		size_t block_size = BGZF_HEADER_SIZE + compressed + BGZF_FOOTER_SIZE;
+		std::memcpy(block.data(), BGZF_EOF, BGZF_HEADER_SIZE);
+		putLittleEndian(&block[16], block_size - 1, 2);
+		uint8_t* footer = &block[BGZF_HEADER_SIZE + compressed];
+		putLittleEndian(footer, crc32(crc32(0, nullptr, 0), reinterpret_cast<const Bytef*>(data), bytes), 4);
+		putLittleEndian(footer + 4, bytes, 4);
+		return writeAll(fd, block.data(), block_size);
+	}
+
+	Writer::Writer(const std::string& fn, Format fmt) : file_name(fn), output_format(fmt) {
+		if (file_name != STDIO_NAME && std::filesystem::exists(file_name)) {
 			std::cerr << "Warning overwriting " << file_name << '\n';
-			file_handler = gzopen(file_name.c_str(), "wb");
-			//file_handler = nullptr;
 		}
+		if (output_format == Format::BGZF) {
+			fd = file_name == STDIO_NAME
+				? dup(STDOUT_FILENO)
+				: open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		} else {
+			const char* mode = output_format == Format::PLAIN ? "wbT"
+				: output_format == Format::GZ_FAST ? "wb1"
+				: "wb";
+			file_handler = file_name == STDIO_NAME
+				? gzdopen(dup(STDOUT_FILENO), mode)
+				: gzopen(file_name.c_str(), mode);
+		}
+		if (!file_handler && fd < 0) {
+			std::cerr << "Can not open " << file_name << " for writing\n";
+			has_failed = true;
+		}
+		buffer.reserve(BUFFER_SIZE + BGZF_BLOCK_INPUT);
+	}
+	Writer::Writer(Writer&& other) noexcept
+		: file_name(std::move(other.file_name)), output_format(other.output_format),
+		file_handler(other.file_handler), fd(other.fd), buffer(std::move(other.buffer)),
+		has_failed(other.has_failed) {
+		other.file_handler = nullptr;
+		other.fd = -1;
+		other.buffer.clear();
 	}
-	//Writer& Writer::operator=(Writer&& other) noexcept {
-		//this->file_name = std::move(other.file_name);
-		//this->file_handler = std::move(other.file_handler);
-		//return *this;
-	//}
 	Writer::~Writer() {
+		flush();
 		if (file_handler) {
 			gzclose(file_handler);
 		}
+		if (fd >= 0) {
+			if (!has_failed) {
+				writeAll(fd, BGZF_EOF, sizeof(BGZF_EOF));
+			}
+			close(fd);
+		}
+	}
+
+	int Writer::encode(const char* data, size_t bytes) {
+		if (has_failed) {
+			return -1;
+		}
+		Stats::ScopedTimer timer(Stats::Stage::WRITE);
+		Stats::add(Stats::Counter::BYTES_OUT, bytes);
+		if (output_format == Format::BGZF) {
+			for (size_t offset = 0; offset < bytes; offset += BGZF_BLOCK_INPUT) {
+				if (!writeBgzfBlock(fd, data + offset, std::min(BGZF_BLOCK_INPUT, bytes - offset))) {
+					has_failed = true;
+					return -1;
+				}
+			}
+			return 0;
+		}
+		size_t max_bytes = std::numeric_limits<int>::max();
+		for (size_t offset = 0; offset < bytes; ) {
+			unsigned chunk = std::min(max_bytes, bytes - offset);
+			if (gzwrite(file_handler, data + offset, chunk) <= 0) {
+				has_failed = true;
+				return -1;
+			}
+			offset += chunk;
+		}
+		return 0;
+	}
+
+	int Writer::flush() {
+		if (buffer.empty()) {
+			return has_failed ? -1 : 0;
+		}
+		int status = encode(buffer.data(), buffer.size());
+		buffer.clear();
+		return status;
 	}
 
 	int Writer::write(void* buff, size_t bytes) {
-		return gzwrite(file_handler, (char*) buff, bytes);
+		if (flush() != 0) {
+			return -1;
+		}
+		return encode(static_cast<const char*>(buff), bytes) == 0 ? bytes : -1;
 	}
 	int Writer::bufferedWrite(const std::vector<uint8_t>& data) {
-		uint64_t written_bytes = 0;
-		size_t bytes = data.size();
-		int max_bytes = std::numeric_limits<int>::max();
-		size_t offset = 0;
-
-		while (written_bytes < bytes) {
-			int buffer_size = std::min(static_cast<uint64_t>(max_bytes), bytes - written_bytes);
-			int gzwrite_output = gzwrite(file_handler, (char*) &data[offset], buffer_size*sizeof(data.at(offset)));
-			if (gzwrite_output < 0) {
-				return gzwrite_output;
-			} else {
-				written_bytes += buffer_size;
-				offset = written_bytes;
-			}
+		return bufferedWrite(data.data(), data.size());
+	}
+	int Writer::bufferedWrite(const uint8_t* data, size_t bytes) {
+		if (flush() != 0) {
+			return -1;
 		}
-		return 0;
+		return encode(reinterpret_cast<const char*>(data), bytes);
 	}
 	int Writer::writeLine(const std::string& str) {
-		std::vector<uint8_t> data(str.begin(), str.end());
-		data.push_back('\n');
-		return bufferedWrite(data);
+		append(str);
+		append('\n');
+		return has_failed ? -1 : 0;
 	}
 }
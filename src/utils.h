@@ -7,13 +7,145 @@
 #include <filesystem>
 #include <vector>
 #include <optional>
+#include <functional>
+#include <memory>
 
 namespace Utils {
 	bool trimNewlineInplace(std::string& str);
 	size_t dataSizeToBytes(std::string str);
+	// Runs task(0) .. task(task_n-1) on thread_n threads (the calling thread
+	// included). Threads pick the next unclaimed index as soon as they are
+	// done, so uneven tasks do not leave threads idle.
+	void parallelFor(size_t task_n, size_t thread_n, const std::function<void(size_t)>& task);
+
+	// connected local stream socket, -1 on failure
+	int connectUnixSocket(const std::string& path);
+
+	// Read only memory map of a whole file, unmapped on destruction
+	class MappedFile {
+		public:
+			static std::optional<MappedFile> open(const std::string& fname);
+			MappedFile(MappedFile&& other) noexcept;
+			MappedFile(const MappedFile&) = delete;
+			MappedFile& operator=(const MappedFile&) = delete;
+			~MappedFile();
+			const uint8_t* data() const { return addr; }
+			size_t size() const { return map_size; }
+		private:
+			MappedFile(const uint8_t* a, size_t s) : addr(a), map_size(s) {}
+			const uint8_t* addr = nullptr;
+			size_t map_size = 0;
+	};
+
+	enum class HugePages {
+		OFF,
+		// transparent huge pages requested with madvise
+		TRANSPARENT,
+		// hugetlbfs pages, which have to be reserved by the administrator
+		EXPLICIT_2M,
+		EXPLICIT_1G,
+	};
+	enum class NumaPolicy {
+		// pages land on the node of the thread touching them first
+		LOCAL,
+		// pages are spread round robin over all nodes
+		INTERLEAVE,
+	};
+	struct MemoryPolicy {
+		HugePages huge_pages = HugePages::TRANSPARENT;
+		NumaPolicy numa = NumaPolicy::LOCAL;
+	};
+	// applies to LargePageAllocator allocations made after the call
+	void setMemoryPolicy(const MemoryPolicy& policy);
+	MemoryPolicy memoryPolicy();
+	// off, thp, 2M or 1G
+	std::optional<HugePages> parseHugePages(const std::string& name);
+	// local or interleave
+	std::optional<NumaPolicy> parseNumaPolicy(const std::string& name);
+
+	// Allocations of at least LARGE_ALLOCATION bytes are anonymous mappings
+	// following the memory policy, smaller ones come from operator new.
+	// Explicit huge pages fall back to transparent ones when none are free.
+	const size_t LARGE_ALLOCATION = 1 << 21;
+	void* allocateLarge(size_t bytes);
+	void deallocateLarge(void* ptr, size_t bytes);
+
+	// Allocator for large, randomly accessed arrays such as filter bytes, where
+	// huge pages save most TLB misses
+	template <typename T>
+	struct LargePageAllocator {
+		using value_type = T;
+		LargePageAllocator() = default;
+		template <typename U>
+		LargePageAllocator(const LargePageAllocator<U>&) {}
+		T* allocate(size_t n) { return static_cast<T*>(allocateLarge(n * sizeof(T))); }
+		void deallocate(T* ptr, size_t n) { deallocateLarge(ptr, n * sizeof(T)); }
+	};
+	template <typename T, typename U>
+	bool operator==(const LargePageAllocator<T>&, const LargePageAllocator<U>&) { return true; }
+	template <typename T, typename U>
+	bool operator!=(const LargePageAllocator<T>&, const LargePageAllocator<U>&) { return false; }
 }
 
 namespace Gz {
+	// file name of the standard input for readers and the standard output for
+	// writers, which write uncompressed so the output can be piped on
+	const std::string STDIO_NAME = "-";
+
+	// compressed bytes consumed by all readers so far, closed ones included;
+	// safe to call from any thread
+	uint64_t compressedBytesRead();
+
+	// Bytes a Reader decodes, gzip compressed or not. Sources hand out their
+	// bytes in chunks they own, so memory and mapped sources are never copied.
+	class Source {
+		public:
+			virtual ~Source() = default;
+			// points data at the next bytes, valid until the following call; 0 at the end
+			virtual size_t next(const uint8_t*& data) = 0;
+	};
+
+	// A file or, for STDIO_NAME, the standard input, read in blocks. Files are
+	// opened with sequential access advice, so the kernel reads further ahead.
+	class FileSource : public Source {
+		public:
+			static constexpr size_t BLOCK_SIZE = 1 << 17;
+			// nullptr when the file can not be opened
+			static std::unique_ptr<FileSource> open(const std::string& fname);
+			explicit FileSource(int descriptor) : fd(descriptor), block(BLOCK_SIZE) {}
+			FileSource(const FileSource&) = delete;
+			FileSource& operator=(const FileSource&) = delete;
+			~FileSource() override;
+			size_t next(const uint8_t*& data) override;
+		private:
+			int fd;
+			std::vector<uint8_t> block;
+	};
+
+	// Bytes in memory, shared by any number of readers
+	class MemorySource : public Source {
+		public:
+			explicit MemorySource(std::shared_ptr<const std::string> bytes) : memory(std::move(bytes)) {}
+			size_t next(const uint8_t*& data) override;
+		private:
+			std::shared_ptr<const std::string> memory;
+			size_t offset = 0;
+	};
+
+	// A memory mapped file, shared by any number of readers
+	class MappedSource : public Source {
+		public:
+			// handed out in chunks so compressedBytesRead follows the progress
+			static constexpr size_t CHUNK_SIZE = 1 << 20;
+			explicit MappedSource(std::shared_ptr<const Utils::MappedFile> file) : mapped(std::move(file)) {}
+			// nullptr when the file can not be mapped, empty files included
+			static std::unique_ptr<MappedSource> open(const std::string& fname);
+			size_t next(const uint8_t*& data) override;
+		private:
+			std::shared_ptr<const Utils::MappedFile> mapped;
+			size_t offset = 0;
+	};
+
 	enum class ReaderState {
 		OK,
 		DONE,
@@ -21,42 +153,121 @@ namespace Gz {
 		FILENOTFOUND,
 	};
 
+	// Buffers decoded ahead by readers started with startReadAhead(), 0
+	// disables read ahead. READ_AHEAD_BUFFERS by default when there is more
+	// than one CPU for the decoding thread to run on, 0 otherwise.
+	const size_t READ_AHEAD_BUFFERS = 4;
+	void setReadAheadBuffers(size_t buffer_n);
+	size_t readAheadBuffers();
+
+	// Decodes gzip input, concatenated members and BGZF included, and passes
+	// other input through unchanged. A reader owns its source and decoder
+	// outright: moving one hands both over without any I/O, copies are not
+	// allowed.
 	class Reader {
 		public:
+			static constexpr size_t BUFFER_SIZE = 1 << 17;
+			static constexpr size_t READ_AHEAD_BUFFER_SIZE = 1 << 20;
 
+			// Gz::STDIO_NAME reads the standard input
 			explicit Reader(const std::string& fn);
+			// name is only used in messages
+			explicit Reader(std::unique_ptr<Source> src, const std::string& name = "");
 			Reader(Reader&& other) noexcept;
-			Reader(const Reader&) noexcept;
+			Reader& operator=(Reader&& other) noexcept;
+			Reader(const Reader&) = delete;
+			Reader& operator=(const Reader&) = delete;
 			~Reader();
 
+			// From now on a thread of the reader reads and decodes the input
+			// into a ring of buffer_n buffers while the caller works on
+			// earlier ones. Does nothing for buffer_n 0 or when already started.
+			void startReadAhead(size_t buffer_n = readAheadBuffers());
+
 			std::string nextLine();
+			// reads the next line into line without its newline, reusing the
+			// capacity of line; false at the end of the file. last_line is not set.
+			bool readLine(std::string& line);
+			int nextChar();
 			std::optional<std::vector<uint8_t>> bufferedLoad(uint64_t bytes);
+			// up to bytes decoded bytes, fewer only at the end of the input, -1 on errors
 			int read(void* buff, size_t bytes);
+			ReaderState status() const;
 			std::string last_line = "";
 
 		private:
-			Reader& operator=(const Reader&);
+			struct Decoder;
+			class ReadAhead;
+			bool fillBuffer();
 
-			const size_t buf_size = 8192;
-			std::string file_name;
-			gzFile file_handler;
-			char* buffer;
+			// the read ahead thread works on the decoder, so it is declared
+			// after it and stopped first
+			std::unique_ptr<Decoder> decoder;
+			std::unique_ptr<ReadAhead> read_ahead;
+			// decoded bytes, in buffer or in a buffer of read_ahead
+			std::unique_ptr<uint8_t[]> buffer;
+			const uint8_t* data = nullptr;
+			size_t data_pos = 0;
+			size_t data_end = 0;
 			ReaderState state = ReaderState::OK;
-
 	};
+	enum class Format {
+		PLAIN,
+		// gzip at zlib's fastest level
+		GZ_FAST,
+		GZ,
+		// blocked gzip, readable by gzip and indexable by htslib tools
+		BGZF,
+	};
+	// BGZF for .bgz and .bgzf, GZ for .gz, PLAIN for other names and the standard output
+	Format formatFromName(const std::string& fname);
+	// plain, gz, gz-fast or bgzf
+	std::optional<Format> parseFormat(const std::string& name);
+
+	// Output is collected in a buffer and handed to the encoder in large blocks,
+	// records are serialized with append() directly into it.
 	class Writer {
 		public:
-			explicit Writer(const std::string& fn);
+			static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+			explicit Writer(const std::string& fn, Format fmt = Format::GZ);
 			Writer(Writer&& other) noexcept;
-			Writer(const Writer&) noexcept;
-			//Writer& operator=(Writer&&) noexcept;
+			Writer(const Writer&) = delete;
+			Writer& operator=(const Writer&) = delete;
 			int write(void* buff, size_t bytes);
 			~Writer();
 			int bufferedWrite(const std::vector<uint8_t>& data);
+			int bufferedWrite(const uint8_t* data, size_t bytes);
 			int writeLine(const std::string& str);
+
+			void append(const char* data, size_t bytes) {
+				buffer.append(data, bytes);
+				if (buffer.size() >= BUFFER_SIZE) {
+					flush();
+				}
+			}
+			void append(const std::string& str) { append(str.data(), str.size()); }
+			void append(char c) {
+				buffer.push_back(c);
+				if (buffer.size() >= BUFFER_SIZE) {
+					flush();
+				}
+			}
+			// encodes and writes the buffered output, 0 on success
+			int flush();
+			// true after any write failed
+			bool failed() const { return has_failed; }
+			Format format() const { return output_format; }
 		private:
+			int encode(const char* data, size_t bytes);
+
 			std::string file_name;
-			gzFile file_handler;
+			Format output_format;
+			gzFile file_handler = nullptr;
+			// BGZF blocks are written to the descriptor directly
+			int fd = -1;
+			std::string buffer;
+			bool has_failed = false;
 	};
 }
 #endif
@@ -0,0 +1,143 @@
+#include "workload.h"
+#include "fastx.h"
+#include "utils.h"
+#include <algorithm>
+#include <filesystem>
+
+namespace Workload {
+	const std::string BASES = "ACGT";
+	const std::string HOST_TAXID = "9606";
+
+	std::string randomSeq(size_t size, std::mt19937_64& rng) {
+		std::string seq(size, 'A');
+		for (char& c: seq) {
+			c = BASES[rng() & 3];
+		}
+		return seq;
+	}
+
+	std::string mutateSeq(const std::string& seq, double rate, std::mt19937_64& rng) {
+		std::string result = seq;
+		if (rate <= 0.0) {
+			return result;
+		}
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		for (char& c: result) {
+			if (uniform(rng) < rate) {
+				// one of the three other bases
+				c = BASES[(BASES.find(c) + 1 + rng() % 3) & 3];
+			}
+		}
+		return result;
+	}
+
+	std::string hostGenome(const std::string& parasite, const Config& config, std::mt19937_64& rng,
+			std::vector<Dna::SeqInterval>& shared) {
+		const size_t segment_size = std::min<size_t>(5000, parasite.size());
+		size_t segment_n = segment_size == 0 ? 0 : config.shared_fraction * config.host_size / segment_size;
+		size_t random_size = config.host_size - std::min(config.host_size, segment_n * segment_size);
+		// random stretches between the segments
+		size_t gap_size = random_size / (segment_n + 1);
+		std::string host;
+		host.reserve(config.host_size);
+		for (size_t i = 0; i < segment_n; i++) {
+			host += randomSeq(gap_size, rng);
+			size_t beg = rng() % (parasite.size() - segment_size + 1);
+			host += mutateSeq(parasite.substr(beg, segment_size), config.mutation_rate, rng);
+			shared.emplace_back(beg, beg + segment_size);
+		}
+		host += randomSeq(config.host_size - std::min(config.host_size, host.size()), rng);
+		return host;
+	}
+
+	std::string kraken2Line(const std::string& contig_id, size_t beg, size_t end,
+			const std::vector<Dna::SeqInterval>& shared, size_t kmer_size) {
+		size_t contig_size = end - beg;
+		size_t kmer_n = contig_size < kmer_size ? 0 : contig_size - kmer_size + 1;
+		std::vector<bool> classified(kmer_n, false);
+		for (const Dna::SeqInterval& interval: shared) {
+			size_t first = std::max(interval.first, beg);
+			size_t last = std::min(interval.second, end);
+			for (size_t pos = first; pos + kmer_size <= last; pos++) {
+				classified[pos - beg] = true;
+			}
+		}
+		std::string kmers;
+		size_t run_beg = 0;
+		for (size_t i = 1; i <= kmer_n; i++) {
+			if (i == kmer_n || classified[i] != classified[run_beg]) {
+				kmers += kmers.empty() ? "" : " ";
+				kmers += (classified[run_beg] ? HOST_TAXID : "0") + ":" + std::to_string(i - run_beg);
+				run_beg = i;
+			}
+		}
+		if (kmers.empty()) {
+			kmers = "0:0";
+		}
+		bool is_classified = std::find(classified.begin(), classified.end(), true) != classified.end();
+		return std::string(is_classified ? "C" : "U") + '\t' + contig_id + '\t' + (is_classified ? HOST_TAXID : "0")
+			+ '\t' + std::to_string(contig_size) + '\t' + kmers;
+	}
+
+	// a read pair from a random fragment of genome, mate 2 on the reverse strand
+	static Fastq::Pair readPair(const std::string& genome, const std::string& name, const Config& config,
+			std::mt19937_64& rng) {
+		size_t fragment_size = std::min(std::max(config.insert_size, config.read_size), genome.size());
+		size_t read_size = std::min(config.read_size, fragment_size);
+		size_t beg = rng() % (genome.size() - fragment_size + 1);
+		std::string fragment = genome.substr(beg, fragment_size);
+		std::string seq1 = mutateSeq(fragment.substr(0, read_size), config.error_rate, rng);
+		std::string seq2 = mutateSeq(Dna::revcom(fragment.substr(fragment_size - read_size)), config.error_rate, rng);
+		std::string qual(read_size, 'I');
+		return Fastq::Pair(Fastq::Rec(name + "/1", seq1, qual), Fastq::Rec(name + "/2", seq2, qual));
+	}
+
+	static std::string replaceFile(const std::string& dir, const std::string& name) {
+		std::filesystem::path path = std::filesystem::path(dir) / name;
+		std::filesystem::remove(path);
+		return path.string();
+	}
+
+	Files generate(const Config& config, const std::string& dir) {
+		std::filesystem::create_directories(dir);
+		Files files;
+		files.parasite_fasta = replaceFile(dir, "parasite.fa.gz");
+		files.host_fasta = replaceFile(dir, "host.fa.gz");
+		files.kraken2 = replaceFile(dir, "parasite.k2.txt.gz");
+		files.mates1 = replaceFile(dir, "reads_1.fq.gz");
+		files.mates2 = replaceFile(dir, "reads_2.fq.gz");
+
+		std::mt19937_64 rng(config.seed);
+		std::string parasite = randomSeq(config.parasite_size, rng);
+		std::vector<Dna::SeqInterval> shared;
+		std::string host = hostGenome(parasite, config, rng, shared);
+		{
+			Gz::Writer parasite_writer(files.parasite_fasta);
+			Gz::Writer kraken2_writer(files.kraken2);
+			size_t contig_size = std::max<size_t>(1, config.contig_size);
+			for (size_t beg = 0; beg < parasite.size(); beg += contig_size) {
+				size_t end = std::min(parasite.size(), beg + contig_size);
+				std::string contig_id = "contig" + std::to_string(beg / contig_size + 1);
+				Fasta::writeRecord(parasite_writer, Fasta::Rec(contig_id, parasite.substr(beg, end - beg)));
+				kraken2_writer.writeLine(kraken2Line(contig_id, beg, end, shared));
+			}
+		}
+		{
+			Gz::Writer host_writer(files.host_fasta);
+			Fasta::writeRecord(host_writer, Fasta::Rec("host", host));
+		}
+		{
+			Gz::Writer mates1_writer(files.mates1);
+			Gz::Writer mates2_writer(files.mates2);
+			std::bernoulli_distribution from_parasite(config.parasite_fraction);
+			for (size_t i = 0; i < config.read_pair_n; i++) {
+				const std::string& source = from_parasite(rng) || host.empty() ? parasite : host;
+				if (source.empty()) {
+					break;
+				}
+				Fastq::writeRecordPair(mates1_writer, mates2_writer, readPair(source, "pair" + std::to_string(i), config, rng));
+			}
+		}
+		return files;
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include "seq.h"
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// Synthetic inputs for end to end benchmarks: a parasite genome, a host
+// genome sharing mutated copies of parasite segments, paired reads sampled
+// from both and a kraken2 classification of the parasite contigs
+namespace Workload {
+	struct Config {
+		size_t parasite_size = 2000000;
+		size_t host_size = 4000000;
+		size_t contig_size = 100000;
+		size_t read_pair_n = 200000;
+		size_t read_size = 150;
+		size_t insert_size = 400;
+		// fraction of read pairs sampled from the parasite genome
+		double parasite_fraction = 0.1;
+		// substitutions per base in the host copies of parasite segments
+		double mutation_rate = 0.01;
+		// fraction of the host made of mutated parasite segments
+		double shared_fraction = 0.05;
+		// substitutions per base in simulated reads
+		double error_rate = 0.001;
+		uint64_t seed = 1;
+	};
+
+	struct Files {
+		std::string parasite_fasta;
+		std::string host_fasta;
+		std::string kraken2;
+		std::string mates1;
+		std::string mates2;
+	};
+
+	std::string randomSeq(size_t size, std::mt19937_64& rng);
+	// copy of seq with each base substituted with probability rate
+	std::string mutateSeq(const std::string& seq, double rate, std::mt19937_64& rng);
+	// random host genome with mutated copies of parasite segments spliced in,
+	// the copied parasite intervals are appended to shared
+	std::string hostGenome(const std::string& parasite, const Config& config, std::mt19937_64& rng,
+			std::vector<Dna::SeqInterval>& shared);
+	// kraken2 output line for the contig at [beg, end) of the parasite, kmers
+	// overlapping shared intervals are classified as host
+	std::string kraken2Line(const std::string& contig_id, size_t beg, size_t end,
+			const std::vector<Dna::SeqInterval>& shared, size_t kmer_size=35);
+
+	// Writes every input into dir, existing files are replaced
+	Files generate(const Config& config, const std::string& dir);
+}
+
+#endif
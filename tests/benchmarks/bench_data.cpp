@@ -0,0 +1,69 @@
+#include "bench_data.h"
+#include "fastx.h"
+#include "utils.h"
+#include <filesystem>
+#include <map>
+#include <random>
+
+namespace BenchData {
+	std::string randomSeq(size_t size, uint64_t seed) {
+		const std::string bases = "ACGT";
+		std::mt19937_64 rng(seed);
+		std::string seq(size, 'A');
+		for (char& c: seq) {
+			c = bases[rng() & 3];
+		}
+		return seq;
+	}
+
+	static std::string tmpFile(const std::string& name) {
+		std::filesystem::path path = std::filesystem::temp_directory_path() / ("paramer_bench_" + name);
+		std::filesystem::remove(path);
+		return path.string();
+	}
+
+	const std::string& fastqFile(size_t read_n) {
+		static std::map<size_t, std::string> files;
+		auto it = files.find(read_n);
+		if (it != files.end()) {
+			return it->second;
+		}
+		std::string fname = tmpFile(std::to_string(read_n) + ".fq.gz");
+		{
+			Gz::Writer gzw(fname);
+			std::mt19937_64 rng(SEED);
+			std::string qual(READ_SIZE, 'F');
+			for (size_t i = 0; i < read_n; i++) {
+				Fastq::Rec rec("read" + std::to_string(i), randomSeq(READ_SIZE, rng()), qual);
+				Fastq::writeRecord(gzw, rec);
+			}
+		}
+		return files.emplace(read_n, fname).first->second;
+	}
+
+	const std::string& kraken2File(size_t read_n) {
+		static std::map<size_t, std::string> files;
+		auto it = files.find(read_n);
+		if (it != files.end()) {
+			return it->second;
+		}
+		std::string fname = tmpFile(std::to_string(read_n) + ".k2.txt.gz");
+		{
+			Gz::Writer gzw(fname);
+			std::mt19937_64 rng(SEED);
+			// kmers per read with the kraken2 default kmer size of 35
+			const size_t kmer_n = READ_SIZE - 35 + 1;
+			for (size_t i = 0; i < read_n; i++) {
+				size_t hit = 1 + rng() % (kmer_n - 1);
+				std::string line = "C\tread" + std::to_string(i) + "\t9606\t" + std::to_string(READ_SIZE) + "\t"
+					+ "0:" + std::to_string(kmer_n - hit) + " 9606:" + std::to_string(hit);
+				gzw.writeLine(line);
+			}
+		}
+		return files.emplace(read_n, fname).first->second;
+	}
+
+	size_t fileSize(const std::string& fname) {
+		return std::filesystem::file_size(fname);
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef BENCH_DATA_H
+#define BENCH_DATA_H
+
+#include <cstdint>
+#include <string>
+
+// Synthetic inputs for the benchmarks, generated from fixed seeds so runs are
+// comparable across commits
+namespace BenchData {
+	const uint64_t SEED = 20240601;
+	const size_t KMER_SIZE = 31;
+	const size_t WINDOW_SIZE = 35;
+	const size_t HASH_N = 3;
+	const size_t READ_SIZE = 150;
+
+	std::string randomSeq(size_t size, uint64_t seed=SEED);
+	// random reads as gzipped fastq, written once per process and reused
+	const std::string& fastqFile(size_t read_n);
+	// kraken2 output with a line per read of fastqFile, written once per process
+	const std::string& kraken2File(size_t read_n);
+	// size of the file in bytes
+	size_t fileSize(const std::string& fname);
+}
+
+#endif
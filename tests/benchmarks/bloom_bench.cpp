@@ -0,0 +1,196 @@
+#include <benchmark/benchmark.h>
+#include "bench_data.h"
+#include "bloom.h"
+#include "sliced.h"
+#include <cstdio>
+#include <map>
+#include <memory>
+
+// Filters are kept between benchmark runs, filling a large one takes longer than probing it
+static Bloom::Filter& benchFilter(uint64_t size, bool minimizers) {
+	static std::map<std::pair<uint64_t, bool>, std::unique_ptr<Bloom::Filter>> filters;
+	auto key = std::make_pair(size, minimizers);
+	auto it = filters.find(key);
+	if (it != filters.end()) {
+		return *it->second;
+	}
+	size_t window_size = minimizers ? BenchData::WINDOW_SIZE : BenchData::KMER_SIZE;
+	auto filter = std::make_unique<Bloom::Filter>(size, BenchData::KMER_SIZE, window_size, BenchData::HASH_N);
+	// a 1Mbp genome, half of the queried kmers are found
+	std::string genome = BenchData::randomSeq(1 << 20);
+	filter->addSeq(genome.substr(0, genome.size() / 2));
+	return *filters.emplace(key, std::move(filter)).first->second;
+}
+
+static std::vector<std::string> benchReads(size_t read_n) {
+	std::string genome = BenchData::randomSeq(1 << 20);
+	std::vector<std::string> reads;
+	for (size_t i = 0; i < read_n; i++) {
+		size_t pos = (i * 7919) % (genome.size() - BenchData::READ_SIZE);
+		reads.push_back(genome.substr(pos, BenchData::READ_SIZE));
+	}
+	return reads;
+}
+
+static void searchBenchmark(benchmark::State& state, bool minimizers) {
+	Bloom::Filter& filter = benchFilter(state.range(0), minimizers);
+	std::vector<std::string> reads = benchReads(1000);
+	size_t kmer_n = reads.size() * (BenchData::READ_SIZE - BenchData::KMER_SIZE + 1);
+	for (auto _: state) {
+		size_t found = 0;
+		for (const std::string& read: reads) {
+			found += minimizers ? filter.searchMinimizers(read) : filter.searchSeq(read);
+		}
+		benchmark::DoNotOptimize(found);
+	}
+	state.counters["s/kmer"] = benchmark::Counter(kmer_n, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+	state.counters["reads/s"] = benchmark::Counter(reads.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+static void BM_searchSeq(benchmark::State& state) {
+	searchBenchmark(state, false);
+}
+// fits in L2, fits in L3 on most servers, mostly cache misses
+BENCHMARK(BM_searchSeq)->Arg(1 << 18)->Arg(1 << 23)->Arg(1 << 28);
+
+static void BM_searchMinimizers(benchmark::State& state) {
+	searchBenchmark(state, true);
+}
+BENCHMARK(BM_searchMinimizers)->Arg(1 << 18)->Arg(1 << 23)->Arg(1 << 28);
+
+// the BM_searchSeq filters loaded as SparseBytes
+static void BM_searchSeqSparse(benchmark::State& state) {
+	std::string fname = "bloom_sparse_bench.blm";
+	benchFilter(state.range(0), false).write(fname, Bloom::Compression::RAW);
+	std::optional<Bloom::Filter> filter = Bloom::Filter::load(fname, true);
+	std::remove(fname.c_str());
+	std::vector<std::string> reads = benchReads(1000);
+	for (auto _: state) {
+		size_t found = 0;
+		for (const std::string& read: reads) {
+			found += filter->searchSeq(read);
+		}
+		benchmark::DoNotOptimize(found);
+	}
+	state.counters["sparse"] = filter->isSparse();
+	state.counters["reads/s"] = benchmark::Counter(reads.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_searchSeqSparse)->Arg(1 << 23)->Arg(1 << 28);
+
+// the largest BM_searchSeq filter loaded dense with Arg as Utils::HugePages
+static void BM_searchSeqHugePages(benchmark::State& state) {
+	std::string fname = "bloom_pages_bench.blm";
+	benchFilter(1 << 28, false).write(fname, Bloom::Compression::RAW);
+	Utils::MemoryPolicy previous = Utils::memoryPolicy();
+	Utils::setMemoryPolicy({static_cast<Utils::HugePages>(state.range(0)), previous.numa});
+	std::optional<Bloom::Filter> filter = Bloom::Filter::loadRaw(fname);
+	Utils::setMemoryPolicy(previous);
+	std::remove(fname.c_str());
+	std::vector<std::string> reads = benchReads(1000);
+	for (auto _: state) {
+		size_t found = 0;
+		for (const std::string& read: reads) {
+			found += filter->searchSeq(read);
+		}
+		benchmark::DoNotOptimize(found);
+	}
+	state.counters["reads/s"] = benchmark::Counter(reads.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_searchSeqHugePages)
+	->Arg(static_cast<int>(Utils::HugePages::OFF))
+	->Arg(static_cast<int>(Utils::HugePages::TRANSPARENT));
+
+// Filter::bfs is private, extendSeq runs it once per read end
+static void BM_extendSeq(benchmark::State& state) {
+	Bloom::Filter filter(1 << 20, BenchData::KMER_SIZE, BenchData::KMER_SIZE, BenchData::HASH_N);
+	std::string genome = BenchData::randomSeq(1 << 16);
+	filter.addSeq(genome);
+	std::vector<std::string> reads;
+	for (size_t pos = 1000; pos + 1000 < genome.size(); pos += 5000) {
+		reads.push_back(genome.substr(pos, BenchData::READ_SIZE));
+	}
+	size_t max_path_length = state.range(0);
+	for (auto _: state) {
+		for (const std::string& read: reads) {
+			std::vector<std::string> extended = filter.extendSeq(read, 10, max_path_length);
+			benchmark::DoNotOptimize(extended.data());
+		}
+	}
+	state.counters["reads/s"] = benchmark::Counter(reads.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_extendSeq)->Arg(100)->Arg(1000);
+
+// one filter, or one slice of the index, of SLICE_SIZE bytes per taxon, each
+// filled from its own random genome; the reads come from the first genome
+const uint64_t SLICE_SIZE = 1 << 20;
+const size_t TAXON_GENOME_SIZE = 1 << 16;
+
+static std::vector<Fastq::Pair> taxonPairs() {
+	std::string genome = BenchData::randomSeq(TAXON_GENOME_SIZE, BenchData::SEED);
+	std::vector<Fastq::Pair> pairs;
+	for (size_t pos = 0; pos + 2 * BenchData::READ_SIZE < genome.size(); pos += 997) {
+		std::string qual(BenchData::READ_SIZE, 'I');
+		pairs.emplace_back(Fastq::Rec("r", genome.substr(pos, BenchData::READ_SIZE), qual),
+				Fastq::Rec("r", genome.substr(pos + BenchData::READ_SIZE, BenchData::READ_SIZE), qual));
+	}
+	return pairs;
+}
+
+static void BM_searchTaxaFilterSet(benchmark::State& state) {
+	size_t taxa_n = state.range(0);
+	std::vector<std::unique_ptr<Bloom::Filter>> filters;
+	std::vector<Bloom::Filter*> filter_ptrs;
+	for (size_t i = 0; i < taxa_n; i++) {
+		filters.push_back(std::make_unique<Bloom::Filter>(SLICE_SIZE, BenchData::KMER_SIZE, BenchData::KMER_SIZE, BenchData::HASH_N));
+		filters.back()->addSeq(BenchData::randomSeq(TAXON_GENOME_SIZE, BenchData::SEED + i));
+		filter_ptrs.push_back(filters.back().get());
+	}
+	Bloom::FilterSet filter_set(filter_ptrs);
+	std::vector<Fastq::Pair> pairs = taxonPairs();
+	for (auto _: state) {
+		for (const Fastq::Pair& pair: pairs) {
+			benchmark::DoNotOptimize(filter_set.searchFastqPair(pair).data());
+		}
+	}
+	state.counters["pairs/s"] = benchmark::Counter(pairs.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_searchTaxaFilterSet)->Arg(1)->Arg(8)->Arg(64);
+
+static void BM_searchTaxaSliced(benchmark::State& state) {
+	size_t taxa_n = state.range(0);
+	std::vector<std::string> taxa;
+	for (size_t i = 0; i < taxa_n; i++) {
+		taxa.push_back("taxon" + std::to_string(i));
+	}
+	Bloom::SlicedIndex index(SLICE_SIZE * Bloom::BITS_IN_BYTE, taxa, BenchData::KMER_SIZE, BenchData::KMER_SIZE, BenchData::HASH_N);
+	for (size_t i = 0; i < taxa_n; i++) {
+		index.addSeq(i, BenchData::randomSeq(TAXON_GENOME_SIZE, BenchData::SEED + i));
+	}
+	std::vector<Fastq::Pair> pairs = taxonPairs();
+	for (auto _: state) {
+		for (const Fastq::Pair& pair: pairs) {
+			benchmark::DoNotOptimize(index.searchFastqPair(pair).data());
+		}
+	}
+	state.counters["pairs/s"] = benchmark::Counter(pairs.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_searchTaxaSliced)->Arg(1)->Arg(8)->Arg(64);
+
+// Arg is the Bloom::Compression of a 64MB filter written once per process
+static void BM_loadFilter(benchmark::State& state) {
+	Bloom::Compression cmpr = static_cast<Bloom::Compression>(state.range(0));
+	std::string fname = "bloom_load_bench_" + std::to_string(state.range(0)) + ".blm";
+	Bloom::Filter& filter = benchFilter(1 << 26, false);
+	filter.write(fname, cmpr);
+	for (auto _: state) {
+		std::optional<Bloom::Filter> loaded = Bloom::Filter::load(fname);
+		benchmark::DoNotOptimize(loaded->size());
+	}
+	state.SetBytesProcessed(state.iterations() * filter.size());
+	std::remove(fname.c_str());
+}
+BENCHMARK(BM_loadFilter)
+	->Arg(static_cast<int>(Bloom::Compression::RAW))
+	->Arg(static_cast<int>(Bloom::Compression::GZ))
+	->Arg(static_cast<int>(Bloom::Compression::CHUNKED))
+	->Unit(benchmark::kMillisecond);
@@ -0,0 +1,118 @@
+#include <benchmark/benchmark.h>
+#include "bench_data.h"
+#include "fastx.h"
+#include "kraken2.h"
+#include "utils.h"
+#include <cstdio>
+
+// MB/s are counted on the uncompressed input
+static void setThroughput(benchmark::State& state, size_t record_n, size_t bytes) {
+	state.counters["records/s"] = benchmark::Counter(record_n, benchmark::Counter::kIsIterationInvariantRate);
+	state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+static void BM_nextLine(benchmark::State& state) {
+	const std::string& fname = BenchData::fastqFile(state.range(0));
+	size_t line_n = 0;
+	size_t bytes = 0;
+	for (auto _: state) {
+		Gz::Reader gzr(fname);
+		line_n = 0;
+		bytes = 0;
+		for (std::string line = gzr.nextLine(); !line.empty(); line = gzr.nextLine()) {
+			line_n++;
+			bytes += line.size();
+		}
+	}
+	setThroughput(state, line_n, bytes);
+}
+BENCHMARK(BM_nextLine)->Arg(100000);
+
+static void BM_fastqNextRecord(benchmark::State& state) {
+	const std::string& fname = BenchData::fastqFile(state.range(0));
+	size_t rec_n = 0;
+	size_t bytes = 0;
+	for (auto _: state) {
+		Gz::Reader gzr(fname);
+		rec_n = 0;
+		bytes = 0;
+		while (std::optional<Fastq::Rec> rec = Fastq::nextRecord(gzr)) {
+			rec_n++;
+			bytes += rec->seq_id.size() + rec->seq.size() + rec->qual.size() + 6;
+		}
+	}
+	setThroughput(state, rec_n, bytes);
+}
+BENCHMARK(BM_fastqNextRecord)->Arg(100000);
+
+// Args are the batch size, 0 reads one optional fragment at a time, and the read ahead buffers
+static void BM_fragmentReader(benchmark::State& state) {
+	const std::string& fname = BenchData::fastqFile(100000);
+	size_t rec_n = 0;
+	size_t bytes = 0;
+	size_t default_buffers = Gz::readAheadBuffers();
+	Gz::setReadAheadBuffers(state.range(1));
+	for (auto _: state) {
+		Fastq::FragmentReader reader(Fastq::Layout::SINGLE, fname);
+		rec_n = 0;
+		bytes = 0;
+		if (state.range(0) == 0) {
+			while (std::optional<Fastq::Pair> read = reader.next()) {
+				rec_n++;
+				bytes += read->first.seq_id.size() + read->first.seq.size() + read->first.qual.size() + 6;
+			}
+			continue;
+		}
+		Fastq::FragmentBatch batch(state.range(0));
+		while (reader.nextBatch(batch)) {
+			for (const Fastq::Pair& read: batch) {
+				rec_n++;
+				bytes += read.first.seq_id.size() + read.first.seq.size() + read.first.qual.size() + 6;
+			}
+		}
+	}
+	Gz::setReadAheadBuffers(default_buffers);
+	setThroughput(state, rec_n, bytes);
+}
+// decoding moves to another thread with read ahead, so only real time compares
+BENCHMARK(BM_fragmentReader)->Args({0, 0})->Args({1024, 0})->Args({1024, Gz::READ_AHEAD_BUFFERS})->UseRealTime();
+
+static void BM_kraken2NextRecord(benchmark::State& state) {
+	const std::string& fname = BenchData::kraken2File(state.range(0));
+	size_t rec_n = 0;
+	for (auto _: state) {
+		Gz::Reader gzr(fname);
+		rec_n = 0;
+		while (std::optional<Kraken2::Rec> rec = Kraken2::nextRecord(gzr)) {
+			rec_n++;
+		}
+	}
+	state.counters["records/s"] = benchmark::Counter(rec_n, benchmark::Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_kraken2NextRecord)->Arg(100000);
+
+// Arg is the Gz::Format of the output
+static void BM_fastqWriteRecord(benchmark::State& state) {
+	Gz::Format format = static_cast<Gz::Format>(state.range(0));
+	std::vector<Fastq::Rec> recs;
+	size_t bytes = 0;
+	Gz::Reader gzr(BenchData::fastqFile(100000));
+	while (std::optional<Fastq::Rec> rec = Fastq::nextRecord(gzr)) {
+		bytes += rec->seq_id.size() + rec->seq.size() + rec->qual.size() + 6;
+		recs.push_back(std::move(*rec));
+	}
+	std::string out_fname = "fastq_write_bench.out";
+	for (auto _: state) {
+		Gz::Writer gzw(out_fname, format);
+		for (const Fastq::Rec& rec: recs) {
+			Fastq::writeRecord(gzw, rec);
+		}
+	}
+	std::remove(out_fname.c_str());
+	setThroughput(state, recs.size(), bytes);
+}
+BENCHMARK(BM_fastqWriteRecord)
+	->Arg(static_cast<int>(Gz::Format::PLAIN))
+	->Arg(static_cast<int>(Gz::Format::GZ_FAST))
+	->Arg(static_cast<int>(Gz::Format::GZ))
+	->Arg(static_cast<int>(Gz::Format::BGZF));
@@ -0,0 +1,30 @@
+#include <benchmark/benchmark.h>
+#include "bench_data.h"
+#include "seq.h"
+
+// ns per kmer is reported as the inverse rate of the kmers counter
+static benchmark::Counter kmerCounter(size_t kmer_n) {
+	return benchmark::Counter(kmer_n, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+static void BM_getHashes(benchmark::State& state) {
+	std::string seq = BenchData::randomSeq(state.range(0));
+	for (auto _: state) {
+		std::vector<uint64_t> hashes = Dna::getHashes(seq, BenchData::KMER_SIZE, BenchData::HASH_N);
+		benchmark::DoNotOptimize(hashes.data());
+	}
+	state.counters["s/kmer"] = kmerCounter(seq.size() - BenchData::KMER_SIZE + 1);
+	state.SetBytesProcessed(state.iterations() * seq.size());
+}
+BENCHMARK(BM_getHashes)->Arg(BenchData::READ_SIZE)->Arg(1 << 16);
+
+static void BM_getMinimizerHashes(benchmark::State& state) {
+	std::string seq = BenchData::randomSeq(state.range(0));
+	for (auto _: state) {
+		std::vector<uint64_t> hashes = Dna::getMinimizerHashes(seq, BenchData::KMER_SIZE, BenchData::HASH_N, BenchData::WINDOW_SIZE);
+		benchmark::DoNotOptimize(hashes.data());
+	}
+	state.counters["s/kmer"] = kmerCounter(seq.size() - BenchData::KMER_SIZE + 1);
+	state.SetBytesProcessed(state.iterations() * seq.size());
+}
+BENCHMARK(BM_getMinimizerHashes)->Arg(BenchData::READ_SIZE)->Arg(1 << 16);
@@ -0,0 +1,41 @@
+#include "doctest.h"
+#include "assembly.h"
+#include <sstream>
+#include <string>
+
+TEST_CASE("Testing Assembly::Graph paths") {
+	Assembly::Graph graph("ACGT");
+	size_t left = graph.addSegment("L1", "GG");
+	size_t right1 = graph.addSegment("R1", "TTA");
+	size_t right2 = graph.addSegment("R2", "C");
+	graph.addLink(left, Assembly::SEED_ID);
+	graph.addLink(Assembly::SEED_ID, right1);
+	graph.addLink(Assembly::SEED_ID, right2);
+	graph.addPath({left, Assembly::SEED_ID, right1});
+	graph.addPath({left, Assembly::SEED_ID, right2});
+	CHECK(graph.segments().size() == 4);
+	CHECK(graph.pathSeq(0) == "GGACGTTTA");
+	CHECK(graph.pathSeq(1) == "GGACGTC");
+	graph.filterPaths([](const std::string& seq) { return seq.size() < 8; });
+	CHECK(graph.paths().size() == 1);
+	CHECK(graph.pathSeq(0) == "GGACGTC");
+}
+
+TEST_CASE("Testing Assembly::Graph::writeGfa and Assembly::Graph::writeFasta") {
+	Assembly::Graph graph("ACGT");
+	size_t right = graph.addSegment("R1", "TTA");
+	graph.addLink(Assembly::SEED_ID, right);
+	graph.addPath({Assembly::SEED_ID, right});
+
+	std::stringstream gfa;
+	graph.writeGfa(gfa, "read1");
+	CHECK(gfa.str() ==
+			"S\tread1_seed\tACGT\n"
+			"S\tread1_R1\tTTA\n"
+			"L\tread1_seed\t+\tread1_R1\t+\t0M\n"
+			"P\tread1_path1\tread1_seed+,read1_R1+\t*\n");
+
+	std::stringstream fasta;
+	graph.writeFasta(fasta, "");
+	CHECK(fasta.str() == ">path1 len=7\nACGTTTA\n");
+}
@@ -1,7 +1,9 @@
 #include "doctest.h"
 #include "bloom.h"
 #include "bit_lookup.h"
+#include <algorithm>
 #include <cstdio>
+#include <filesystem>
 
 TEST_CASE("Test Bloom::Filter constructor") {
 	Bloom::Filter t1 = Bloom::Filter(1000, 31, 31, 3);
@@ -85,6 +87,9 @@ TEST_CASE("Test Bloom::Filter::seekSeq") {
 			std::optional<Bloom::Filter> bloom_load = Bloom::Filter::loadPointer("test_data/t1.blm");
 			size_t result = bloom_load->seekSeq(seq);
 			CHECK(result == 30);
+			// adding reads the filter in first
+			bloom_load->addSeq(seq.substr(0, 40));
+			CHECK(bloom_load->searchSeq(seq) == 30);
 			std::remove("test_data/t1.blm");
 		}
 	}
@@ -133,6 +138,88 @@ TEST_CASE("Test Bloom::Filter::searchFastqPair") {
 	}
 }
 
+TEST_CASE("Test Bloom::Filter::queryHashes and Bloom::Filter::sameHashing") {
+	std::string seq = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC";
+	Bloom::Filter bloom = Bloom::Filter(1000, 31, 31, 3);
+	bloom.addSeq(seq);
+	std::vector<uint64_t> hashes;
+	CHECK(bloom.queryHashes(seq, hashes));
+	CHECK(hashes == Dna::getHashes(seq, 31, 3));
+	CHECK(bloom.searchHashes(hashes) == bloom.searchSeq(seq));
+	CHECK(!bloom.queryHashes(seq.substr(0, 30), hashes));
+	CHECK(hashes.empty());
+	CHECK(!bloom.queryHashes("N" + seq, hashes));
+
+	CHECK(bloom.sameHashing(Bloom::Filter(2000, 31, 31, 3)));
+	CHECK(!bloom.sameHashing(Bloom::Filter(1000, 25, 25, 3)));
+	CHECK(!bloom.sameHashing(Bloom::Filter(1000, 31, 41, 3)));
+	CHECK(!bloom.sameHashing(Bloom::Filter(1000, 31, 31, 2)));
+	CHECK(!bloom.sameHashing(Bloom::Filter(1000, 31, 31, 3, Dna::HashMode::FORWARD)));
+}
+
+TEST_CASE("Test Bloom::FilterSet::searchFastqPair") {
+	Gz::Reader reader1 = Gz::Reader("test_data/test.sub.1.fq.gz");
+	Gz::Reader reader2 = Gz::Reader("test_data/test.sub.2.fq.gz");
+	std::optional<Fastq::Pair> rec_pair = Fastq::nextRecordPair(reader1, reader2);
+	std::string seq1 = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC"; //subsequence from test.sub.1.fq.gz
+	std::string seq2 = "ATTTACCGGAACAGATACGCATAAATGCGATCCTGTCCCTGTGGTTTTTATTCATATTTG"; //subsequence from test.sub.2.fq.gz
+	Bloom::Filter bloom1 = Bloom::Filter(1000, 31, 31, 3);
+	bloom1.addSeq(seq1);
+	Bloom::Filter bloom2 = Bloom::Filter(2000, 31, 31, 3);
+	bloom2.addSeq(seq2);
+	Bloom::Filter bloom3 = Bloom::Filter(1000, 25, 25, 2);
+	bloom3.addSeq(seq1 + seq2);
+	Bloom::Filter bloom4 = Bloom::Filter(1000, 21, 31, 2);
+	bloom4.addMinimizers(seq1);
+
+	Bloom::FilterSet filter_set({&bloom1, &bloom2, &bloom3, &bloom4});
+	CHECK(filter_set.size() == 4);
+	CHECK(filter_set.hashGroupN() == 3);
+	std::vector<size_t> hits = filter_set.searchFastqPair(*rec_pair);
+	REQUIRE(hits.size() == 4);
+	CHECK(hits[0] == 30);
+	CHECK(hits[1] == 30);
+	CHECK(hits[0] == bloom1.searchFastqPair(*rec_pair));
+	CHECK(hits[1] == bloom2.searchFastqPair(*rec_pair));
+	CHECK(hits[2] == bloom3.searchFastqPair(*rec_pair));
+	CHECK(hits[3] == bloom4.searchFastqPair(*rec_pair));
+}
+
+TEST_CASE("Test Bloom::FilterSet::filterFastqPairs") {
+	std::string seq1 = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC";
+	Bloom::Filter bloom1 = Bloom::Filter(1000, 31, 31, 3);
+	bloom1.addSeq(seq1);
+	Bloom::Filter bloom2 = Bloom::Filter(1000, 25, 25, 3);
+	Bloom::FilterSet filter_set({&bloom1, &bloom2});
+	std::vector<Bloom::PairCounts> counts;
+	{
+		Gz::Writer hit_matrix("test_data/hits.tsv.gz");
+		counts = filter_set.filterFastqPairs("test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz",
+				{"test_data/out.a1.fq.gz", "test_data/out.b1.fq.gz"}, {"test_data/out.a2.fq.gz", "test_data/out.b2.fq.gz"},
+				30, &hit_matrix);
+	}
+	REQUIRE(counts.size() == 2);
+	CHECK(counts[0].pairs == counts[1].pairs);
+	CHECK(counts[0].kept >= 1);
+	CHECK(counts[1].kept == 0);
+	Bloom::PairCounts single = bloom1.filterFastqPairs("test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz",
+			"test_data/out.c1.fq.gz", "test_data/out.c2.fq.gz", 30);
+	CHECK(single.pairs == counts[0].pairs);
+	CHECK(single.kept == counts[0].kept);
+
+	Gz::Reader hit_matrix("test_data/hits.tsv.gz");
+	size_t rows = 0;
+	for (std::string line = hit_matrix.nextLine(); !line.empty(); line = hit_matrix.nextLine()) {
+		CHECK(std::count(line.begin(), line.end(), '\t') == 2);
+		rows++;
+	}
+	CHECK(rows == counts[0].pairs);
+	for (const char* fname: {"test_data/hits.tsv.gz", "test_data/out.a1.fq.gz", "test_data/out.a2.fq.gz",
+			"test_data/out.b1.fq.gz", "test_data/out.b2.fq.gz", "test_data/out.c1.fq.gz", "test_data/out.c2.fq.gz"}) {
+		std::remove(fname);
+	}
+}
+
 TEST_CASE("Test Bloom::Filter::writeGz and Bloom::Filter::loadGz") {
 	Bloom::Filter t0_bloom = Bloom::Filter(1000, 31, 31, 1);
 	t0_bloom.writeGz("test_data/t0.blm");
@@ -159,6 +246,80 @@ TEST_CASE("Test Bloom::Filter::writeGz and Bloom::Filter::loadGz") {
 	CHECK(t1_bloom_load->at(999) == 255);
 }
 
+TEST_CASE("Test Bloom::Filter::writeChunked and Bloom::Filter::loadChunked") {
+	// several chunks, the middle ones all zero, and a partial last chunk
+	uint64_t size = 5 * Bloom::Filter::CHUNK_SIZE + 1000;
+	Bloom::Filter t1_bloom = Bloom::Filter(size, 31, 35, 2, Dna::HashMode::FORWARD);
+	t1_bloom.atRef(0) = 1;
+	t1_bloom.atRef(Bloom::Filter::CHUNK_SIZE - 1) = 3;
+	t1_bloom.atRef(size - 1) = 255;
+	CHECK(t1_bloom.writeChunked("test_data/t1_chunked.blm", 3) == 0);
+	CHECK(Bloom::Filter::inferCompression("test_data/t1_chunked.blm") == Bloom::Compression::CHUNKED);
+	std::optional<Bloom::Filter> t1_bloom_load = Bloom::Filter::loadChunked("test_data/t1_chunked.blm", 2);
+	REQUIRE(t1_bloom_load);
+	CHECK(t1_bloom_load->size() == size);
+	CHECK(t1_bloom_load->kmerSize() == 31);
+	CHECK(t1_bloom_load->windowSize() == 35);
+	CHECK(t1_bloom_load->hashN() == 2);
+	CHECK(t1_bloom_load->hashMode() == Dna::HashMode::FORWARD);
+	CHECK(t1_bloom_load->setBitsCount() == 11);
+	CHECK(t1_bloom_load->at(0) == 1);
+	CHECK(t1_bloom_load->at(Bloom::Filter::CHUNK_SIZE - 1) == 3);
+	CHECK(t1_bloom_load->at(size - 1) == 255);
+
+	// a truncated file is rejected
+	std::filesystem::resize_file("test_data/t1_chunked.blm", std::filesystem::file_size("test_data/t1_chunked.blm") - 4);
+	CHECK(!Bloom::Filter::loadChunked("test_data/t1_chunked.blm"));
+	std::remove("test_data/t1_chunked.blm");
+}
+
+TEST_CASE("Test Bloom::Filter::load sparse") {
+	std::string seq = "AGTGCGTCGTCGTCGTCAGAGTGAAAACGTGCGCATGACTGACTGACTGACGTACAGGAA";
+	std::string other = "TTGACCAGTAGGCATCGATCGGGCTAGCTAGGACTTTAGCGCGAATCGATCGA";
+	Bloom::Filter low_fill = Bloom::Filter(1 << 20, 31, 31, 3);
+	low_fill.addSeq(seq);
+	for (Bloom::Compression cmpr: {Bloom::Compression::RAW, Bloom::Compression::GZ, Bloom::Compression::CHUNKED}) {
+		low_fill.write("test_data/sparse.blm", cmpr);
+		std::optional<Bloom::Filter> sparse = Bloom::Filter::load("test_data/sparse.blm", true);
+		std::optional<Bloom::Filter> dense = Bloom::Filter::load("test_data/sparse.blm");
+		REQUIRE(sparse);
+		REQUIRE(dense);
+		CHECK(sparse->isSparse());
+		CHECK(!dense->isSparse());
+		CHECK(sparse->size() == low_fill.size());
+		CHECK(sparse->setBitsCount() == low_fill.setBitsCount());
+		CHECK(sparse->searchSeq(seq) == low_fill.searchSeq(seq));
+		CHECK(sparse->searchSeq(other) == low_fill.searchSeq(other));
+		// written back dense
+		sparse->write("test_data/sparse2.blm", Bloom::Compression::RAW);
+		std::optional<Bloom::Filter> rewritten = Bloom::Filter::loadRaw("test_data/sparse2.blm");
+		CHECK(rewritten->setBitsCount() == low_fill.setBitsCount());
+		// adding to a sparse filter first makes it dense
+		sparse->addSeq(other);
+		CHECK(!sparse->isSparse());
+		CHECK(sparse->searchSeq(seq) == low_fill.searchSeq(seq));
+		CHECK(sparse->searchSeq(other) == other.size() - 30);
+		std::remove("test_data/sparse.blm");
+		std::remove("test_data/sparse2.blm");
+	}
+
+	// a filter with more than SPARSE_MAX_FILL of its bits set stays dense
+	Bloom::Filter high_fill = Bloom::Filter(1 << 12, 31, 31, 3);
+	for (size_t i = 0; i < high_fill.size(); i += 64) {
+		high_fill.atRef(i) = 1;
+	}
+	high_fill.write("test_data/dense.blm", Bloom::Compression::GZ);
+	CHECK(Bloom::Filter::load("test_data/dense.blm", true)->isSparse());
+	for (size_t i = 0; i < 40; i++) {
+		high_fill.atRef(i) = 0xff;
+	}
+	high_fill.write("test_data/dense.blm", Bloom::Compression::GZ);
+	std::optional<Bloom::Filter> dense = Bloom::Filter::load("test_data/dense.blm", true);
+	std::remove("test_data/dense.blm");
+	CHECK(!dense->isSparse());
+	CHECK(dense->setBitsCount() == high_fill.setBitsCount());
+}
+
 TEST_CASE("Test Bloom::Filter::writeRaw and Bloom::Filter::loadRaw") {
 	Bloom::Filter t0_bloom = Bloom::Filter(1000, 31, 31, 1);
 	t0_bloom.writeRaw("test_data/t0.blm");
@@ -185,6 +346,69 @@ TEST_CASE("Test Bloom::Filter::writeRaw and Bloom::Filter::loadRaw") {
 	CHECK(t1_bloom_load->at(999) == 255);
 }
 
+TEST_CASE("Test Bloom::Filter::loadMmap") {
+	Bloom::Filter t1_bloom = Bloom::Filter(1000, 31, 31, 1, Dna::HashMode::FORWARD);
+	t1_bloom.atRef(0) = 1;
+	t1_bloom.atRef(10) = 4;
+	t1_bloom.atRef(999) = 255;
+	t1_bloom.writeRaw("test_data/t1.blm");
+	std::optional<Bloom::Filter> t1_bloom_map = Bloom::Filter::loadMmap("test_data/t1.blm");
+	// the mapping outlives the file name
+	std::remove("test_data/t1.blm");
+	REQUIRE(t1_bloom_map);
+	CHECK(t1_bloom_map->isMapped());
+	CHECK(t1_bloom_map->size() == 1000);
+	CHECK(t1_bloom_map->kmerSize() == 31);
+	CHECK(t1_bloom_map->hashMode() == Dna::HashMode::FORWARD);
+	CHECK(t1_bloom_map->getByteVecVal(0) == 1);
+	CHECK(t1_bloom_map->getByteVecVal(10) == 4);
+	CHECK(t1_bloom_map->getByteVecVal(999) == 255);
+	CHECK(t1_bloom_map->setBitsCount() == 10);
+
+	std::string seq = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC";
+	Bloom::Filter t2_bloom = Bloom::Filter(1000, 31, 31, 3);
+	t2_bloom.addSeq(seq);
+	t2_bloom.writeRaw("test_data/t2.blm");
+	std::optional<Bloom::Filter> t2_bloom_map = Bloom::Filter::loadMmap("test_data/t2.blm");
+	std::remove("test_data/t2.blm");
+	REQUIRE(t2_bloom_map);
+	CHECK(t2_bloom_map->searchSeq(seq) == t2_bloom.searchSeq(seq));
+	// writes go to a private copy
+	t1_bloom_map->atRef(1) = 2;
+	CHECK(!t1_bloom_map->isMapped());
+	CHECK(t1_bloom_map->getByteVecVal(1) == 2);
+	CHECK(t1_bloom_map->getByteVecVal(999) == 255);
+
+	t2_bloom.writeGz("test_data/t2.blm");
+	CHECK(!Bloom::Filter::loadMmap("test_data/t2.blm"));
+	std::remove("test_data/t2.blm");
+	CHECK(!Bloom::Filter::loadMmap("test_data/missing.blm"));
+}
+
+TEST_CASE("Test Bloom::Filter::filterFastqPairs") {
+	std::string seq = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC"; //subsequence from test.sub.1.fq.gz
+	Bloom::Filter bloom = Bloom::Filter(1000, 31, 31, 3);
+	bloom.addSeq(seq);
+	Bloom::PairCounts counts = bloom.filterFastqPairs("test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz",
+			"test_data/out.1.fq.gz", "test_data/out.2.fq.gz", 30);
+	CHECK(counts.pairs > 1);
+	CHECK(counts.kept >= 1);
+	CHECK(counts.kept < counts.pairs);
+	{
+		Gz::Reader reader1 = Gz::Reader("test_data/out.1.fq.gz");
+		Gz::Reader reader2 = Gz::Reader("test_data/out.2.fq.gz");
+		size_t written = 0;
+		for (std::optional<Fastq::Pair> rec_pair = Fastq::nextRecordPair(reader1, reader2); rec_pair;
+				rec_pair = Fastq::nextRecordPair(reader1, reader2)) {
+			CHECK(bloom.searchFastqPair(*rec_pair) >= 30);
+			written++;
+		}
+		CHECK(written == counts.kept);
+	}
+	std::remove("test_data/out.1.fq.gz");
+	std::remove("test_data/out.2.fq.gz");
+}
+
 TEST_CASE("Test Bloom::Filter::write and Bloom::Filter::load") {
 	{
 		Bloom::Compression cmpr = Bloom::Compression::RAW;
@@ -238,6 +462,61 @@ TEST_CASE("Test Bloom::Filter::write and Bloom::Filter::load") {
 		CHECK(t1_bloom_load->at(10) == 4);
 		CHECK(t1_bloom_load->at(999) == 255);
 	}
+	{
+		Bloom::Filter t1_bloom = Bloom::Filter(1000, 31, 31, 1);
+		t1_bloom.atRef(3) = 3;
+		t1_bloom.write("test_data/t1.blm", Bloom::Compression::CHUNKED);
+		std::optional<Bloom::Filter> t1_bloom_load = Bloom::Filter::load("test_data/t1.blm");
+		std::remove("test_data/t1.blm");
+		CHECK(t1_bloom_load->size() == 1000);
+		CHECK(t1_bloom_load->at(3) == 3);
+	}
+}
+
+TEST_CASE("Test Bloom::Filter hash mode") {
+	std::string seq = "AGTGCGTCGTCGTCGTCAGAGTGAAAACGTGCGCATGACTGACTGACTGACGTACAGGAA";
+	std::string seq_rc = Dna::revcom(seq);
+	{
+		Bloom::Filter bloom = Bloom::Filter(100000, 31, 31, 3, Dna::HashMode::CANONICAL);
+		bloom.addSeq(seq);
+		CHECK(bloom.searchSeq(seq) == 30);
+		CHECK(bloom.searchSeq(seq_rc) == 30);
+	}
+	{
+		Bloom::Filter bloom = Bloom::Filter(100000, 31, 31, 3, Dna::HashMode::FORWARD);
+		bloom.addSeq(seq);
+		CHECK(bloom.searchSeq(seq) == 30);
+		CHECK(bloom.searchSeq(seq_rc) == 0);
+		for (Bloom::Compression cmpr: {Bloom::Compression::RAW, Bloom::Compression::GZ}) {
+			bloom.write("test_data/t1.blm", cmpr);
+			std::optional<Bloom::Filter> bloom_load = Bloom::Filter::load("test_data/t1.blm");
+			std::remove("test_data/t1.blm");
+			CHECK(bloom_load->hashMode() == Dna::HashMode::FORWARD);
+			CHECK(bloom_load->windowSize() == 31);
+			CHECK(bloom_load->searchSeq(seq) == 30);
+			CHECK(bloom_load->searchSeq(seq_rc) == 0);
+		}
+	}
+	{
+		Bloom::Filter bloom = Bloom::Filter(1000, 31, 35, 3);
+		bloom.write("test_data/t1.blm", Bloom::Compression::GZ);
+		std::optional<Bloom::Filter> bloom_load = Bloom::Filter::load("test_data/t1.blm");
+		std::remove("test_data/t1.blm");
+		CHECK(bloom_load->hashMode() == Dna::HashMode::CANONICAL);
+		CHECK(bloom_load->windowSize() == 35);
+		CHECK(bloom_load->size() == 1000);
+	}
+}
+
+TEST_CASE("Test Bloom::Filter min entropy") {
+	std::string repeat = "CACACACACACACACACACACACACACACACACACACACA";
+	std::string seq = "AGTGCGTCGTCGTCGTCAGAGTGAAAACGTGCGCATGACTGACTGACTGACGTACAGGAA";
+	Bloom::Filter bloom = Bloom::Filter(100000, 31, 31, 3);
+	bloom.setMinEntropy(2.0);
+	bloom.addSeq(repeat);
+	bloom.addSeq(seq);
+	CHECK(bloom.searchSeq(repeat) == 0);
+	CHECK(bloom.searchSeq(seq) == 30);
 }
 
 TEST_CASE ("Test Bloom::Filter::extendSeq") {
@@ -253,6 +532,113 @@ TEST_CASE ("Test Bloom::Filter::extendSeq") {
 		CHECK(result.at(0) == t1_seq1);
 		CHECK(result.at(1) == t1_seq2);
 	}
+	for (Dna::HashMode hash_mode: {Dna::HashMode::CANONICAL, Dna::HashMode::FORWARD}) {
+		Bloom::Filter bloom = Bloom::Filter(10000, 31, 31, 3, hash_mode);
+		std::string seq = "GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCACTGACAAATTTTGGTG";
+		bloom.addSeq(seq);
+		auto result = bloom.extendSeq(seq.substr(30, 40), 10, 1000);
+		CHECK(result.size() == 1);
+		CHECK(result.at(0) == seq);
+		result = bloom.extendSeq(seq.substr(30, 40), 10, 5);
+		CHECK(result.size() == 1);
+		CHECK(result.at(0) == seq.substr(25, 50));
+	}
+
+	{
+		// the kmer at 41 is the first whose Dna::shannon is below 2.0 (1.993), with its
+		// last trinucleotide counted it would be 2.109 and the walk would reach the end
+		Bloom::Filter bloom = Bloom::Filter(10000, 31, 31, 3);
+		std::string seq = "GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCAAAACAAAACAACACCAACACAAGAAACAACTGACAACCC";
+		bloom.addSeq(seq);
+		CHECK(Dna::shannon(seq.substr(41, 31)) < 2.0);
+		auto result = bloom.extendSeq(seq.substr(0, 40), 10, 1000);
+		CHECK(result.size() == 1);
+		CHECK(result.at(0) == seq.substr(0, 72));
+		// walking left the reverse complement stops on the kmer at 9 of it
+		std::string seq_rc = Dna::revcom(seq);
+		result = bloom.extendSeq(seq_rc.substr(40, 40), 10, 1000);
+		CHECK(result.size() == 1);
+		CHECK(result.at(0) == seq_rc.substr(9));
+	}
+
+	{
+		Bloom::Filter bloom = Bloom::Filter(10000, 31, 31, 3);
+		std::string seq = "GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCACTGACAAATTTTGGTG";
+		bloom.addSeq(seq);
+		Bloom::WalkBudget budget;
+		budget.max_nodes = 6;
+		bloom.setWalkBudget(budget);
+		// the start kmer and 5 queued kmers per direction
+		auto result = bloom.extendSeq(seq.substr(30, 40), 10, 1000);
+		CHECK(result.size() == 1);
+		CHECK(result.at(0) == seq.substr(25, 50));
+		CHECK(bloom.truncationCounts().nodes == 2);
+		CHECK(bloom.truncationCounts().depth == 0);
+		result = bloom.extendSeq(seq.substr(30, 40), 10, 3);
+		CHECK(result.at(0) == seq.substr(27, 46));
+		CHECK(bloom.truncationCounts().depth == 2);
+		bloom.setWalkBudget(Bloom::WalkBudget());
+		result = bloom.extendSeq(seq.substr(30, 40), 10, 1000);
+		CHECK(result.at(0) == seq);
+		CHECK(bloom.truncationCounts().nodes == 2);
+	}
+
+	{
+		Bloom::Filter bloom = Bloom::Filter(10000, 31, 31, 3);
+		std::string seq = "GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCACTGACAAATTTTGGTG";
+		bloom.addSeq(seq);
+		Bloom::ExtensionCache cache;
+		auto result = bloom.extendSeq(seq.substr(30, 40), 10, 1000, &cache);
+		CHECK(result.size() == 1);
+		CHECK(result.at(0) == seq);
+		CHECK(cache.hits() == 0);
+		CHECK(cache.size() > 0);
+		// the right end lies on the unitig walked by the first query, the left end does not
+		result = bloom.extendSeq(seq.substr(35, 40), 10, 1000, &cache);
+		CHECK(cache.hits() == 1);
+		CHECK(result.size() == 1);
+		CHECK(result.at(0) == seq);
+		// the cached right walk passes the first kmer of this read, which a fresh walk skips
+		std::string looped = seq.substr(69, 31) + seq.substr(35, 40);
+		CHECK(bloom.extendSeq(looped, 10, 1000, &cache) == bloom.extendSeq(looped, 10, 1000));
+		CHECK(cache.hits() == 1);
+		// results of other limits are not reused
+		CHECK(bloom.extendSeq(seq.substr(30, 40), 10, 50, &cache) == bloom.extendSeq(seq.substr(30, 40), 10, 50));
+		CHECK(cache.hits() == 1);
+	}
+
+	{
+		Bloom::Filter bloom = Bloom::Filter(1000, 31, 31, 3);
+		std::string seq1 = "GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCACTGACAAATTTTGGTGTGGAAACATTTTTAAAACATTTTTTACAGATGACATATTCTCCATTGCCA";
+		std::string seq2 = "GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCACTGACAAATTTTGGTGTGGAAACATTTTTAAAGCGTTACGCGTACGATCGATCAGTCATGACTG";
+		bloom.addSeq(seq1);
+		bloom.addSeq(seq2);
+		Assembly::Graph graph = bloom.assembleSeq("ATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCACTGACAAATTTTGGTGTGGAAACATTTTTAAA", 10, 1000);
+		// one unitig to the left, the right end branches into two
+		CHECK(graph.segments().size() == 4);
+		CHECK(graph.links().size() == 3);
+		REQUIRE(graph.paths().size() == 2);
+		std::vector<std::string> paths = {graph.pathSeq(0), graph.pathSeq(1)};
+		std::sort(paths.begin(), paths.end());
+		CHECK(paths.at(0) == seq1);
+		CHECK(paths.at(1) == seq2);
+	}
+
+	{
+		Bloom::Filter bloom = Bloom::Filter(10000, 31, 31, 3);
+		std::string seq1 = "GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCACTGACAAATTTTGGTG";
+		std::string seq2 = seq1;
+		seq2[40] = 'A';
+		bloom.addSeq(seq1);
+		bloom.addSeq(seq2);
+		Assembly::Graph graph = bloom.assembleSeq(seq1.substr(0, 40), 10, 1000);
+		// a bubble: both branches of the SNP link to the unitig after it
+		REQUIRE(graph.segments().size() == 4);
+		CHECK(graph.segments()[3].seq == seq1.substr(71));
+		std::vector<std::pair<size_t, size_t>> links = graph.links();
+		std::sort(links.begin(), links.end());
+		CHECK(links == std::vector<std::pair<size_t, size_t>>{{0, 1}, {0, 2}, {1, 3}, {2, 3}});
+	}
 
 	//{
 		//Bloom::Filter bloom = Bloom::Filter(1000, 31, 31, 3);
@@ -4,6 +4,7 @@
 #include <vector>
 #include "utils.h"
 #include "fastx.h"
+#include <filesystem>
 #include <fstream>
 
 
@@ -149,3 +150,21 @@ TEST_CASE("Test Cmd::StatsFasta::run") {
 		std::remove("test_data/stats_t1.out.txt");
 	}
 }
+
+TEST_CASE("Test Cmd::Bench::run") {
+	std::vector<std::string> arg_strs = {"paramer", "bench", "-d", "test_data/bench", "--parasite-size", "20000",
+		"--host-size", "40000", "--read-pairs", "200", "--filter-size", "1M", "-o", "test_data/bench.json"};
+	std::vector<char*> args;
+	for (std::string& arg: arg_strs) {
+		args.push_back(arg.data());
+	}
+	CHECK(Cmd::Bench::run(args.size(), args.data()) == 0);
+	std::ifstream ifh("test_data/bench.json");
+	std::string json((std::istreambuf_iterator<char>(ifh)), std::istreambuf_iterator<char>());
+	for (std::string stage: {"generate", "bloom-build", "bloom-search", "mask", "extend"}) {
+		CHECK(json.find("\"name\": \"" + stage + "\"") != std::string::npos);
+	}
+	CHECK(json.find("\"status\": 1") == std::string::npos);
+	std::remove("test_data/bench.json");
+	std::filesystem::remove_all("test_data/bench");
+}
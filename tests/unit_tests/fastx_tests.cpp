@@ -1,6 +1,7 @@
 #include "doctest.h"
 #include "fastx.h"
 #include "kraken2.h"
+#include <cstdio>
 
 TEST_CASE("Testing Fasta::nextRecord") {
 	{
@@ -102,6 +103,159 @@ TEST_CASE("Testing Fastq::nextRecordPair") {
 	CHECK(last_rec->second.qual == "FFFAFAFBEFE6DDEFEFF7FE3F@D@AFD@AED>FBFDDFFBF?A0:FFFEFAFEAF90F?EBFFFFCE?EFDE8FFCFAD81ACFGBDBCF:;FE<BBA7BF4F1D3@=CBFF>FCECF/E=D-F2?F-F7F>=F99-FEF9@F=5E=");
 }
 
+TEST_CASE("Testing Fastq::FragmentReader and Fastq::FragmentWriter") {
+	std::vector<Fastq::Pair> pairs;
+	{
+		Fastq::FragmentReader reader(Fastq::Layout::PAIRED, "test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz");
+		CHECK(reader.layout() == Fastq::Layout::PAIRED);
+		for (std::optional<Fastq::Pair> pair = reader.next(); pair; pair = reader.next()) {
+			pairs.push_back(*pair);
+		}
+	}
+	REQUIRE(pairs.size() == 2500);
+	{
+		Fastq::FragmentWriter writer(Fastq::Layout::INTERLEAVED, "test_data/interleaved.fq.gz");
+		for (const Fastq::Pair& pair: pairs) {
+			writer.write(pair);
+		}
+	}
+	{
+		Fastq::FragmentReader reader(Fastq::Layout::INTERLEAVED, "test_data/interleaved.fq.gz");
+		size_t pair_n = 0;
+		for (std::optional<Fastq::Pair> pair = reader.next(); pair; pair = reader.next()) {
+			CHECK(pair->first.seq_id == pairs[pair_n].first.seq_id);
+			CHECK(pair->second.seq_id == pairs[pair_n].second.seq_id);
+			CHECK(pair->second.seq == pairs[pair_n].second.seq);
+			pair_n++;
+		}
+		CHECK(pair_n == pairs.size());
+	}
+	{
+		// single end reads have an empty mate, which is not written
+		Fastq::FragmentReader reader(Fastq::Layout::SINGLE, "test_data/interleaved.fq.gz");
+		Fastq::FragmentWriter writer(Fastq::Layout::SINGLE, "test_data/single.fq.gz");
+		size_t read_n = 0;
+		for (std::optional<Fastq::Pair> read = reader.next(); read; read = reader.next()) {
+			CHECK(read->second.seq.empty());
+			writer.write(*read);
+			read_n++;
+		}
+		CHECK(read_n == 2 * pairs.size());
+	}
+	{
+		Gz::Reader reader("test_data/single.fq.gz");
+		size_t line_n = 0;
+		while (!reader.nextLine().empty()) {
+			line_n++;
+		}
+		CHECK(line_n == 4 * 2 * pairs.size());
+	}
+	std::remove("test_data/interleaved.fq.gz");
+	std::remove("test_data/single.fq.gz");
+}
+
+TEST_CASE("Testing Fastq::FragmentReader::nextBatch") {
+	std::vector<Fastq::Pair> pairs;
+	{
+		Fastq::FragmentReader reader(Fastq::Layout::PAIRED, "test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz");
+		for (std::optional<Fastq::Pair> pair = reader.next(); pair; pair = reader.next()) {
+			pairs.push_back(*pair);
+		}
+	}
+	REQUIRE(pairs.size() == 2500);
+	Fastq::FragmentReader reader(Fastq::Layout::PAIRED, "test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz");
+	// 2500 is not a multiple of the capacity, the last batch is partial
+	Fastq::FragmentBatch batch(1000);
+	CHECK(batch.capacity() == 1000);
+	std::vector<size_t> batch_sizes;
+	size_t pair_n = 0;
+	while (reader.nextBatch(batch)) {
+		batch_sizes.push_back(batch.size());
+		for (const Fastq::Pair& pair: batch) {
+			CHECK(pair.first.seq_id == pairs[pair_n].first.seq_id);
+			CHECK(pair.first.qual == pairs[pair_n].first.qual);
+			CHECK(pair.second.seq == pairs[pair_n].second.seq);
+			pair_n++;
+		}
+	}
+	CHECK(batch_sizes == std::vector<size_t>{1000, 1000, 500});
+	CHECK(pair_n == pairs.size());
+	CHECK(batch.empty());
+	CHECK(!reader.nextBatch(batch));
+}
+
+TEST_CASE("Testing Fastq::sameFragment") {
+	CHECK(Fastq::sameFragment("V350082487L3C001R0020157281/1", "V350082487L3C001R0020157281/2"));
+	CHECK(Fastq::sameFragment("read7 1:N:0:ATCACG", "read7 2:N:0:ATCACG"));
+	CHECK(Fastq::sameFragment("read7\tlength=150", "read7/2"));
+	CHECK(Fastq::sameFragment("read7", "read7"));
+	CHECK(!Fastq::sameFragment("read7/1", "read8/2"));
+	CHECK(!Fastq::sameFragment("read7/1", "read77/2"));
+	CHECK(!Fastq::sameFragment("read7/1", ""));
+	CHECK(Fastq::parsePairCheck("resync") == Fastq::PairCheck::RESYNC);
+	CHECK(!Fastq::parsePairCheck("lenient"));
+}
+
+TEST_CASE("Testing Fastq::FragmentReader pair checks") {
+	std::vector<Fastq::Pair> pairs;
+	{
+		Fastq::FragmentReader reader(Fastq::Layout::PAIRED, "test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz");
+		for (std::optional<Fastq::Pair> pair = reader.next(); pair; pair = reader.next()) {
+			pairs.push_back(*pair);
+		}
+	}
+	REQUIRE(pairs.size() == 2500);
+	// the second mates of pairs 100 and 1000 to 1002 are missing
+	{
+		Fastq::FragmentWriter writer1(Fastq::Layout::SINGLE, "test_data/dropped.1.fq.gz");
+		Fastq::FragmentWriter writer2(Fastq::Layout::SINGLE, "test_data/dropped.2.fq.gz");
+		for (size_t i = 0; i < pairs.size(); i++) {
+			writer1.write(Fastq::Pair(pairs[i].first, Fastq::Rec()));
+			if (i != 100 && (i < 1000 || i > 1002)) {
+				writer2.write(Fastq::Pair(pairs[i].second, Fastq::Rec()));
+			}
+		}
+	}
+	auto readAll = [](Fastq::PairCheck check, size_t& mispaired) {
+		Fastq::FragmentReader reader(Fastq::Layout::PAIRED, "test_data/dropped.1.fq.gz", "test_data/dropped.2.fq.gz", check);
+		Fastq::FragmentBatch batch(64);
+		size_t pair_n = 0;
+		mispaired = 0;
+		while (reader.nextBatch(batch)) {
+			for (const Fastq::Pair& pair: batch) {
+				mispaired += !Fastq::sameFragment(pair.first.seq_id, pair.second.seq_id);
+				pair_n++;
+			}
+		}
+		return std::make_pair(pair_n, reader.pairCheckCounts());
+	};
+	size_t mispaired = 0;
+	{
+		auto [pair_n, counts] = readAll(Fastq::PairCheck::STRICT, mispaired);
+		CHECK(pair_n == 100);
+		CHECK(counts.failed);
+		CHECK(counts.mismatched == 1);
+	}
+	{
+		auto [pair_n, counts] = readAll(Fastq::PairCheck::WARN, mispaired);
+		CHECK(pair_n == 2496);
+		CHECK(mispaired == 2396);
+		CHECK(!counts.failed);
+		// the last 4 reads of the first file have no mate
+		CHECK(counts.mismatched == 2396 + 1);
+	}
+	{
+		auto [pair_n, counts] = readAll(Fastq::PairCheck::RESYNC, mispaired);
+		CHECK(pair_n == 2496);
+		CHECK(mispaired == 0);
+		CHECK(!counts.failed);
+		CHECK(counts.mismatched == 2);
+		CHECK(counts.skipped == 4);
+	}
+	std::remove("test_data/dropped.1.fq.gz");
+	std::remove("test_data/dropped.2.fq.gz");
+}
+
 TEST_CASE("testing hasing") {
 	std::string t1 = "nnaCAGCAGTAAAAGCTAAAAGAACGAATACCACaga";
 	size_t hash_n = 1;
@@ -121,3 +275,12 @@ TEST_CASE("testing hasing") {
 	CHECK(t2_hash_value == 1489897631772959496);
 
 }
+
+TEST_CASE("Testing Fasta::loadUnmaskedKmers") {
+	std::optional<robin_hood::unordered_set<uint64_t>> kmers = Fasta::loadUnmaskedKmers("test_data/test2.fa", 31);
+	REQUIRE(kmers);
+	CHECK(kmers->size() == Fasta::loadUnmaskedKmerHashes("test_data/test2.fa", 31).size());
+	Fasta::dropKmersFound("test_data/test2.fa.gz", 31, *kmers);
+	CHECK(kmers->empty());
+	CHECK(!Fasta::loadUnmaskedKmers("test_data/test2.fa", 33));
+}
@@ -37,3 +37,77 @@ TEST_CASE("Test Kraken2::nextRecord") {
 
 	}
 }
+
+TEST_CASE("Test Kraken2::IntervalStream") {
+	{
+		Gz::Reader gzreader("test_data/empty_k2.out.txt");
+		Kraken2::IntervalStream k2_stream(gzreader);
+		CHECK(!k2_stream.nextRecord());
+	}
+	{
+		Gz::Reader gzreader("test_data/t3.k2out.txt");
+		Kraken2::IntervalStream k2_stream(gzreader, 35);
+		CHECK(k2_stream.nextRecord());
+		CHECK(k2_stream.seqId() == "EVEC_scaffold0000001");
+		CHECK(k2_stream.seqSize() == 176877);
+		std::vector<Dna::SeqInterval> true_intervals = {{0, 50}, {343, 537}, {1739, 1789}, {1855, 2015}};
+		for (const auto& true_interval: true_intervals) {
+			std::optional<Dna::SeqInterval> interval = k2_stream.nextInterval();
+			CHECK(interval);
+			CHECK(*interval == true_interval);
+		}
+		CHECK(!k2_stream.nextInterval());
+
+		CHECK(k2_stream.nextRecord());
+		CHECK(k2_stream.seqId() == "EVEC_scaffold0000002");
+		CHECK(k2_stream.nextRecord());
+		CHECK(k2_stream.seqId() == "EVEC_scaffold0000003");
+		CHECK(k2_stream.nextInterval() == Dna::SeqInterval(2777, 2816));
+		CHECK(k2_stream.nextRecord());
+		CHECK(k2_stream.seqId() == "EVEC_scaffold0000004");
+		CHECK(!k2_stream.nextRecord());
+	}
+	{
+		// overlapping kmer runs are returned as a single interval
+		Gz::Reader gzreader("test_data/test2.k1.out.txt");
+		Kraken2::IntervalStream k2_stream(gzreader, 35);
+		k2_stream.nextRecord();
+		CHECK(!k2_stream.nextInterval());
+		k2_stream.nextRecord();
+		CHECK(k2_stream.nextInterval() == Dna::SeqInterval(0, 180));
+		k2_stream.nextRecord();
+		CHECK(k2_stream.nextInterval() == Dna::SeqInterval(3, 60));
+		CHECK(k2_stream.nextInterval() == Dna::SeqInterval(76, 180));
+		CHECK(!k2_stream.nextInterval());
+	}
+}
+
+TEST_CASE("Test Kraken2::IntervalMerger") {
+	Gz::Reader gzreader1("test_data/test2.k1.out.txt");
+	Gz::Reader gzreader2("test_data/test2.k2.out.txt");
+	Kraken2::IntervalStream k2_stream1(gzreader1, 35);
+	Kraken2::IntervalStream k2_stream2(gzreader2, 35);
+	std::vector<Kraken2::IntervalStream*> streams = {&k2_stream1, &k2_stream2};
+	{
+		k2_stream1.nextRecord();
+		k2_stream2.nextRecord();
+		Kraken2::IntervalMerger merger(streams);
+		CHECK(merger.nextInterval() == Dna::SeqInterval(66, 160));
+		CHECK(!merger.nextInterval());
+	}
+	{
+		k2_stream1.nextRecord();
+		k2_stream2.nextRecord();
+		Kraken2::IntervalMerger merger(streams);
+		CHECK(merger.nextInterval() == Dna::SeqInterval(0, 180));
+		CHECK(!merger.nextInterval());
+	}
+	{
+		k2_stream1.nextRecord();
+		k2_stream2.nextRecord();
+		Kraken2::IntervalMerger merger(streams);
+		CHECK(merger.nextInterval() == Dna::SeqInterval(0, 60));
+		CHECK(merger.nextInterval() == Dna::SeqInterval(76, 180));
+		CHECK(!merger.nextInterval());
+	}
+}
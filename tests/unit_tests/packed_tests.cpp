@@ -0,0 +1,94 @@
+#include "doctest.h"
+#include "packed.h"
+#include "seq.h"
+#include <string>
+
+TEST_CASE("Testing Dna::PackedSeq conversion") {
+	std::vector<std::string> seqs = {
+		"",
+		"A",
+		"acgt",
+		"ACGTNacgtn",
+		"AGTGCGTCGTCGTCGTCAGAGTGAAAACGTG",
+		"AGTGCGTCGTCGTCGTCAGAGTGAAAACGTGC",
+		"AGTGCGTCGTCGTCGTCAGAGTGAAAACGTGCG",
+		"GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCACTGACAAATTTTGGTGTGGAAACATTTTTAAAgcattttttacagatgacatattctcNNNNNNNNNNCATTGCCA"
+	};
+	for (const std::string& seq: seqs) {
+		Dna::PackedSeq packed(seq);
+		CHECK(packed.size() == seq.size());
+		CHECK(packed.toString() == seq);
+		CHECK(packed.revcom().toString() == Dna::revcom(seq));
+		CHECK(packed.revcom().revcom().toString() == seq);
+	}
+	CHECK(Dna::PackedSeq("ACGRT").toString() == "ACGNT");
+}
+
+TEST_CASE("Testing Dna::PackedSeq masking") {
+	Dna::PackedSeq packed("ACGTNACGTA");
+	CHECK(packed.isN(4));
+	CHECK(!packed.isN(3));
+	CHECK(packed.hasN(0, 5));
+	CHECK(!packed.hasN(0, 4));
+	CHECK(!packed.hasN(5, 10));
+	packed.softmask(2, 6);
+	CHECK(packed.toString() == "ACgtnaCGTA");
+	packed.unmask(3, 5);
+	CHECK(packed.toString() == "ACgTNaCGTA");
+
+	std::string long_seq(200, 'A');
+	long_seq[130] = 'N';
+	Dna::PackedSeq long_packed(long_seq);
+	CHECK(long_packed.hasN(0, 200));
+	CHECK(long_packed.hasN(100, 131));
+	CHECK(!long_packed.hasN(0, 130));
+	CHECK(!long_packed.hasN(131, 200));
+	CHECK(long_packed.bytes() < long_seq.size());
+}
+
+TEST_CASE("Testing Dna::PackedSeq::kmer") {
+	std::string seq = "GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTG";
+	Dna::PackedSeq packed(seq);
+	for (size_t kmer_size: {1, 5, 31, 32}) {
+		for (size_t pos = 0; pos + kmer_size <= seq.size(); pos++) {
+			std::string kmer = seq.substr(pos, kmer_size);
+			CHECK(packed.kmer(pos, kmer_size) == Dna::packKmer(kmer.data(), kmer_size));
+			CHECK(Dna::unpackKmer(packed.kmer(pos, kmer_size), kmer_size) == kmer);
+		}
+	}
+}
+
+TEST_CASE("Testing Dna::revcomKmer and Dna::canonicalKmer") {
+	for (std::string kmer: {"A", "ACGT", "GAACTCTTAGACGGTGCAAGCGCAGAATTTG", "GAACTCTTAGACGGTGCAAGCGCAGAATTTGA"}) {
+		std::string kmer_rc = Dna::revcom(kmer);
+		uint64_t packed = Dna::packKmer(kmer.data(), kmer.size());
+		uint64_t packed_rc = Dna::packKmer(kmer_rc.data(), kmer.size());
+		CHECK(Dna::revcomKmer(packed, kmer.size()) == packed_rc);
+		CHECK(Dna::canonicalKmer(packed, kmer.size()) == Dna::canonicalKmer(packed_rc, kmer.size()));
+		CHECK(Dna::unpackKmer(Dna::canonicalKmer(packed, kmer.size()), kmer.size()) == Dna::canonicalKmer(kmer));
+	}
+}
+
+TEST_CASE("Testing Dna::addPackedKmers") {
+	robin_hood::unordered_set<uint64_t> kmers;
+	Dna::addPackedKmers(Dna::PackedSeq("ACGTACGTNACGTA"), 4, kmers);
+	CHECK(kmers.size() == 4);
+	CHECK(kmers.count(Dna::packKmer("ACGT", 4)));
+	CHECK(kmers.count(Dna::packKmer("CGTA", 4)));
+	CHECK(kmers.count(Dna::packKmer("GTAC", 4)));
+	CHECK(kmers.count(Dna::packKmer("TACG", 4)));
+}
+
+TEST_CASE("Testing Dna::addCanonicalKmers and Dna::eraseCanonicalKmers") {
+	robin_hood::unordered_set<uint64_t> kmers;
+	Dna::addCanonicalKmers(Dna::PackedSeq("AACGNTTT"), 3, kmers);
+	CHECK(kmers.size() == 3);
+	CHECK(kmers.count(Dna::packKmer("AAC", 3)));
+	CHECK(kmers.count(Dna::packKmer("ACG", 3)));
+	CHECK(kmers.count(Dna::packKmer("AAA", 3)));
+	// reverse complement of AAACG
+	Dna::eraseCanonicalKmers(Dna::PackedSeq("CGTTT"), 3, kmers);
+	CHECK(kmers.empty());
+	Dna::addCanonicalKmers(Dna::PackedSeq(std::string(40, 'A')), 33, kmers);
+	CHECK(kmers.empty());
+}
@@ -2,7 +2,10 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 #include "seq.h"
+#include "packed.h"
+#include "ntHashIterator.hpp"
 #include <iostream>
+#include <cmath>
 
 TEST_CASE("Testing Dna::revcom") {
 	CHECK(Dna::revcom("") == "");
@@ -165,6 +168,65 @@ TEST_CASE("Testing Dna::getHashes") {
 	CHECK(t1_hashes[0] == t1_hashes_rc[0]);
 }
 
+TEST_CASE("Testing Dna::KmerHasher") {
+	{
+		std::string t1 = "nnaCAGCAGTAAAAGCTAAAAGAACGAATACCACagaNNAGTGCGTCGTCGTCGTCAGAGTGAAAACGTGCGCATGA";
+		size_t hash_n = 3;
+		size_t kmer_size = 31;
+		ntHashIterator itr(t1, hash_n, kmer_size);
+		Dna::KmerHasher hasher(t1, kmer_size, hash_n);
+		size_t kmer_count = 0;
+		while (itr != itr.end()) {
+			CHECK(hasher.next());
+			CHECK(hasher.pos() == itr.pos());
+			for (size_t i = 0; i < hash_n; i++) {
+				CHECK(hasher.hashes()[i] == (*itr)[i]);
+			}
+			kmer_count++;
+			++itr;
+		}
+		CHECK(!hasher.next());
+		CHECK(kmer_count == 13);
+	}
+	{
+		std::string t1 = "AGTGCGTCGTCGTCGTCAGAGTGAAAACGTGCG";
+		std::string t1_rc = Dna::revcom(t1);
+		std::vector<uint64_t> fwd = Dna::getHashes(t1, 31, 2, Dna::HashMode::FORWARD);
+		std::vector<uint64_t> fwd_rc = Dna::getHashes(t1_rc, 31, 2, Dna::HashMode::FORWARD);
+		std::vector<uint64_t> cnc = Dna::getHashes(t1, 31, 2, Dna::HashMode::CANONICAL);
+		std::vector<uint64_t> cnc_rc = Dna::getHashes(t1_rc, 31, 2, Dna::HashMode::CANONICAL);
+		CHECK(fwd.size() == 6);
+		CHECK(fwd[0] != fwd_rc[4]);
+		CHECK(cnc[0] == cnc_rc[4]);
+		CHECK(cnc[1] == cnc_rc[5]);
+		CHECK(cnc[4] == cnc_rc[0]);
+	}
+	{
+		Dna::KmerHasher hasher("ACGNACG", 5, 1);
+		CHECK(!hasher.next());
+	}
+}
+
+TEST_CASE("Testing Dna::containsKmersOf") {
+	std::string seq = "GAACTCTTAGACGGTGCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTG";
+	std::string query = "GCAAGCGCAGAATTTGACATGGATCTTGTATCAAAGG";
+	CHECK(Dna::containsKmersOf(seq, query, 31));
+	CHECK(Dna::containsKmersOf(seq, Dna::revcom(query), 31));
+	CHECK(!Dna::containsKmersOf(seq, "GCAAGCGCAGAATTTGACATGGATCTTGTATCAATTT", 31));
+	CHECK(Dna::containsKmersOf(seq, "GCAAGCG", 31));
+	CHECK(!Dna::containsKmersOf(seq, "GCAAGCT", 31));
+	CHECK(Dna::containsKmersOf(seq, Dna::revcom("GCAAGCG"), 31));
+	// first kmer and last kmer found but on different strands
+	std::string first_kmer = query.substr(0, 31);
+	std::string last_kmer = query.substr(query.size() - 31);
+	CHECK(!Dna::containsKmersOf(first_kmer + "ACGTACGT" + Dna::revcom(last_kmer), query, 31));
+	// both on the same strand but not at the distance they have in query
+	CHECK(!Dna::containsKmersOf(first_kmer + "A" + last_kmer, query, 31));
+	CHECK(!Dna::containsKmersOf(last_kmer + first_kmer, query, 31));
+	CHECK(Dna::containsKmersOf(first_kmer.substr(0, 6) + last_kmer, query, 31));
+	CHECK(Dna::containsKmersOf(Dna::revcom(first_kmer.substr(0, 6) + last_kmer), query, 31));
+}
+
 TEST_CASE("Testing Dna::getMinimizerHashes") {
 	//std::vector<uint64_t> hashes = {2129312363048739376, 9967842831092148701, 4304134488848462692, 5819929052895302100, 12220444832806783367, 10118878782716752413, 6763474896827383532, 12220444832806783367, 10118878782716752413, 6763474896827383532, 12220444832806783367, 10118878782716752413, 6763474896827383532, 2737971792425662502, 11230458238545705290, 10883788240495922400, 2634314553780154417, 5922399782513233315, 1525707548702619386, 1194839728021048584, 5851829680807274824, 2555383599579742470, 1842717004517856612, 10829959314427631260, 11374462795461361796, 9484111255990750150, 5917157688684197953};
    
@@ -291,6 +353,49 @@ TEST_CASE("Testing Dna::shannon") {
 	CHECK(std::abs(Dna::shannon("GTCTGTCTGGTAGCTTACGATTTCCCGTGGT") - 3.0599691653497123) < 0.000001 );
 }
 
+TEST_CASE("Testing Dna::EntropyTracker") {
+	Dna::EntropyTracker empty;
+	CHECK(empty.entropy() == 0.0);
+
+	std::string seq = "GTCTGTCTGGTAGCTTACGATTTCCCGTGGTAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA";
+	size_t window = 20;
+	Dna::EntropyTracker rolling;
+	rolling.add(seq.data(), window);
+	CHECK(rolling.kmerCount() == window - 2);
+	for (size_t pos = 1; pos + window <= seq.size(); pos++) {
+		rolling.removeKmer(seq.data() + pos - 1);
+		rolling.addKmer(seq.data() + pos + window - 3);
+		Dna::EntropyTracker fresh;
+		fresh.add(seq.data() + pos, window);
+		CHECK(std::abs(rolling.entropy() - fresh.entropy()) < 0.000001);
+	}
+	CHECK(rolling.entropy() == 0.0);
+
+	Dna::EntropyTracker uniform;
+	uniform.add("ACGTNAGG", 8);
+	CHECK(uniform.kmerCount() == 3);
+	CHECK(std::abs(uniform.entropy() - std::log(3)) < 0.000001);
+
+	// packed kmers shifted a base at a time, both ways
+	size_t k = 31;
+	uint64_t kmer = Dna::packKmer(seq.data(), k);
+	double log_sum = Dna::EntropyTracker::packedLogSum(kmer, k);
+	CHECK(Dna::EntropyTracker::packedCount(kmer, k, 0) == 0);
+	CHECK(Dna::EntropyTracker::packedCount(kmer, k, (3 << 4) | (1 << 2) | 3) == 2);
+	CHECK(std::abs(Dna::EntropyTracker::packedEntropy(log_sum, k) - Dna::shannon(seq.substr(0, k))) < 0.000001);
+	for (size_t pos = 1; pos + k <= seq.size(); pos++) {
+		uint64_t next = Dna::packKmer(seq.data() + pos, k);
+		// right, the first trinucleotide leaves and the last one of kmer enters
+		log_sum = Dna::EntropyTracker::shiftLogSum(log_sum, kmer, k, kmer >> 2*(k-3), kmer);
+		CHECK(std::abs(Dna::EntropyTracker::packedEntropy(log_sum, k) - Dna::shannon(seq.substr(pos, k))) < 0.000001);
+		// left, the one before the last base leaves and the first one of kmer enters
+		double back = Dna::EntropyTracker::shiftLogSum(log_sum, next, k, next >> 2, kmer >> 2*(k-3));
+		CHECK(std::abs(back - Dna::EntropyTracker::packedLogSum(kmer, k)) < 0.000001);
+		kmer = next;
+	}
+	CHECK(std::abs(Dna::EntropyTracker::packedEntropy(log_sum, k) - Dna::shannon(std::string(k, 'A'))) < 0.000001);
+}
+
 TEST_CASE("Test Dna::maskingStats") {
 	{
 		std::string test_case = "";
@@ -342,3 +447,29 @@ TEST_CASE("Test Dna::maskingStats") {
 		CHECK(res.hardmasked == 2);
 	}
 }
+
+TEST_CASE("Testing Dna::softmaskNotInKmers") {
+	std::string ref = "CCGATGCATCGATCGCCGACGACCACCCNCCCCCCCATGCATGATTCGACTGAG";
+	std::string target = "ttCCGATGCATCGATCGCCGAGGACCACCCNCCCCCCCATGCATGATTCGACTGAGACGT";
+	size_t kmer_size = 7;
+	robin_hood::unordered_set<uint64_t> kmers;
+	robin_hood::unordered_set<uint64_t> kmer_hashes;
+	for (const Dna::SeqInterval& interval: Dna::nonmaskedRegions(target)) {
+		Dna::addCanonicalKmers(Dna::PackedSeq(target.data() + interval.first, interval.second - interval.first), kmer_size, kmers);
+	}
+	Dna::KmerHasher hasher(target, kmer_size, 1);
+	while (hasher.next()) {
+		kmer_hashes.insert(hasher.hashes()[0]);
+	}
+	Dna::eraseCanonicalKmers(Dna::PackedSeq(Dna::revcom(ref)), kmer_size, kmers);
+	Dna::KmerHasher ref_hasher(ref, kmer_size, 1);
+	while (ref_hasher.next()) {
+		kmer_hashes.erase(ref_hasher.hashes()[0]);
+	}
+	std::string packed_masked = target;
+	std::string hash_masked = target;
+	Dna::softmaskNotInKmers(packed_masked, kmers, kmer_size);
+	Dna::softmaskNotInKmerHashes(hash_masked, kmer_hashes, kmer_size);
+	CHECK(packed_masked == hash_masked);
+	CHECK(packed_masked == "ttccgatgcatcgatcgccgaGgaccacccNcccccccatgcatgattcgactgagACGT");
+}
@@ -0,0 +1,102 @@
+#include "doctest.h"
+#include "server.h"
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+static Server::Filters testFilters(const std::string& seq) {
+	Server::Filters filters;
+	Bloom::Filter bloom = Bloom::Filter(1000, 31, 31, 3);
+	bloom.addSeq(seq);
+	filters.emplace("t1", std::move(bloom));
+	return filters;
+}
+
+TEST_CASE("Test Server::Session::handleLine") {
+	std::string seq = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC"; //subsequence from test.sub.1.fq.gz
+	Server::Filters filters = testFilters(seq);
+	{
+		Server::Session session(filters);
+		CHECK(session.handleLine("LIST") == "OK 1\nt1 31 31 1000\n\n");
+		CHECK(session.handleLine("") == "ERR empty request\n");
+		CHECK(session.handleLine("PING") == "ERR unknown request PING\n");
+		CHECK(!session.closed());
+		CHECK(session.handleLine("QUIT") == "OK\n");
+		CHECK(session.closed());
+		CHECK(!session.shutdownRequested());
+	}
+	{
+		Server::Session session(filters);
+		CHECK(session.handleLine("COUNT t2") == "ERR unknown filter t2\n");
+		CHECK(session.handleLine("COUNT") == "ERR usage: COUNT <filter>\n");
+		CHECK(session.handleLine("COUNT t1") == "OK\n");
+		CHECK(session.handleLine(seq) == "30\n");
+		// request words are counted as sequences until the block ends
+		CHECK(session.handleLine("LIST") == "0\n");
+		CHECK(session.handleLine("") == "\n");
+		CHECK(session.handleLine("SHUTDOWN") == "OK\n");
+		CHECK(session.shutdownRequested());
+	}
+	{
+		Server::Session session(filters);
+		CHECK(session.handleLine("FILTER t1 30") == "ERR usage: FILTER <filter> <mincount> <mates1> <mates2> <out1> <out2>\n");
+		CHECK(session.handleLine("FILTER t1 x a b c d") == "ERR invalid mincount x\n");
+		CHECK(session.handleLine("FILTER t1 30 test_data/missing.fq.gz test_data/test.sub.2.fq.gz c d")
+				== "ERR can not read test_data/missing.fq.gz\n");
+		std::string response = session.handleLine(
+				"FILTER t1 30 test_data/test.sub.1.fq.gz test_data/test.sub.2.fq.gz test_data/out.1.fq.gz test_data/out.2.fq.gz");
+		std::remove("test_data/out.1.fq.gz");
+		std::remove("test_data/out.2.fq.gz");
+		Bloom::PairCounts counts = filters.at("t1").filterFastqPairs("test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz",
+				"test_data/out.1.fq.gz", "test_data/out.2.fq.gz", 30);
+		std::remove("test_data/out.1.fq.gz");
+		std::remove("test_data/out.2.fq.gz");
+		CHECK(response == "OK " + std::to_string(counts.pairs) + ' ' + std::to_string(counts.kept) + '\n');
+	}
+	{
+		// the second mates start one read late
+		{
+			Fastq::FragmentReader reader(Fastq::Layout::SINGLE, "test_data/test.sub.2.fq.gz");
+			Fastq::FragmentWriter writer(Fastq::Layout::SINGLE, "test_data/shifted.2.fq.gz");
+			reader.next();
+			for (std::optional<Fastq::Pair> read = reader.next(); read; read = reader.next()) {
+				writer.write(*read);
+			}
+		}
+		std::string request = "FILTER t1 30 test_data/test.sub.1.fq.gz test_data/shifted.2.fq.gz test_data/out.1.fq.gz test_data/out.2.fq.gz";
+		Server::Session strict(filters);
+		CHECK(strict.handleLine(request) == "ERR mates of test_data/test.sub.1.fq.gz and test_data/shifted.2.fq.gz "
+				"name different fragments after pair 0, the output is incomplete\n");
+		Server::Session resync(filters, Fastq::PairCheck::RESYNC);
+		CHECK(resync.handleLine(request).compare(0, 3, "OK ") == 0);
+		std::remove("test_data/shifted.2.fq.gz");
+		std::remove("test_data/out.1.fq.gz");
+		std::remove("test_data/out.2.fq.gz");
+	}
+}
+
+TEST_CASE("Test Server::serve and Server::exchange") {
+	std::string seq = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC";
+	Server::Filters filters = testFilters(seq);
+	std::string socket_path = "test_data/server_test.sock";
+	CHECK(!Server::exchange(socket_path, "LIST\n"));
+
+	std::thread server([&]() { Server::serve(socket_path, filters); });
+	std::optional<std::string> response;
+	for (int attempt = 0; attempt < 100 && !response; attempt++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		response = Server::exchange(socket_path, "COUNT t1\n" + seq + "\n\n");
+	}
+	CHECK(response == "OK\n30\n\nOK\n");
+	namespace fs = std::filesystem;
+	CHECK(fs::status(socket_path).permissions() == (fs::perms::owner_read | fs::perms::owner_write));
+	// connections come and go without the server keeping their threads
+	size_t listed = 0;
+	for (int connection = 0; connection < 50; connection++) {
+		listed += Server::exchange(socket_path, "LIST\n") == "OK 1\nt1 31 31 1000\n\nOK\n";
+	}
+	CHECK(listed == 50);
+	CHECK(Server::exchange(socket_path, "SHUTDOWN\n") == "OK\nOK\n");
+	server.join();
+	CHECK(!std::filesystem::exists(socket_path));
+}
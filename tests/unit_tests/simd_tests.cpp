@@ -0,0 +1,76 @@
+#include "doctest.h"
+#include "simd.h"
+#include <random>
+#include <string>
+#include <vector>
+
+std::vector<std::string> simdTestSeqs() {
+	std::vector<std::string> seqs = {"", "A", "acgtnACGTN", "ACGTRYKMacgtrykm-.*NNnn"};
+	std::mt19937 gen(42);
+	std::string alphabet = "ACGTNacgtnRYKMrykm-*.";
+	std::uniform_int_distribution<size_t> pick(0, alphabet.size()-1);
+	for (size_t size: {15, 16, 17, 31, 32, 33, 63, 64, 65, 200, 1027}) {
+		std::string seq(size, 'A');
+		for (char& c: seq) {
+			c = alphabet[pick(gen)];
+		}
+		seqs.push_back(seq);
+		// long runs so mask toggles land in the middle of vector blocks
+		seqs.push_back(std::string(size, 'A') + std::string(size/2 + 1, 'n') + std::string(size, 'C'));
+	}
+	return seqs;
+}
+
+TEST_CASE("Testing Simd kernels against scalar") {
+	const Simd::Kernels& scalar = Simd::kernels(Simd::Level::SCALAR);
+	for (Simd::Level level: {Simd::Level::SSSE3, Simd::Level::AVX2}) {
+		if (!Simd::isSupported(level)) {
+			continue;
+		}
+		const Simd::Kernels& vec = Simd::kernels(level);
+		for (const std::string& seq: simdTestSeqs()) {
+			std::string expected(seq.size(), 'N');
+			std::string result(seq.size(), 'N');
+			scalar.revcom(seq.data(), &expected[0], seq.size());
+			vec.revcom(seq.data(), &result[0], seq.size());
+			CHECK(result == expected);
+
+			expected = seq;
+			result = seq;
+			scalar.softmask(&expected[0], seq.size());
+			vec.softmask(&result[0], seq.size());
+			CHECK(result == expected);
+
+			expected = seq;
+			result = seq;
+			scalar.unmask(&expected[0], seq.size());
+			vec.unmask(&result[0], seq.size());
+			CHECK(result == expected);
+
+			for (bool masked: {false, true}) {
+				for (size_t beg = 0; beg < seq.size(); beg += 7) {
+					CHECK(vec.findMaskToggle(seq.data() + beg, seq.size() - beg, masked)
+							== scalar.findMaskToggle(seq.data() + beg, seq.size() - beg, masked));
+				}
+			}
+
+			Simd::MaskCounts expected_counts = scalar.countMasked(seq.data(), seq.size());
+			Simd::MaskCounts counts = vec.countMasked(seq.data(), seq.size());
+			CHECK(counts.softmasked == expected_counts.softmasked);
+			CHECK(counts.hardmasked == expected_counts.hardmasked);
+		}
+	}
+}
+
+TEST_CASE("Testing Simd scalar kernels") {
+	const Simd::Kernels& scalar = Simd::kernels(Simd::Level::SCALAR);
+	std::string seq = "ACGTacgtNnRY";
+	std::string rc(seq.size(), ' ');
+	scalar.revcom(seq.data(), &rc[0], seq.size());
+	CHECK(rc == "YRnNacgtACGT");
+	CHECK(scalar.findMaskToggle(seq.data(), seq.size(), false) == 4);
+	CHECK(scalar.findMaskToggle(seq.data() + 4, seq.size() - 4, true) == 6);
+	Simd::MaskCounts counts = scalar.countMasked(seq.data(), seq.size());
+	CHECK(counts.softmasked == 4);
+	CHECK(counts.hardmasked == 2);
+}
@@ -0,0 +1,125 @@
+#include "doctest.h"
+#include "sliced.h"
+#include <cstdio>
+#include <filesystem>
+
+TEST_CASE("Test Bloom::SlicedIndex constructor") {
+	Bloom::SlicedIndex t1 = Bloom::SlicedIndex(8000, {"a", "b", "c"}, 31, 31, 3);
+	CHECK(t1.positions() == 8000);
+	CHECK(t1.loadsPerPosition() == 1);
+	CHECK(t1.bytes() == 3000);
+	CHECK(t1.taxa().size() == 3);
+	CHECK(t1.kmerSize() == 31);
+	CHECK(t1.hashN() == 3);
+	CHECK(t1.setBitsCount(0) == 0);
+
+	std::vector<std::string> taxa(65, "t");
+	CHECK(Bloom::SlicedIndex(8000, taxa, 31, 31, 3).loadsPerPosition() == 2);
+	CHECK(Bloom::SlicedIndex(8000, taxa, 31, 31, 3).bytes() == 65000);
+}
+
+TEST_CASE("Test Bloom::SlicedIndex::searchSeq") {
+	std::string seq1 = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC";
+	std::string seq2 = "ATTTACCGGAACAGATACGCATAAATGCGATCCTGTCCCTGTGGTTTTTATTCATATTTG";
+	// taxa across two loads per position, rows of 70 bits start anywhere in a byte
+	std::vector<std::string> taxa(70, "t");
+	Bloom::SlicedIndex index = Bloom::SlicedIndex(8000, taxa, 31, 31, 3);
+	index.addSeq(0, seq1);
+	index.addSeq(56, seq1);
+	index.addSeq(66, seq1);
+	index.addSeq(1, seq2);
+	std::vector<size_t> hits(taxa.size(), 0);
+	index.searchSeq(seq1, hits);
+	CHECK(hits[0] == 30);
+	CHECK(hits[56] == 30);
+	CHECK(hits[66] == 30);
+	CHECK(hits[1] < 30);
+	CHECK(hits[2] == 0);
+	// hits add up over calls
+	index.searchSeq(seq2, hits);
+	CHECK(hits[1] == 30);
+	CHECK(hits[0] >= 30);
+
+	// a taxon slice answers like a Bloom::Filter of the same size
+	Bloom::Filter bloom = Bloom::Filter(1000, 31, 31, 3);
+	bloom.addSeq(seq1);
+	Bloom::SlicedIndex one_taxon = Bloom::SlicedIndex(8000, {"a"}, 31, 31, 3);
+	one_taxon.addSeq(0, seq1);
+	CHECK(one_taxon.setBitsCount(0) == bloom.setBitsCount());
+	std::vector<size_t> one_hits(1, 0);
+	one_taxon.searchSeq(seq2, one_hits);
+	CHECK(one_hits[0] == bloom.searchSeq(seq2));
+	one_taxon.searchSeq("NNNN" + seq1, one_hits);
+	CHECK(one_hits[0] == bloom.searchSeq(seq2));
+}
+
+TEST_CASE("Test Bloom::SlicedIndex::filterFastqPairs") {
+	std::string seq1 = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC"; //subsequence from test.sub.1.fq.gz
+	Bloom::SlicedIndex index = Bloom::SlicedIndex(8000, {"a", "b"}, 31, 31, 3);
+	index.addSeq(0, seq1);
+	std::vector<Bloom::PairCounts> counts;
+	{
+		Gz::Writer hit_matrix("test_data/hits.tsv.gz");
+		counts = index.filterFastqPairs("test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz",
+				"test_data/out.1.fq.gz", "test_data/out.2.fq.gz", 30, &hit_matrix);
+	}
+	REQUIRE(counts.size() == 2);
+	CHECK(counts[0].kept >= 1);
+	CHECK(counts[1].kept == 0);
+
+	Bloom::Filter bloom = Bloom::Filter(1000, 31, 31, 3);
+	bloom.addSeq(seq1);
+	Bloom::PairCounts single = bloom.filterFastqPairs("test_data/test.sub.1.fq.gz", "test_data/test.sub.2.fq.gz",
+			"test_data/out.3.fq.gz", "test_data/out.4.fq.gz", 30);
+	CHECK(single.pairs == counts[0].pairs);
+	CHECK(single.kept == counts[0].kept);
+	CHECK(!counts[0].pair_check_failed);
+	// the second file ends after two reads
+	std::vector<Bloom::PairCounts> unpaired = index.filterFastqPairs("test_data/test.sub.1.fq.gz",
+			"test_data/test.unzipped.1.fq", "", "", 30);
+	CHECK(unpaired[0].pairs == 2);
+	CHECK(unpaired[0].pair_check_failed);
+	CHECK(unpaired[1].pair_check_failed);
+
+	Gz::Reader hit_matrix("test_data/hits.tsv.gz");
+	size_t rows = 0;
+	for (std::string line = hit_matrix.nextLine(); !line.empty(); line = hit_matrix.nextLine()) {
+		rows++;
+	}
+	CHECK(rows == counts[0].pairs);
+	for (const char* fname: {"test_data/hits.tsv.gz", "test_data/out.1.fq.gz", "test_data/out.2.fq.gz",
+			"test_data/out.3.fq.gz", "test_data/out.4.fq.gz"}) {
+		std::remove(fname);
+	}
+}
+
+TEST_CASE("Test Bloom::SlicedIndex::write and Bloom::SlicedIndex::load") {
+	std::string seq1 = "AATTTGACATGGATCTTGTATCAAAGGGAGAACTTTCACCTGTATTTTTCGGTTCTGCAC";
+	Bloom::SlicedIndex index = Bloom::SlicedIndex(8000, {"ascaris", "trichuris"}, 31, 41, 2, Dna::HashMode::FORWARD);
+	index.addSeq(1, seq1);
+	// magic, 6 header fields and the taxon names, then one 1000 byte slice per taxon
+	CHECK(index.write("test_data/t1.sli", Bloom::Compression::RAW) == 0);
+	CHECK(std::filesystem::file_size("test_data/t1.sli") == 8 + 6 * 8 + 2 * 8 + 7 + 9 + 2 * 1000);
+	for (Bloom::Compression cmpr: {Bloom::Compression::RAW, Bloom::Compression::GZ}) {
+		CHECK(index.write("test_data/t1.sli", cmpr) == 0);
+		CHECK(Bloom::SlicedIndex::isIndex("test_data/t1.sli"));
+		std::optional<Bloom::SlicedIndex> loaded = Bloom::SlicedIndex::load("test_data/t1.sli");
+		std::remove("test_data/t1.sli");
+		REQUIRE(loaded);
+		CHECK(loaded->taxa() == index.taxa());
+		CHECK(loaded->positions() == 8000);
+		CHECK(loaded->kmerSize() == 31);
+		CHECK(loaded->windowSize() == 41);
+		CHECK(loaded->hashN() == 2);
+		CHECK(loaded->hashMode() == Dna::HashMode::FORWARD);
+		CHECK(loaded->setBitsCount(0) == 0);
+		CHECK(loaded->setBitsCount(1) == index.setBitsCount(1));
+	}
+
+	Bloom::Filter bloom = Bloom::Filter(1000, 31, 31, 1);
+	bloom.writeGz("test_data/t0.blm");
+	CHECK(!Bloom::SlicedIndex::isIndex("test_data/t0.blm"));
+	CHECK(!Bloom::SlicedIndex::load("test_data/t0.blm"));
+	std::remove("test_data/t0.blm");
+	CHECK(!Bloom::SlicedIndex::isIndex("test_data/missing.sli"));
+}
@@ -0,0 +1,35 @@
+#include "doctest.h"
+#include "sparse.h"
+#include <vector>
+
+TEST_CASE("Test Bloom::SparseBytes") {
+	// an empty block, a block with a few bytes set, a dense block and a partial block
+	size_t size = 3 * Bloom::SparseBytes::BLOCK_SIZE + 100;
+	std::vector<uint8_t> bytes(size, 0);
+	size_t block = Bloom::SparseBytes::BLOCK_SIZE;
+	bytes[block] = 1;
+	bytes[block + 7] = 128;
+	bytes[2 * block - 1] = 255;
+	for (size_t i = 2 * block; i < 3 * block; i += 2) {
+		bytes[i] = 3;
+	}
+	bytes[size - 1] = 16;
+
+	Bloom::SparseBytes sparse;
+	// appended in two parts like a loader reading blocks
+	sparse.append(bytes.data(), 2 * block);
+	sparse.append(bytes.data() + 2 * block, size - 2 * block);
+	sparse.shrinkToFit();
+	CHECK(sparse.size() == size);
+	bool same = true;
+	for (size_t i = 0; i < size; i++) {
+		same = same && sparse.at(i) == bytes[i];
+	}
+	CHECK(same);
+	CHECK(sparse.setBitsCount() == 1 + 1 + 8 + block + 1);
+	CHECK(sparse.memoryBytes() < size / 2);
+
+	std::vector<uint8_t> copy(size, 42);
+	sparse.copyTo(copy.data());
+	CHECK(copy == bytes);
+}
@@ -0,0 +1,68 @@
+#include "doctest.h"
+#include "stats.h"
+#include <sstream>
+#include <thread>
+
+TEST_CASE("Testing Stats::LatencyHistogram buckets") {
+	for (uint64_t nanos: {0, 1, 15, 16, 17, 31, 32, 1000, 123456789}) {
+		size_t idx = Stats::LatencyHistogram::bucketIdx(nanos);
+		CHECK(Stats::LatencyHistogram::bucketMin(idx) <= nanos);
+		CHECK(Stats::LatencyHistogram::bucketMin(idx + 1) > nanos);
+	}
+	CHECK(Stats::LatencyHistogram::bucketIdx(~0ULL) == Stats::LatencyHistogram::BUCKET_N - 1);
+}
+
+TEST_CASE("Testing Stats::LatencyHistogram::percentile") {
+	Stats::LatencyHistogram histogram;
+	CHECK(histogram.percentile(0.5) == 0);
+	for (uint64_t nanos = 1; nanos <= 100; nanos++) {
+		histogram.record(nanos * 1000);
+	}
+	CHECK(histogram.count() == 100);
+	// buckets are at most 1/16 of their lower bound wide
+	CHECK(histogram.percentile(0.5) <= 50000);
+	CHECK(histogram.percentile(0.5) > 50000 * 15 / 16);
+	CHECK(histogram.percentile(0.99) <= 99000);
+	CHECK(histogram.percentile(0.99) > 99000 * 15 / 16);
+	CHECK(histogram.percentile(1.0) > 100000 * 15 / 16);
+	// the bucket of 100001 starts below it, the maximum does not
+	histogram.record(100001);
+	CHECK(histogram.percentile(1.0) < 100001);
+	CHECK(histogram.max() == 100001);
+	histogram.clear();
+	CHECK(histogram.count() == 0);
+	CHECK(histogram.max() == 0);
+}
+
+TEST_CASE("Testing Stats timers and counters") {
+	Stats::reset();
+	Stats::setEnabled(false);
+	Stats::add(Stats::Counter::RECORDS, 5);
+	{
+		Stats::ScopedTimer timer(Stats::Stage::PARSE);
+	}
+	CHECK(Stats::count(Stats::Counter::RECORDS) == 0);
+	CHECK(Stats::nanos(Stats::Stage::PARSE) == 0);
+
+	Stats::setEnabled(true);
+	Stats::add(Stats::Counter::RECORDS, 5);
+	{
+		Stats::LatencyTimer latency_timer;
+		Stats::ScopedTimer outer(Stats::Stage::PARSE);
+		Stats::ScopedTimer inner(Stats::Stage::DECOMPRESS);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	Stats::setEnabled(false);
+	CHECK(Stats::count(Stats::Counter::RECORDS) == 5);
+	// the nested decompression time is not counted as parsing
+	CHECK(Stats::nanos(Stats::Stage::DECOMPRESS) >= 20000000);
+	CHECK(Stats::nanos(Stats::Stage::PARSE) < Stats::nanos(Stats::Stage::DECOMPRESS));
+	CHECK(Stats::recordLatencies().count() == 1);
+
+	std::stringstream json;
+	Stats::writeJson(json);
+	CHECK(json.str().find("\"decompress\": {\"seconds\": ") != std::string::npos);
+	CHECK(json.str().find("\"records\": 5") != std::string::npos);
+	Stats::reset();
+	CHECK(Stats::count(Stats::Counter::RECORDS) == 0);
+}
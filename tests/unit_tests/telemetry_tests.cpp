@@ -0,0 +1,96 @@
+#include "doctest.h"
+#include "telemetry.h"
+#include "utils.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+TEST_CASE("Testing Telemetry::formatRecord") {
+	Telemetry::Sample previous;
+	previous.elapsed_seconds = 1.0;
+	previous.records = 100;
+	previous.compressed_bytes_in = 1000;
+	Telemetry::Sample sample;
+	sample.elapsed_seconds = 3.0;
+	sample.records = 300;
+	sample.compressed_bytes_in = 3000;
+	std::string record = Telemetry::formatRecord("mask", sample, previous, 10000, false);
+	CHECK(record.find("\"command\": \"mask\"") != std::string::npos);
+	CHECK(record.find("\"records_per_s\": 100,") != std::string::npos);
+	CHECK(record.find("\"progress\": 0.3,") != std::string::npos);
+	CHECK(record.find("\"eta_s\": 7,") != std::string::npos);
+	CHECK(record.find("\"done\": false}") != std::string::npos);
+	CHECK(record.back() == '\n');
+	record = Telemetry::formatRecord("mask", sample, previous, 10000, true);
+	CHECK(record.find("eta_s") == std::string::npos);
+	CHECK(record.find("\"done\": true}") != std::string::npos);
+	CHECK(Telemetry::residentBytes() > 0);
+}
+
+TEST_CASE("Testing Gz::compressedBytesRead") {
+	uint64_t before = Gz::compressedBytesRead();
+	{
+		Gz::Reader gzr("test_data/t1.fa.gz");
+		while (!gzr.nextLine().empty()) {
+		}
+		CHECK(Gz::compressedBytesRead() - before == std::filesystem::file_size("test_data/t1.fa.gz"));
+	}
+	CHECK(Gz::compressedBytesRead() - before == std::filesystem::file_size("test_data/t1.fa.gz"));
+}
+
+TEST_CASE("Testing Telemetry::Emitter") {
+	{
+		std::string fname = "test_data/telemetry.jsonl";
+		std::remove(fname.c_str());
+		{
+			Telemetry::Emitter emitter(fname, "test", {"test_data/t1.fa.gz"}, std::chrono::milliseconds(5));
+			CHECK(emitter.isOpen());
+			Gz::Reader gzr("test_data/t1.fa.gz");
+			while (!gzr.nextLine().empty()) {
+			}
+			usleep(30000);
+		}
+		std::ifstream ifh(fname);
+		std::string line;
+		std::string last_line;
+		size_t line_n = 0;
+		while (std::getline(ifh, line)) {
+			last_line = line;
+			line_n++;
+		}
+		CHECK(line_n > 1);
+		CHECK(last_line.find("\"progress\": 1,") != std::string::npos);
+		CHECK(last_line.find("\"done\": true}") != std::string::npos);
+		std::remove(fname.c_str());
+	}
+	{
+		std::string path = "test_data/telemetry.sock";
+		unlink(path.c_str());
+		int server = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+		REQUIRE(bind(server, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+		REQUIRE(listen(server, 1) == 0);
+		{
+			Telemetry::Emitter emitter("unix:" + path, "test", {}, std::chrono::seconds(60));
+			CHECK(emitter.isOpen());
+		}
+		int client = accept(server, nullptr, nullptr);
+		std::string received;
+		char buffer[256];
+		ssize_t n = 0;
+		while ((n = read(client, buffer, sizeof(buffer))) > 0) {
+			received.append(buffer, n);
+		}
+		CHECK(received.find("\"done\": true}\n") != std::string::npos);
+		close(client);
+		close(server);
+		unlink(path.c_str());
+	}
+	CHECK(!Telemetry::Emitter("unix:test_data/missing.sock", "test", {}, std::chrono::seconds(1)).isOpen());
+}
@@ -1,6 +1,9 @@
 #include "doctest.h"
 #include "utils.h"
+#include "stats.h"
 #include <cstdio>
+#include <fstream>
+#include <memory>
 
 TEST_CASE("Test Utils::trimNewlineInplace") {
 	std::string t1 = "";
@@ -39,6 +42,54 @@ TEST_CASE("Test Utils::dataSizeToBytes") {
 	CHECK(Utils::dataSizeToBytes("13G") == (size_t)13*1024*1024*1024);
 }
 
+TEST_CASE("Test Utils::parallelFor") {
+	for (size_t thread_n: {1, 3, 8}) {
+		std::vector<int> visits(1000, 0);
+		Utils::parallelFor(visits.size(), thread_n, [&](size_t i) { visits[i]++; });
+		CHECK(std::count(visits.begin(), visits.end(), 1) == 1000);
+	}
+	size_t calls = 0;
+	Utils::parallelFor(0, 4, [&](size_t) { calls++; });
+	CHECK(calls == 0);
+}
+
+TEST_CASE("Test Utils::MappedFile") {
+	{
+		std::ofstream out("test_data/mapped.txt");
+		out << "ACGT";
+	}
+	std::optional<Utils::MappedFile> file = Utils::MappedFile::open("test_data/mapped.txt");
+	std::remove("test_data/mapped.txt");
+	REQUIRE(file);
+	CHECK(file->size() == 4);
+	CHECK(std::string(reinterpret_cast<const char*>(file->data()), file->size()) == "ACGT");
+	Utils::MappedFile moved = std::move(*file);
+	CHECK(file->data() == nullptr);
+	CHECK(moved.data()[3] == 'T');
+	CHECK(!Utils::MappedFile::open("test_data/missing.txt"));
+}
+
+TEST_CASE("Test Utils::LargePageAllocator") {
+	CHECK(Utils::parseHugePages("1G") == Utils::HugePages::EXPLICIT_1G);
+	CHECK(!Utils::parseHugePages("4K"));
+	CHECK(Utils::parseNumaPolicy("interleave") == Utils::NumaPolicy::INTERLEAVE);
+	CHECK(!Utils::parseNumaPolicy("replicate"));
+
+	Utils::MemoryPolicy previous = Utils::memoryPolicy();
+	for (Utils::HugePages huge_pages: {Utils::HugePages::OFF, Utils::HugePages::TRANSPARENT, Utils::HugePages::EXPLICIT_2M}) {
+		Utils::setMemoryPolicy({huge_pages, Utils::NumaPolicy::INTERLEAVE});
+		// large allocations start at a huge page boundary, even when hugetlb pages fall back
+		std::vector<uint8_t, Utils::LargePageAllocator<uint8_t>> large(3 * Utils::LARGE_ALLOCATION + 5, 1);
+		CHECK(reinterpret_cast<uintptr_t>(large.data()) % Utils::LARGE_ALLOCATION == 0);
+		CHECK(large.back() == 1);
+		std::vector<uint8_t, Utils::LargePageAllocator<uint8_t>> small(100, 2);
+		CHECK(small.back() == 2);
+		large = std::move(small);
+		CHECK(large.size() == 100);
+	}
+	Utils::setMemoryPolicy(previous);
+}
+
 TEST_CASE("Test Gz::Writer::writeLine") {
 	{
 		std::string fname = "test_data/gz_writer_test.txt.gz";
@@ -83,3 +134,167 @@ TEST_CASE("Test Gz::Writer::writeLine") {
 		std::remove(fname.c_str());
 	}
 }
+
+TEST_CASE("Test Gz::Reader sources and moves") {
+	std::string fname = "test_data/gz_reader_test.txt.gz";
+	{
+		Gz::Writer gzw(fname);
+		gzw.writeLine("line1");
+		gzw.writeLine("line2\r");
+	}
+	{
+		// a second gzip member appended, as in concatenated files and BGZF
+		Gz::Writer gzw("test_data/gz_reader_test.member.gz");
+		gzw.writeLine("line3");
+	}
+	std::string compressed;
+	for (const char* name: {"test_data/gz_reader_test.txt.gz", "test_data/gz_reader_test.member.gz"}) {
+		std::ifstream in(name, std::ios::binary);
+		compressed.append(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	{
+		std::ofstream out(fname, std::ios::binary);
+		out << compressed;
+	}
+	std::remove("test_data/gz_reader_test.member.gz");
+	{
+		// moved readers continue where they were
+		Gz::Reader gzr(fname);
+		CHECK(gzr.nextLine() == "line1");
+		Gz::Reader moved(std::move(gzr));
+		CHECK(moved.nextLine() == "line2");
+		std::vector<Gz::Reader> readers;
+		readers.push_back(std::move(moved));
+		readers.emplace_back(fname);
+		CHECK(readers[0].nextLine() == "line3");
+		CHECK(readers[1].nextLine() == "line1");
+		std::string line;
+		CHECK(!readers[0].readLine(line));
+		CHECK(readers[0].status() == Gz::ReaderState::DONE);
+	}
+	{
+		// shared memory
+		auto memory = std::make_shared<const std::string>(compressed);
+		Gz::Reader gzr1(std::make_unique<Gz::MemorySource>(memory));
+		Gz::Reader gzr2(std::make_unique<Gz::MemorySource>(memory));
+		CHECK(gzr1.nextLine() == "line1");
+		CHECK(gzr2.nextLine() == "line1");
+		CHECK(gzr1.nextLine() == "line2");
+		CHECK(gzr1.nextLine() == "line3");
+		CHECK(gzr1.nextLine().empty());
+		CHECK(gzr2.nextLine() == "line2");
+		Gz::Reader plain(std::make_unique<Gz::MemorySource>(std::make_shared<const std::string>("a\nb")));
+		CHECK(plain.nextLine() == "a");
+		CHECK(plain.nextLine() == "b");
+		CHECK(plain.nextChar() == -1);
+	}
+	{
+		// mapped file
+		std::unique_ptr<Gz::MappedSource> source = Gz::MappedSource::open(fname);
+		REQUIRE(source);
+		Gz::Reader gzr(std::move(source), fname);
+		char bytes[19];
+		CHECK(gzr.read(bytes, sizeof(bytes)) == 19);
+		CHECK(std::string(bytes, sizeof(bytes)) == "line1\nline2\r\nline3\n");
+		CHECK(gzr.read(bytes, sizeof(bytes)) == 0);
+		CHECK(!Gz::MappedSource::open("test_data/nonexistent.gz"));
+	}
+	{
+		// truncated input
+		Gz::Reader gzr(std::make_unique<Gz::MemorySource>(
+					std::make_shared<const std::string>(compressed.substr(0, compressed.size() / 2))));
+		while (!gzr.nextLine().empty()) {
+		}
+		CHECK(gzr.status() == Gz::ReaderState::ERROR);
+	}
+	std::remove(fname.c_str());
+}
+
+TEST_CASE("Test Gz::Reader::startReadAhead") {
+	std::string fname = "test_data/gz_read_ahead_test.txt.gz";
+	const size_t line_n = 200000;
+	{
+		Gz::Writer gzw(fname);
+		for (size_t i = 0; i < line_n; i++) {
+			gzw.writeLine(std::to_string(i));
+		}
+	}
+	// more lines than fit in the ring of two buffers
+	Gz::Reader gzr(fname);
+	CHECK(gzr.nextLine() == "0");
+	Stats::reset();
+	Stats::setEnabled(true);
+	gzr.startReadAhead(2);
+	std::vector<Gz::Reader> readers;
+	readers.push_back(std::move(gzr));
+	size_t read_n = 1;
+	std::string line;
+	bool in_order = true;
+	while (readers[0].readLine(line)) {
+		in_order = in_order && line == std::to_string(read_n);
+		read_n++;
+	}
+	Stats::setEnabled(false);
+	CHECK(in_order);
+	CHECK(read_n == line_n);
+	CHECK(readers[0].status() == Gz::ReaderState::DONE);
+	// decoding is timed on the read-ahead thread, the reader only waits
+	CHECK(Stats::nanos(Stats::Stage::DECOMPRESS) > 0);
+	CHECK(Stats::nanos(Stats::Stage::READ_WAIT) > 0);
+	Stats::reset();
+	{
+		// stopped while its buffers are full
+		Gz::Reader abandoned(fname);
+		abandoned.startReadAhead(2);
+		CHECK(abandoned.nextLine() == "0");
+	}
+	std::remove(fname.c_str());
+}
+
+TEST_CASE("Test Gz::formatFromName") {
+	CHECK(Gz::formatFromName("reads.fq.gz") == Gz::Format::GZ);
+	CHECK(Gz::formatFromName("reads.fq.bgz") == Gz::Format::BGZF);
+	CHECK(Gz::formatFromName("reads.fq.bgzf") == Gz::Format::BGZF);
+	CHECK(Gz::formatFromName("reads.fq") == Gz::Format::PLAIN);
+	CHECK(Gz::formatFromName(Gz::STDIO_NAME) == Gz::Format::PLAIN);
+	CHECK(Gz::parseFormat("gz-fast") == Gz::Format::GZ_FAST);
+	CHECK(!Gz::parseFormat("zstd"));
+}
+
+TEST_CASE("Test Gz::Writer formats") {
+	std::string fname = "test_data/gz_writer_format_test";
+	// more than one buffer and many BGZF blocks
+	std::vector<std::string> lines;
+	for (size_t i = 0; i < 100000; i++) {
+		lines.push_back("line " + std::to_string(i) + " " + std::string(i % 50, 'a'));
+	}
+	for (Gz::Format format: {Gz::Format::PLAIN, Gz::Format::GZ_FAST, Gz::Format::GZ, Gz::Format::BGZF}) {
+		{
+			Gz::Writer gzw(fname, format);
+			for (const std::string& line: lines) {
+				gzw.append(line);
+				gzw.append('\n');
+			}
+			CHECK(!gzw.failed());
+		}
+		std::ifstream raw(fname, std::ios::binary);
+		unsigned char magic[2] = {0, 0};
+		raw.read(reinterpret_cast<char*>(magic), 2);
+		CHECK((magic[0] == 0x1f && magic[1] == 0x8b) == (format != Gz::Format::PLAIN));
+		if (format == Gz::Format::BGZF) {
+			char eof_block[28];
+			raw.seekg(-28, std::ios::end);
+			raw.read(eof_block, sizeof(eof_block));
+			CHECK(eof_block[12] == 'B');
+			CHECK(eof_block[13] == 'C');
+		}
+		Gz::Reader gzr(fname);
+		bool same = true;
+		for (const std::string& line: lines) {
+			same = same && gzr.nextLine() == line;
+		}
+		CHECK(same);
+		CHECK(gzr.nextLine() == "");
+		std::remove(fname.c_str());
+	}
+}
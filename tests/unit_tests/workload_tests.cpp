@@ -0,0 +1,79 @@
+#include "doctest.h"
+#include "workload.h"
+#include "fastx.h"
+#include "utils.h"
+#include <filesystem>
+#include <string>
+
+TEST_CASE("Testing Workload::randomSeq and Workload::mutateSeq") {
+	std::mt19937_64 rng1(7);
+	std::mt19937_64 rng2(7);
+	std::string seq = Workload::randomSeq(1000, rng1);
+	CHECK(seq.size() == 1000);
+	CHECK(seq.find_first_not_of("ACGT") == std::string::npos);
+	CHECK(Workload::randomSeq(1000, rng2) == seq);
+
+	CHECK(Workload::mutateSeq(seq, 0.0, rng1) == seq);
+	std::string mutated = Workload::mutateSeq(seq, 1.0, rng1);
+	CHECK(mutated.size() == seq.size());
+	CHECK(mutated.find_first_not_of("ACGT") == std::string::npos);
+	for (size_t i = 0; i < seq.size(); i++) {
+		CHECK(mutated[i] != seq[i]);
+	}
+}
+
+TEST_CASE("Testing Workload::hostGenome") {
+	Workload::Config config;
+	config.host_size = 100000;
+	config.shared_fraction = 0.1;
+	config.mutation_rate = 0.0;
+	std::mt19937_64 rng(1);
+	std::string parasite = Workload::randomSeq(20000, rng);
+	std::vector<Dna::SeqInterval> shared;
+	std::string host = Workload::hostGenome(parasite, config, rng, shared);
+	CHECK(host.size() == config.host_size);
+	REQUIRE(shared.size() == 2);
+	for (const Dna::SeqInterval& interval: shared) {
+		CHECK(host.find(parasite.substr(interval.first, interval.second - interval.first)) != std::string::npos);
+	}
+}
+
+TEST_CASE("Testing Workload::kraken2Line") {
+	std::vector<Dna::SeqInterval> shared = {{110, 160}, {500, 600}};
+	CHECK(Workload::kraken2Line("c1", 100, 200, shared, 35) == "C\tc1\t9606\t100\t0:10 9606:16 0:40");
+	CHECK(Workload::kraken2Line("c2", 200, 300, shared, 35) == "U\tc2\t0\t100\t0:66");
+	CHECK(Workload::kraken2Line("c3", 200, 220, shared, 35) == "U\tc3\t0\t20\t0:0");
+}
+
+TEST_CASE("Testing Workload::generate") {
+	Workload::Config config;
+	config.parasite_size = 20000;
+	config.host_size = 40000;
+	config.contig_size = 8000;
+	config.read_pair_n = 100;
+	std::string dir = "test_data/workload";
+	Workload::Files files = Workload::generate(config, dir);
+
+	Gz::Reader fasta_reader(files.parasite_fasta);
+	size_t contig_n = 0;
+	while (Fasta::nextRecord(fasta_reader)) {
+		contig_n++;
+	}
+	CHECK(contig_n == 3);
+	Gz::Reader kraken2_reader(files.kraken2);
+	size_t kraken2_n = 0;
+	while (!kraken2_reader.nextLine().empty()) {
+		kraken2_n++;
+	}
+	CHECK(kraken2_n == 3);
+	Gz::Reader mates1_reader(files.mates1);
+	Gz::Reader mates2_reader(files.mates2);
+	size_t pair_n = 0;
+	while (std::optional<Fastq::Pair> pair = Fastq::nextRecordPair(mates1_reader, mates2_reader)) {
+		CHECK(pair->first.size() == config.read_size);
+		CHECK(pair->second.size() == config.read_size);
+		pair_n++;
+	}
+	CHECK(pair_n == config.read_pair_n);
+	std::filesystem::remove_all(dir);
+}